@@ -15,9 +15,14 @@
 #include <stdio.h>
 #include <time.h> 
 #include <stdlib.h>
+#include <string.h>
 #include <listjrp.h>
 #include <listv2.h>
 #include <math.h>
+#include <signal.h>
+#ifndef _WIN32
+#include <pthread.h>
+#endif /* _WIN32 */
 
 /***************************************************************************************
  * Macros
@@ -40,85 +45,905 @@
 #define KCR_DIFF(X,Y,N) ((abs((long)(X)-(long)(Y)) <= (N)/2) ? ((long)(X)-(long)(Y)) : \
                         ((long)(X)-(long)(Y) > 0 ? (long)(X)-(long)(Y)-(long)(N) : (long)(X)-(long)(Y)+(long)(N)))
 
+/***************************************************************************************
+ * Number of coordinates stored per individual: three in a three-dimensional box, else
+ * two.
+ ***************************************************************************************/
+#define KCR_NO_COORDS(ROOT) (((ROOT)->box_depth > 1) ? 3 : 2)
+
+/***************************************************************************************
+ * Index of site (X,Y) in a per-site grid laid out by a KCR_GRID_LAYOUT.  X and Y may
+ * be up to KCR_GRID_HALO outside the box (as signed values), wrapping round.
+ ***************************************************************************************/
+#define KCR_GRID_INDEX(LAYOUT,X,Y) ((LAYOUT)->x_offsets[X] + (LAYOUT)->y_offsets[Y])
+
+/***************************************************************************************
+ * Whether the cell at per-site grid index INDEX is blocked in a habitat mask.
+ ***************************************************************************************/
+#define KCR_MASK_BLOCKED(MASK,INDEX) (((MASK)[(INDEX) >> 6] >> ((INDEX) & 63)) & 1)
+
 /***************************************************************************************
  * Pre-processor definitions
  ***************************************************************************************/
 
 /***************************************************************************************
- * Yes and no.
+ * Yes and no.
+ ***************************************************************************************/
+#define KCR_YES 1
+#define KCR_NO  2
+
+/***************************************************************************************
+ * Return codes.
+ ***************************************************************************************/
+#define KCR_RC_OK    1
+#define KCR_RC_ERROR 2
+
+/***************************************************************************************
+ * Codes for X, Y and Z
+ ***************************************************************************************/
+#define KCR_X    1
+#define KCR_Y    2
+#define KCR_Z    3
+
+/***************************************************************************************
+ * pi
+ ***************************************************************************************/
+#define KCR_PI 3.14159265358979
+
+/***************************************************************************************
+ * Parser block size and the longest number the parser accepts.
+ ***************************************************************************************/
+#define KCR_PARSER_BLOCK_SIZE (1 << 20)
+#define KCR_PARSER_MAX_TOKEN  64
+
+/***************************************************************************************
+ * Files smaller than this are parsed by a single thread.
+ ***************************************************************************************/
+#define KCR_PARSE_PARALLEL_MIN_SIZE (4 << 20)
+
+/***************************************************************************************
+ * Largest number of worker threads.
+ ***************************************************************************************/
+#define KCR_MAX_THREADS 256
+
+/***************************************************************************************
+ * Largest number of populations with specialised interaction kernels.
+ ***************************************************************************************/
+#define KCR_MAX_SPECIALISED_POPS 4
+
+/***************************************************************************************
+ * Tokens returned by the parser.
+ ***************************************************************************************/
+#define KCR_TOKEN_NUMBER      1
+#define KCR_TOKEN_END_OF_ROW  2
+#define KCR_TOKEN_END_OF_FILE 3
+#define KCR_TOKEN_ERROR       4
+
+/***************************************************************************************
+ * Per-site grids: side of the square tiles (a power of two, 8x8 doubles being eight
+ * cache lines) and the number of sites outside the box the index tables cover.
+ ***************************************************************************************/
+#define KCR_GRID_TILE 8
+#define KCR_GRID_TILE_SHIFT 3
+#define KCR_GRID_HALO 16
+
+/***************************************************************************************
+ * Boundary conditions, chosen per axis.  An individual stepping off an absorbing edge
+ * is removed and replaced by one placed uniformly at random in the box, so that the
+ * population size stays fixed.  The default is periodic in a build with KCR_PBC
+ * defined and reflecting otherwise.  KCR_OUTSIDE is the destination of a step off an
+ * absorbing edge.
+ ***************************************************************************************/
+#define KCR_BOUNDARY_REFLECTING 1
+#define KCR_BOUNDARY_PERIODIC   2
+#define KCR_BOUNDARY_ABSORBING  3
+#ifdef KCR_PBC
+#define KCR_BOUNDARY_DEFAULT KCR_BOUNDARY_PERIODIC
+#else /* KCR_PBC */
+#define KCR_BOUNDARY_DEFAULT KCR_BOUNDARY_REFLECTING
+#endif /* KCR_PBC */
+#define KCR_OUTSIDE ((unsigned long)-1)
+
+/***************************************************************************************
+ * Default threshold of the habitat mask: cells with values below it are blocked, so a
+ * file of 1 for habitat and 0 for the rest can be used as it is.
+ ***************************************************************************************/
+#define KCR_MASK_DEFAULT_THRESHOLD 0.5
+
+/***************************************************************************************
+ * Shapes of the interaction kernel.  KCR_KERNEL_DIRECT is the top-hat worked out
+ * directly for each pair of individuals; the others are tabulated per lattice offset.
+ * All shapes have the same total weight as the top-hat.  The Gaussian and exponential
+ * are cut off at these multiples of delta.
+ ***************************************************************************************/
+#define KCR_KERNEL_DIRECT      0
+#define KCR_KERNEL_TOP_HAT     1
+#define KCR_KERNEL_GAUSSIAN    2
+#define KCR_KERNEL_EXPONENTIAL 3
+#define KCR_KERNEL_LINEAR      4
+#define KCR_KERNEL_GAUSSIAN_CUTOFF    4
+#define KCR_KERNEL_EXPONENTIAL_CUTOFF 8
+
+/***************************************************************************************
+ * Allowance for rounding when working out how many sweeps a population's move rate
+ * has brought due, in multirate time steps.
+ ***************************************************************************************/
+#define KCR_RATE_EPSILON 1e-9
+
+/***************************************************************************************
+ * Mean field: the four moves (down, up, left and right), the relative size of the
+ * random ripple in the starting densities, the value mixed into the seed of its
+ * generator, and the change per step (relative to the number of individuals) below
+ * which the densities are taken to be steady.
+ ***************************************************************************************/
+#define KCR_MF_DOWN      0
+#define KCR_MF_UP        1
+#define KCR_MF_LEFT      2
+#define KCR_MF_RIGHT     3
+#define KCR_MF_NO_MOVES  4
+#define KCR_MF_RIPPLE    0.1
+#define KCR_MF_SEED_MIX  0x6d66ULL
+#define KCR_MF_TOLERANCE 1e-9
+
+/***************************************************************************************
+ * FFT: largest prime factor of a length transformed by the mixed-radix method (other
+ * lengths use Bluestein's method), and the most factors a length can have.
+ ***************************************************************************************/
+#define KCR_FFT_MAX_RADIX   7
+#define KCR_FFT_MAX_FACTORS 64
+
+/***************************************************************************************
+ * Trajectory likelihood: the most blocks the steps are split into (the threads share
+ * out whole blocks, so the sums do not depend on the number of threads).
+ ***************************************************************************************/
+#define KCR_LIKELIHOOD_BLOCKS 256
+
+/***************************************************************************************
+ * Fitting the a_ij by L-BFGS: number of past steps remembered, sufficient decrease
+ * for the line search and the most times it halves the step, and the relative change
+ * in the log-likelihood and the largest derivative below which the fit has converged.
+ ***************************************************************************************/
+#define KCR_LBFGS_MEMORY       8
+#define KCR_LBFGS_ARMIJO       1e-4
+#define KCR_LBFGS_MAX_HALVINGS 40
+#define KCR_LBFGS_FTOL         1e-10
+#define KCR_LBFGS_GTOL         1e-6
+
+/***************************************************************************************
+ * ABC-SMC: the most windows the steps are split into (the summaries are averaged over
+ * each, and the distance checked at the end of each), the value mixed into the seeds
+ * of the simulations, and the most simulations per particle a generation may take.
+ ***************************************************************************************/
+#define KCR_ABC_WINDOWS      16
+#define KCR_ABC_SEED_MIX     0x616263ULL
+#define KCR_ABC_MAX_ATTEMPTS 1000
+
+/***************************************************************************************
+ * Scent marks: number of tabulated decay factors, default decay rate per time step
+ * and default deposit per visit.
+ ***************************************************************************************/
+#define KCR_MARK_DECAY_TABLE_SIZE 4096
+#define KCR_MARK_DEFAULT_DECAY 0.01
+#define KCR_MARK_DEFAULT_DEPOSIT 1
+
+/***************************************************************************************
+ * Burn-in cache: suffix of cache files, default size bound in megabytes, and the
+ * starting value and multiplier of the 64-bit FNV-1a hash used for the cache keys.
+ ***************************************************************************************/
+#define KCR_CACHE_SUFFIX ".kcp"
+#define KCR_CACHE_DEFAULT_SIZE 1024
+#define KCR_HASH_START 0xcbf29ce484222325ULL
+#define KCR_HASH_PRIME 0x100000001b3ULL
+
+/***************************************************************************************
+ * Results of kcr_fork_process().
+ ***************************************************************************************/
+#define KCR_FORK_CHILD  1
+#define KCR_FORK_PARENT 2
+#define KCR_FORK_NONE   3
+
+/***************************************************************************************
+ * Binary environmental raster: magic number, format version and value types.
+ ***************************************************************************************/
+#define KCR_ENV_MAGIC         "KCRENV01"
+#define KCR_ENV_VERSION       1
+#define KCR_ENV_TYPE_FLOAT32  1
+#define KCR_ENV_TYPE_FLOAT16  2
+#define KCR_ENV_TYPE_UINT8    3
+
+/***************************************************************************************
+ * Binary state file: magic number and format version.
+ ***************************************************************************************/
+#define KCR_STATE_MAGIC       "KCRSTA01"
+#define KCR_STATE_VERSION     1
+
+/***************************************************************************************
+ * Checkpoint file: magic number and format version.
+ ***************************************************************************************/
+#define KCR_CHECKPOINT_MAGIC   "KCRCKP01"
+#define KCR_CHECKPOINT_VERSION 5
+
+/***************************************************************************************
+ * Control blocks
+ ***************************************************************************************/
+
+/***************************************************************************************
+ * Name: KCR_POPULATION
+ *
+ * Purpose: Stores all population-level data.
+ ***************************************************************************************/
+typedef struct kcr_population
+{
+	/***********************************************************************************
+	 * Root of the list of kcr_individual CBs for this population
+	 ***********************************************************************************/
+    LIST_ROOT individual_list_root;
+
+	/***********************************************************************************
+	 * List element of this population
+	 ***********************************************************************************/
+    LIST_ELT list_elt;
+
+	/***********************************************************************************
+	 * Index of this population
+	 ***********************************************************************************/
+    unsigned short index;
+
+	/***********************************************************************************
+	 * Moves per unit time of each individual, in event-driven mode or with multirate
+	 * time steps.
+	 ***********************************************************************************/
+    double move_rate;
+
+} KCR_POPULATION;
+
+/***************************************************************************************
+ * Name: KCR_INDIVIDUAL
+ *
+ * Purpose: Stores all individual-level data.
+ ***************************************************************************************/
+typedef struct kcr_individual
+{
+	/***********************************************************************************
+	 * Current x-, y- and z-position (z always 0 unless the box is three-dimensional)
+	 ***********************************************************************************/
+    unsigned long current_x_pos;
+    unsigned long current_y_pos;
+    unsigned long current_z_pos;
+
+	/***********************************************************************************
+	 * List element of this individual.
+	 ***********************************************************************************/
+    LIST_ELT list_elt;
+
+	/***********************************************************************************
+	 * Index of this individual.
+	 ***********************************************************************************/
+    unsigned short index;
+
+} KCR_INDIVIDUAL;
+
+/***************************************************************************************
+ * Name: KCR_PARSER
+ *
+ * Purpose: State of a parser reading tab-separated numbers from a file or from memory.
+ ***************************************************************************************/
+typedef struct kcr_parser
+{
+	/***********************************************************************************
+	 * File being read (NULL when parsing memory) and the block buffer owned by the
+	 * parser (NULL when parsing memory).
+	 ***********************************************************************************/
+    FILE *in_file;
+    char *buffer;
+
+	/***********************************************************************************
+	 * Start of the data, current position and end of the valid data.
+	 ***********************************************************************************/
+    const char *base;
+    const char *curr;
+    const char *end;
+
+	/***********************************************************************************
+	 * Offset of base within the file, and of the start of the current line.
+	 ***********************************************************************************/
+    unsigned long long base_offset;
+    unsigned long long line_offset;
+
+	/***********************************************************************************
+	 * Current line, and line and column of the most recent number.
+	 ***********************************************************************************/
+    unsigned long line;
+    unsigned long token_line;
+    unsigned long token_column;
+
+	/***********************************************************************************
+	 * Whether the file has been read to the end, and whether the current row has
+	 * produced any numbers yet.
+	 ***********************************************************************************/
+    unsigned short eof;
+    unsigned short row_has_values;
+
+	/***********************************************************************************
+	 * Description of the data for error messages, whether errors are held for the
+	 * caller rather than printed, and the most recent error (NULL if none).
+	 ***********************************************************************************/
+    const char *name;
+    unsigned short hold_errors;
+    const char *error_text;
+
+} KCR_PARSER;
+
+/***************************************************************************************
+ * Name: KCR_GRID_LAYOUT
+ *
+ * Purpose: Layout of the per-site grids (environmental data and the like).  Sites are
+ *          stored in KCR_GRID_TILE x KCR_GRID_TILE tiles, Morton (Z) ordered within
+ *          each tile, with the tiles row by row.  The layout is separable, so the index
+ *          of a site is the sum of an x-offset and a y-offset looked up in two small
+ *          tables (see KCR_GRID_INDEX).  Boxes less than one tile high (including 1d
+ *          boxes) are stored row by row instead.
+ ***************************************************************************************/
+typedef struct kcr_grid_layout
+{
+	/***********************************************************************************
+	 * Offset tables, each covering KCR_GRID_HALO sites either side of the box, and
+	 * pointers to their entries for site 0.
+	 ***********************************************************************************/
+    unsigned long *x_table;
+    unsigned long *y_table;
+    const unsigned long *x_offsets;
+    const unsigned long *y_offsets;
+
+	/***********************************************************************************
+	 * Number of elements in a grid, including the padding of partial tiles.
+	 ***********************************************************************************/
+    unsigned long size;
+
+} KCR_GRID_LAYOUT;
+
+/***************************************************************************************
+ * Name: KCR_AXIS
+ *
+ * Purpose: Boundary condition of one axis of the box, tabulated per coordinate so
+ *          that the movement kernels and stencils handle every boundary condition
+ *          with the same loads and no tests of the position or of the condition.
+ ***************************************************************************************/
+typedef struct kcr_axis
+{
+	/***********************************************************************************
+	 * Boundary condition (KCR_BOUNDARY_*) and number of sites along the axis.
+	 ***********************************************************************************/
+    unsigned short boundary;
+    unsigned long size;
+
+	/***********************************************************************************
+	 * Per coordinate: weight of a step down or up the axis (0 where a reflecting edge
+	 * forbids it, else 1) and the coordinate it leads to (KCR_OUTSIDE off an
+	 * absorbing edge).
+	 ***********************************************************************************/
+    double *lo_weight;
+    double *hi_weight;
+    unsigned long *lo_dest;
+    unsigned long *hi_dest;
+
+	/***********************************************************************************
+	 * Per coordinate: the sites either side used for differences (wrapping round if
+	 * periodic, else the site itself at an edge) and the distance between them (0 on
+	 * an axis one site long, which has no gradient).
+	 ***********************************************************************************/
+    unsigned long *lo_stencil;
+    unsigned long *hi_stencil;
+    double *stencil_span;
+
+	/***********************************************************************************
+	 * Minimum-image offsets: diffs[a - b] is KCR_DIFF(a, b, size) for coordinates a
+	 * and b.  diffs points to the middle of diff_table, which has 2*size - 1 entries.
+	 ***********************************************************************************/
+    long *diff_table;
+    const long *diffs;
+
+} KCR_AXIS;
+
+/***************************************************************************************
+ * Name: KCR_PARSE_CHUNK
+ *
+ * Purpose: A run of whole lines of a mapped file parsed by one thread.
+ ***************************************************************************************/
+typedef struct kcr_parse_chunk
+{
+	/***********************************************************************************
+	 * The lines: from start up to (not including) end.
+	 ***********************************************************************************/
+    const char *start;
+    const char *end;
+
+	/***********************************************************************************
+	 * Number of lines and of rows (lines holding values) in the chunk, and the line
+	 * number and row index of its first line.
+	 ***********************************************************************************/
+    unsigned long no_lines;
+    unsigned long no_rows;
+    unsigned long first_line;
+    unsigned long first_row;
+
+	/***********************************************************************************
+	 * Destination array and its dimensions, and description for error messages.
+	 ***********************************************************************************/
+    double *dbl_array;
+    const KCR_GRID_LAYOUT *layout;
+    unsigned long width;
+    unsigned long height;
+    const char *name;
+
+	/***********************************************************************************
+	 * Result of parsing the chunk, and the parser, which holds any error until the
+	 * chunks are reported in order.
+	 ***********************************************************************************/
+    unsigned short rc;
+    KCR_PARSER parser;
+
+} KCR_PARSE_CHUNK;
+
+/***************************************************************************************
+ * Name: KCR_THREAD
+ *
+ * Purpose: A thread, and the function and argument it was started with.
+ ***************************************************************************************/
+typedef struct kcr_thread
+{
+    void (*function)(void *);
+    void *arg;
+#ifdef _WIN32
+    HANDLE handle;
+#else /* _WIN32 */
+    pthread_t handle;
+#endif /* _WIN32 */
+
+} KCR_THREAD;
+
+/***************************************************************************************
+ * Name: KCR_MAPPING
+ *
+ * Purpose: A file mapped read-only into memory.
+ ***************************************************************************************/
+typedef struct kcr_mapping
+{
+	/***********************************************************************************
+	 * Start and size of the mapped data (NULL and 0 if nothing is mapped).
+	 ***********************************************************************************/
+    const void *data;
+    unsigned long long size;
+
+	/***********************************************************************************
+	 * Operating system handle for the mapping, where one is needed.
+	 ***********************************************************************************/
+    void *handle;
+
+} KCR_MAPPING;
+
+/***************************************************************************************
+ * Name: KCR_FILE_INFO
+ *
+ * Purpose: Name, size and modification time of a file found by kcr_list_files().
+ ***************************************************************************************/
+typedef struct kcr_file_info
+{
+    char *name;
+    unsigned long long size;
+    long long mtime;
+
+} KCR_FILE_INFO;
+
+/***************************************************************************************
+ * Name: KCR_ENV_HEADER
+ *
+ * Purpose: Header at the start of a binary environmental raster file.  64 bytes, so
+ *          the values that follow it are aligned.
+ ***************************************************************************************/
+typedef struct kcr_env_header
+{
+	/***********************************************************************************
+	 * KCR_ENV_MAGIC (not null-terminated) and KCR_ENV_VERSION.
+	 ***********************************************************************************/
+    char magic[8];
+    unsigned int version;
+
+	/***********************************************************************************
+	 * Type of the stored values (KCR_ENV_TYPE_*) and dimensions of the raster.
+	 ***********************************************************************************/
+    unsigned int type;
+    unsigned int width;
+    unsigned int height;
+
+	/***********************************************************************************
+	 * Environmental value = offset + scale*stored value.
+	 ***********************************************************************************/
+    double scale;
+    double offset;
+
+	/***********************************************************************************
+	 * Reserved: zero.
+	 ***********************************************************************************/
+    unsigned char reserved[24];
+
+} KCR_ENV_HEADER;
+
+/***************************************************************************************
+ * Name: KCR_ENV_RASTER
+ *
+ * Purpose: A binary environmental raster mapped into memory.
+ ***************************************************************************************/
+typedef struct kcr_env_raster
+{
+	/***********************************************************************************
+	 * Mapping of the raster file.
+	 ***********************************************************************************/
+    KCR_MAPPING mapping;
+
+	/***********************************************************************************
+	 * First stored value (NULL if no raster is mapped) and type of the values.
+	 ***********************************************************************************/
+    const void *values;
+    unsigned short type;
+
+	/***********************************************************************************
+	 * Environmental value = offset + scale*stored value.
+	 ***********************************************************************************/
+    double scale;
+    double offset;
+
+} KCR_ENV_RASTER;
+
+/***************************************************************************************
+ * Name: KCR_ENV_FRAMES
+ *
+ * Purpose: A time-varying environmental layer: a sequence of frames, each in effect
+ *          from its switch time, with the next frame loaded by a background thread.
+ ***************************************************************************************/
+typedef struct kcr_env_frames
+{
+	/***********************************************************************************
+	 * Number of frames, their switch times and their files (none if no_frames is 0).
+	 ***********************************************************************************/
+    unsigned long no_frames;
+    unsigned long *switch_times;
+    char **names;
+
+	/***********************************************************************************
+	 * Index of the frame to switch to next.
+	 ***********************************************************************************/
+    unsigned long next_frame;
+
+	/***********************************************************************************
+	 * Spare buffers the next frame and its gradient are loaded into, and the frame
+	 * they hold (no_frames if none).  Owned by the loader thread while loading is KCR_YES.
+	 ***********************************************************************************/
+    double *spare;
+    float *spare_grad_x;
+    float *spare_grad_y;
+    unsigned long spare_frame;
+    unsigned short loading;
+    KCR_THREAD loader;
+
+} KCR_ENV_FRAMES;
+
+/***************************************************************************************
+ * Name: KCR_STATE_HEADER
+ *
+ * Purpose: Header at the start of a binary state file.
+ ***************************************************************************************/
+typedef struct kcr_state_header
+{
+	/***********************************************************************************
+	 * KCR_STATE_MAGIC (not null-terminated) and KCR_STATE_VERSION.
+	 ***********************************************************************************/
+    char magic[8];
+    unsigned int version;
+
+	/***********************************************************************************
+	 * Shape of the simulation the positions belong to.
+	 ***********************************************************************************/
+    unsigned int no_pops;
+    unsigned int no_indivs;
+    unsigned int box_width;
+    unsigned int box_height;
+
+	/***********************************************************************************
+	 * Depth of the box: more than 1 if three-dimensional, when a z-position follows
+	 * the x- and y-position of every individual.  Zero or 1 otherwise.
+	 ***********************************************************************************/
+    unsigned int box_depth;
+
+} KCR_STATE_HEADER;
+
+/***************************************************************************************
+ * Name: KCR_CHECKPOINT_HEADER
+ *
+ * Purpose: Header at the start of a checkpoint file.  Every field is naturally
+ *          aligned, so the layout has no padding.
+ ***************************************************************************************/
+typedef struct kcr_checkpoint_header
+{
+	/***********************************************************************************
+	 * KCR_CHECKPOINT_MAGIC (not null-terminated) and KCR_CHECKPOINT_VERSION.
+	 ***********************************************************************************/
+    char magic[8];
+    unsigned int version;
+
+	/***********************************************************************************
+	 * Shape of the simulation.
+	 ***********************************************************************************/
+    unsigned int no_pops;
+    unsigned int no_indivs;
+    unsigned int box_width;
+    unsigned int box_height;
+    unsigned int packing_term;
+
+	/***********************************************************************************
+	 * Time step reached, random seed and random number generator state.
+	 ***********************************************************************************/
+    unsigned long long current_time;
+    unsigned long long seed;
+    unsigned long long rng_state[4];
+
+	/***********************************************************************************
+	 * Model parameters.
+	 ***********************************************************************************/
+    double total_time;
+    double start_measure_time;
+    double l_val;
+    double env_weight;
+    double kappa;
+
+	/***********************************************************************************
+	 * KCR_YES if a mark section (decay rate, deposit, response matrix, mark times and
+	 * mark grids) follows the positions; zero or KCR_NO otherwise.  Then the number
+	 * of sites in each mark grid.
+	 ***********************************************************************************/
+    unsigned int has_marks;
+    unsigned int mark_grid_size;
+
+	/***********************************************************************************
+	 * KCR_YES if an event section (move rates of the populations and time of the
+	 * next move of each individual) follows; zero or KCR_NO otherwise.
+	 ***********************************************************************************/
+    unsigned int has_events;
+
+	/***********************************************************************************
+	 * Boundary conditions of the x- and y-axes, and the shape of the interaction
+	 * kernel.
+	 ***********************************************************************************/
+    unsigned int boundary_x;
+    unsigned int boundary_y;
+    unsigned int kernel_shape;
+
+	/***********************************************************************************
+	 * KCR_YES if a rate section (move rates of the populations, for multirate time
+	 * steps) follows any mark section; zero or KCR_NO otherwise.  Then reserved:
+	 * zero.
+	 ***********************************************************************************/
+    unsigned int has_rates;
+
+	/***********************************************************************************
+	 * Depth of the box (1 unless three-dimensional) and the boundary condition of the
+	 * z-axis.  Then reserved: zero.
+	 ***********************************************************************************/
+    unsigned int box_depth;
+    unsigned int boundary_z;
+    unsigned char reserved[4];
+
+} KCR_CHECKPOINT_HEADER;
+
+/***************************************************************************************
+ * Name: KCR_EVENT
+ *
+ * Purpose: The next move of an individual, in event-driven mode.
  ***************************************************************************************/
-#define KCR_YES 1
-#define KCR_NO  2
+typedef struct kcr_event
+{
+    double time;
+    KCR_INDIVIDUAL *individual;
+    KCR_POPULATION *population;
+
+} KCR_EVENT;
 
 /***************************************************************************************
- * Return codes.
+ * Name: KCR_KERNEL_TABLE
+ *
+ * Purpose: The interaction kernel for one value of delta, per unit a_ij, tabulated
+ *          for every lattice offset within its cutoff.
  ***************************************************************************************/
-#define KCR_RC_OK    1
-#define KCR_RC_ERROR 2
+typedef struct kcr_kernel_table
+{
+	/***********************************************************************************
+	 * delta, and the largest offsets tabulated along each axis.
+	 ***********************************************************************************/
+    double delta;
+    long x_radius;
+    long y_radius;
+    long z_radius;
+
+	/***********************************************************************************
+	 * Drift in x and y towards an individual at offset (x,y):
+	 * weights[2*((y + y_radius)*(2*x_radius + 1) + x + x_radius)] and the next entry.
+	 * In a three-dimensional box, drift in x, y and z towards offset (x,y,z):
+	 * weights[3*(((z + z_radius)*(2*y_radius + 1) + y + y_radius)*(2*x_radius + 1) +
+	 * x + x_radius)] and the next two entries.
+	 ***********************************************************************************/
+    double *weights;
+
+} KCR_KERNEL_TABLE;
 
 /***************************************************************************************
- * Codes for X and Y
+ * Name: KCR_INTERACTION
+ *
+ * Purpose: A population whose individuals the individuals of another population have
+ *          to look at: one that they interact with, or, if there is a packing term,
+ *          one that only counts towards the density at their site.
  ***************************************************************************************/
-#define KCR_X    1
-#define KCR_Y    2
+typedef struct kcr_interaction
+{
+    KCR_POPULATION *source;
+    double delta;
+    double delta_sq;
+    double coeff;
+    unsigned short interacts;
+    KCR_KERNEL_TABLE *table;
+
+} KCR_INTERACTION;
 
 /***************************************************************************************
- * pi
+ * Name: KCR_COMPLEX
+ *
+ * Purpose: A complex number.
  ***************************************************************************************/
-#define KCR_PI 3.14159265358979
+typedef struct kcr_complex
+{
+    double re;
+    double im;
+
+} KCR_COMPLEX;
 
 /***************************************************************************************
- * Control blocks
+ * Name: KCR_FFT
+ *
+ * Purpose: Tables for fast Fourier transforms of one length.
  ***************************************************************************************/
+typedef struct kcr_fft
+{
+	/***********************************************************************************
+	 * Length of the transforms, and of the mixed-radix transforms used for them
+	 * (the same unless Bluestein's method is used) with its prime factors.
+	 ***********************************************************************************/
+    unsigned long size;
+    unsigned long inner_size;
+    unsigned short factors[KCR_FFT_MAX_FACTORS];
+    unsigned short no_factors;
+
+	/***********************************************************************************
+	 * Twiddle factors exp(-2*pi*i*k/inner_size) for k < inner_size, and two work
+	 * arrays of inner_size values.
+	 ***********************************************************************************/
+    KCR_COMPLEX *twiddles;
+    KCR_COMPLEX *work;
+    KCR_COMPLEX *scratch;
+
+	/***********************************************************************************
+	 * Bluestein's method, if size is not a power of two (else NULL): the chirp
+	 * exp(-pi*i*k^2/size) for k < size, and the transformed conjugate chirp filter.
+	 ***********************************************************************************/
+    KCR_COMPLEX *chirp;
+    KCR_COMPLEX *filter;
+
+} KCR_FFT;
 
 /***************************************************************************************
- * Name: KCR_POPULATION
+ * Name: KCR_MEAN_FIELD
  *
- * Purpose: Stores all population-level data.
+ * Purpose: State of the mean-field solver.  Sites are numbered x + y*box_width.
  ***************************************************************************************/
-typedef struct kcr_population
+typedef struct kcr_mean_field
 {
 	/***********************************************************************************
-	 * Root of the list of kcr_individual CBs for this population
+	 * Number of sites, and the number of time steps integrated.
 	 ***********************************************************************************/
-    LIST_ROOT individual_list_root;
+    unsigned long size;
+    unsigned long no_steps;
 
 	/***********************************************************************************
-	 * List element of this population
+	 * Expected number of individuals of population p at each site, at p*size + site
+	 * (NULL if there is no mean field), and the next densities of one population.
 	 ***********************************************************************************/
-    LIST_ELT list_elt;
+    double *density;
+    double *next;
 
 	/***********************************************************************************
-	 * Index of this population
+	 * Drift of one population at each site, and the total density at each site.
 	 ***********************************************************************************/
-    unsigned short index;
+    double *drift_x;
+    double *drift_y;
+    double *crowding;
 
-} KCR_POPULATION;
+	/***********************************************************************************
+	 * Per site: KCR_YES if open; the weight and destination (a site, or KCR_OUTSIDE)
+	 * of each move, the move at dir*size + site.
+	 ***********************************************************************************/
+    unsigned char *open;
+    double *weights;
+    unsigned long *dests;
+
+	/***********************************************************************************
+	 * Transformed densities, by population, and transformed interaction kernels in x
+	 * and y, by pair (in the order of the a_ij-values).
+	 ***********************************************************************************/
+    KCR_COMPLEX *density_hat;
+    KCR_COMPLEX *kernel_x_hat;
+    KCR_COMPLEX *kernel_y_hat;
+    KCR_COMPLEX *work;
+    KCR_FFT x_fft;
+    KCR_FFT y_fft;
+
+	/***********************************************************************************
+	 * Cumulative sums of the densities, by population, for drawing positions (NULL
+	 * until first needed).
+	 ***********************************************************************************/
+    double *cumulative;
+
+} KCR_MEAN_FIELD;
 
 /***************************************************************************************
- * Name: KCR_INDIVIDUAL
+ * Name: KCR_RNG
  *
- * Purpose: Stores all individual-level data.
+ * Purpose: State of a random number generator.
  ***************************************************************************************/
-typedef struct kcr_individual
+typedef struct kcr_rng
+{
+    unsigned long long state[4];
+
+} KCR_RNG;
+
+/***************************************************************************************
+ * Name: KCR_BRANCH
+ *
+ * Purpose: Settings of one branch in branch mode.
+ ***************************************************************************************/
+typedef struct kcr_branch
 {
 	/***********************************************************************************
-	 * Current x- and y-position
+	 * Random seed (0 to continue the current random number stream) and total time.
 	 ***********************************************************************************/
-    unsigned long current_x_pos;
-    unsigned long current_y_pos;
+    unsigned long long seed;
+    double total_time;
 
 	/***********************************************************************************
-	 * List element of this individual.
+	 * Replacement a_ij-values (NULL to keep the current ones).
 	 ***********************************************************************************/
-    LIST_ELT list_elt;
+    double *aijs;
+
+} KCR_BRANCH;
+
+/***************************************************************************************
+ * Name: KCR_TRAJECTORY
+ *
+ * Purpose: An observed trajectory: the positions of every individual at successive
+ *          time steps.
+ ***************************************************************************************/
+typedef struct kcr_trajectory
+{
+	/***********************************************************************************
+	 * Number of rows (time steps) and of values in each row: the coordinates of every
+	 * individual, in the order the simulation prints them.
+	 ***********************************************************************************/
+    unsigned long no_rows;
+    unsigned long no_values;
 
 	/***********************************************************************************
-	 * Index of this individual.
+	 * The rows, one after another.
 	 ***********************************************************************************/
-    unsigned short index;
+    unsigned int *positions;
 
-} KCR_INDIVIDUAL;
+} KCR_TRAJECTORY;
 
 /***************************************************************************************
  * Name: KCR_ROOT_DATA
@@ -166,6 +991,11 @@ typedef struct kcr_root_data
 	 * Height of box.
 	 ***********************************************************************************/
     unsigned long box_height;
+
+	/***********************************************************************************
+	 * Depth of box: 1 unless the box is three-dimensional.
+	 ***********************************************************************************/
+    unsigned long box_depth;
     
 	/***********************************************************************************
 	 * Model parameters
@@ -175,10 +1005,121 @@ typedef struct kcr_root_data
     double l_val;
 
 	/***********************************************************************************
-	 * Environmental data and weighting
+	 * For each population, the populations its individuals have to look at, in list
+	 * order: interactions[i*no_pops .. i*no_pops + no_interactions[i] - 1] for
+	 * population i.  Rebuilt by kcr_setup_interactions() whenever aijs or deltas
+	 * change.
+	 ***********************************************************************************/
+    KCR_INTERACTION *interactions;
+    unsigned short *no_interactions;
+
+	/***********************************************************************************
+	 * Shape of the interaction kernel (KCR_KERNEL_*), and unless it is
+	 * KCR_KERNEL_DIRECT, its tables: one for each value of delta in use.
+	 ***********************************************************************************/
+    unsigned short kernel_shape;
+    KCR_KERNEL_TABLE *kernel_tables;
+    unsigned long no_kernel_tables;
+
+	/***********************************************************************************
+	 * Environmental data and weighting.  env_data is NULL when the environmental
+	 * layer is read from a mapped binary raster instead, or when there is no layer.
+	 * env_active is KCR_YES only if there is a layer and its weighting is non-zero, so
+	 * that it has to be evaluated at all.
 	 ***********************************************************************************/
     double *env_data;
+    KCR_ENV_RASTER env_raster;
     double env_weight;
+    unsigned short env_active;
+
+	/***********************************************************************************
+	 * Layout of env_data and every other per-site grid.
+	 ***********************************************************************************/
+    KCR_GRID_LAYOUT grid;
+
+	/***********************************************************************************
+	 * Boundary conditions of the x- and y-axes, and of the z-axis in a
+	 * three-dimensional box.
+	 ***********************************************************************************/
+    KCR_AXIS x_axis;
+    KCR_AXIS y_axis;
+    KCR_AXIS z_axis;
+
+	/***********************************************************************************
+	 * Gradient of the environmental layer in x and y, per lattice step, as per-site
+	 * grids.  Only allocated when env_active is KCR_YES.
+	 ***********************************************************************************/
+    float *env_grad_x;
+    float *env_grad_y;
+
+	/***********************************************************************************
+	 * Habitat mask, a bit per site in the per-site grid layout, set for blocked
+	 * cells; NULL if every cell is open.
+	 ***********************************************************************************/
+    unsigned long long *habitat_mask;
+
+	/***********************************************************************************
+	 * Scent marks, if marks_active is KCR_YES.  mark_data holds no_pops marks per
+	 * site (per-site grid index*no_pops + population), valid as of the time step in
+	 * mark_times for that site.  mark_resp is the no_pops x no_pops response matrix
+	 * and mark_decay the table of decay factors.
+	 ***********************************************************************************/
+    unsigned short marks_active;
+    double *mark_data;
+    unsigned long long *mark_times;
+    double *mark_resp;
+    double *mark_decay;
+    double mark_decay_rate;
+    double mark_deposit;
+
+	/***********************************************************************************
+	 * Event-driven mode, if events_active is KCR_YES: every individual moves at the
+	 * times of a Poisson process of its population's move_rate, and event_heap is a
+	 * binary min-heap (on time) of the next move of each individual.
+	 ***********************************************************************************/
+    unsigned short events_active;
+    KCR_EVENT *event_heap;
+    unsigned long no_events;
+
+	/***********************************************************************************
+	 * Multirate time steps, if multirate_active is KCR_YES: in each time step every
+	 * population sweeps as many times as its move_rate has brought due.
+	 ***********************************************************************************/
+    unsigned short multirate_active;
+
+	/***********************************************************************************
+	 * Mean field, if mean_field.density is not NULL: initial positions are then drawn
+	 * from its densities.
+	 ***********************************************************************************/
+    KCR_MEAN_FIELD mean_field;
+
+	/***********************************************************************************
+	 * Time-varying environmental layer, if any: env_data is then the current frame.
+	 ***********************************************************************************/
+    KCR_ENV_FRAMES env_frames;
+
+	/***********************************************************************************
+	 * Random seed and random number generator.
+	 ***********************************************************************************/
+    unsigned long long seed;
+    KCR_RNG rng;
+
+	/***********************************************************************************
+	 * File the positions of individuals are printed to (default stdout).
+	 ***********************************************************************************/
+    FILE *out_file;
+
+	/***********************************************************************************
+	 * Checkpoint file name (NULL if checkpointing is off) and the number of time
+	 * steps between checkpoints (0 to checkpoint only when asked to stop).
+	 ***********************************************************************************/
+    const char *checkpoint_name;
+    unsigned long checkpoint_interval;
+
+	/***********************************************************************************
+	 * Number of worker threads for parallel work.
+	 ***********************************************************************************/
+    unsigned short no_threads;
 
 	/***********************************************************************************
 	 * Set packing_term to 0 if there is no packing term; 1 if there is (default = 0).
@@ -189,6 +1130,145 @@ typedef struct kcr_root_data
 
 } KCR_ROOT_DATA;
 
+/***************************************************************************************
+ * Name: KCR_LIKELIHOOD_CHUNK
+ *
+ * Purpose: A run of the steps of a trajectory, whose likelihood one thread works out.
+ ***************************************************************************************/
+typedef struct kcr_likelihood_chunk
+{
+	/***********************************************************************************
+	 * Copy of the simulation for this thread to move the individuals of, the
+	 * trajectory and the number of sites an individual can be placed on.
+	 ***********************************************************************************/
+    KCR_ROOT_DATA *root_data;
+    const KCR_TRAJECTORY *trajectory;
+    unsigned long no_open;
+
+	/***********************************************************************************
+	 * The blocks: from first_block up to (not including) last_block, of the no_blocks
+	 * the steps are split into.  Step t goes from row t to row t + 1.
+	 ***********************************************************************************/
+    unsigned long no_blocks;
+    unsigned long first_block;
+    unsigned long last_block;
+
+	/***********************************************************************************
+	 * Log-likelihood of each block, by block, and, if the gradient is wanted (else
+	 * NULL), its gradient with respect to the a_ij, and room for the drifts from
+	 * each population.
+	 ***********************************************************************************/
+    double *block_log_liks;
+    double *block_gradients;
+    double *terms;
+
+} KCR_LIKELIHOOD_CHUNK;
+
+/***************************************************************************************
+ * Name: KCR_ABC
+ *
+ * Purpose: A generation of ABC-SMC, shared by the threads running its simulations.
+ ***************************************************************************************/
+typedef struct kcr_abc
+{
+	/***********************************************************************************
+	 * The observed trajectory, and the bounds of the uniform prior of each a_ij
+	 * (lows then highs, each laid out as root_data->aijs).
+	 ***********************************************************************************/
+    const KCR_TRAJECTORY *trajectory;
+    const double *prior;
+    unsigned long no_params;
+
+	/***********************************************************************************
+	 * The summaries: no_stats per window, of no_windows.  Cells of cell_width sites a
+	 * side (less at the far edges), no_cells_x by no_cells_y by however many deep, are
+	 * counted; no_equal_cells is the number of equal cells individuals spread at
+	 * random would share as often.  obs_summaries are those of the trajectory and
+	 * scales what each difference is divided by.
+	 ***********************************************************************************/
+    unsigned long no_windows;
+    unsigned long no_stats;
+    unsigned long cell_width;
+    unsigned long no_cells_x;
+    unsigned long no_cells_y;
+    unsigned long no_cells;
+    double no_equal_cells;
+    double *obs_summaries;
+    double *scales;
+
+	/***********************************************************************************
+	 * The generation: its number, the square of its tolerance (HUGE_VAL in the first,
+	 * which draws from the prior) and, after the first, the particles and weights of
+	 * the previous one and the standard deviation of the perturbation of each a_ij.
+	 ***********************************************************************************/
+    unsigned short generation;
+    double tolerance_sq;
+    const double *prev_particles;
+    const double *prev_weights;
+    unsigned long no_prev;
+    const double *perturb_sds;
+
+	/***********************************************************************************
+	 * The batch of simulations being run: batch_size of them from first_attempt.  For
+	 * each, the a_ij drawn, the square of the distance (of as much as was simulated),
+	 * whether it was accepted, the time steps simulated and, in the first generation,
+	 * its summaries.
+	 ***********************************************************************************/
+    unsigned long first_attempt;
+    unsigned long batch_size;
+    double *batch_params;
+    double *batch_dist_sqs;
+    unsigned short *batch_accepted;
+    unsigned long *batch_steps;
+    double *batch_summaries;
+
+} KCR_ABC;
+
+/***************************************************************************************
+ * Name: KCR_ABC_WORKER
+ *
+ * Purpose: A thread running ABC-SMC simulations.
+ ***************************************************************************************/
+typedef struct kcr_abc_worker
+{
+	/***********************************************************************************
+	 * Copy of the simulation for this thread to run, the generation, and which of the
+	 * batch this thread runs: every no_workers-th from worker_no.
+	 ***********************************************************************************/
+    KCR_ROOT_DATA *root_data;
+    KCR_ABC *abc;
+    unsigned long worker_no;
+    unsigned long no_workers;
+
+	/***********************************************************************************
+	 * The cell of every individual (in list order) and the count of each population in
+	 * every cell (cell*no_pops + population index), this step and the last.  Only the
+	 * counts of the cells individuals are in are non-zero.
+	 ***********************************************************************************/
+    unsigned long *cells;
+    unsigned long *prev_cells;
+    unsigned int *counts;
+    unsigned int *prev_counts;
+
+	/***********************************************************************************
+	 * Room for the raw overlaps of a step (two no_pops x no_pops matrices), the
+	 * summaries of a step and their sums over a window.
+	 ***********************************************************************************/
+    double *overlaps;
+    double *stats;
+    double *window_sums;
+
+} KCR_ABC_WORKER;
+
+/***************************************************************************************
+ * Name: KCR_INTERACTION_KERNEL, KCR_INTERACTION_KERNEL1D
+ *
+ * Purpose: Kernels summing the interactions of an individual with every individual, in
+ *          two and one dimensions.
+ ***************************************************************************************/
+typedef void (*KCR_INTERACTION_KERNEL)(KCR_INDIVIDUAL *, KCR_POPULATION *, KCR_ROOT_DATA *, double *, double *, double *);
+typedef void (*KCR_INTERACTION_KERNEL1D)(KCR_INDIVIDUAL *, KCR_POPULATION *, KCR_ROOT_DATA *, double *);
+
 /***************************************************************************************
  * Function declarations.
  ***************************************************************************************/
@@ -213,11 +1293,15 @@ KCR_ROOT_DATA *kcr_init(unsigned short,
 						FILE *,
 						double,
 						unsigned short,
-						double);
+						double,
+						unsigned short,
+						unsigned short,
+						unsigned short);
 KCR_POPULATION *kcr_pop_init(unsigned short, KCR_ROOT_DATA *);
 KCR_INDIVIDUAL *kcr_indiv_init(unsigned short, KCR_POPULATION *, KCR_ROOT_DATA *);
 unsigned short kcr_setup_array(FILE *, KCR_ROOT_DATA *, double *);
-void kcr_set_init_conds(FILE *, KCR_ROOT_DATA *);
+unsigned short kcr_set_init_conds(FILE *, KCR_ROOT_DATA *);
+unsigned short kcr_setup_interactions(KCR_ROOT_DATA *);
 void kcr_term(KCR_ROOT_DATA *);
 void kcr_pop_term(KCR_POPULATION *);
 void kcr_indiv_term(KCR_INDIVIDUAL *);
@@ -225,13 +1309,272 @@ void kcr_indiv_term(KCR_INDIVIDUAL *);
 /***************************************************************************************
  * kcrproc.c
  ***************************************************************************************/
+void kcr_request_stop(int);
 void kcr_perform_simulation(FILE *, KCR_ROOT_DATA *);
+void kcr_perform_time_step(FILE *, KCR_ROOT_DATA *);
 void kcr_move_individual(KCR_INDIVIDUAL *, 
                          KCR_POPULATION *, 
 						 KCR_ROOT_DATA *);
 void kcr_move_individual1d(KCR_INDIVIDUAL *, 
                            KCR_POPULATION *, 
 						   KCR_ROOT_DATA *);
-void kcr_setup_env(FILE *, KCR_ROOT_DATA *);
+void kcr_move_weights(KCR_INDIVIDUAL *, KCR_POPULATION *, KCR_ROOT_DATA *, double *, double *);
+void kcr_move_weights1d(KCR_INDIVIDUAL *, KCR_POPULATION *, KCR_ROOT_DATA *, double *, double *);
+void kcr_place_individual(KCR_INDIVIDUAL *, KCR_ROOT_DATA *);
+void kcr_interactions(KCR_INDIVIDUAL *, KCR_POPULATION *, KCR_ROOT_DATA *, double *, double *, double *);
+void kcr_interactions1d(KCR_INDIVIDUAL *, KCR_POPULATION *, KCR_ROOT_DATA *, double *);
+void kcr_tabulated_interactions(KCR_INDIVIDUAL *, KCR_POPULATION *, KCR_ROOT_DATA *, double *, double *, double *);
+void kcr_interactions_1(KCR_INDIVIDUAL *, KCR_POPULATION *, KCR_ROOT_DATA *, double *, double *, double *);
+void kcr_interactions1d_1(KCR_INDIVIDUAL *, KCR_POPULATION *, KCR_ROOT_DATA *, double *);
+void kcr_interactions_2(KCR_INDIVIDUAL *, KCR_POPULATION *, KCR_ROOT_DATA *, double *, double *, double *);
+void kcr_interactions1d_2(KCR_INDIVIDUAL *, KCR_POPULATION *, KCR_ROOT_DATA *, double *);
+void kcr_interactions_3(KCR_INDIVIDUAL *, KCR_POPULATION *, KCR_ROOT_DATA *, double *, double *, double *);
+void kcr_interactions1d_3(KCR_INDIVIDUAL *, KCR_POPULATION *, KCR_ROOT_DATA *, double *);
+void kcr_interactions_4(KCR_INDIVIDUAL *, KCR_POPULATION *, KCR_ROOT_DATA *, double *, double *, double *);
+void kcr_interactions1d_4(KCR_INDIVIDUAL *, KCR_POPULATION *, KCR_ROOT_DATA *, double *);
+unsigned short kcr_setup_env(FILE *, KCR_ROOT_DATA *);
+
+/***************************************************************************************
+ * kcrparse.c
+ ***************************************************************************************/
+unsigned short kcr_parse_double(const char **, const char *, double *);
+unsigned short kcr_parser_open_file(KCR_PARSER *, FILE *, const char *);
+void kcr_parser_open_memory(KCR_PARSER *, const char *, const char *, unsigned long, const char *);
+void kcr_parser_close(KCR_PARSER *);
+void kcr_parser_fill(KCR_PARSER *);
+unsigned short kcr_parser_next(KCR_PARSER *, double *);
+void kcr_parser_error(KCR_PARSER *, const char *);
+void kcr_parser_report(KCR_PARSER *);
+unsigned short kcr_parse_matrix(FILE *,
+                                const char *,
+                                double *,
+                                const KCR_GRID_LAYOUT *,
+                                unsigned long,
+                                unsigned long,
+                                unsigned short);
+void kcr_count_chunk_rows(void *);
+void kcr_parse_chunk(void *);
+unsigned short kcr_parse_matrix_parallel(FILE *,
+                                         const char *,
+                                         double *,
+                                         const KCR_GRID_LAYOUT *,
+                                         unsigned long,
+                                         unsigned long,
+                                         unsigned short,
+                                         unsigned short);
+
+/***************************************************************************************
+ * kcrgrid.c
+ ***************************************************************************************/
+unsigned long kcr_grid_spread(unsigned long);
+unsigned short kcr_grid_init(KCR_GRID_LAYOUT *, unsigned long, unsigned long);
+void kcr_grid_term(KCR_GRID_LAYOUT *);
+double *kcr_grid_alloc(const KCR_GRID_LAYOUT *);
+float *kcr_grid_alloc_float(const KCR_GRID_LAYOUT *);
+unsigned short kcr_axis_init(KCR_AXIS *, unsigned short, unsigned long);
+void kcr_axis_term(KCR_AXIS *);
+
+/***************************************************************************************
+ * kcrenv.c
+ ***************************************************************************************/
+double kcr_half_to_double(unsigned short);
+unsigned short kcr_double_to_half(double);
+unsigned short kcr_env_is_raster(FILE *);
+unsigned short kcr_env_map_raster(FILE *, KCR_ENV_RASTER *, unsigned long, unsigned long, unsigned short);
+double kcr_env_raster_value(const KCR_ENV_RASTER *, unsigned long);
+double kcr_env_value(KCR_ROOT_DATA *, unsigned long, unsigned long);
+unsigned short kcr_write_env_raster(FILE *, KCR_ROOT_DATA *, unsigned short);
+void kcr_env_gradient(KCR_ROOT_DATA *, const double *, float *, float *);
+unsigned short kcr_setup_env_gradient(KCR_ROOT_DATA *);
+unsigned short kcr_load_env_frame(const char *, KCR_ROOT_DATA *, double *, unsigned short, unsigned short);
+void kcr_env_frame_loader(void *);
+void kcr_start_env_prefetch(KCR_ROOT_DATA *);
+void kcr_finish_env_prefetch(KCR_ROOT_DATA *);
+unsigned short kcr_switch_env_frame(KCR_ROOT_DATA *);
+unsigned short kcr_seek_env_frames(KCR_ROOT_DATA *);
+unsigned short kcr_setup_env_frames(FILE *, KCR_ROOT_DATA *);
+void kcr_env_frames_term(KCR_ROOT_DATA *);
+
+/***************************************************************************************
+ * kcrstate.c
+ ***************************************************************************************/
+void kcr_pack_positions(KCR_ROOT_DATA *, unsigned int *);
+unsigned short kcr_unpack_positions(KCR_ROOT_DATA *, const unsigned int *);
+unsigned short kcr_state_is_binary(FILE *);
+unsigned short kcr_read_state(FILE *, KCR_ROOT_DATA *);
+unsigned short kcr_write_state(FILE *, KCR_ROOT_DATA *);
+unsigned short kcr_write_checkpoint(KCR_ROOT_DATA *);
+char *kcr_build_checkpoint(KCR_ROOT_DATA *, size_t *);
+unsigned short kcr_save_checkpoint(KCR_ROOT_DATA *, const char *);
+char *kcr_load_checkpoint(FILE *);
+unsigned short kcr_restore_checkpoint(KCR_ROOT_DATA *, const char *);
+KCR_ROOT_DATA *kcr_read_checkpoint(FILE *, FILE *, unsigned short);
+
+/***************************************************************************************
+ * kcrcache.c
+ ***************************************************************************************/
+unsigned long long kcr_hash_bytes(unsigned long long, const void *, unsigned long);
+unsigned long long kcr_burn_in_key(KCR_ROOT_DATA *, unsigned long);
+void kcr_evict_cache(const char *, unsigned long long);
+unsigned short kcr_perform_burn_in(KCR_ROOT_DATA *, const char *, unsigned long);
+
+/***************************************************************************************
+ * kcrmark.c
+ ***************************************************************************************/
+unsigned short kcr_setup_marks(FILE *, KCR_ROOT_DATA *, double, double);
+unsigned short kcr_alloc_marks(KCR_ROOT_DATA *, double, double);
+void kcr_marks_term(KCR_ROOT_DATA *);
+double kcr_mark_decay_factor(KCR_ROOT_DATA *, unsigned long long);
+double kcr_mark_value(KCR_ROOT_DATA *, unsigned long, unsigned short);
+void kcr_deposit_mark(KCR_ROOT_DATA *, unsigned long, unsigned long, unsigned short);
+void kcr_mark_drift(KCR_ROOT_DATA *, unsigned long, unsigned long, unsigned short, double *, double *);
+
+/***************************************************************************************
+ * kcrmask.c
+ ***************************************************************************************/
+unsigned short kcr_setup_mask(FILE *, KCR_ROOT_DATA *, double);
+void kcr_mask_term(KCR_ROOT_DATA *);
+
+/***************************************************************************************
+ * kcrcoarse.c
+ ***************************************************************************************/
+unsigned short kcr_coarse_equilibrate(KCR_ROOT_DATA *, unsigned long, unsigned long);
+
+/***************************************************************************************
+ * kcr3d.c
+ ***************************************************************************************/
+unsigned short kcr_setup_3d(KCR_ROOT_DATA *, unsigned long, unsigned short);
+void kcr_move_individual3d(KCR_INDIVIDUAL *, KCR_POPULATION *, KCR_ROOT_DATA *);
+void kcr_move_weights3d(KCR_INDIVIDUAL *, KCR_POPULATION *, KCR_ROOT_DATA *, double *, double *);
+void kcr_interactions3d(KCR_INDIVIDUAL *, KCR_POPULATION *, KCR_ROOT_DATA *, double *, double *, double *, double *);
+
+/***************************************************************************************
+ * kcrkernel.c
+ ***************************************************************************************/
+double kcr_kernel_weight(unsigned short, double, double, unsigned short);
+double kcr_kernel_cutoff(unsigned short, double);
+KCR_KERNEL_TABLE *kcr_kernel_table(KCR_ROOT_DATA *, double);
+void kcr_kernel_tables_term(KCR_ROOT_DATA *);
+
+/***************************************************************************************
+ * kcrevent.c
+ ***************************************************************************************/
+unsigned short kcr_setup_events(FILE *, KCR_ROOT_DATA *);
+double *kcr_read_move_rates(FILE *, KCR_ROOT_DATA *);
+unsigned short kcr_alloc_events(KCR_ROOT_DATA *, const double *);
+void kcr_events_term(KCR_ROOT_DATA *);
+double kcr_event_wait(KCR_ROOT_DATA *, double);
+void kcr_event_sift_down(KCR_ROOT_DATA *, unsigned long);
+void kcr_build_event_heap(KCR_ROOT_DATA *);
+void kcr_perform_events(KCR_ROOT_DATA *, double);
+void kcr_pack_events(KCR_ROOT_DATA *, double *);
+unsigned short kcr_unpack_events(KCR_ROOT_DATA *, const double *);
+
+/***************************************************************************************
+ * kcrrate.c
+ ***************************************************************************************/
+unsigned short kcr_setup_multirate(FILE *, KCR_ROOT_DATA *);
+void kcr_set_multirate(KCR_ROOT_DATA *, const double *);
+void kcr_pack_multirate(KCR_ROOT_DATA *, double *);
+unsigned long kcr_sweeps_due(KCR_POPULATION *, unsigned long);
+void kcr_perform_multirate_moves(KCR_ROOT_DATA *);
+
+/***************************************************************************************
+ * kcrmf.c
+ ***************************************************************************************/
+unsigned short kcr_setup_mean_field(KCR_ROOT_DATA *, unsigned long);
+unsigned short kcr_alloc_mean_field(KCR_ROOT_DATA *);
+void kcr_mean_field_term(KCR_ROOT_DATA *);
+void kcr_mf_init_kernels(KCR_ROOT_DATA *);
+void kcr_mf_drift(KCR_ROOT_DATA *, unsigned short);
+double kcr_mf_step(KCR_ROOT_DATA *);
+void kcr_write_mean_field(FILE *, KCR_ROOT_DATA *);
+unsigned short kcr_mf_place_individual(KCR_INDIVIDUAL *, KCR_POPULATION *, KCR_ROOT_DATA *);
+
+/***************************************************************************************
+ * kcrfft.c
+ ***************************************************************************************/
+unsigned short kcr_fft_init(KCR_FFT *, unsigned long);
+void kcr_fft_term(KCR_FFT *);
+void kcr_fft_stage(const KCR_FFT *, const KCR_COMPLEX *, unsigned long, KCR_COMPLEX *, unsigned long, unsigned short);
+void kcr_fft_line(KCR_FFT *, KCR_COMPLEX *, unsigned long, unsigned short);
+void kcr_fft_2d(KCR_FFT *, KCR_FFT *, KCR_COMPLEX *, unsigned short);
+
+/***************************************************************************************
+ * kcrbranch.c
+ ***************************************************************************************/
+unsigned short kcr_read_branches(FILE *, KCR_ROOT_DATA *, KCR_BRANCH **, unsigned long *);
+void kcr_free_branches(KCR_BRANCH *, unsigned long);
+unsigned short kcr_run_branch(KCR_ROOT_DATA *, KCR_BRANCH *, unsigned long, const char *);
+unsigned short kcr_perform_branches(FILE *, KCR_ROOT_DATA *, const char *);
+
+/***************************************************************************************
+ * kcrlik.c
+ ***************************************************************************************/
+unsigned short kcr_read_trajectory(FILE *, KCR_ROOT_DATA *, KCR_TRAJECTORY *);
+void kcr_trajectory_term(KCR_TRAJECTORY *);
+unsigned short kcr_trajectory_log_likelihood(KCR_ROOT_DATA *, const KCR_TRAJECTORY *, double *, double *);
+KCR_ROOT_DATA *kcr_likelihood_copy(KCR_ROOT_DATA *);
+void kcr_likelihood_copy_term(KCR_ROOT_DATA *);
+void kcr_likelihood_chunk(void *);
+unsigned long kcr_count_open_sites(KCR_ROOT_DATA *);
+double kcr_step_log_likelihood(KCR_ROOT_DATA *, const unsigned int *, const unsigned int *, unsigned long, double *,
+                               double *);
+double kcr_move_probability(KCR_INDIVIDUAL *, KCR_POPULATION *, KCR_ROOT_DATA *, const unsigned int *, unsigned long,
+                            double *);
+void kcr_interaction_terms(KCR_INDIVIDUAL *, KCR_POPULATION *, KCR_ROOT_DATA *, double *, double *);
+
+/***************************************************************************************
+ * kcrfit.c
+ ***************************************************************************************/
+unsigned short kcr_fit_aijs(KCR_ROOT_DATA *, const KCR_TRAJECTORY *, unsigned long, double *, double *);
+unsigned short kcr_fit_evaluate(KCR_ROOT_DATA *, const KCR_TRAJECTORY *, const double *, double *, double *);
+void kcr_write_param_matrix(FILE *, const double *, unsigned short);
+
+/***************************************************************************************
+ * kcrabc.c
+ ***************************************************************************************/
+unsigned short kcr_read_abc_prior(FILE *, KCR_ROOT_DATA *, double *);
+unsigned short kcr_perform_abc(KCR_ROOT_DATA *, const KCR_TRAJECTORY *, FILE *, unsigned long, unsigned short, double);
+unsigned short kcr_abc_worker_init(KCR_ABC_WORKER *, KCR_ROOT_DATA *, KCR_ABC *);
+void kcr_abc_worker_term(KCR_ABC_WORKER *);
+void kcr_abc_batch(void *);
+void kcr_abc_attempt(KCR_ABC_WORKER *, unsigned long);
+void kcr_abc_propose(KCR_ABC *, KCR_RNG *, double *);
+void kcr_abc_observe(KCR_ABC_WORKER *);
+void kcr_abc_place_row(KCR_ROOT_DATA *, const unsigned int *);
+void kcr_abc_count_cells(KCR_ABC_WORKER *);
+void kcr_abc_clear_cells(KCR_ABC_WORKER *);
+void kcr_abc_step_summaries(KCR_ABC_WORKER *);
+double kcr_abc_equal_cells(unsigned long, unsigned long);
+double kcr_abc_window_distance(KCR_ABC *, unsigned long, const double *);
+void kcr_abc_weigh(KCR_ABC *, const double *, unsigned long, double *);
+double kcr_abc_quantile(const double *, unsigned long, double, double *);
+
+/***************************************************************************************
+ * kcrrand.c
+ ***************************************************************************************/
+void kcr_rng_seed(KCR_RNG *, unsigned long long);
+unsigned long long kcr_rng_next(KCR_RNG *);
+double kcr_rng_uniform(KCR_RNG *);
+unsigned long kcr_rng_below(KCR_RNG *, unsigned long);
+double kcr_rng_gaussian(KCR_RNG *);
+
+/***************************************************************************************
+ * kcrplat.c
+ ***************************************************************************************/
+unsigned short kcr_map_file(FILE *, KCR_MAPPING *);
+void kcr_unmap_file(KCR_MAPPING *);
+unsigned short kcr_thread_create(KCR_THREAD *, void (*)(void *), void *);
+void kcr_thread_join(KCR_THREAD *);
+unsigned short kcr_num_cpus(void);
+unsigned short kcr_commit_file(FILE *);
+unsigned short kcr_replace_file(const char *, const char *);
+unsigned short kcr_fork_process(void);
+void kcr_exit_process(unsigned short);
+unsigned short kcr_wait_process(void);
+void kcr_touch_file(const char *);
+unsigned short kcr_list_files(const char *, const char *, KCR_FILE_INFO **, unsigned long *);
+void kcr_free_file_list(KCR_FILE_INFO *, unsigned long);
 
 #endif /* __KCR_H_ */
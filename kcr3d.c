@@ -0,0 +1,288 @@
+/***************************************************************************************
+ * Filename: kcr3d.c
+ *
+ * Description: Three-dimensional boxes, for aquatic and arboreal systems.  Individuals
+ *              have a z-position as well, step in one of six directions, and interact
+ *              over a sphere of radius delta.  The moves use the boundary tables of a
+ *              z-axis like those of x and y, and the interactions are table-driven
+ *              throughout: minimum-image offsets come from the tables of the axes and
+ *              the weight of every offset from a kernel table, since a sphere holds
+ *              far more lattice sites than the disk of kcr_move_individual().
+ ***************************************************************************************/
+
+#include <kcr.h>
+
+/***************************************************************************************
+ * Name: kcr_setup_3d()
+ *
+ * Purpose: Make the box three-dimensional.
+ *
+ * Parameters: IN/OUT root_data - pointer to a CB containing all the root data for KCR,
+ *                                before the initial conditions are set.
+ *             IN     box_depth - depth of the box (more than 1)
+ *             IN     boundary_z - boundary condition of the z-axis (KCR_BOUNDARY_*)
+ *
+ * Returns: rc - KCR_RC_OK if ok or KCR_RC_ERROR if error.
+ *
+ * Operation: Tabulate the z-axis and rebuild the interactions, now tabulated over
+ *            three dimensions.
+ ***************************************************************************************/
+unsigned short kcr_setup_3d(KCR_ROOT_DATA *root_data, unsigned long box_depth, unsigned short boundary_z)
+{
+	/* Local variables */
+	unsigned short rc = KCR_RC_ERROR;
+
+	/* Sanity checks */
+	assert(root_data != NULL);
+	assert(box_depth > 1);
+
+	if(root_data->box_height == 1)
+	{
+		fprintf(stderr,"Error: a three-dimensional box needs a height greater than 1\n");
+		goto EXIT_LABEL;
+	}
+	rc = kcr_axis_init(&root_data->z_axis, boundary_z, box_depth);
+	if(rc != KCR_RC_OK)
+	{
+		goto EXIT_LABEL;
+	}
+	root_data->box_depth = box_depth;
+	rc = kcr_setup_interactions(root_data);
+
+EXIT_LABEL:
+	/* Return */
+	return(rc);
+}
+
+/***************************************************************************************
+ * Name: kcr_move_individual3d()
+ *
+ * Purpose: Move the individual in a three-dimensional box.
+ *
+ * Parameters: IN/OUT individual - the individual
+ *             IN     population - pointer to the population CB containing this individual
+ *             IN     root_data - pointer to a CB containing all the root data for KCR.
+ *
+ * Returns: Nothing.
+ *
+ * Operation: Weigh the six moves with kcr_move_weights3d() and choose one at random.
+ ***************************************************************************************/
+void kcr_move_individual3d(KCR_INDIVIDUAL *individual,
+                           KCR_POPULATION *population,
+                           KCR_ROOT_DATA *root_data)
+{
+	/* Local variables */
+	double random;
+	double weights[6];
+
+    /* Sanity checks. */
+	assert(root_data != NULL);
+	assert(individual != NULL);
+	assert(population != NULL);
+
+    kcr_move_weights3d(individual, population, root_data, weights, NULL);
+
+    /* Get a random number between 0 and the sum of the weights */
+    random = kcr_rng_uniform(&root_data->rng)*(weights[0]+weights[1]+weights[2]+weights[3]+weights[4]+weights[5]);
+
+   	/* Use this random number to determine next position */
+   	if(random < weights[0])
+   	{
+   		individual->current_y_pos = root_data->y_axis.lo_dest[individual->current_y_pos];
+	}
+	else if(random < weights[0] + weights[1])
+	{
+   		individual->current_y_pos = root_data->y_axis.hi_dest[individual->current_y_pos];
+	}
+	else if(random < weights[0] + weights[1] + weights[2])
+	{
+   		individual->current_x_pos = root_data->x_axis.lo_dest[individual->current_x_pos];
+	}
+	else if(random < weights[0] + weights[1] + weights[2] + weights[3])
+	{
+   		individual->current_x_pos = root_data->x_axis.hi_dest[individual->current_x_pos];
+	}
+	else if(random < weights[0] + weights[1] + weights[2] + weights[3] + weights[4])
+	{
+   		individual->current_z_pos = root_data->z_axis.lo_dest[individual->current_z_pos];
+	}
+   	else
+   	{
+   		individual->current_z_pos = root_data->z_axis.hi_dest[individual->current_z_pos];
+    }
+    if((individual->current_x_pos == KCR_OUTSIDE) || (individual->current_y_pos == KCR_OUTSIDE) ||
+       (individual->current_z_pos == KCR_OUTSIDE))
+    {
+        /* Stepped off an absorbing edge: replaced by a new individual */
+        kcr_place_individual(individual, root_data);
+    }
+
+    /* Return */
+    return;
+}
+
+/***************************************************************************************
+ * Name: kcr_move_weights3d()
+ *
+ * Purpose: Weigh the moves an individual can make in a three-dimensional box.
+ *
+ * Parameters: IN     individual - the individual
+ *             IN     population - pointer to the population CB containing this individual
+ *             IN     root_data - pointer to a CB containing all the root data for KCR.
+ *             OUT    weights - weights of moving down, up, left, right, below and above,
+ *                              in that order
+ *             OUT    drifts - if not NULL, the drifts in x, y and z
+ *
+ * Returns: Nothing.
+ *
+ * Operation: As kcr_move_weights(), with a drift in z as well, each of the six moves
+ *            weighted (1 +/- drift)/6.
+ ***************************************************************************************/
+void kcr_move_weights3d(KCR_INDIVIDUAL *individual,
+                        KCR_POPULATION *population,
+                        KCR_ROOT_DATA *root_data,
+                        double *weights,
+                        double *drifts)
+{
+	/* Local variables */
+	double sx = 0;
+	double sy = 0;
+	double sz = 0;
+	double popsum = 0;
+
+    /* Sanity checks. */
+	assert(root_data != NULL);
+	assert(individual != NULL);
+	assert(population != NULL);
+	assert(weights != NULL);
+
+    /* Sum the interactions with every individual */
+    kcr_interactions3d(individual, population, root_data, &sx, &sy, &sz, &popsum);
+    if(root_data->packing_term == 1)
+    {
+    	/* We need to incorporate the packing */
+    	sx /= (1+root_data->kappa*popsum);
+    	sy /= (1+root_data->kappa*popsum);
+    	sz /= (1+root_data->kappa*popsum);
+	}
+    sx = max(-1,min(1,sx));
+    sy = max(-1,min(1,sy));
+    sz = max(-1,min(1,sz));
+
+    /* A reflecting edge cannot be crossed */
+    weights[0] = root_data->y_axis.lo_weight[individual->current_y_pos]*(1-sy)/6;
+    weights[1] = root_data->y_axis.hi_weight[individual->current_y_pos]*(1+sy)/6;
+    weights[2] = root_data->x_axis.lo_weight[individual->current_x_pos]*(1-sx)/6;
+    weights[3] = root_data->x_axis.hi_weight[individual->current_x_pos]*(1+sx)/6;
+    weights[4] = root_data->z_axis.lo_weight[individual->current_z_pos]*(1-sz)/6;
+    weights[5] = root_data->z_axis.hi_weight[individual->current_z_pos]*(1+sz)/6;
+    if(drifts != NULL)
+    {
+        drifts[0] = sx;
+        drifts[1] = sy;
+        drifts[2] = sz;
+    }
+
+    /* Return */
+    return;
+}
+
+/***************************************************************************************
+ * Name: kcr_interactions3d()
+ *
+ * Purpose: Sum the interactions of an individual with every individual in a
+ *          three-dimensional box.
+ *
+ * Parameters: IN     individual - the individual
+ *             IN     population - pointer to the population CB containing this individual
+ *             IN     root_data - pointer to a CB containing all the root data for KCR.
+ *             IN/OUT sx - drift in x, added to
+ *             IN/OUT sy - drift in y, added to
+ *             IN/OUT sz - drift in z, added to
+ *             IN/OUT popsum - density at the individual's site, added to
+ *
+ * Returns: Nothing.
+ *
+ * Operation: Each individual costs three loads of its minimum-image offsets, a range
+ *            test and, if in range, a load of the three weights of its offset from
+ *            the kernel table: no square roots or divisions.  As in
+ *            kcr_tabulated_interactions(), the weights of each source population are
+ *            summed and then multiplied by its a_ij once.
+ ***************************************************************************************/
+void kcr_interactions3d(KCR_INDIVIDUAL *individual,
+                        KCR_POPULATION *population,
+                        KCR_ROOT_DATA *root_data,
+                        double *sx,
+                        double *sy,
+                        double *sz,
+                        double *popsum)
+{
+	/* Local variables */
+	KCR_INTERACTION *interaction;
+	KCR_INTERACTION *last_interaction;
+	KCR_KERNEL_TABLE *table;
+	LIST_ELT *curr_elt;
+	KCR_INDIVIDUAL *curr_indiv_cb;
+	const long *x_diffs = root_data->x_axis.diffs;
+	const long *y_diffs = root_data->y_axis.diffs;
+	const long *z_diffs = root_data->z_axis.diffs;
+	const long x_pos = (long)individual->current_x_pos;
+	const long y_pos = (long)individual->current_y_pos;
+	const long z_pos = (long)individual->current_z_pos;
+	const double site_density = 1/pow(root_data->l_val,3);
+	const double *centre;
+	const double *weight;
+	double x_sum;
+	double y_sum;
+	double z_sum;
+	long x_diff;
+	long y_diff;
+	long z_diff;
+	long y_stride;
+	long z_stride;
+
+    interaction = root_data->interactions + (unsigned long)population->index*root_data->no_pops;
+    last_interaction = interaction + root_data->no_interactions[population->index];
+    for(; interaction < last_interaction; interaction++)
+    {
+        table = interaction->table;
+        centre = NULL;
+        y_stride = 0;
+        z_stride = 0;
+        if(table != NULL)
+        {
+            y_stride = 2*table->x_radius + 1;
+            z_stride = y_stride*(2*table->y_radius + 1);
+            centre = table->weights + 3*(table->z_radius*z_stride + table->y_radius*y_stride + table->x_radius);
+        }
+        x_sum = 0;
+        y_sum = 0;
+        z_sum = 0;
+        for(curr_elt = interaction->source->individual_list_root; curr_elt != NULL; curr_elt = curr_elt->next)
+        {
+            curr_indiv_cb = (KCR_INDIVIDUAL *)curr_elt->data;
+            x_diff = x_diffs[(long)curr_indiv_cb->current_x_pos - x_pos];
+            y_diff = y_diffs[(long)curr_indiv_cb->current_y_pos - y_pos];
+            z_diff = z_diffs[(long)curr_indiv_cb->current_z_pos - z_pos];
+            if((centre != NULL) && (labs(x_diff) <= table->x_radius) && (labs(y_diff) <= table->y_radius) &&
+               (labs(z_diff) <= table->z_radius))
+            {
+                weight = centre + 3*(z_diff*z_stride + y_diff*y_stride + x_diff);
+                x_sum += weight[0];
+                y_sum += weight[1];
+                z_sum += weight[2];
+            }
+            if((x_diff == 0) && (y_diff == 0) && (z_diff == 0))
+            {
+                /* Individuals are in the same place; increment popsum, storing sum of all populations at current point */
+                *popsum += site_density;
+            }
+        }
+        *sx += interaction->coeff*x_sum;
+        *sy += interaction->coeff*y_sum;
+        *sz += interaction->coeff*z_sum;
+    }
+
+    /* Return */
+    return;
+}
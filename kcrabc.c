@@ -0,0 +1,1268 @@
+/***************************************************************************************
+ * Filename: kcrabc.c
+ *
+ * Description: Approximate Bayesian computation of the a_ij by sequential Monte Carlo
+ *              (ABC-SMC).  The first generation draws particles (sets of a_ij) from a
+ *              uniform prior; each later one draws them from the particles of the one
+ *              before, perturbs them, and keeps those whose simulation comes closer to
+ *              an observed trajectory than a tolerance, the given quantile of the
+ *              distances of the one before.  Particles are weighted by the prior over
+ *              the density they were drawn with.
+ *
+ *              The simulations start from the first row of the trajectory and run as
+ *              many steps as it has, printing nothing.  Instead, after each step the
+ *              summaries of where the individuals are are worked out and added to
+ *              those of the window of steps the step is in: for each pair of
+ *              populations, how many times more often than at random their
+ *              individuals share a cell as wide as the largest delta, and for
+ *              different populations the same one step apart, which tells the
+ *              population that follows from the one followed.  The distance is the
+ *              root of the sum, over windows and summaries, of the square of the
+ *              difference of the window mean from the trajectory's, scaled by the
+ *              spread of the first generation.  It only grows as windows finish, so a
+ *              simulation is stopped as soon as it is past the tolerance: most of the
+ *              simulations of a generation are rejected, and few run to the end.
+ *
+ *              Every simulation has a seed of its own, from the seed of the run, the
+ *              generation and its number within the generation, and a generation's
+ *              particles are the first in that numbering to be accepted, so the
+ *              results do not depend on the number of threads.
+ *
+ *              The prior file has one row per a_ij, in the order of the a_ij file:
+ *                 low high
+ ***************************************************************************************/
+
+#include <kcr.h>
+
+/***************************************************************************************
+ * Name: kcr_compare_doubles()
+ *
+ * Purpose: qsort() comparison putting doubles in increasing order.
+ *
+ * Parameters: IN     a, b - the doubles
+ *
+ * Returns: Negative, zero or positive as a is less than, equal to, or more than b.
+ ***************************************************************************************/
+static int kcr_compare_doubles(const void *a, const void *b)
+{
+	/* Local variables */
+	double a_val = *(const double *)a;
+	double b_val = *(const double *)b;
+
+	/* Return */
+	return((a_val > b_val) - (a_val < b_val));
+}
+
+/***************************************************************************************
+ * Name: kcr_read_abc_prior()
+ *
+ * Purpose: Read the bounds of the uniform prior of every a_ij from the prior file.
+ *
+ * Parameters: IN     prior_file - the prior file
+ *             IN     root_data - pointer to a CB containing all the root data for KCR.
+ *             OUT    prior - the lows then the highs, each laid out as root_data->aijs
+ *
+ * Returns: rc - KCR_RC_OK if ok or KCR_RC_ERROR if the file is malformed.
+ ***************************************************************************************/
+unsigned short kcr_read_abc_prior(FILE *prior_file, KCR_ROOT_DATA *root_data, double *prior)
+{
+	/* Local variables */
+	KCR_PARSER parser;
+	unsigned long no_params;
+	unsigned long no_rows = 0;
+	unsigned long no_values = 0;
+	double values[2];
+	double value;
+	unsigned short token;
+	unsigned short rc;
+
+	/* Sanity checks */
+	assert(prior_file != NULL);
+	assert(root_data != NULL);
+	assert(prior != NULL);
+
+	no_params = (unsigned long)root_data->no_pops*root_data->no_pops;
+	rc = kcr_parser_open_file(&parser, prior_file, "prior file");
+	if(rc != KCR_RC_OK)
+	{
+		goto EXIT_LABEL;
+	}
+
+	for(;;)
+	{
+		token = kcr_parser_next(&parser, &value);
+		if(token == KCR_TOKEN_NUMBER)
+		{
+			if(no_values == 2)
+			{
+				kcr_parser_error(&parser, "too many values");
+				rc = KCR_RC_ERROR;
+				break;
+			}
+			values[no_values++] = value;
+		}
+		else if(token == KCR_TOKEN_END_OF_ROW)
+		{
+			if((no_values != 2) || !(values[0] <= values[1]))
+			{
+				kcr_parser_error(&parser, "a_ij needs a low and a high bound, in that order");
+				rc = KCR_RC_ERROR;
+				break;
+			}
+			if(no_rows == no_params)
+			{
+				kcr_parser_error(&parser, "too many a_ij");
+				rc = KCR_RC_ERROR;
+				break;
+			}
+			prior[no_rows] = values[0];
+			prior[no_params + no_rows] = values[1];
+			no_rows++;
+			no_values = 0;
+		}
+		else if(token == KCR_TOKEN_END_OF_FILE)
+		{
+			break;
+		}
+		else
+		{
+			rc = KCR_RC_ERROR;
+			break;
+		}
+	}
+	kcr_parser_close(&parser);
+	if((rc == KCR_RC_OK) && (no_rows != no_params))
+	{
+		fprintf(stderr,"Error: the prior file needs a row for each of the %lu a_ij\n", no_params);
+		rc = KCR_RC_ERROR;
+	}
+
+EXIT_LABEL:
+	/* Return */
+	return(rc);
+}
+
+/***************************************************************************************
+ * Name: kcr_perform_abc()
+ *
+ * Purpose: Run ABC-SMC of the a_ij given an observed trajectory, printing the particles
+ *          of every generation.
+ *
+ * Parameters: IN     root_data - pointer to a CB containing all the root data for KCR.
+ *             IN     trajectory - the trajectory
+ *             IN     prior_file - the prior file
+ *             IN     no_particles - number of particles in each generation
+ *             IN     no_generations - number of generations
+ *             IN     quantile - quantile of the distances of a generation that is the
+ *                               tolerance of the next
+ *
+ * Returns: rc - KCR_RC_OK if ok or KCR_RC_ERROR if error.
+ *
+ * Operation: Each generation runs batches of simulations, shared out among
+ *            root_data->no_threads threads each running its own copy of the
+ *            simulation, until no_particles have been accepted.  A batch is as many
+ *            simulations as the acceptance rate so far says are still needed.  The
+ *            first generation is run to the end, to scale each summary of each window
+ *            by its standard deviation over the prior.  The perturbation of each a_ij
+ *            is Gaussian with twice the weighted variance of the particles it
+ *            perturbs.
+ *
+ *            Each particle is printed as a row of root_data->out_file: the generation,
+ *            the weight, the distance and the a_ij, laid out as root_data->aijs.
+ ***************************************************************************************/
+unsigned short kcr_perform_abc(KCR_ROOT_DATA *root_data,
+                               const KCR_TRAJECTORY *trajectory,
+                               FILE *prior_file,
+                               unsigned long no_particles,
+                               unsigned short no_generations,
+                               double quantile)
+{
+	/* Local variables */
+	KCR_ABC abc;
+	KCR_ABC_WORKER *workers = NULL;
+	KCR_THREAD *threads = NULL;
+	double *work = NULL;
+	double *prior;
+	double *particles;
+	double *weights;
+	double *dists;
+	double *new_particles;
+	double *new_weights;
+	double *new_dists;
+	double *perturb_sds;
+	double *swap;
+	double max_delta = 0;
+	double tolerance = HUGE_VAL;
+	double rate;
+	double mean;
+	double var;
+	double diff;
+	unsigned long no_params;
+	unsigned long no_summaries;
+	unsigned long no_steps;
+	unsigned long capacity;
+	unsigned long no_workers;
+	unsigned long curr_worker;
+	unsigned long param;
+	unsigned long particle;
+	unsigned long summary;
+	unsigned long batch;
+	unsigned long no_accepted;
+	unsigned long no_run;
+	unsigned long no_rejected;
+	unsigned long steps_run;
+	unsigned short generation;
+	unsigned short rc = KCR_RC_ERROR;
+
+	/* Sanity checks */
+	assert(root_data != NULL);
+	assert(trajectory != NULL);
+	assert(prior_file != NULL);
+	assert(no_particles > 0);
+	assert((quantile > 0) && (quantile <= 1));
+
+	memset(&abc, 0, sizeof(KCR_ABC));
+	no_params = (unsigned long)root_data->no_pops*root_data->no_pops;
+	no_steps = trajectory->no_rows - 1;
+	no_workers = KCR_MAX(root_data->no_threads, 1);
+	capacity = 4*no_particles + no_workers;
+
+	/* The summaries */
+	abc.trajectory = trajectory;
+	abc.no_params = no_params;
+	abc.no_windows = KCR_MIN(no_steps, KCR_ABC_WINDOWS);
+	abc.no_stats = (unsigned long)root_data->no_pops*(root_data->no_pops + 1)/2 +
+	               (unsigned long)root_data->no_pops*(root_data->no_pops - 1);
+	for(param = 0; param < no_params; param++)
+	{
+		max_delta = KCR_MAX(max_delta, fabs(root_data->deltas[param]));
+	}
+	/* delta is a length, so cells span delta/l_val sites */
+	abc.cell_width = KCR_MAX((unsigned long)ceil(max_delta/root_data->l_val), 1);
+	abc.no_cells_x = (root_data->box_width + abc.cell_width - 1)/abc.cell_width;
+	abc.no_cells_y = (root_data->box_height + abc.cell_width - 1)/abc.cell_width;
+	abc.no_cells = abc.no_cells_x*abc.no_cells_y*((root_data->box_depth + abc.cell_width - 1)/abc.cell_width);
+	abc.no_equal_cells = kcr_abc_equal_cells(root_data->box_width, abc.cell_width)*
+	                     kcr_abc_equal_cells(root_data->box_height, abc.cell_width)*
+	                     kcr_abc_equal_cells(root_data->box_depth, abc.cell_width);
+	no_summaries = abc.no_windows*abc.no_stats;
+
+	work = (double *)malloc((2*no_params + 2*no_particles*(no_params + 2) + no_params + 2*no_summaries +
+	                         capacity*(no_params + 1 + no_summaries))*sizeof(double));
+	abc.batch_accepted = (unsigned short *)malloc(capacity*sizeof(unsigned short));
+	abc.batch_steps = (unsigned long *)malloc(capacity*sizeof(unsigned long));
+	workers = (KCR_ABC_WORKER *)calloc(no_workers, sizeof(KCR_ABC_WORKER));
+	threads = (KCR_THREAD *)calloc(no_workers, sizeof(KCR_THREAD));
+	if((work == NULL) || (abc.batch_accepted == NULL) || (abc.batch_steps == NULL) || (workers == NULL) ||
+	   (threads == NULL))
+	{
+		fprintf(stderr,"MEMORY ALLOCATION FAILURE FOR ABC\n");
+		goto EXIT_LABEL;
+	}
+	prior = work;
+	particles = prior + 2*no_params;
+	weights = particles + no_particles*no_params;
+	dists = weights + no_particles;
+	new_particles = dists + no_particles;
+	new_weights = new_particles + no_particles*no_params;
+	new_dists = new_weights + no_particles;
+	perturb_sds = new_dists + no_particles;
+	abc.obs_summaries = perturb_sds + no_params;
+	abc.scales = abc.obs_summaries + no_summaries;
+	abc.batch_params = abc.scales + no_summaries;
+	abc.batch_dist_sqs = abc.batch_params + capacity*no_params;
+	abc.batch_summaries = abc.batch_dist_sqs + capacity;
+
+	if(kcr_read_abc_prior(prior_file, root_data, prior) != KCR_RC_OK)
+	{
+		goto EXIT_LABEL;
+	}
+	abc.prior = prior;
+	for(curr_worker = 0; curr_worker < no_workers; curr_worker++)
+	{
+		if(kcr_abc_worker_init(&workers[curr_worker], root_data, &abc) != KCR_RC_OK)
+		{
+			goto EXIT_LABEL;
+		}
+		workers[curr_worker].worker_no = curr_worker;
+		workers[curr_worker].no_workers = no_workers;
+	}
+	kcr_abc_observe(&workers[0]);
+	fprintf(stderr,"ABC-SMC: %lu summaries in each of %lu windows, over cells %lu sites wide\n",
+	        abc.no_stats, abc.no_windows, abc.cell_width);
+
+	for(generation = 0; generation < no_generations; generation++)
+	{
+		abc.generation = generation;
+		if(generation == 0)
+		{
+			/* From the prior, run to the end to scale the summaries */
+			abc.tolerance_sq = HUGE_VAL;
+			abc.prev_particles = NULL;
+		}
+		else
+		{
+			/* From the last generation, within the quantile of its distances */
+			tolerance = kcr_abc_quantile(dists, no_particles, quantile, new_dists);
+			abc.tolerance_sq = tolerance*tolerance;
+			abc.prev_particles = particles;
+			abc.prev_weights = weights;
+			abc.no_prev = no_particles;
+			for(param = 0; param < no_params; param++)
+			{
+				mean = 0;
+				var = 0;
+				for(particle = 0; particle < no_particles; particle++)
+				{
+					mean += weights[particle]*particles[particle*no_params + param];
+				}
+				for(particle = 0; particle < no_particles; particle++)
+				{
+					diff = particles[particle*no_params + param] - mean;
+					var += weights[particle]*diff*diff;
+				}
+				perturb_sds[param] = sqrt(2*var);
+			}
+			abc.perturb_sds = perturb_sds;
+		}
+
+		no_accepted = 0;
+		no_run = 0;
+		no_rejected = 0;
+		steps_run = 0;
+		while(no_accepted < no_particles)
+		{
+			if(no_run >= no_particles*KCR_ABC_MAX_ATTEMPTS)
+			{
+				fprintf(stderr,"Error: ABC generation %u accepted only %lu particles in %lu simulations\n",
+				        generation, no_accepted, no_run);
+				goto EXIT_LABEL;
+			}
+
+			/* As many as the acceptance rate so far says are still needed */
+			rate = (no_accepted > 0) ? (double)no_accepted/no_run : ((generation == 0) ? 1 : quantile);
+			abc.first_attempt = no_run;
+			abc.batch_size = (unsigned long)ceil((no_particles - no_accepted)/rate);
+			abc.batch_size = KCR_MIN(KCR_MAX(abc.batch_size, no_workers), capacity);
+			for(curr_worker = 0; curr_worker < no_workers; curr_worker++)
+			{
+				if((curr_worker == no_workers - 1) ||
+				   (kcr_thread_create(&threads[curr_worker], kcr_abc_batch, &workers[curr_worker]) != KCR_RC_OK))
+				{
+					/* The last worker, or no thread: do the work here instead */
+					threads[curr_worker].function = NULL;
+					kcr_abc_batch(&workers[curr_worker]);
+				}
+			}
+			for(curr_worker = 0; curr_worker < no_workers; curr_worker++)
+			{
+				if(threads[curr_worker].function != NULL)
+				{
+					kcr_thread_join(&threads[curr_worker]);
+				}
+			}
+
+			/* Keep the first accepted, in order */
+			for(batch = 0; batch < abc.batch_size; batch++)
+			{
+				steps_run += abc.batch_steps[batch];
+				if((abc.batch_accepted[batch] != KCR_YES) && (generation == 0))
+				{
+					/* Only a simulation that could not be set up is rejected from the prior */
+					fprintf(stderr,"Error: cannot set up ABC simulation %lu\n", no_run + batch);
+					goto EXIT_LABEL;
+				}
+				if(abc.batch_accepted[batch] != KCR_YES)
+				{
+					no_rejected++;
+				}
+				else if(no_accepted < no_particles)
+				{
+					memcpy(new_particles + no_accepted*no_params, abc.batch_params + batch*no_params,
+					       no_params*sizeof(double));
+					new_dists[no_accepted] = sqrt(abc.batch_dist_sqs[batch]);
+					no_accepted++;
+				}
+			}
+			no_run += abc.batch_size;
+		}
+
+		if(generation == 0)
+		{
+			/* Scale each summary by its spread over the prior, then work out the distances */
+			for(summary = 0; summary < no_summaries; summary++)
+			{
+				mean = 0;
+				var = 0;
+				for(particle = 0; particle < no_particles; particle++)
+				{
+					mean += abc.batch_summaries[particle*no_summaries + summary]/no_particles;
+				}
+				for(particle = 0; particle < no_particles; particle++)
+				{
+					diff = abc.batch_summaries[particle*no_summaries + summary] - mean;
+					var += diff*diff/no_particles;
+				}
+				abc.scales[summary] = (var > 0) ? sqrt(var) : 1;
+			}
+			for(particle = 0; particle < no_particles; particle++)
+			{
+				new_dists[particle] = 0;
+				for(summary = 0; summary < abc.no_windows; summary++)
+				{
+					new_dists[particle] +=
+						kcr_abc_window_distance(&abc, summary,
+						                        abc.batch_summaries + particle*no_summaries + summary*abc.no_stats);
+				}
+				new_dists[particle] = sqrt(new_dists[particle]);
+				new_weights[particle] = 1.0/no_particles;
+			}
+		}
+		else
+		{
+			kcr_abc_weigh(&abc, new_particles, no_particles, new_weights);
+		}
+		swap = particles;
+		particles = new_particles;
+		new_particles = swap;
+		swap = weights;
+		weights = new_weights;
+		new_weights = swap;
+		swap = dists;
+		dists = new_dists;
+		new_dists = swap;
+
+		for(particle = 0; particle < no_particles; particle++)
+		{
+			fprintf(root_data->out_file, "%u\t%.17g\t%.17g", generation, weights[particle], dists[particle]);
+			for(param = 0; param < no_params; param++)
+			{
+				fprintf(root_data->out_file, "\t%.17g", particles[particle*no_params + param]);
+			}
+			fprintf(root_data->out_file, "\n");
+		}
+		fprintf(stderr,"ABC generation %u: tolerance %g, %lu simulations for %lu particles, %lu rejected, "
+		               "%.1f%% of their time steps run\n",
+		        generation, tolerance, no_run, no_particles, no_rejected, 100.0*steps_run/((double)no_run*no_steps));
+	}
+	rc = KCR_RC_OK;
+
+EXIT_LABEL:
+	if(workers != NULL)
+	{
+		for(curr_worker = 0; curr_worker < no_workers; curr_worker++)
+		{
+			kcr_abc_worker_term(&workers[curr_worker]);
+		}
+		free(workers);
+	}
+	if(threads != NULL)
+	{
+		free(threads);
+	}
+	if(abc.batch_accepted != NULL)
+	{
+		free(abc.batch_accepted);
+	}
+	if(abc.batch_steps != NULL)
+	{
+		free(abc.batch_steps);
+	}
+	if(work != NULL)
+	{
+		free(work);
+	}
+
+	/* Return */
+	return(rc);
+}
+
+/***************************************************************************************
+ * Name: kcr_abc_worker_init()
+ *
+ * Purpose: Set up a thread to run ABC-SMC simulations.
+ *
+ * Parameters: OUT    worker - the worker
+ *             IN     root_data - pointer to a CB containing all the root data for KCR.
+ *             IN     abc - the generations
+ *
+ * Returns: rc - KCR_RC_OK if ok or KCR_RC_ERROR if error.
+ *
+ * Operation: The copy of the simulation is made as for the likelihood.  The counts
+ *            start at zero and every individual in cell 0, so that clearing the cells
+ *            the individuals were last in is always safe.
+ ***************************************************************************************/
+unsigned short kcr_abc_worker_init(KCR_ABC_WORKER *worker, KCR_ROOT_DATA *root_data, KCR_ABC *abc)
+{
+	/* Local variables */
+	unsigned long no_individuals;
+	unsigned short rc = KCR_RC_ERROR;
+
+	/* Sanity checks */
+	assert(worker != NULL);
+	assert(root_data != NULL);
+	assert(abc != NULL);
+
+	worker->abc = abc;
+	worker->root_data = kcr_likelihood_copy(root_data);
+	if(worker->root_data == NULL)
+	{
+		goto EXIT_LABEL;
+	}
+	worker->root_data->seed = root_data->seed;
+	no_individuals = (unsigned long)root_data->no_pops*root_data->no_indivs;
+	worker->cells = (unsigned long *)calloc(no_individuals, sizeof(unsigned long));
+	worker->prev_cells = (unsigned long *)calloc(no_individuals, sizeof(unsigned long));
+	worker->counts = (unsigned int *)calloc(abc->no_cells*root_data->no_pops, sizeof(unsigned int));
+	worker->prev_counts = (unsigned int *)calloc(abc->no_cells*root_data->no_pops, sizeof(unsigned int));
+	worker->overlaps = (double *)malloc(2*(unsigned long)root_data->no_pops*root_data->no_pops*sizeof(double));
+	worker->stats = (double *)malloc(abc->no_stats*sizeof(double));
+	worker->window_sums = (double *)malloc(abc->no_stats*sizeof(double));
+	if((worker->cells == NULL) || (worker->prev_cells == NULL) || (worker->counts == NULL) ||
+	   (worker->prev_counts == NULL) || (worker->overlaps == NULL) || (worker->stats == NULL) ||
+	   (worker->window_sums == NULL))
+	{
+		fprintf(stderr,"MEMORY ALLOCATION FAILURE FOR ABC\n");
+		goto EXIT_LABEL;
+	}
+	rc = KCR_RC_OK;
+
+EXIT_LABEL:
+	/* Return */
+	return(rc);
+}
+
+/***************************************************************************************
+ * Name: kcr_abc_worker_term()
+ *
+ * Purpose: Free what kcr_abc_worker_init() allocated.
+ *
+ * Parameters: IN/OUT worker - the worker (all NULL if never set up)
+ *
+ * Returns: Nothing.
+ ***************************************************************************************/
+void kcr_abc_worker_term(KCR_ABC_WORKER *worker)
+{
+	/* Sanity checks */
+	assert(worker != NULL);
+
+	if(worker->root_data != NULL)
+	{
+		kcr_likelihood_copy_term(worker->root_data);
+	}
+	if(worker->cells != NULL)
+	{
+		free(worker->cells);
+	}
+	if(worker->prev_cells != NULL)
+	{
+		free(worker->prev_cells);
+	}
+	if(worker->counts != NULL)
+	{
+		free(worker->counts);
+	}
+	if(worker->prev_counts != NULL)
+	{
+		free(worker->prev_counts);
+	}
+	if(worker->overlaps != NULL)
+	{
+		free(worker->overlaps);
+	}
+	if(worker->stats != NULL)
+	{
+		free(worker->stats);
+	}
+	if(worker->window_sums != NULL)
+	{
+		free(worker->window_sums);
+	}
+	memset(worker, 0, sizeof(KCR_ABC_WORKER));
+
+	/* Return */
+	return;
+}
+
+/***************************************************************************************
+ * Name: kcr_abc_batch()
+ *
+ * Purpose: Run a worker's share of a batch of simulations.  Run in a thread of its own.
+ *
+ * Parameters: IN/OUT arg - the KCR_ABC_WORKER
+ *
+ * Returns: Nothing.
+ *
+ * Operation: The simulations are dealt out in turn rather than in runs, since most
+ *            stop early and at different times.
+ ***************************************************************************************/
+void kcr_abc_batch(void *arg)
+{
+	/* Local variables */
+	KCR_ABC_WORKER *worker = (KCR_ABC_WORKER *)arg;
+	unsigned long batch;
+
+	/* Sanity checks */
+	assert(worker != NULL);
+
+	for(batch = worker->worker_no; batch < worker->abc->batch_size; batch += worker->no_workers)
+	{
+		kcr_abc_attempt(worker, worker->abc->first_attempt + batch);
+	}
+
+	/* Return */
+	return;
+}
+
+/***************************************************************************************
+ * Name: kcr_abc_attempt()
+ *
+ * Purpose: Draw a particle and simulate it, stopping as soon as it cannot be accepted.
+ *
+ * Parameters: IN/OUT worker - the worker
+ *             IN     attempt - number of the simulation within the generation
+ *
+ * Returns: Nothing.
+ *
+ * Operation: Seed the copy's generator for this simulation, draw the a_ij, put the
+ *            individuals where the first row of the trajectory has them and step.
+ *            At the end of each window add its part of the distance, and stop if the
+ *            square of the distance is past that of the tolerance.  In the first
+ *            generation keep the summaries instead, to be scaled once all are in.
+ ***************************************************************************************/
+void kcr_abc_attempt(KCR_ABC_WORKER *worker, unsigned long attempt)
+{
+	/* Local variables */
+	KCR_ABC *abc;
+	KCR_ROOT_DATA *copy;
+	double *params;
+	double dist_sq = 0;
+	unsigned long batch;
+	unsigned long no_steps;
+	unsigned long window;
+	unsigned long last_step;
+	unsigned long stat;
+	unsigned short accepted = KCR_YES;
+
+	/* Sanity checks */
+	assert(worker != NULL);
+
+	abc = worker->abc;
+	copy = worker->root_data;
+	batch = attempt - abc->first_attempt;
+	params = abc->batch_params + batch*abc->no_params;
+	no_steps = abc->trajectory->no_rows - 1;
+
+	kcr_rng_seed(&copy->rng, (copy->seed ^ KCR_ABC_SEED_MIX) + ((unsigned long long)abc->generation << 40) + attempt);
+	kcr_abc_propose(abc, &copy->rng, params);
+	memcpy(copy->aijs, params, abc->no_params*sizeof(double));
+	if(kcr_setup_interactions(copy) != KCR_RC_OK)
+	{
+		accepted = KCR_NO;
+		goto EXIT_LABEL;
+	}
+
+	kcr_abc_place_row(copy, abc->trajectory->positions);
+	copy->current_time = 0;
+	copy->total_time = (double)no_steps;
+	copy->start_measure_time = (double)no_steps + 1;
+	kcr_abc_count_cells(worker);
+	for(window = 0; window < abc->no_windows; window++)
+	{
+		memset(worker->window_sums, 0, abc->no_stats*sizeof(double));
+		last_step = no_steps*(window + 1)/abc->no_windows;
+		while(copy->current_time < last_step)
+		{
+			kcr_perform_time_step(NULL, copy);
+			kcr_abc_count_cells(worker);
+			kcr_abc_step_summaries(worker);
+			for(stat = 0; stat < abc->no_stats; stat++)
+			{
+				worker->window_sums[stat] += worker->stats[stat];
+			}
+		}
+		for(stat = 0; stat < abc->no_stats; stat++)
+		{
+			worker->window_sums[stat] /= (double)(last_step - no_steps*window/abc->no_windows);
+		}
+
+		if(abc->prev_particles == NULL)
+		{
+			memcpy(abc->batch_summaries + (batch*abc->no_windows + window)*abc->no_stats, worker->window_sums,
+			       abc->no_stats*sizeof(double));
+		}
+		else
+		{
+			dist_sq += kcr_abc_window_distance(abc, window, worker->window_sums);
+			if(dist_sq > abc->tolerance_sq)
+			{
+				/* Can no longer be accepted */
+				accepted = KCR_NO;
+				break;
+			}
+		}
+	}
+	kcr_abc_clear_cells(worker);
+
+EXIT_LABEL:
+	abc->batch_dist_sqs[batch] = dist_sq;
+	abc->batch_accepted[batch] = accepted;
+	abc->batch_steps[batch] = copy->current_time;
+
+	/* Return */
+	return;
+}
+
+/***************************************************************************************
+ * Name: kcr_abc_propose()
+ *
+ * Purpose: Draw a particle.
+ *
+ * Parameters: IN     abc - the generation
+ *             IN/OUT rng - the generator to draw with
+ *             OUT    params - the a_ij drawn
+ *
+ * Returns: Nothing.
+ *
+ * Operation: In the first generation draw from the prior.  After it, pick a particle
+ *            of the last generation with probability its weight and perturb it,
+ *            picking again until the perturbed particle is inside the prior.
+ ***************************************************************************************/
+void kcr_abc_propose(KCR_ABC *abc, KCR_RNG *rng, double *params)
+{
+	/* Local variables */
+	const double *lows;
+	const double *highs;
+	const double *particle;
+	double random;
+	unsigned long param;
+	unsigned long picked;
+	unsigned short inside;
+
+	/* Sanity checks */
+	assert(abc != NULL);
+	assert(rng != NULL);
+	assert(params != NULL);
+
+	lows = abc->prior;
+	highs = abc->prior + abc->no_params;
+	if(abc->prev_particles == NULL)
+	{
+		for(param = 0; param < abc->no_params; param++)
+		{
+			params[param] = lows[param] + (highs[param] - lows[param])*kcr_rng_uniform(rng);
+		}
+		goto EXIT_LABEL;
+	}
+
+	do
+	{
+		random = kcr_rng_uniform(rng);
+		for(picked = 0; picked < abc->no_prev - 1; picked++)
+		{
+			random -= abc->prev_weights[picked];
+			if(random < 0)
+			{
+				break;
+			}
+		}
+		particle = abc->prev_particles + picked*abc->no_params;
+		inside = KCR_YES;
+		for(param = 0; param < abc->no_params; param++)
+		{
+			params[param] = particle[param] + abc->perturb_sds[param]*kcr_rng_gaussian(rng);
+			if((params[param] < lows[param]) || (params[param] > highs[param]))
+			{
+				inside = KCR_NO;
+			}
+		}
+	} while(inside == KCR_NO);
+
+EXIT_LABEL:
+	/* Return */
+	return;
+}
+
+/***************************************************************************************
+ * Name: kcr_abc_observe()
+ *
+ * Purpose: Work out the summaries of the observed trajectory.
+ *
+ * Parameters: IN/OUT worker - a worker, whose copy of the simulation is used to hold
+ *                             each row of the trajectory in turn
+ *
+ * Returns: Nothing.
+ ***************************************************************************************/
+void kcr_abc_observe(KCR_ABC_WORKER *worker)
+{
+	/* Local variables */
+	KCR_ABC *abc;
+	const KCR_TRAJECTORY *trajectory;
+	unsigned long no_steps;
+	unsigned long window;
+	unsigned long step;
+	unsigned long stat;
+	double *window_means;
+
+	/* Sanity checks */
+	assert(worker != NULL);
+
+	abc = worker->abc;
+	trajectory = abc->trajectory;
+	no_steps = trajectory->no_rows - 1;
+	kcr_abc_place_row(worker->root_data, trajectory->positions);
+	kcr_abc_count_cells(worker);
+	for(window = 0; window < abc->no_windows; window++)
+	{
+		window_means = abc->obs_summaries + window*abc->no_stats;
+		memset(window_means, 0, abc->no_stats*sizeof(double));
+		for(step = no_steps*window/abc->no_windows; step < no_steps*(window + 1)/abc->no_windows; step++)
+		{
+			kcr_abc_place_row(worker->root_data, trajectory->positions + (step + 1)*trajectory->no_values);
+			kcr_abc_count_cells(worker);
+			kcr_abc_step_summaries(worker);
+			for(stat = 0; stat < abc->no_stats; stat++)
+			{
+				window_means[stat] += worker->stats[stat];
+			}
+		}
+		for(stat = 0; stat < abc->no_stats; stat++)
+		{
+			window_means[stat] /= (double)(no_steps*(window + 1)/abc->no_windows - no_steps*window/abc->no_windows);
+		}
+	}
+	kcr_abc_clear_cells(worker);
+
+	/* Return */
+	return;
+}
+
+/***************************************************************************************
+ * Name: kcr_abc_place_row()
+ *
+ * Purpose: Put every individual where a row of a trajectory has it.
+ *
+ * Parameters: IN/OUT root_data - pointer to a CB containing all the root data for KCR.
+ *             IN     row - the row
+ *
+ * Returns: Nothing.
+ ***************************************************************************************/
+void kcr_abc_place_row(KCR_ROOT_DATA *root_data, const unsigned int *row)
+{
+	/* Local variables */
+	KCR_POPULATION *curr_pop_cb;
+	KCR_INDIVIDUAL *curr_indiv_cb;
+	unsigned short no_coords;
+
+	/* Sanity checks */
+	assert(root_data != NULL);
+	assert(row != NULL);
+
+	no_coords = KCR_NO_COORDS(root_data);
+	curr_pop_cb = (KCR_POPULATION *)LIST_GET_FIRST(root_data->population_list_root);
+	while(curr_pop_cb != NULL)
+	{
+		curr_indiv_cb = (KCR_INDIVIDUAL *)LIST_GET_FIRST(curr_pop_cb->individual_list_root);
+		while(curr_indiv_cb != NULL)
+		{
+			curr_indiv_cb->current_x_pos = row[0];
+			curr_indiv_cb->current_y_pos = row[1];
+			if(no_coords == 3)
+			{
+				curr_indiv_cb->current_z_pos = row[2];
+			}
+			row += no_coords;
+			curr_indiv_cb = (KCR_INDIVIDUAL *)LIST_GET_NEXT(curr_indiv_cb->list_elt);
+		}
+		curr_pop_cb = (KCR_POPULATION *)LIST_GET_NEXT(curr_pop_cb->list_elt);
+	}
+
+	/* Return */
+	return;
+}
+
+/***************************************************************************************
+ * Name: kcr_abc_count_cells()
+ *
+ * Purpose: Count the individuals of each population in every cell, keeping the counts
+ *          of the last step.
+ *
+ * Parameters: IN/OUT worker - the worker
+ *
+ * Returns: Nothing.
+ *
+ * Operation: Clear the counts of the step before last by going through the cells its
+ *            individuals were in, rather than through every cell, and reuse them for
+ *            this step.
+ ***************************************************************************************/
+void kcr_abc_count_cells(KCR_ABC_WORKER *worker)
+{
+	/* Local variables */
+	KCR_ROOT_DATA *root_data;
+	KCR_ABC *abc;
+	KCR_POPULATION *curr_pop_cb;
+	KCR_INDIVIDUAL *curr_indiv_cb;
+	unsigned long *cells;
+	unsigned int *counts;
+	unsigned long no_individuals;
+	unsigned long indiv;
+	unsigned long cell;
+	unsigned short pop_no;
+
+	/* Sanity checks */
+	assert(worker != NULL);
+
+	root_data = worker->root_data;
+	abc = worker->abc;
+	no_individuals = (unsigned long)root_data->no_pops*root_data->no_indivs;
+	for(indiv = 0; indiv < no_individuals; indiv++)
+	{
+		for(pop_no = 0; pop_no < root_data->no_pops; pop_no++)
+		{
+			worker->prev_counts[worker->prev_cells[indiv]*root_data->no_pops + pop_no] = 0;
+		}
+	}
+	cells = worker->prev_cells;
+	counts = worker->prev_counts;
+	worker->prev_cells = worker->cells;
+	worker->prev_counts = worker->counts;
+	worker->cells = cells;
+	worker->counts = counts;
+
+	indiv = 0;
+	curr_pop_cb = (KCR_POPULATION *)LIST_GET_FIRST(root_data->population_list_root);
+	while(curr_pop_cb != NULL)
+	{
+		curr_indiv_cb = (KCR_INDIVIDUAL *)LIST_GET_FIRST(curr_pop_cb->individual_list_root);
+		while(curr_indiv_cb != NULL)
+		{
+			cell = ((curr_indiv_cb->current_z_pos/abc->cell_width)*abc->no_cells_y +
+			        curr_indiv_cb->current_y_pos/abc->cell_width)*abc->no_cells_x +
+			       curr_indiv_cb->current_x_pos/abc->cell_width;
+			cells[indiv++] = cell;
+			counts[cell*root_data->no_pops + curr_pop_cb->index]++;
+			curr_indiv_cb = (KCR_INDIVIDUAL *)LIST_GET_NEXT(curr_indiv_cb->list_elt);
+		}
+		curr_pop_cb = (KCR_POPULATION *)LIST_GET_NEXT(curr_pop_cb->list_elt);
+	}
+
+	/* Return */
+	return;
+}
+
+/***************************************************************************************
+ * Name: kcr_abc_clear_cells()
+ *
+ * Purpose: Clear the counts of this step and the last.
+ *
+ * Parameters: IN/OUT worker - the worker
+ *
+ * Returns: Nothing.
+ ***************************************************************************************/
+void kcr_abc_clear_cells(KCR_ABC_WORKER *worker)
+{
+	/* Local variables */
+	unsigned long no_individuals;
+	unsigned long indiv;
+	unsigned short no_pops;
+	unsigned short pop_no;
+
+	/* Sanity checks */
+	assert(worker != NULL);
+
+	no_pops = worker->root_data->no_pops;
+	no_individuals = (unsigned long)no_pops*worker->root_data->no_indivs;
+	for(indiv = 0; indiv < no_individuals; indiv++)
+	{
+		for(pop_no = 0; pop_no < no_pops; pop_no++)
+		{
+			worker->counts[worker->cells[indiv]*no_pops + pop_no] = 0;
+			worker->prev_counts[worker->prev_cells[indiv]*no_pops + pop_no] = 0;
+		}
+	}
+
+	/* Return */
+	return;
+}
+
+/***************************************************************************************
+ * Name: kcr_abc_step_summaries()
+ *
+ * Purpose: Work out the summaries of a step from the counts of it and the last.
+ *
+ * Parameters: IN/OUT worker - the worker: the summaries are left in worker->stats
+ *
+ * Returns: Nothing.
+ *
+ * Operation: Adding, for each individual of population i, the count of population j
+ *            in its cell gives the sum over cells of the product of the counts of i
+ *            and j, and the count of j in its cell the step before gives that of i
+ *            now and j a step before.  Each is divided by what it would be if the
+ *            individuals were spread at random over the cells, so is 1 then.  The
+ *            summaries are the overlaps of i with j, for i up to j, and then those of
+ *            i with j a step before, for i not j, both with i and j population
+ *            indices.
+ ***************************************************************************************/
+void kcr_abc_step_summaries(KCR_ABC_WORKER *worker)
+{
+	/* Local variables */
+	KCR_ROOT_DATA *root_data;
+	KCR_POPULATION *curr_pop_cb;
+	KCR_INDIVIDUAL *curr_indiv_cb;
+	double *same;
+	double *lagged;
+	const unsigned int *counts;
+	const unsigned int *prev_counts;
+	double no_cells;
+	double no_indivs;
+	unsigned long indiv;
+	unsigned long stat;
+	unsigned short no_pops;
+	unsigned short pop_no;
+	unsigned short source;
+
+	/* Sanity checks */
+	assert(worker != NULL);
+
+	root_data = worker->root_data;
+	no_pops = root_data->no_pops;
+	same = worker->overlaps;
+	lagged = worker->overlaps + (unsigned long)no_pops*no_pops;
+	memset(worker->overlaps, 0, 2*(unsigned long)no_pops*no_pops*sizeof(double));
+
+	indiv = 0;
+	curr_pop_cb = (KCR_POPULATION *)LIST_GET_FIRST(root_data->population_list_root);
+	while(curr_pop_cb != NULL)
+	{
+		curr_indiv_cb = (KCR_INDIVIDUAL *)LIST_GET_FIRST(curr_pop_cb->individual_list_root);
+		while(curr_indiv_cb != NULL)
+		{
+			counts = worker->counts + worker->cells[indiv]*no_pops;
+			prev_counts = worker->prev_counts + worker->cells[indiv]*no_pops;
+			for(source = 0; source < no_pops; source++)
+			{
+				same[curr_pop_cb->index*no_pops + source] += counts[source];
+				lagged[curr_pop_cb->index*no_pops + source] += prev_counts[source];
+			}
+			indiv++;
+			curr_indiv_cb = (KCR_INDIVIDUAL *)LIST_GET_NEXT(curr_indiv_cb->list_elt);
+		}
+		curr_pop_cb = (KCR_POPULATION *)LIST_GET_NEXT(curr_pop_cb->list_elt);
+	}
+
+	no_cells = worker->abc->no_equal_cells;
+	no_indivs = (double)root_data->no_indivs;
+	stat = 0;
+	for(pop_no = 0; pop_no < no_pops; pop_no++)
+	{
+		/* An individual shares its cell with itself, which does not count */
+		worker->stats[stat++] = (no_indivs > 1) ?
+		                        no_cells*(same[pop_no*no_pops + pop_no] - no_indivs)/(no_indivs*(no_indivs - 1)) : 0;
+		for(source = pop_no + 1; source < no_pops; source++)
+		{
+			worker->stats[stat++] = no_cells*same[pop_no*no_pops + source]/(no_indivs*no_indivs);
+		}
+	}
+	for(pop_no = 0; pop_no < no_pops; pop_no++)
+	{
+		for(source = 0; source < no_pops; source++)
+		{
+			if(source != pop_no)
+			{
+				worker->stats[stat++] = no_cells*lagged[pop_no*no_pops + source]/(no_indivs*no_indivs);
+			}
+		}
+	}
+
+	/* Return */
+	return;
+}
+
+/***************************************************************************************
+ * Name: kcr_abc_equal_cells()
+ *
+ * Purpose: Get the number of equal cells along an axis that individuals spread at
+ *          random would share as often as the cells it is cut into.
+ *
+ * Parameters: IN     length - length of the axis
+ *             IN     cell_width - width of the cells, the last being cut short
+ *
+ * Returns: The square of the length over the sum of the squares of the widths.
+ *
+ * Operation: Two individuals at random share a cell with probability the sum of the
+ *            squares of the cells' shares of the axis, and the number for a box is
+ *            the product of those of its axes.
+ ***************************************************************************************/
+double kcr_abc_equal_cells(unsigned long length, unsigned long cell_width)
+{
+	/* Local variables */
+	double remainder;
+
+	/* Sanity checks */
+	assert(cell_width > 0);
+
+	remainder = (double)(length % cell_width);
+
+	/* Return */
+	return((double)length*length/((double)(length/cell_width)*cell_width*cell_width + remainder*remainder));
+}
+
+/***************************************************************************************
+ * Name: kcr_abc_window_distance()
+ *
+ * Purpose: Get a window's part of the square of the distance from the trajectory.
+ *
+ * Parameters: IN     abc - the generations
+ *             IN     window - the window
+ *             IN     means - the means of the summaries over the window
+ *
+ * Returns: The sum of the squares of the scaled differences from the trajectory.
+ ***************************************************************************************/
+double kcr_abc_window_distance(KCR_ABC *abc, unsigned long window, const double *means)
+{
+	/* Local variables */
+	const double *obs;
+	const double *scales;
+	double diff;
+	double dist_sq = 0;
+	unsigned long stat;
+
+	/* Sanity checks */
+	assert(abc != NULL);
+	assert(means != NULL);
+
+	obs = abc->obs_summaries + window*abc->no_stats;
+	scales = abc->scales + window*abc->no_stats;
+	for(stat = 0; stat < abc->no_stats; stat++)
+	{
+		diff = (means[stat] - obs[stat])/scales[stat];
+		dist_sq += diff*diff;
+	}
+
+	/* Return */
+	return(dist_sq);
+}
+
+/***************************************************************************************
+ * Name: kcr_abc_weigh()
+ *
+ * Purpose: Weigh the particles of a generation after the first.
+ *
+ * Parameters: IN     abc - the generation
+ *             IN     particles - its particles
+ *             IN     no_particles - number of particles
+ *             OUT    weights - their weights, adding up to 1
+ *
+ * Returns: Nothing.
+ *
+ * Operation: The prior is uniform, so a particle's weight is in proportion to one over
+ *            the density it was drawn with: the sum over the last generation of the
+ *            weight of each particle times the perturbation density from it.  The
+ *            normalising constants of the perturbation are the same for every
+ *            particle and are left out, a_ij not perturbed (which are then the same
+ *            in every particle) are skipped, and the sums are worked out from their
+ *            logs so that they cannot underflow.
+ ***************************************************************************************/
+void kcr_abc_weigh(KCR_ABC *abc, const double *particles, unsigned long no_particles, double *weights)
+{
+	/* Local variables */
+	const double *particle;
+	const double *prev_particle;
+	double log_term;
+	double max_log;
+	double sum;
+	double diff;
+	double min_log_density = HUGE_VAL;
+	double total = 0;
+	unsigned long curr_particle;
+	unsigned long prev;
+	unsigned long param;
+
+	/* Sanity checks */
+	assert(abc != NULL);
+	assert(abc->prev_particles != NULL);
+	assert(particles != NULL);
+	assert(weights != NULL);
+
+	for(curr_particle = 0; curr_particle < no_particles; curr_particle++)
+	{
+		/* Log of the density, into weights for now */
+		particle = particles + curr_particle*abc->no_params;
+		max_log = -HUGE_VAL;
+		for(prev = 0; prev < abc->no_prev; prev++)
+		{
+			prev_particle = abc->prev_particles + prev*abc->no_params;
+			log_term = 0;
+			for(param = 0; param < abc->no_params; param++)
+			{
+				if(abc->perturb_sds[param] > 0)
+				{
+					diff = (particle[param] - prev_particle[param])/abc->perturb_sds[param];
+					log_term -= diff*diff/2;
+				}
+			}
+			max_log = KCR_MAX(max_log, log_term);
+		}
+		sum = 0;
+		for(prev = 0; prev < abc->no_prev; prev++)
+		{
+			prev_particle = abc->prev_particles + prev*abc->no_params;
+			log_term = 0;
+			for(param = 0; param < abc->no_params; param++)
+			{
+				if(abc->perturb_sds[param] > 0)
+				{
+					diff = (particle[param] - prev_particle[param])/abc->perturb_sds[param];
+					log_term -= diff*diff/2;
+				}
+			}
+			sum += abc->prev_weights[prev]*exp(log_term - max_log);
+		}
+		weights[curr_particle] = max_log + log(sum);
+		min_log_density = KCR_MIN(min_log_density, weights[curr_particle]);
+	}
+	for(curr_particle = 0; curr_particle < no_particles; curr_particle++)
+	{
+		weights[curr_particle] = exp(min_log_density - weights[curr_particle]);
+		total += weights[curr_particle];
+	}
+	for(curr_particle = 0; curr_particle < no_particles; curr_particle++)
+	{
+		weights[curr_particle] /= total;
+	}
+
+	/* Return */
+	return;
+}
+
+/***************************************************************************************
+ * Name: kcr_abc_quantile()
+ *
+ * Purpose: Get a quantile of some values.
+ *
+ * Parameters: IN     values - the values
+ *             IN     no_values - number of values
+ *             IN     quantile - the quantile, more than 0 and at most 1
+ *             OUT    sorted - room for no_values values, left holding them sorted
+ *
+ * Returns: The smallest value at least the given fraction of the values are no more
+ *          than.
+ ***************************************************************************************/
+double kcr_abc_quantile(const double *values, unsigned long no_values, double quantile, double *sorted)
+{
+	/* Local variables */
+	unsigned long rank;
+
+	/* Sanity checks */
+	assert(values != NULL);
+	assert(sorted != NULL);
+	assert(no_values > 0);
+
+	memcpy(sorted, values, no_values*sizeof(double));
+	qsort(sorted, no_values, sizeof(double), kcr_compare_doubles);
+	rank = (unsigned long)ceil(quantile*no_values);
+	rank = KCR_MIN(KCR_MAX(rank, 1), no_values);
+
+	/* Return */
+	return(sorted[rank - 1]);
+}
@@ -0,0 +1,401 @@
+/***************************************************************************************
+ * Filename: kcrbranch.c
+ *
+ * Description: Branch mode: continue one (typically equilibrated) state several times
+ *              with different settings.  Each branch runs in a copy-on-write child
+ *              process where the operating system supports fork(), and otherwise in
+ *              turn within this process, restarting from an in-memory checkpoint.
+ *
+ *              The branch file has one row per branch:
+ *                 seed total_time [a_11 a_12 ... a_NN]
+ *              A seed of 0 continues the random number stream of the state being
+ *              branched from; the a_ij-values, if present, replace the current ones.
+ ***************************************************************************************/
+
+#include <kcr.h>
+
+/***************************************************************************************
+ * Name: kcr_read_branches()
+ *
+ * Purpose: Read the settings of every branch from the branch file.
+ *
+ * Parameters: IN     branch_file - the branch file
+ *             IN     root_data - pointer to a CB containing all the root data for KCR.
+ *             OUT    branches - array of branch settings, allocated here
+ *             OUT    no_branches - number of branches
+ *
+ * Returns: rc - KCR_RC_OK if ok or KCR_RC_ERROR if the file is malformed.
+ ***************************************************************************************/
+unsigned short kcr_read_branches(FILE *branch_file,
+                                 KCR_ROOT_DATA *root_data,
+                                 KCR_BRANCH **branches,
+                                 unsigned long *no_branches)
+{
+	/* Local variables */
+	KCR_PARSER parser;
+	KCR_BRANCH *branch_array = NULL;
+	KCR_BRANCH *new_array;
+	unsigned long array_size = 0;
+	unsigned long no_params;
+	unsigned long no_values = 0;
+	double *values;
+	double value;
+	unsigned short token;
+	unsigned short rc;
+
+	/* Sanity checks */
+	assert(branch_file != NULL);
+	assert(root_data != NULL);
+
+	*no_branches = 0;
+	no_params = (unsigned long)root_data->no_pops*root_data->no_pops;
+	values = (double *)malloc((2 + no_params)*sizeof(double));
+	if(values == NULL)
+	{
+		fprintf(stderr,"MEMORY ALLOCATION FAILURE FOR BRANCHES\n");
+		rc = KCR_RC_ERROR;
+		goto EXIT_LABEL;
+	}
+	rc = kcr_parser_open_file(&parser, branch_file, "branch file");
+	if(rc != KCR_RC_OK)
+	{
+		goto EXIT_LABEL;
+	}
+
+	for(;;)
+	{
+		token = kcr_parser_next(&parser, &value);
+		if(token == KCR_TOKEN_NUMBER)
+		{
+			if(no_values == 2 + no_params)
+			{
+				kcr_parser_error(&parser, "too many values");
+				rc = KCR_RC_ERROR;
+				break;
+			}
+			values[no_values++] = value;
+		}
+		else if(token == KCR_TOKEN_END_OF_ROW)
+		{
+			if((no_values != 2) && (no_values != 2 + no_params))
+			{
+				kcr_parser_error(&parser, "branch needs a seed, a total time and optionally every a_ij");
+				rc = KCR_RC_ERROR;
+				break;
+			}
+
+			/* Grow the array as needed */
+			if(*no_branches == array_size)
+			{
+				array_size = KCR_MAX(16, 2*array_size);
+				new_array = (KCR_BRANCH *)realloc(branch_array, array_size*sizeof(KCR_BRANCH));
+				if(new_array == NULL)
+				{
+					fprintf(stderr,"MEMORY ALLOCATION FAILURE FOR BRANCHES\n");
+					rc = KCR_RC_ERROR;
+					break;
+				}
+				branch_array = new_array;
+			}
+			branch_array[*no_branches].seed = (unsigned long long)values[0];
+			branch_array[*no_branches].total_time = values[1];
+			branch_array[*no_branches].aijs = NULL;
+			if(no_values > 2)
+			{
+				branch_array[*no_branches].aijs = (double *)malloc(no_params*sizeof(double));
+				if(branch_array[*no_branches].aijs == NULL)
+				{
+					fprintf(stderr,"MEMORY ALLOCATION FAILURE FOR BRANCHES\n");
+					rc = KCR_RC_ERROR;
+					break;
+				}
+				memcpy(branch_array[*no_branches].aijs, values + 2, no_params*sizeof(double));
+			}
+			(*no_branches)++;
+			no_values = 0;
+		}
+		else if(token == KCR_TOKEN_END_OF_FILE)
+		{
+			break;
+		}
+		else
+		{
+			rc = KCR_RC_ERROR;
+			break;
+		}
+	}
+	kcr_parser_close(&parser);
+
+EXIT_LABEL:
+	if(values != NULL)
+	{
+		free(values);
+	}
+	if(rc != KCR_RC_OK)
+	{
+		kcr_free_branches(branch_array, *no_branches);
+		branch_array = NULL;
+		*no_branches = 0;
+	}
+	*branches = branch_array;
+
+	/* Return */
+	return(rc);
+}
+
+/***************************************************************************************
+ * Name: kcr_free_branches()
+ *
+ * Purpose: Free the array allocated by kcr_read_branches().
+ *
+ * Parameters: IN     branches - the array (may be NULL)
+ *             IN     no_branches - number of branches in it
+ *
+ * Returns: Nothing.
+ ***************************************************************************************/
+void kcr_free_branches(KCR_BRANCH *branches, unsigned long no_branches)
+{
+	/* Local variables */
+	unsigned long curr_branch;
+
+	if(branches != NULL)
+	{
+		for(curr_branch = 0; curr_branch < no_branches; curr_branch++)
+		{
+			if(branches[curr_branch].aijs != NULL)
+			{
+				free(branches[curr_branch].aijs);
+			}
+		}
+		free(branches);
+	}
+
+	/* Return */
+	return;
+}
+
+/***************************************************************************************
+ * Name: kcr_run_branch()
+ *
+ * Purpose: Apply a branch's settings to the simulation and run it to completion.
+ *
+ * Parameters: IN/OUT root_data - pointer to a CB containing all the root data for KCR,
+ *                                in the state being branched from.
+ *             IN     branch - the branch's settings
+ *             IN     branch_no - index of the branch
+ *             IN     prefix - prefix of the branch's file names
+ *
+ * Returns: rc - KCR_RC_OK if ok or KCR_RC_ERROR if error.
+ *
+ * Operation: Positions are printed to <prefix>.<branch_no>.out and the end state is
+ *            written to the binary state file <prefix>.<branch_no>.end.  If
+ *            checkpointing is on, the branch checkpoints to <checkpoint>.<branch_no>.
+ ***************************************************************************************/
+unsigned short kcr_run_branch(KCR_ROOT_DATA *root_data,
+                              KCR_BRANCH *branch,
+                              unsigned long branch_no,
+                              const char *prefix)
+{
+	/* Local variables */
+	char *file_name = NULL;
+	char *cp_name = NULL;
+	const char *parent_cp_name;
+	FILE *out_file = NULL;
+	FILE *end_file = NULL;
+	unsigned short rc = KCR_RC_OK;
+
+	/* Sanity checks */
+	assert(root_data != NULL);
+	assert(branch != NULL);
+	assert(prefix != NULL);
+
+	parent_cp_name = root_data->checkpoint_name;
+	file_name = (char *)malloc(strlen(prefix) + 32);
+	if(parent_cp_name != NULL)
+	{
+		cp_name = (char *)malloc(strlen(parent_cp_name) + 32);
+	}
+	if((file_name == NULL) || ((parent_cp_name != NULL) && (cp_name == NULL)))
+	{
+		fprintf(stderr,"MEMORY ALLOCATION FAILURE FOR BRANCH FILE NAMES\n");
+		rc = KCR_RC_ERROR;
+		goto EXIT_LABEL;
+	}
+
+	/* Apply the settings */
+	if(branch->seed != 0)
+	{
+		root_data->seed = branch->seed;
+		kcr_rng_seed(&root_data->rng, branch->seed);
+	}
+	root_data->total_time = branch->total_time;
+	if(branch->aijs != NULL)
+	{
+		memcpy(root_data->aijs, branch->aijs, (unsigned long)root_data->no_pops*root_data->no_pops*sizeof(double));
+		if(kcr_setup_interactions(root_data) != KCR_RC_OK)
+		{
+			rc = KCR_RC_ERROR;
+			goto EXIT_LABEL;
+		}
+	}
+	if(cp_name != NULL)
+	{
+		sprintf(cp_name, "%s.%lu", parent_cp_name, branch_no);
+		root_data->checkpoint_name = cp_name;
+	}
+
+	/* Run it */
+	sprintf(file_name, "%s.%lu.out", prefix, branch_no);
+	out_file = fopen(file_name, "w");
+	if(out_file == NULL)
+	{
+		fprintf(stderr,"Error: cannot open %s\n", file_name);
+		rc = KCR_RC_ERROR;
+		goto EXIT_LABEL;
+	}
+	root_data->out_file = out_file;
+	kcr_perform_simulation(NULL, root_data);
+
+	sprintf(file_name, "%s.%lu.end", prefix, branch_no);
+	end_file = fopen(file_name, "wb");
+	if(end_file == NULL)
+	{
+		fprintf(stderr,"Error: cannot open %s\n", file_name);
+		rc = KCR_RC_ERROR;
+		goto EXIT_LABEL;
+	}
+	rc = kcr_write_state(end_file, root_data);
+
+EXIT_LABEL:
+	root_data->out_file = stdout;
+	root_data->checkpoint_name = parent_cp_name;
+	if(out_file != NULL)
+	{
+		fclose(out_file);
+	}
+	if(end_file != NULL)
+	{
+		fclose(end_file);
+	}
+	if(file_name != NULL)
+	{
+		free(file_name);
+	}
+	if(cp_name != NULL)
+	{
+		free(cp_name);
+	}
+
+	/* Return */
+	return(rc);
+}
+
+/***************************************************************************************
+ * Name: kcr_perform_branches()
+ *
+ * Purpose: Run every branch listed in the branch file from the current state.
+ *
+ * Parameters: IN     branch_file - the branch file
+ *             IN/OUT root_data - pointer to a CB containing all the root data for KCR.
+ *             IN     prefix - prefix of the branches' file names
+ *
+ * Returns: rc - KCR_RC_OK if every branch succeeded, else KCR_RC_ERROR.
+ *
+ * Operation: Where fork() is available, run up to root_data->no_threads branches at a
+ *            time, each in a child process that shares the parent's memory
+ *            copy-on-write.  Otherwise build a checkpoint in memory and run the
+ *            branches in turn, restoring the checkpoint before each.
+ ***************************************************************************************/
+unsigned short kcr_perform_branches(FILE *branch_file, KCR_ROOT_DATA *root_data, const char *prefix)
+{
+	/* Local variables */
+	KCR_BRANCH *branches = NULL;
+	unsigned long no_branches = 0;
+	unsigned long curr_branch;
+	unsigned long no_running = 0;
+	unsigned short fork_result;
+	char *snapshot = NULL;
+	size_t snapshot_size;
+	double total_time;
+	unsigned short rc;
+
+	/* Sanity checks */
+	assert(branch_file != NULL);
+	assert(root_data != NULL);
+
+	rc = kcr_read_branches(branch_file, root_data, &branches, &no_branches);
+	if(rc != KCR_RC_OK)
+	{
+		goto EXIT_LABEL;
+	}
+
+	/* Snapshot of the state being branched from, for branches run in this process */
+	snapshot = kcr_build_checkpoint(root_data, &snapshot_size);
+	if(snapshot == NULL)
+	{
+		rc = KCR_RC_ERROR;
+		goto EXIT_LABEL;
+	}
+	total_time = root_data->total_time;
+
+	for(curr_branch = 0; curr_branch < no_branches; curr_branch++)
+	{
+		if(no_running == root_data->no_threads)
+		{
+			/* Wait for a running branch to finish before starting another */
+			if(kcr_wait_process() != KCR_RC_OK)
+			{
+				rc = KCR_RC_ERROR;
+			}
+			no_running--;
+		}
+
+		/* A child process would not inherit the environmental frame loader thread */
+		kcr_finish_env_prefetch(root_data);
+		fork_result = kcr_fork_process();
+		if(fork_result == KCR_FORK_CHILD)
+		{
+			/* Child: run the branch and exit */
+			kcr_exit_process(kcr_run_branch(root_data, &branches[curr_branch], curr_branch, prefix));
+		}
+		else if(fork_result == KCR_FORK_PARENT)
+		{
+			no_running++;
+		}
+		else
+		{
+			/* No child: run the branch here, then restore the snapshot */
+			if(kcr_run_branch(root_data, &branches[curr_branch], curr_branch, prefix) != KCR_RC_OK)
+			{
+				rc = KCR_RC_ERROR;
+			}
+			root_data->total_time = total_time;
+			if((kcr_restore_checkpoint(root_data, snapshot) != KCR_RC_OK) ||
+			   ((root_data->env_frames.no_frames > 0) && (kcr_seek_env_frames(root_data) != KCR_RC_OK)))
+			{
+				rc = KCR_RC_ERROR;
+				break;
+			}
+		}
+	}
+
+	/* Wait for the remaining branches */
+	while(no_running > 0)
+	{
+		if(kcr_wait_process() != KCR_RC_OK)
+		{
+			rc = KCR_RC_ERROR;
+		}
+		no_running--;
+	}
+
+EXIT_LABEL:
+	kcr_free_branches(branches, no_branches);
+	if(snapshot != NULL)
+	{
+		free(snapshot);
+	}
+
+	/* Return */
+	return(rc);
+}
@@ -0,0 +1,402 @@
+/***************************************************************************************
+ * Filename: kcrcache.c
+ *
+ * Description: On-disk cache of burn-in states.  Runs in a parameter sweep often share
+ *              everything that determines the dynamics up to start_measure_time, so the
+ *              state reached at the end of the burn-in is saved as a checkpoint named
+ *              after a hash of all of those inputs, and later runs with the same hash
+ *              start from it instead of repeating the burn-in.  The cache directory is
+ *              kept below a size bound by removing the least recently used states.
+ ***************************************************************************************/
+
+#include <kcr.h>
+
+/***************************************************************************************
+ * Name: kcr_hash_bytes()
+ *
+ * Purpose: Add a block of bytes to a 64-bit FNV-1a style hash.
+ *
+ * Parameters: IN     hash - hash so far (KCR_HASH_START to begin)
+ *             IN     data - the bytes
+ *             IN     size - number of bytes
+ *
+ * Returns: The updated hash.
+ *
+ * Operation: Whole 8-byte words are folded in one at a time, which is much faster
+ *            than byte at a time on large environmental layers; the tail is folded in
+ *            byte by byte.
+ ***************************************************************************************/
+unsigned long long kcr_hash_bytes(unsigned long long hash, const void *data, unsigned long size)
+{
+	/* Local variables */
+	const unsigned char *bytes = (const unsigned char *)data;
+	unsigned long long word;
+
+	while(size >= sizeof(word))
+	{
+		memcpy(&word, bytes, sizeof(word));
+		hash = (hash ^ word)*KCR_HASH_PRIME;
+		bytes += sizeof(word);
+		size -= sizeof(word);
+	}
+	while(size > 0)
+	{
+		hash = (hash ^ *bytes)*KCR_HASH_PRIME;
+		bytes++;
+		size--;
+	}
+
+	/* Return */
+	return(hash);
+}
+
+/***************************************************************************************
+ * Name: kcr_burn_in_key()
+ *
+ * Purpose: Compute the cache key of a burn-in.
+ *
+ * Parameters: IN     root_data - pointer to a CB containing all the root data for KCR,
+ *                                with the initial conditions set.
+ *             IN     burn_in_time - time step at which the burn-in ends
+ *
+ * Returns: The key: a hash of everything that affects the dynamics up to burn_in_time.
+ *
+ * Operation: Hash the shape of the simulation, the model parameters, the a_ij- and
+ *            delta-values, any kernel shape other than the direct top-hat, the
+ *            environmental layer, any habitat mask, any scent marks and their
+ *            parameters, any move rates and scheduled moves, the starting time and
+ *            positions, the seed and the generator state, the boundary conditions and
+ *            the burn-in time.  The total time and start_measure_time do not affect the
+ *            burn-in, so runs differing only in those share a key.
+ ***************************************************************************************/
+unsigned long long kcr_burn_in_key(KCR_ROOT_DATA *root_data, unsigned long burn_in_time)
+{
+	/* Local variables */
+	unsigned long long hash = KCR_HASH_START;
+	unsigned long long shape[10];
+	double params[4];
+	unsigned long no_params;
+	unsigned long no_coords;
+	unsigned long no_events;
+	unsigned int *coords;
+	double *events;
+	double *rates;
+	KCR_ENV_RASTER *raster;
+	unsigned long value_size;
+	KCR_ENV_FRAMES *frames;
+	unsigned long curr_frame;
+
+	/* Sanity checks */
+	assert(root_data != NULL);
+
+	shape[0] = KCR_CHECKPOINT_VERSION;
+	shape[1] = root_data->no_pops;
+	shape[2] = root_data->no_indivs;
+	shape[3] = root_data->box_width;
+	shape[4] = root_data->box_height;
+	shape[5] = root_data->packing_term;
+	shape[6] = root_data->x_axis.boundary;
+	shape[7] = root_data->y_axis.boundary;
+	shape[8] = root_data->box_depth;
+	shape[9] = root_data->z_axis.boundary;
+	hash = kcr_hash_bytes(hash, shape, sizeof(shape));
+	params[0] = root_data->l_val;
+	params[1] = root_data->env_weight;
+	params[2] = root_data->kappa;
+	params[3] = 0;
+	hash = kcr_hash_bytes(hash, params, sizeof(params));
+
+	no_params = (unsigned long)root_data->no_pops*root_data->no_pops;
+	hash = kcr_hash_bytes(hash, root_data->aijs, no_params*sizeof(double));
+	hash = kcr_hash_bytes(hash, root_data->deltas, no_params*sizeof(double));
+	if(root_data->kernel_shape != KCR_KERNEL_DIRECT)
+	{
+		hash = kcr_hash_bytes(hash, &root_data->kernel_shape, sizeof(root_data->kernel_shape));
+	}
+
+	/* Environmental layer, in whichever form it is held */
+	raster = &root_data->env_raster;
+	if(root_data->env_data != NULL)
+	{
+		hash = kcr_hash_bytes(hash, root_data->env_data, root_data->grid.size*sizeof(double));
+	}
+	else if(raster->values != NULL)
+	{
+		value_size = (raster->type == KCR_ENV_TYPE_FLOAT32) ? 4 :
+		             ((raster->type == KCR_ENV_TYPE_FLOAT16) ? 2 : 1);
+		hash = kcr_hash_bytes(hash, &raster->type, sizeof(raster->type));
+		hash = kcr_hash_bytes(hash, &raster->scale, sizeof(raster->scale));
+		hash = kcr_hash_bytes(hash, &raster->offset, sizeof(raster->offset));
+		hash = kcr_hash_bytes(hash, raster->values,
+		                      value_size*root_data->box_width*root_data->box_height);
+	}
+
+	/* Environmental frames still to come, by name and switch time */
+	frames = &root_data->env_frames;
+	for(curr_frame = 0; curr_frame < frames->no_frames; curr_frame++)
+	{
+		hash = kcr_hash_bytes(hash, frames->names[curr_frame], strlen(frames->names[curr_frame]));
+		hash = kcr_hash_bytes(hash, &frames->switch_times[curr_frame], sizeof(unsigned long));
+	}
+
+	/* Habitat mask */
+	if(root_data->habitat_mask != NULL)
+	{
+		hash = kcr_hash_bytes(hash, root_data->habitat_mask,
+		                      (root_data->grid.size + 63)/64*sizeof(unsigned long long));
+	}
+
+	/* Scent marks */
+	if(root_data->marks_active == KCR_YES)
+	{
+		hash = kcr_hash_bytes(hash, &root_data->mark_decay_rate, sizeof(double));
+		hash = kcr_hash_bytes(hash, &root_data->mark_deposit, sizeof(double));
+		hash = kcr_hash_bytes(hash, root_data->mark_resp, no_params*sizeof(double));
+		hash = kcr_hash_bytes(hash, root_data->mark_times, root_data->grid.size*sizeof(unsigned long long));
+		hash = kcr_hash_bytes(hash, root_data->mark_data,
+		                      root_data->grid.size*root_data->no_pops*sizeof(double));
+	}
+
+	/* Multirate move rates */
+	if(root_data->multirate_active == KCR_YES)
+	{
+		rates = (double *)malloc(root_data->no_pops*sizeof(double));
+		if(rates != NULL)
+		{
+			kcr_pack_multirate(root_data, rates);
+			hash = kcr_hash_bytes(hash, rates, root_data->no_pops*sizeof(double));
+			free(rates);
+		}
+		else
+		{
+			hash = kcr_hash_bytes(hash, &root_data, sizeof(root_data));
+		}
+	}
+
+	/* Starting state */
+	no_coords = KCR_NO_COORDS(root_data)*(unsigned long)root_data->no_pops*root_data->no_indivs;
+	if(root_data->events_active == KCR_YES)
+	{
+		no_events = root_data->no_pops + (unsigned long)root_data->no_pops*root_data->no_indivs;
+		events = (double *)malloc(no_events*sizeof(double));
+		if(events != NULL)
+		{
+			kcr_pack_events(root_data, events);
+			hash = kcr_hash_bytes(hash, events, no_events*sizeof(double));
+			free(events);
+		}
+		else
+		{
+			hash = kcr_hash_bytes(hash, &root_data, sizeof(root_data));
+		}
+	}
+	coords = (unsigned int *)malloc(no_coords*sizeof(unsigned int));
+	if(coords != NULL)
+	{
+		kcr_pack_positions(root_data, coords);
+		hash = kcr_hash_bytes(hash, coords, no_coords*sizeof(unsigned int));
+		free(coords);
+	}
+	else
+	{
+		/* Cannot identify the starting positions: make the key unique to this run */
+		hash = kcr_hash_bytes(hash, &root_data, sizeof(root_data));
+	}
+	hash = kcr_hash_bytes(hash, &root_data->current_time, sizeof(root_data->current_time));
+	hash = kcr_hash_bytes(hash, &root_data->seed, sizeof(root_data->seed));
+	hash = kcr_hash_bytes(hash, root_data->rng.state, sizeof(root_data->rng.state));
+	hash = kcr_hash_bytes(hash, &burn_in_time, sizeof(burn_in_time));
+
+	/* Return */
+	return(hash);
+}
+
+/***************************************************************************************
+ * Name: kcr_compare_mtime()
+ *
+ * Purpose: qsort() comparison putting KCR_FILE_INFOs in order of modification time.
+ *
+ * Parameters: IN     a, b - the KCR_FILE_INFOs
+ *
+ * Returns: Negative, zero or positive as a is older than, as old as, or newer than b.
+ ***************************************************************************************/
+static int kcr_compare_mtime(const void *a, const void *b)
+{
+	/* Local variables */
+	long long a_mtime = ((const KCR_FILE_INFO *)a)->mtime;
+	long long b_mtime = ((const KCR_FILE_INFO *)b)->mtime;
+
+	/* Return */
+	return((a_mtime > b_mtime) - (a_mtime < b_mtime));
+}
+
+/***************************************************************************************
+ * Name: kcr_evict_cache()
+ *
+ * Purpose: Keep the burn-in cache within its size bound.
+ *
+ * Parameters: IN     cache_dir - the cache directory
+ *             IN     max_size - size bound in bytes
+ *
+ * Returns: Nothing.
+ *
+ * Operation: Every use of a cached state updates its modification time, so removing
+ *            the files with the oldest modification times first removes the least
+ *            recently used states.
+ ***************************************************************************************/
+void kcr_evict_cache(const char *cache_dir, unsigned long long max_size)
+{
+	/* Local variables */
+	KCR_FILE_INFO *files;
+	unsigned long no_files;
+	unsigned long curr_file;
+	unsigned long long total_size = 0;
+
+	/* Sanity checks */
+	assert(cache_dir != NULL);
+
+	if(kcr_list_files(cache_dir, KCR_CACHE_SUFFIX, &files, &no_files) != KCR_RC_OK)
+	{
+		goto EXIT_LABEL;
+	}
+	for(curr_file = 0; curr_file < no_files; curr_file++)
+	{
+		total_size += files[curr_file].size;
+	}
+	qsort(files, no_files, sizeof(KCR_FILE_INFO), kcr_compare_mtime);
+	for(curr_file = 0; (curr_file < no_files) && (total_size > max_size); curr_file++)
+	{
+		if(remove(files[curr_file].name) == 0)
+		{
+			total_size -= files[curr_file].size;
+		}
+	}
+	kcr_free_file_list(files, no_files);
+
+EXIT_LABEL:
+	/* Return */
+	return;
+}
+
+/***************************************************************************************
+ * Name: kcr_perform_burn_in()
+ *
+ * Purpose: Bring the simulation to the end of its burn-in, from the cache if possible.
+ *
+ * Parameters: IN/OUT root_data - pointer to a CB containing all the root data for KCR,
+ *                                with the initial conditions set.
+ *             IN     cache_dir - the cache directory
+ *             IN     max_size - size bound of the cache in megabytes
+ *
+ * Returns: rc - KCR_RC_OK if ok or KCR_RC_ERROR if error.  Failing to write to the
+ *               cache is not an error.
+ *
+ * Operation: The burn-in is every time step before start_measure_time, during which
+ *            nothing is output.  If the cache holds a state for this burn-in's key,
+ *            and its parameters match, restore it and mark it as recently used.  A
+ *            failed restore is an error, as it may have changed part of the state.
+ *            Otherwise run the burn-in, save its end state to the cache and evict old
+ *            states to keep within the size bound.  Checkpointing and stop requests
+ *            take effect once the measured phase starts.
+ ***************************************************************************************/
+unsigned short kcr_perform_burn_in(KCR_ROOT_DATA *root_data, const char *cache_dir, unsigned long max_size)
+{
+	/* Local variables */
+	unsigned long burn_in_time;
+	unsigned long long key;
+	char *cp_name = NULL;
+	FILE *cp_file;
+	char *buffer = NULL;
+	const KCR_CHECKPOINT_HEADER *header;
+	unsigned long no_params;
+	unsigned short rc = KCR_RC_OK;
+
+	/* Sanity checks */
+	assert(root_data != NULL);
+	assert(cache_dir != NULL);
+
+	/* Nothing to cache unless some steps come before the measured phase and the end */
+	burn_in_time = (root_data->start_measure_time > 0) ?
+	               (unsigned long)ceil(root_data->start_measure_time) - 1 : 0;
+	if((burn_in_time <= root_data->current_time) || ((double)burn_in_time >= root_data->total_time))
+	{
+		goto EXIT_LABEL;
+	}
+
+	key = kcr_burn_in_key(root_data, burn_in_time);
+	cp_name = (char *)malloc(strlen(cache_dir) + 32);
+	if(cp_name == NULL)
+	{
+		fprintf(stderr,"MEMORY ALLOCATION FAILURE FOR BURN-IN CACHE\n");
+		rc = KCR_RC_ERROR;
+		goto EXIT_LABEL;
+	}
+	sprintf(cp_name, "%s/%016llx%s", cache_dir, key, KCR_CACHE_SUFFIX);
+
+	/* Look for the state in the cache */
+	cp_file = fopen(cp_name, "rb");
+	if(cp_file != NULL)
+	{
+		buffer = kcr_load_checkpoint(cp_file);
+		fclose(cp_file);
+	}
+	if(buffer != NULL)
+	{
+		header = (const KCR_CHECKPOINT_HEADER *)buffer;
+		no_params = (unsigned long)root_data->no_pops*root_data->no_pops;
+		if((header->no_pops == root_data->no_pops) &&
+		   (header->no_indivs == root_data->no_indivs) &&
+		   (header->box_width == root_data->box_width) &&
+		   (header->box_height == root_data->box_height) &&
+		   (header->box_depth == root_data->box_depth) &&
+		   (header->packing_term == root_data->packing_term) &&
+		   (header->current_time == burn_in_time) &&
+		   (header->seed == root_data->seed) &&
+		   (header->l_val == root_data->l_val) &&
+		   (header->env_weight == root_data->env_weight) &&
+		   (header->kappa == root_data->kappa) &&
+		   (header->kernel_shape == root_data->kernel_shape) &&
+		   (memcmp(buffer + sizeof(KCR_CHECKPOINT_HEADER), root_data->aijs,
+		           no_params*sizeof(double)) == 0) &&
+		   (memcmp(buffer + sizeof(KCR_CHECKPOINT_HEADER) + no_params*sizeof(double),
+		           root_data->deltas, no_params*sizeof(double)) == 0))
+		{
+			rc = kcr_restore_checkpoint(root_data, buffer);
+			if(rc != KCR_RC_OK)
+			{
+				fprintf(stderr,"Error: cannot restore burn-in from %s\n", cp_name);
+				goto EXIT_LABEL;
+			}
+			kcr_touch_file(cp_name);
+			fprintf(stderr,"Burn-in to time step %lu restored from %s\n", burn_in_time, cp_name);
+			if(root_data->env_frames.no_frames > 0)
+			{
+				rc = kcr_seek_env_frames(root_data);
+			}
+			goto EXIT_LABEL;
+		}
+	}
+
+	/* Not cached: run the burn-in and cache its end state */
+	while(root_data->current_time < burn_in_time)
+	{
+		kcr_perform_time_step(NULL, root_data);
+	}
+	if(kcr_save_checkpoint(root_data, cp_name) == KCR_RC_OK)
+	{
+		kcr_evict_cache(cache_dir, (unsigned long long)max_size << 20);
+	}
+
+EXIT_LABEL:
+	if(buffer != NULL)
+	{
+		free(buffer);
+	}
+	if(cp_name != NULL)
+	{
+		free(cp_name);
+	}
+
+	/* Return */
+	return(rc);
+}
@@ -0,0 +1,155 @@
+/***************************************************************************************
+ * Filename: kcrcoarse.c
+ *
+ * Description: Coarse-to-fine equilibration.  The burn-in only has to reach the right
+ *              large-scale pattern, so the early part of it can be run on a lattice
+ *              coarsened by an integer factor, far more cheaply, before the positions
+ *              are carried back to the lattice of the simulation.
+ ***************************************************************************************/
+
+#include <kcr.h>
+
+/***************************************************************************************
+ * Name: kcr_coarse_equilibrate()
+ *
+ * Purpose: Run the simulation up to a time on a coarsened lattice.
+ *
+ * Parameters: IN/OUT root_data - pointer to a CB containing all the root data for KCR,
+ *                                with the initial conditions set.
+ *             IN     factor - the lattice spacing is multiplied by this, and the box
+ *                             dimensions (other than a height of 1) divided by it
+ *             IN     coarse_time - time step, on the lattice of the simulation, that
+ *                                  the coarse run stands in for
+ *
+ * Returns: rc - KCR_RC_OK if ok or KCR_RC_ERROR if error.
+ *
+ * Operation: Set up a coarse simulation with the same parameters, deltas staying the
+ *            same lengths (so fewer lattice units), and each individual in the
+ *            coarse cell containing its site.  A step on the coarse lattice covers
+ *            factor times the distance of a step on the fine one, and both the
+ *            diffusion and the drift of the walk (the drift goes with the lattice
+ *            spacing) make it worth factor^2 fine steps, so coarse_time/factor^2
+ *            coarse steps are run.  Each individual is then put on a site chosen
+ *            uniformly at random in its coarse cell, and the simulation carries on
+ *            from the time the coarse steps stand in for.  The random number
+ *            generator is handed to the coarse run and back, so the whole run
+ *            follows from the seed.
+ ***************************************************************************************/
+unsigned short kcr_coarse_equilibrate(KCR_ROOT_DATA *root_data, unsigned long factor, unsigned long coarse_time)
+{
+	/* Local variables */
+	KCR_ROOT_DATA *coarse_data = NULL;
+	KCR_POPULATION *pop_cb;
+	KCR_POPULATION *coarse_pop_cb;
+	KCR_INDIVIDUAL *indiv_cb;
+	KCR_INDIVIDUAL *coarse_indiv_cb;
+	unsigned long no_params;
+	unsigned long no_steps;
+	unsigned long y_factor;
+	unsigned short rc = KCR_RC_OK;
+
+	/* Sanity checks */
+	assert(root_data != NULL);
+	assert(factor > 1);
+
+	y_factor = (root_data->box_height == 1) ? 1 : factor;
+	if((root_data->box_width % factor != 0) || (root_data->box_height % y_factor != 0))
+	{
+		fprintf(stderr,"Error: the box is not a whole number of coarse cells\n");
+		rc = KCR_RC_ERROR;
+		goto EXIT_LABEL;
+	}
+	no_steps = coarse_time/(factor*factor);
+	if(no_steps == 0)
+	{
+		goto EXIT_LABEL;
+	}
+
+	/* The coarse simulation: never printed or checkpointed */
+	coarse_data = kcr_init(root_data->no_indivs,
+	                       root_data->no_pops,
+	                       (double)no_steps,
+	                       (double)no_steps + 1,
+	                       NULL,
+	                       root_data->box_width/factor,
+	                       root_data->box_height/y_factor,
+	                       NULL,
+	                       root_data->l_val*factor,
+	                       NULL,
+	                       0,
+	                       root_data->packing_term,
+	                       root_data->kappa,
+	                       root_data->x_axis.boundary,
+	                       root_data->y_axis.boundary,
+	                       root_data->no_threads);
+	if(coarse_data == NULL)
+	{
+		rc = KCR_RC_ERROR;
+		goto EXIT_LABEL;
+	}
+	no_params = (unsigned long)root_data->no_pops*root_data->no_pops;
+	memcpy(coarse_data->aijs, root_data->aijs, no_params*sizeof(double));
+	memcpy(coarse_data->deltas, root_data->deltas, no_params*sizeof(double));
+	coarse_data->kernel_shape = root_data->kernel_shape;
+	rc = kcr_setup_interactions(coarse_data);
+	if(rc != KCR_RC_OK)
+	{
+		goto EXIT_LABEL;
+	}
+	coarse_data->seed = root_data->seed;
+	coarse_data->rng = root_data->rng;
+
+	/* Down to the coarse lattice.  Both simulations list their populations and
+	 * individuals in the same order. */
+	pop_cb = (KCR_POPULATION *)LIST_GET_FIRST(root_data->population_list_root);
+	coarse_pop_cb = (KCR_POPULATION *)LIST_GET_FIRST(coarse_data->population_list_root);
+	while(pop_cb != NULL)
+	{
+		indiv_cb = (KCR_INDIVIDUAL *)LIST_GET_FIRST(pop_cb->individual_list_root);
+		coarse_indiv_cb = (KCR_INDIVIDUAL *)LIST_GET_FIRST(coarse_pop_cb->individual_list_root);
+		while(indiv_cb != NULL)
+		{
+			coarse_indiv_cb->current_x_pos = indiv_cb->current_x_pos/factor;
+			coarse_indiv_cb->current_y_pos = indiv_cb->current_y_pos/y_factor;
+			indiv_cb = (KCR_INDIVIDUAL *)LIST_GET_NEXT(indiv_cb->list_elt);
+			coarse_indiv_cb = (KCR_INDIVIDUAL *)LIST_GET_NEXT(coarse_indiv_cb->list_elt);
+		}
+		pop_cb = (KCR_POPULATION *)LIST_GET_NEXT(pop_cb->list_elt);
+		coarse_pop_cb = (KCR_POPULATION *)LIST_GET_NEXT(coarse_pop_cb->list_elt);
+	}
+
+	kcr_perform_simulation(NULL, coarse_data);
+	root_data->rng = coarse_data->rng;
+
+	/* And back up to the fine one */
+	pop_cb = (KCR_POPULATION *)LIST_GET_FIRST(root_data->population_list_root);
+	coarse_pop_cb = (KCR_POPULATION *)LIST_GET_FIRST(coarse_data->population_list_root);
+	while(pop_cb != NULL)
+	{
+		indiv_cb = (KCR_INDIVIDUAL *)LIST_GET_FIRST(pop_cb->individual_list_root);
+		coarse_indiv_cb = (KCR_INDIVIDUAL *)LIST_GET_FIRST(coarse_pop_cb->individual_list_root);
+		while(indiv_cb != NULL)
+		{
+			indiv_cb->current_x_pos = coarse_indiv_cb->current_x_pos*factor +
+			                          kcr_rng_below(&root_data->rng, factor);
+			indiv_cb->current_y_pos = coarse_indiv_cb->current_y_pos*y_factor +
+			                          kcr_rng_below(&root_data->rng, y_factor);
+			indiv_cb = (KCR_INDIVIDUAL *)LIST_GET_NEXT(indiv_cb->list_elt);
+			coarse_indiv_cb = (KCR_INDIVIDUAL *)LIST_GET_NEXT(coarse_indiv_cb->list_elt);
+		}
+		pop_cb = (KCR_POPULATION *)LIST_GET_NEXT(pop_cb->list_elt);
+		coarse_pop_cb = (KCR_POPULATION *)LIST_GET_NEXT(coarse_pop_cb->list_elt);
+	}
+	root_data->current_time = no_steps*factor*factor;
+	fprintf(stderr,"Coarse lattice: %lu time steps at %lu times the spacing, standing in for %lu\n",
+	        no_steps, factor, root_data->current_time);
+
+EXIT_LABEL:
+	if(coarse_data != NULL)
+	{
+		kcr_term(coarse_data);
+	}
+
+	/* Return */
+	return(rc);
+}
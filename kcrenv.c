@@ -0,0 +1,1022 @@
+/***************************************************************************************
+ * Filename: kcrenv.c
+ *
+ * Description: Procedures for the environmental layer: the memory-mapped binary
+ *              raster format, its converter and access to environmental values.
+ *
+ *              A binary raster is a KCR_ENV_HEADER followed by box_width*box_height
+ *              values stored row by row, each either a float32, a float16 or a uint8.
+ *              The environmental value is offset + scale*stored_value.
+ ***************************************************************************************/
+
+#include <kcr.h>
+
+/***************************************************************************************
+ * Name: kcr_half_to_double()
+ *
+ * Purpose: Convert an IEEE 754 half-precision number to a double.
+ *
+ * Parameters: IN     half - the half-precision bit pattern
+ *
+ * Returns: The value as a double.
+ ***************************************************************************************/
+double kcr_half_to_double(unsigned short half)
+{
+	/* Local variables */
+	unsigned short exponent = (half >> 10) & 0x1f;
+	unsigned short mantissa = half & 0x3ff;
+	double value;
+
+	if(exponent == 0)
+	{
+		/* Zero or subnormal */
+		value = ldexp((double)mantissa, -24);
+	}
+	else if(exponent == 0x1f)
+	{
+		/* Infinity or NaN */
+		value = (mantissa == 0) ? HUGE_VAL : sqrt(-1.0);
+	}
+	else
+	{
+		/* Normal number */
+		value = ldexp((double)(mantissa | 0x400), exponent - 25);
+	}
+
+	/* Return */
+	return((half & 0x8000) ? -value : value);
+}
+
+/***************************************************************************************
+ * Name: kcr_double_to_half()
+ *
+ * Purpose: Convert a double to the nearest IEEE 754 half-precision number.
+ *
+ * Parameters: IN     value - the value
+ *
+ * Returns: The half-precision bit pattern.  Values too large for half precision
+ *          become infinity.
+ ***************************************************************************************/
+unsigned short kcr_double_to_half(double value)
+{
+	/* Local variables */
+	unsigned short sign = 0;
+	unsigned short half;
+	double fraction;
+	int exponent;
+	unsigned long mantissa;
+
+	if(value != value)
+	{
+		/* NaN */
+		half = 0x7e00;
+		goto EXIT_LABEL;
+	}
+	if(value < 0)
+	{
+		sign = 0x8000;
+		value = -value;
+	}
+
+	if(value >= 65520.0)
+	{
+		/* Overflow */
+		half = 0x7c00;
+	}
+	else if(value < ldexp(1.0, -14))
+	{
+		/* Subnormal (rounding up to the smallest normal number is still correct) */
+		half = (unsigned short)floor(ldexp(value, 24) + 0.5);
+	}
+	else
+	{
+		/* Normal: value = fraction*2^exponent with fraction in [0.5,1) */
+		fraction = frexp(value, &exponent);
+		mantissa = (unsigned long)floor((fraction*2 - 1)*1024 + 0.5);
+		if(mantissa == 1024)
+		{
+			/* Rounded up to the next power of two */
+			mantissa = 0;
+			exponent++;
+		}
+		half = (unsigned short)(((exponent - 1 + 15) << 10) | mantissa);
+	}
+	half |= sign;
+
+EXIT_LABEL:
+	/* Return */
+	return(half);
+}
+
+/***************************************************************************************
+ * Name: kcr_env_is_raster()
+ *
+ * Purpose: Determine whether a file is a binary environmental raster.
+ *
+ * Parameters: IN     env_file - the environmental data file
+ *
+ * Returns: KCR_YES if the file starts with the raster magic number, else KCR_NO.
+ ***************************************************************************************/
+unsigned short kcr_env_is_raster(FILE *env_file)
+{
+	/* Local variables */
+	char magic[8];
+	unsigned short is_raster = KCR_NO;
+
+	/* Sanity checks */
+	assert(env_file != NULL);
+
+	rewind(env_file);
+	if((fread(magic, 1, sizeof(magic), env_file) == sizeof(magic)) &&
+	   (memcmp(magic, KCR_ENV_MAGIC, sizeof(magic)) == 0))
+	{
+		is_raster = KCR_YES;
+	}
+	rewind(env_file);
+
+	/* Return */
+	return(is_raster);
+}
+
+/***************************************************************************************
+ * Name: kcr_env_map_raster()
+ *
+ * Purpose: Map a binary environmental raster into memory.
+ *
+ * Parameters: IN     env_file - the raster file
+ *             OUT    raster - the mapped raster
+ *             IN     box_width - width of box
+ *             IN     box_height - height of box
+ *             IN     report_errors - KCR_YES to say why the raster is unusable, KCR_NO
+ *                                    to fail silently
+ *
+ * Returns: rc - KCR_RC_OK if ok or KCR_RC_ERROR if the raster is unusable.
+ *
+ * Operation: Map the file read-only and check that the header matches the box and
+ *            that the file holds all of the values.  The values are not copied: they
+ *            are read through kcr_env_raster_value(), paging the file in as it is
+ *            touched.
+ ***************************************************************************************/
+unsigned short kcr_env_map_raster(FILE *env_file,
+                                  KCR_ENV_RASTER *raster,
+                                  unsigned long box_width,
+                                  unsigned long box_height,
+                                  unsigned short report_errors)
+{
+	/* Local variables */
+	const KCR_ENV_HEADER *header;
+	unsigned long long value_size;
+	unsigned short rc;
+
+	/* Sanity checks */
+	assert(env_file != NULL);
+	assert(raster != NULL);
+
+	rc = kcr_map_file(env_file, &raster->mapping);
+	if(rc != KCR_RC_OK)
+	{
+		if(report_errors == KCR_YES)
+		{
+			fprintf(stderr,"Error: failed to map environmental raster into memory\n");
+		}
+		goto EXIT_LABEL;
+	}
+	if(raster->mapping.size < sizeof(KCR_ENV_HEADER))
+	{
+		if(report_errors == KCR_YES)
+		{
+			fprintf(stderr,"Error: environmental raster is truncated\n");
+		}
+		rc = KCR_RC_ERROR;
+		goto EXIT_LABEL;
+	}
+
+	/* Check the header */
+	header = (const KCR_ENV_HEADER *)raster->mapping.data;
+	if(header->version != KCR_ENV_VERSION)
+	{
+		if(report_errors == KCR_YES)
+		{
+			fprintf(stderr,"Error: unsupported environmental raster version %u\n", header->version);
+		}
+		rc = KCR_RC_ERROR;
+		goto EXIT_LABEL;
+	}
+	if((header->width != box_width) || (header->height != box_height))
+	{
+		if(report_errors == KCR_YES)
+		{
+			fprintf(stderr,"Error: environmental raster is %ux%u but the box is %lux%lu\n",
+			        header->width, header->height, box_width, box_height);
+		}
+		rc = KCR_RC_ERROR;
+		goto EXIT_LABEL;
+	}
+	if(header->type == KCR_ENV_TYPE_FLOAT32)
+	{
+		value_size = 4;
+	}
+	else if(header->type == KCR_ENV_TYPE_FLOAT16)
+	{
+		value_size = 2;
+	}
+	else if(header->type == KCR_ENV_TYPE_UINT8)
+	{
+		value_size = 1;
+	}
+	else
+	{
+		if(report_errors == KCR_YES)
+		{
+			fprintf(stderr,"Error: unknown environmental raster type %u\n", header->type);
+		}
+		rc = KCR_RC_ERROR;
+		goto EXIT_LABEL;
+	}
+	if(raster->mapping.size < sizeof(KCR_ENV_HEADER) +
+	                          value_size*(unsigned long long)header->width*header->height)
+	{
+		if(report_errors == KCR_YES)
+		{
+			fprintf(stderr,"Error: environmental raster is truncated\n");
+		}
+		rc = KCR_RC_ERROR;
+		goto EXIT_LABEL;
+	}
+
+	raster->type = (unsigned short)header->type;
+	raster->scale = header->scale;
+	raster->offset = header->offset;
+	raster->values = (const char *)raster->mapping.data + sizeof(KCR_ENV_HEADER);
+
+EXIT_LABEL:
+	if(rc != KCR_RC_OK)
+	{
+		kcr_unmap_file(&raster->mapping);
+		raster->values = NULL;
+	}
+
+	/* Return */
+	return(rc);
+}
+
+/***************************************************************************************
+ * Name: kcr_env_raster_value()
+ *
+ * Purpose: Decode one value of a mapped raster.
+ *
+ * Parameters: IN     raster - the raster
+ *             IN     index - index of the value (x+y*box_width)
+ *
+ * Returns: The environmental value.
+ ***************************************************************************************/
+double kcr_env_raster_value(const KCR_ENV_RASTER *raster, unsigned long index)
+{
+	/* Local variables */
+	double value;
+
+	/* Sanity checks */
+	assert(raster != NULL);
+	assert(raster->values != NULL);
+
+	if(raster->type == KCR_ENV_TYPE_FLOAT32)
+	{
+		value = ((const float *)raster->values)[index];
+	}
+	else if(raster->type == KCR_ENV_TYPE_FLOAT16)
+	{
+		value = kcr_half_to_double(((const unsigned short *)raster->values)[index]);
+	}
+	else
+	{
+		value = ((const unsigned char *)raster->values)[index];
+	}
+
+	/* Return */
+	return(raster->offset + raster->scale*value);
+}
+
+/***************************************************************************************
+ * Name: kcr_env_value()
+ *
+ * Purpose: Get the environmental value at a site.
+ *
+ * Parameters: IN     root_data - pointer to a CB containing all the root data for KCR.
+ *             IN     x_val - x-position of the site
+ *             IN     y_val - y-position of the site
+ *
+ * Returns: The environmental value, from the in-memory array or the mapped raster.
+ *          Zero if there is no environmental layer.
+ ***************************************************************************************/
+double kcr_env_value(KCR_ROOT_DATA *root_data, unsigned long x_val, unsigned long y_val)
+{
+	/* Local variables */
+	double value = 0;
+
+	/* Sanity checks */
+	assert(root_data != NULL);
+	assert(x_val < root_data->box_width);
+	assert(y_val < root_data->box_height);
+
+	if(root_data->env_data != NULL)
+	{
+		value = root_data->env_data[KCR_GRID_INDEX(&root_data->grid, x_val, y_val)];
+	}
+	else if(root_data->env_raster.values != NULL)
+	{
+		value = kcr_env_raster_value(&root_data->env_raster, x_val+y_val*root_data->box_width);
+	}
+
+	/* Return */
+	return(value);
+}
+
+/***************************************************************************************
+ * Name: kcr_write_env_raster()
+ *
+ * Purpose: Write the environmental layer out as a binary raster.
+ *
+ * Parameters: IN     out_file - file for the raster (opened for binary writing)
+ *             IN     root_data - pointer to a CB containing all the root data for KCR.
+ *             IN     type - KCR_ENV_TYPE_FLOAT32, KCR_ENV_TYPE_FLOAT16 or
+ *                           KCR_ENV_TYPE_UINT8
+ *
+ * Returns: rc - KCR_RC_OK if ok or KCR_RC_ERROR if error.
+ *
+ * Operation: float32 and float16 rasters store the values directly (scale 1, offset 0).
+ *            uint8 rasters are quantised linearly between the smallest and largest
+ *            values, so the offset is the minimum and the scale is the range/255.
+ ***************************************************************************************/
+unsigned short kcr_write_env_raster(FILE *out_file, KCR_ROOT_DATA *root_data, unsigned short type)
+{
+	/* Local variables */
+	KCR_ENV_HEADER header;
+	unsigned long no_values;
+	unsigned long index;
+	unsigned long value_size;
+	void *values = NULL;
+	double min_val;
+	double max_val;
+	double value;
+	double quantised;
+	unsigned short rc = KCR_RC_OK;
+
+	/* Sanity checks */
+	assert(out_file != NULL);
+	assert(root_data != NULL);
+
+	no_values = root_data->box_width*root_data->box_height;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, KCR_ENV_MAGIC, sizeof(header.magic));
+	header.version = KCR_ENV_VERSION;
+	header.type = type;
+	header.width = (unsigned int)root_data->box_width;
+	header.height = (unsigned int)root_data->box_height;
+	header.scale = 1;
+	header.offset = 0;
+
+	value_size = (type == KCR_ENV_TYPE_FLOAT32) ? 4 : ((type == KCR_ENV_TYPE_FLOAT16) ? 2 : 1);
+	values = malloc(no_values*value_size);
+	if(values == NULL)
+	{
+		fprintf(stderr,"MEMORY ALLOCATION FAILURE FOR ENVIRONMENTAL RASTER\n");
+		rc = KCR_RC_ERROR;
+		goto EXIT_LABEL;
+	}
+
+	if(type == KCR_ENV_TYPE_UINT8)
+	{
+		/* Find the range of the values for the quantisation */
+		min_val = kcr_env_value(root_data, 0, 0);
+		max_val = min_val;
+		for(index = 0; index < no_values; index++)
+		{
+			value = kcr_env_value(root_data, index % root_data->box_width, index / root_data->box_width);
+			min_val = KCR_MIN(min_val, value);
+			max_val = KCR_MAX(max_val, value);
+		}
+		header.offset = min_val;
+		header.scale = (max_val > min_val) ? (max_val - min_val)/255 : 1;
+	}
+
+	for(index = 0; index < no_values; index++)
+	{
+		value = kcr_env_value(root_data, index % root_data->box_width, index / root_data->box_width);
+		if(type == KCR_ENV_TYPE_FLOAT32)
+		{
+			((float *)values)[index] = (float)value;
+		}
+		else if(type == KCR_ENV_TYPE_FLOAT16)
+		{
+			((unsigned short *)values)[index] = kcr_double_to_half(value);
+		}
+		else
+		{
+			quantised = floor((value - header.offset)/header.scale + 0.5);
+			((unsigned char *)values)[index] = (unsigned char)KCR_MAX(0, KCR_MIN(255, quantised));
+		}
+	}
+
+	if((fwrite(&header, sizeof(header), 1, out_file) != 1) ||
+	   (fwrite(values, value_size, no_values, out_file) != no_values))
+	{
+		fprintf(stderr,"Error: failed to write environmental raster\n");
+		rc = KCR_RC_ERROR;
+	}
+
+EXIT_LABEL:
+	if(values != NULL)
+	{
+		free(values);
+	}
+
+	/* Return */
+	return(rc);
+}
+
+/***************************************************************************************
+ * Name: kcr_env_gradient()
+ *
+ * Purpose: Compute the gradient of an environmental layer.
+ *
+ * Parameters: IN     root_data - pointer to a CB containing all the root data for KCR.
+ *             IN     env_data - per-site grid of environmental values, or NULL to use
+ *                               root_data's mapped raster
+ *             OUT    grad_x - per-site grid for the x-gradient
+ *             OUT    grad_y - per-site grid for the y-gradient
+ *
+ * Returns: Nothing.
+ *
+ * Operation: Central differences, (E(x+1)-E(x-1))/2.  Along a periodic axis these
+ *            wrap round; otherwise one-sided differences are used at the edges (the
+ *            stencils are taken from the boundary tables).  A dimension one site wide
+ *            has no gradient.  Only reads root_data's box size, grid layout, boundary
+ *            tables and raster, so it is safe to call from the loader thread.
+ ***************************************************************************************/
+void kcr_env_gradient(KCR_ROOT_DATA *root_data, const double *env_data, float *grad_x, float *grad_y)
+{
+	/* Local variables */
+	const KCR_GRID_LAYOUT *grid;
+	unsigned long x_val;
+	unsigned long y_val;
+	unsigned long lo;
+	unsigned long hi;
+	double span;
+	double lo_val;
+	double hi_val;
+	unsigned long index;
+
+	/* Sanity checks */
+	assert(root_data != NULL);
+	assert(grad_x != NULL);
+	assert(grad_y != NULL);
+
+	grid = &root_data->grid;
+	for(y_val = 0; y_val < root_data->box_height; y_val++)
+	{
+		for(x_val = 0; x_val < root_data->box_width; x_val++)
+		{
+			index = KCR_GRID_INDEX(grid, x_val, y_val);
+
+			/* x-gradient */
+			lo = root_data->x_axis.lo_stencil[x_val];
+			hi = root_data->x_axis.hi_stencil[x_val];
+			span = root_data->x_axis.stencil_span[x_val];
+			grad_x[index] = 0;
+			if(span > 0)
+			{
+				lo_val = (env_data != NULL) ? env_data[KCR_GRID_INDEX(grid, lo, y_val)] :
+				                              kcr_env_value(root_data, lo, y_val);
+				hi_val = (env_data != NULL) ? env_data[KCR_GRID_INDEX(grid, hi, y_val)] :
+				                              kcr_env_value(root_data, hi, y_val);
+				grad_x[index] = (float)((hi_val - lo_val)/span);
+			}
+
+			/* y-gradient */
+			lo = root_data->y_axis.lo_stencil[y_val];
+			hi = root_data->y_axis.hi_stencil[y_val];
+			span = root_data->y_axis.stencil_span[y_val];
+			grad_y[index] = 0;
+			if(span > 0)
+			{
+				lo_val = (env_data != NULL) ? env_data[KCR_GRID_INDEX(grid, x_val, lo)] :
+				                              kcr_env_value(root_data, x_val, lo);
+				hi_val = (env_data != NULL) ? env_data[KCR_GRID_INDEX(grid, x_val, hi)] :
+				                              kcr_env_value(root_data, x_val, hi);
+				grad_y[index] = (float)((hi_val - lo_val)/span);
+			}
+		}
+	}
+
+	/* Return */
+	return;
+}
+
+/***************************************************************************************
+ * Name: kcr_setup_env_gradient()
+ *
+ * Purpose: Allocate and compute the gradient grids of the environmental layer.
+ *
+ * Parameters: IN/OUT root_data - pointer to a CB containing all the root data for KCR.
+ *
+ * Returns: rc - KCR_RC_OK if ok or KCR_RC_ERROR if memory allocation fails.
+ *
+ * Operation: The movement kernels add env_weight times the gradient at an individual's
+ *            site to its drift, so computing the gradient once here makes the
+ *            environmental term O(1) per move.
+ ***************************************************************************************/
+unsigned short kcr_setup_env_gradient(KCR_ROOT_DATA *root_data)
+{
+	/* Local variables */
+	unsigned short rc = KCR_RC_OK;
+
+	/* Sanity checks */
+	assert(root_data != NULL);
+
+	root_data->env_grad_x = kcr_grid_alloc_float(&root_data->grid);
+	root_data->env_grad_y = kcr_grid_alloc_float(&root_data->grid);
+	if((root_data->env_grad_x == NULL) || (root_data->env_grad_y == NULL))
+	{
+		fprintf(stderr,"MEMORY ALLOCATION FAILURE FOR ENVIRONMENTAL GRADIENT\n");
+		rc = KCR_RC_ERROR;
+		goto EXIT_LABEL;
+	}
+	kcr_env_gradient(root_data, root_data->env_data, root_data->env_grad_x, root_data->env_grad_y);
+
+EXIT_LABEL:
+	/* Return */
+	return(rc);
+}
+
+/***************************************************************************************
+ * Name: kcr_load_env_frame()
+ *
+ * Purpose: Load and decode one environmental frame into an array.
+ *
+ * Parameters: IN     name - name of the frame's file, a text matrix or a binary raster
+ *             IN     root_data - pointer to a CB containing all the root data for KCR.
+ *             OUT    env_data - per-site grid for the values
+ *             IN     no_threads - number of threads to parse a text file with
+ *             IN     report_errors - KCR_YES to print any error, KCR_NO to fail silently
+ *
+ * Returns: rc - KCR_RC_OK if ok or KCR_RC_ERROR if error.
+ *
+ * Operation: Only reads root_data's box size and grid layout, so it is safe to call
+ *            from the loader thread while the simulation runs.
+ ***************************************************************************************/
+unsigned short kcr_load_env_frame(const char *name,
+                                  KCR_ROOT_DATA *root_data,
+                                  double *env_data,
+                                  unsigned short no_threads,
+                                  unsigned short report_errors)
+{
+	/* Local variables */
+	FILE *frame_file;
+	KCR_ENV_RASTER raster;
+	unsigned long x_val;
+	unsigned long y_val;
+	unsigned short rc;
+
+	/* Sanity checks */
+	assert(name != NULL);
+	assert(root_data != NULL);
+	assert(env_data != NULL);
+
+	frame_file = fopen(name, "rb");
+	if(frame_file == NULL)
+	{
+		if(report_errors == KCR_YES)
+		{
+			fprintf(stderr,"Error: cannot open environmental frame %s\n", name);
+		}
+		rc = KCR_RC_ERROR;
+		goto EXIT_LABEL;
+	}
+
+	if(kcr_env_is_raster(frame_file) == KCR_YES)
+	{
+		/* Binary raster: decode every value */
+		memset(&raster, 0, sizeof(raster));
+		rc = kcr_env_map_raster(frame_file,
+		                        &raster,
+		                        root_data->box_width,
+		                        root_data->box_height,
+		                        report_errors);
+		if(rc == KCR_RC_OK)
+		{
+			for(y_val = 0; y_val < root_data->box_height; y_val++)
+			{
+				for(x_val = 0; x_val < root_data->box_width; x_val++)
+				{
+					env_data[KCR_GRID_INDEX(&root_data->grid, x_val, y_val)] =
+					    kcr_env_raster_value(&raster, x_val+y_val*root_data->box_width);
+				}
+			}
+			kcr_unmap_file(&raster.mapping);
+		}
+	}
+	else
+	{
+		/* Text matrix: values missing from the file are zero */
+		memset(env_data, 0, root_data->grid.size*sizeof(double));
+		rc = kcr_parse_matrix_parallel(frame_file,
+		                               name,
+		                               env_data,
+		                               &root_data->grid,
+		                               root_data->box_width,
+		                               root_data->box_height,
+		                               no_threads,
+		                               report_errors);
+	}
+	fclose(frame_file);
+
+EXIT_LABEL:
+	/* Return */
+	return(rc);
+}
+
+/***************************************************************************************
+ * Name: kcr_env_frame_loader()
+ *
+ * Purpose: Loader thread: load the next environmental frame, and compute its gradient,
+ *          into the spare buffers.
+ *
+ * Parameters: IN     arg - pointer to a CB containing all the root data for KCR.
+ *
+ * Returns: Nothing.  On success spare_frame is set to the frame loaded.
+ *
+ * Operation: Touches only the spare buffers and spare_frame, which the simulation
+ *            leaves alone until it has joined this thread.  A text frame is parsed on
+ *            this thread alone so that loading does not compete with the simulation
+ *            for processors.  Errors are not printed: kcr_switch_env_frame() loads a
+ *            frame that failed again, and reports the error then.
+ ***************************************************************************************/
+void kcr_env_frame_loader(void *arg)
+{
+	/* Local variables */
+	KCR_ROOT_DATA *root_data = (KCR_ROOT_DATA *)arg;
+	KCR_ENV_FRAMES *frames;
+
+	/* Sanity checks */
+	assert(root_data != NULL);
+
+	frames = &root_data->env_frames;
+	if(kcr_load_env_frame(frames->names[frames->next_frame], root_data, frames->spare, 1, KCR_NO) == KCR_RC_OK)
+	{
+		kcr_env_gradient(root_data, frames->spare, frames->spare_grad_x, frames->spare_grad_y);
+		frames->spare_frame = frames->next_frame;
+	}
+
+	/* Return */
+	return;
+}
+
+/***************************************************************************************
+ * Name: kcr_start_env_prefetch()
+ *
+ * Purpose: Start loading the next environmental frame in the background.
+ *
+ * Parameters: IN/OUT root_data - pointer to a CB containing all the root data for KCR.
+ *
+ * Returns: Nothing.  If the thread cannot be started, the frame is loaded when it is
+ *          needed instead.
+ ***************************************************************************************/
+void kcr_start_env_prefetch(KCR_ROOT_DATA *root_data)
+{
+	/* Local variables */
+	KCR_ENV_FRAMES *frames;
+
+	/* Sanity checks */
+	assert(root_data != NULL);
+
+	frames = &root_data->env_frames;
+	assert(frames->loading == KCR_NO);
+	frames->spare_frame = frames->no_frames;
+	if((frames->next_frame < frames->no_frames) &&
+	   (kcr_thread_create(&frames->loader, kcr_env_frame_loader, root_data) == KCR_RC_OK))
+	{
+		frames->loading = KCR_YES;
+	}
+
+	/* Return */
+	return;
+}
+
+/***************************************************************************************
+ * Name: kcr_finish_env_prefetch()
+ *
+ * Purpose: Wait for any background load of an environmental frame to finish.
+ *
+ * Parameters: IN/OUT root_data - pointer to a CB containing all the root data for KCR.
+ *
+ * Returns: Nothing.
+ *
+ * Operation: Called before switching frames, and before forking, since a child process
+ *            does not inherit the loader thread.
+ ***************************************************************************************/
+void kcr_finish_env_prefetch(KCR_ROOT_DATA *root_data)
+{
+	/* Sanity checks */
+	assert(root_data != NULL);
+
+	if(root_data->env_frames.loading == KCR_YES)
+	{
+		kcr_thread_join(&root_data->env_frames.loader);
+		root_data->env_frames.loading = KCR_NO;
+	}
+
+	/* Return */
+	return;
+}
+
+/***************************************************************************************
+ * Name: kcr_switch_env_frame()
+ *
+ * Purpose: Make the next environmental frame current.
+ *
+ * Parameters: IN/OUT root_data - pointer to a CB containing all the root data for KCR.
+ *
+ * Returns: rc - KCR_RC_OK if ok or KCR_RC_ERROR if the frame cannot be loaded.
+ *
+ * Operation: Wait for the loader thread, which normally finished long before, swap
+ *            the spare buffers with env_data and its gradient, and start loading the
+ *            frame after.  If the background load failed, load the frame now so that
+ *            any error is reported.
+ ***************************************************************************************/
+unsigned short kcr_switch_env_frame(KCR_ROOT_DATA *root_data)
+{
+	/* Local variables */
+	KCR_ENV_FRAMES *frames;
+	double *swap;
+	float *swap_grad;
+	unsigned short rc = KCR_RC_OK;
+
+	/* Sanity checks */
+	assert(root_data != NULL);
+
+	frames = &root_data->env_frames;
+	assert(frames->next_frame < frames->no_frames);
+	kcr_finish_env_prefetch(root_data);
+	if(frames->spare_frame != frames->next_frame)
+	{
+		rc = kcr_load_env_frame(frames->names[frames->next_frame],
+		                        root_data,
+		                        frames->spare,
+		                        root_data->no_threads,
+		                        KCR_YES);
+		if(rc != KCR_RC_OK)
+		{
+			goto EXIT_LABEL;
+		}
+		kcr_env_gradient(root_data, frames->spare, frames->spare_grad_x, frames->spare_grad_y);
+	}
+
+	swap = root_data->env_data;
+	root_data->env_data = frames->spare;
+	frames->spare = swap;
+	swap_grad = root_data->env_grad_x;
+	root_data->env_grad_x = frames->spare_grad_x;
+	frames->spare_grad_x = swap_grad;
+	swap_grad = root_data->env_grad_y;
+	root_data->env_grad_y = frames->spare_grad_y;
+	frames->spare_grad_y = swap_grad;
+	frames->next_frame++;
+	kcr_start_env_prefetch(root_data);
+
+EXIT_LABEL:
+	/* Return */
+	return(rc);
+}
+
+/***************************************************************************************
+ * Name: kcr_seek_env_frames()
+ *
+ * Purpose: Make current the environmental frame for the next time step, wherever the
+ *          simulation has got to.
+ *
+ * Parameters: IN/OUT root_data - pointer to a CB containing all the root data for KCR.
+ *
+ * Returns: rc - KCR_RC_OK if ok or KCR_RC_ERROR if the frame cannot be loaded.
+ *
+ * Operation: Used at the start and after current_time has jumped (a restored
+ *            burn-in or branch).  The frame for time step t is the last one whose
+ *            switch time is at most t, or the first frame if there is none.
+ ***************************************************************************************/
+unsigned short kcr_seek_env_frames(KCR_ROOT_DATA *root_data)
+{
+	/* Local variables */
+	KCR_ENV_FRAMES *frames;
+	unsigned long frame = 0;
+	unsigned short rc;
+
+	/* Sanity checks */
+	assert(root_data != NULL);
+
+	frames = &root_data->env_frames;
+	kcr_finish_env_prefetch(root_data);
+	while((frame + 1 < frames->no_frames) &&
+	      (frames->switch_times[frame + 1] <= root_data->current_time + 1))
+	{
+		frame++;
+	}
+	frames->next_frame = frame;
+	frames->spare_frame = frames->no_frames;
+	rc = kcr_switch_env_frame(root_data);
+
+	/* Return */
+	return(rc);
+}
+
+/***************************************************************************************
+ * Name: kcr_setup_env_frames()
+ *
+ * Purpose: Set up a sequence of environmental frames.
+ *
+ * Parameters: IN     frame_file - file listing the frames
+ *             IN/OUT root_data - pointer to a CB containing all the root data for KCR.
+ *
+ * Returns: rc - KCR_RC_OK if ok or KCR_RC_ERROR if error.
+ *
+ * Operation: Each line of the frame list is "switch_time file", the file being a text
+ *            matrix or a binary raster of the whole box.  The frame is in effect from
+ *            time step switch_time until the next frame's switch time; switch times
+ *            must increase.  Frames replace any environmental data file, and like it
+ *            are only read if env_weight is non-zero.  Two sets of buffers are
+ *            allocated: the current frame (env_data and its gradient) and spares into
+ *            which the next frame is loaded in the background.
+ ***************************************************************************************/
+unsigned short kcr_setup_env_frames(FILE *frame_file, KCR_ROOT_DATA *root_data)
+{
+	/* Local variables */
+	KCR_ENV_FRAMES *frames;
+	char line[4096];
+	char name[4096];
+	unsigned long switch_time;
+	unsigned long array_size = 0;
+	unsigned long line_no = 0;
+	unsigned long *new_times;
+	char **new_names;
+	unsigned short rc = KCR_RC_OK;
+
+	/* Sanity checks */
+	assert(frame_file != NULL);
+	assert(root_data != NULL);
+
+	frames = &root_data->env_frames;
+	if(root_data->env_weight == 0)
+	{
+		/* The layer would have no effect: do not read it */
+		goto EXIT_LABEL;
+	}
+
+	/* Read the list of frames */
+	while(fgets(line, sizeof(line), frame_file) != NULL)
+	{
+		line_no++;
+		if(sscanf(line, "%lu %4095[^\r\n]", &switch_time, name) != 2)
+		{
+			if(strspn(line, " \t\r\n") != strlen(line))
+			{
+				fprintf(stderr,"Error: expected \"switch_time file\" in frame list at line %lu\n", line_no);
+				rc = KCR_RC_ERROR;
+				goto EXIT_LABEL;
+			}
+			continue;
+		}
+		if((frames->no_frames > 0) && (switch_time <= frames->switch_times[frames->no_frames - 1]))
+		{
+			fprintf(stderr,"Error: switch times must increase in frame list at line %lu\n", line_no);
+			rc = KCR_RC_ERROR;
+			goto EXIT_LABEL;
+		}
+
+		/* Grow the arrays as needed */
+		if(frames->no_frames == array_size)
+		{
+			array_size = KCR_MAX(16, 2*array_size);
+			new_times = (unsigned long *)realloc(frames->switch_times, array_size*sizeof(unsigned long));
+			if(new_times != NULL)
+			{
+				frames->switch_times = new_times;
+			}
+			new_names = (char **)realloc(frames->names, array_size*sizeof(char *));
+			if(new_names != NULL)
+			{
+				frames->names = new_names;
+			}
+			if((new_times == NULL) || (new_names == NULL))
+			{
+				fprintf(stderr,"MEMORY ALLOCATION FAILURE FOR ENVIRONMENTAL FRAMES\n");
+				rc = KCR_RC_ERROR;
+				goto EXIT_LABEL;
+			}
+		}
+		frames->names[frames->no_frames] = (char *)malloc(strlen(name) + 1);
+		if(frames->names[frames->no_frames] == NULL)
+		{
+			fprintf(stderr,"MEMORY ALLOCATION FAILURE FOR ENVIRONMENTAL FRAMES\n");
+			rc = KCR_RC_ERROR;
+			goto EXIT_LABEL;
+		}
+		strcpy(frames->names[frames->no_frames], name);
+		frames->switch_times[frames->no_frames] = switch_time;
+		frames->no_frames++;
+	}
+	if(frames->no_frames == 0)
+	{
+		fprintf(stderr,"Error: frame list is empty\n");
+		rc = KCR_RC_ERROR;
+		goto EXIT_LABEL;
+	}
+
+	/* The two sets of buffers, replacing any environmental data read already */
+	if(root_data->env_data != NULL)
+	{
+		free(root_data->env_data);
+	}
+	if(root_data->env_grad_x != NULL)
+	{
+		free(root_data->env_grad_x);
+	}
+	if(root_data->env_grad_y != NULL)
+	{
+		free(root_data->env_grad_y);
+	}
+	kcr_unmap_file(&root_data->env_raster.mapping);
+	root_data->env_raster.values = NULL;
+	root_data->env_data = kcr_grid_alloc(&root_data->grid);
+	root_data->env_grad_x = kcr_grid_alloc_float(&root_data->grid);
+	root_data->env_grad_y = kcr_grid_alloc_float(&root_data->grid);
+	frames->spare = kcr_grid_alloc(&root_data->grid);
+	frames->spare_grad_x = kcr_grid_alloc_float(&root_data->grid);
+	frames->spare_grad_y = kcr_grid_alloc_float(&root_data->grid);
+	if((root_data->env_data == NULL) || (root_data->env_grad_x == NULL) || (root_data->env_grad_y == NULL) ||
+	   (frames->spare == NULL) || (frames->spare_grad_x == NULL) || (frames->spare_grad_y == NULL))
+	{
+		fprintf(stderr,"MEMORY ALLOCATION FAILURE FOR ENVIRONMENTAL FRAMES\n");
+		rc = KCR_RC_ERROR;
+		goto EXIT_LABEL;
+	}
+
+	/* Load the current frame and start loading the next */
+	rc = kcr_seek_env_frames(root_data);
+	if(rc == KCR_RC_OK)
+	{
+		root_data->env_active = KCR_YES;
+	}
+
+EXIT_LABEL:
+	/* Return */
+	return(rc);
+}
+
+/***************************************************************************************
+ * Name: kcr_env_frames_term()
+ *
+ * Purpose: Free the environmental frames.
+ *
+ * Parameters: IN/OUT root_data - pointer to a CB containing all the root data for KCR.
+ *
+ * Returns: Nothing.  env_data and its gradient are left for kcr_term() to free.
+ ***************************************************************************************/
+void kcr_env_frames_term(KCR_ROOT_DATA *root_data)
+{
+	/* Local variables */
+	KCR_ENV_FRAMES *frames;
+	unsigned long curr_frame;
+
+	/* Sanity checks */
+	assert(root_data != NULL);
+
+	frames = &root_data->env_frames;
+	kcr_finish_env_prefetch(root_data);
+	if(frames->names != NULL)
+	{
+		for(curr_frame = 0; curr_frame < frames->no_frames; curr_frame++)
+		{
+			free(frames->names[curr_frame]);
+		}
+		free(frames->names);
+	}
+	if(frames->switch_times != NULL)
+	{
+		free(frames->switch_times);
+	}
+	if(frames->spare != NULL)
+	{
+		free(frames->spare);
+	}
+	if(frames->spare_grad_x != NULL)
+	{
+		free(frames->spare_grad_x);
+	}
+	if(frames->spare_grad_y != NULL)
+	{
+		free(frames->spare_grad_y);
+	}
+	memset(frames, 0, sizeof(KCR_ENV_FRAMES));
+	frames->loading = KCR_NO;
+
+	/* Return */
+	return;
+}
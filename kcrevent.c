@@ -0,0 +1,420 @@
+/***************************************************************************************
+ * Filename: kcrevent.c
+ *
+ * Description: Event-driven mode.  Instead of every individual moving once per time
+ *              step, each individual moves at the times of a Poisson process whose
+ *              rate is set per population, and moves are processed in time order
+ *              from a binary heap holding the next move of every individual.  The
+ *              positions are still printed at the end of every time step.
+ *
+ *              The rate at which an individual moves does not depend on its
+ *              neighbours, which only bias the direction of the move.  So the drift
+ *              is worked out once per move, when the move happens, against the
+ *              neighbours as they are then, and no scheduled move ever has to be
+ *              recomputed because something nearby moved.  Populations with low
+ *              rates cost in proportion to the moves they actually make.
+ ***************************************************************************************/
+
+#include <kcr.h>
+
+/***************************************************************************************
+ * Name: kcr_setup_events()
+ *
+ * Purpose: Switch to event-driven mode, reading the move rates of the populations.
+ *
+ * Parameters: IN     rate_file - file containing one row of no_pops move rates (moves
+ *                                per time step; missing values are 1)
+ *             IN/OUT root_data - pointer to a CB containing all the root data for KCR,
+ *                                with the initial conditions set.
+ *
+ * Returns: rc - KCR_RC_OK if ok or KCR_RC_ERROR if error.
+ *
+ * Operation: Schedule the first move of every individual after the current time and
+ *            build the heap.
+ ***************************************************************************************/
+unsigned short kcr_setup_events(FILE *rate_file, KCR_ROOT_DATA *root_data)
+{
+	/* Local variables */
+	double *rates;
+	unsigned long curr_event;
+	unsigned short rc = KCR_RC_ERROR;
+
+	/* Sanity checks */
+	assert(rate_file != NULL);
+	assert(root_data != NULL);
+
+	rates = kcr_read_move_rates(rate_file, root_data);
+	if((rates == NULL) || (kcr_alloc_events(root_data, rates) != KCR_RC_OK))
+	{
+		goto EXIT_LABEL;
+	}
+
+	/* First moves */
+	for(curr_event = 0; curr_event < root_data->no_events; curr_event++)
+	{
+		root_data->event_heap[curr_event].time = (double)root_data->current_time +
+		    kcr_event_wait(root_data, root_data->event_heap[curr_event].population->move_rate);
+	}
+	kcr_build_event_heap(root_data);
+	rc = KCR_RC_OK;
+
+EXIT_LABEL:
+	if(rates != NULL)
+	{
+		free(rates);
+	}
+
+	/* Return */
+	return(rc);
+}
+
+/***************************************************************************************
+ * Name: kcr_read_move_rates()
+ *
+ * Purpose: Read the move rates of the populations.
+ *
+ * Parameters: IN     rate_file - file containing one row of no_pops move rates (moves
+ *                                per time step; missing values are 1)
+ *             IN     root_data - pointer to a CB containing all the root data for KCR.
+ *
+ * Returns: rates - the rates by population index, allocated, or NULL on error.
+ ***************************************************************************************/
+double *kcr_read_move_rates(FILE *rate_file, KCR_ROOT_DATA *root_data)
+{
+	/* Local variables */
+	double *rates;
+	unsigned short curr_pop;
+	unsigned short rc = KCR_RC_ERROR;
+
+	/* Sanity checks */
+	assert(rate_file != NULL);
+	assert(root_data != NULL);
+
+	rates = (double *)malloc(root_data->no_pops*sizeof(double));
+	if(rates == NULL)
+	{
+		fprintf(stderr,"MEMORY ALLOCATION FAILURE FOR MOVE RATES\n");
+		goto EXIT_LABEL;
+	}
+	for(curr_pop = 0; curr_pop < root_data->no_pops; curr_pop++)
+	{
+		rates[curr_pop] = 1;
+	}
+	if(kcr_parse_matrix(rate_file, "rate file", rates, NULL, root_data->no_pops, 1, KCR_YES) != KCR_RC_OK)
+	{
+		goto EXIT_LABEL;
+	}
+	for(curr_pop = 0; curr_pop < root_data->no_pops; curr_pop++)
+	{
+		if(!(rates[curr_pop] >= 0))
+		{
+			fprintf(stderr,"Error: move rate of population %u is negative\n", curr_pop);
+			goto EXIT_LABEL;
+		}
+	}
+	rc = KCR_RC_OK;
+
+EXIT_LABEL:
+	if((rc != KCR_RC_OK) && (rates != NULL))
+	{
+		free(rates);
+		rates = NULL;
+	}
+
+	/* Return */
+	return(rates);
+}
+
+/***************************************************************************************
+ * Name: kcr_alloc_events()
+ *
+ * Purpose: Set the move rates and allocate the heap, one event per individual.
+ *
+ * Parameters: IN/OUT root_data - pointer to a CB containing all the root data for KCR.
+ *             IN     rates - move rate of each population, by index
+ *
+ * Returns: rc - KCR_RC_OK if ok or KCR_RC_ERROR if memory allocation fails.
+ *
+ * Operation: The events are left in list order with time 0; the caller sets the
+ *            times and then calls kcr_build_event_heap().
+ ***************************************************************************************/
+unsigned short kcr_alloc_events(KCR_ROOT_DATA *root_data, const double *rates)
+{
+	/* Local variables */
+	KCR_POPULATION *curr_pop_cb;
+	KCR_INDIVIDUAL *curr_indiv_cb;
+	KCR_EVENT *event;
+	unsigned short rc = KCR_RC_OK;
+
+	/* Sanity checks */
+	assert(root_data != NULL);
+	assert(rates != NULL);
+
+	if(root_data->event_heap == NULL)
+	{
+		root_data->event_heap = (KCR_EVENT *)malloc((unsigned long)root_data->no_pops*root_data->no_indivs*
+		                                            sizeof(KCR_EVENT));
+		if(root_data->event_heap == NULL)
+		{
+			fprintf(stderr,"MEMORY ALLOCATION FAILURE FOR EVENTS\n");
+			rc = KCR_RC_ERROR;
+			goto EXIT_LABEL;
+		}
+	}
+
+	root_data->no_events = 0;
+    curr_pop_cb = (KCR_POPULATION *)LIST_GET_FIRST(root_data->population_list_root);
+    while(curr_pop_cb != NULL)
+    {
+    	curr_pop_cb->move_rate = rates[curr_pop_cb->index];
+        curr_indiv_cb = (KCR_INDIVIDUAL *)LIST_GET_FIRST(curr_pop_cb->individual_list_root);
+        while(curr_indiv_cb != NULL)
+        {
+        	event = &root_data->event_heap[root_data->no_events++];
+        	event->time = 0;
+        	event->individual = curr_indiv_cb;
+        	event->population = curr_pop_cb;
+            curr_indiv_cb = (KCR_INDIVIDUAL *)LIST_GET_NEXT(curr_indiv_cb->list_elt);
+        }
+        curr_pop_cb = (KCR_POPULATION *)LIST_GET_NEXT(curr_pop_cb->list_elt);
+    }
+	root_data->events_active = KCR_YES;
+
+EXIT_LABEL:
+	/* Return */
+	return(rc);
+}
+
+/***************************************************************************************
+ * Name: kcr_events_term()
+ *
+ * Purpose: Free the heap and return to time-stepped mode.
+ *
+ * Parameters: IN/OUT root_data - pointer to a CB containing all the root data for KCR.
+ *
+ * Returns: Nothing.
+ ***************************************************************************************/
+void kcr_events_term(KCR_ROOT_DATA *root_data)
+{
+	/* Sanity checks */
+	assert(root_data != NULL);
+
+	if(root_data->event_heap != NULL)
+	{
+		free(root_data->event_heap);
+	}
+	root_data->event_heap = NULL;
+	root_data->no_events = 0;
+	root_data->events_active = KCR_NO;
+
+	/* Return */
+	return;
+}
+
+/***************************************************************************************
+ * Name: kcr_event_wait()
+ *
+ * Purpose: Draw the time to an individual's next move.
+ *
+ * Parameters: IN/OUT root_data - pointer to a CB containing all the root data for KCR.
+ *             IN     rate - move rate of the individual's population
+ *
+ * Returns: An exponentially distributed time with mean 1/rate; HUGE_VAL if the rate
+ *          is zero, so the individual never moves.
+ ***************************************************************************************/
+double kcr_event_wait(KCR_ROOT_DATA *root_data, double rate)
+{
+	/* Return */
+	return((rate > 0) ? -log(1 - kcr_rng_uniform(&root_data->rng))/rate : HUGE_VAL);
+}
+
+/***************************************************************************************
+ * Name: kcr_event_sift_down()
+ *
+ * Purpose: Move an event down the heap until it is no later than its children.
+ *
+ * Parameters: IN/OUT root_data - pointer to a CB containing all the root data for KCR.
+ *             IN     position - position of the event in the heap
+ *
+ * Returns: Nothing.
+ ***************************************************************************************/
+void kcr_event_sift_down(KCR_ROOT_DATA *root_data, unsigned long position)
+{
+	/* Local variables */
+	KCR_EVENT *heap;
+	KCR_EVENT event;
+	unsigned long child;
+
+	heap = root_data->event_heap;
+	event = heap[position];
+	for(;;)
+	{
+		child = 2*position + 1;
+		if(child >= root_data->no_events)
+		{
+			break;
+		}
+		if((child + 1 < root_data->no_events) && (heap[child + 1].time < heap[child].time))
+		{
+			child++;
+		}
+		if(!(heap[child].time < event.time))
+		{
+			break;
+		}
+		heap[position] = heap[child];
+		position = child;
+	}
+	heap[position] = event;
+
+	/* Return */
+	return;
+}
+
+/***************************************************************************************
+ * Name: kcr_build_event_heap()
+ *
+ * Purpose: Arrange the events into a heap once their times are set.
+ *
+ * Parameters: IN/OUT root_data - pointer to a CB containing all the root data for KCR.
+ *
+ * Returns: Nothing.
+ ***************************************************************************************/
+void kcr_build_event_heap(KCR_ROOT_DATA *root_data)
+{
+	/* Local variables */
+	unsigned long position;
+
+	/* Sanity checks */
+	assert(root_data != NULL);
+
+	for(position = root_data->no_events/2; position > 0; position--)
+	{
+		kcr_event_sift_down(root_data, position - 1);
+	}
+
+	/* Return */
+	return;
+}
+
+/***************************************************************************************
+ * Name: kcr_perform_events()
+ *
+ * Purpose: Make every move due up to a given time.
+ *
+ * Parameters: IN/OUT root_data - pointer to a CB containing all the root data for KCR.
+ *             IN     end_time - time up to which to move
+ *
+ * Returns: Nothing.
+ *
+ * Operation: While the earliest event is due, move its individual (with the same
+ *            drift as a time-stepped move), draw the time of its next move and sift
+ *            it back down the heap.
+ ***************************************************************************************/
+void kcr_perform_events(KCR_ROOT_DATA *root_data, double end_time)
+{
+	/* Local variables */
+	KCR_EVENT *next;
+
+	/* Sanity checks */
+	assert(root_data != NULL);
+	assert(root_data->events_active == KCR_YES);
+
+	next = root_data->event_heap;
+	while((root_data->no_events > 0) && (next->time <= end_time))
+	{
+        if(root_data->box_height == 1)
+        {
+            kcr_move_individual1d(next->individual, next->population, root_data);
+		}
+		else if(root_data->box_depth > 1)
+		{
+            kcr_move_individual3d(next->individual, next->population, root_data);
+		}
+		else
+		{
+            kcr_move_individual(next->individual, next->population, root_data);
+		}
+		next->time += kcr_event_wait(root_data, next->population->move_rate);
+		kcr_event_sift_down(root_data, 0);
+	}
+
+	/* Return */
+	return;
+}
+
+/***************************************************************************************
+ * Name: kcr_pack_events()
+ *
+ * Purpose: Copy the move rates and the times of the next moves into an array.
+ *
+ * Parameters: IN     root_data - pointer to a CB containing all the root data for KCR.
+ *             OUT    values - array of no_pops + no_pops*no_indivs values
+ *
+ * Returns: Nothing.
+ *
+ * Operation: The rate of population p is stored at values[p], and the time of the
+ *            next move of individual i of population p at values[no_pops +
+ *            p*no_indivs + i], so the array does not depend on the order of the heap.
+ ***************************************************************************************/
+void kcr_pack_events(KCR_ROOT_DATA *root_data, double *values)
+{
+	/* Local variables */
+	const KCR_EVENT *event;
+	unsigned long curr_event;
+
+	/* Sanity checks */
+	assert(root_data != NULL);
+	assert(values != NULL);
+
+	for(curr_event = 0; curr_event < root_data->no_events; curr_event++)
+	{
+		event = &root_data->event_heap[curr_event];
+		values[event->population->index] = event->population->move_rate;
+		values[root_data->no_pops + (unsigned long)event->population->index*root_data->no_indivs +
+		       event->individual->index] = event->time;
+	}
+
+	/* Return */
+	return;
+}
+
+/***************************************************************************************
+ * Name: kcr_unpack_events()
+ *
+ * Purpose: Set the move rates and the times of the next moves from an array,
+ *          switching to event-driven mode if need be.
+ *
+ * Parameters: IN/OUT root_data - pointer to a CB containing all the root data for KCR.
+ *             IN     values - array laid out as by kcr_pack_events()
+ *
+ * Returns: rc - KCR_RC_OK if ok or KCR_RC_ERROR if memory allocation fails.
+ ***************************************************************************************/
+unsigned short kcr_unpack_events(KCR_ROOT_DATA *root_data, const double *values)
+{
+	/* Local variables */
+	KCR_EVENT *event;
+	unsigned long curr_event;
+	unsigned short rc;
+
+	/* Sanity checks */
+	assert(root_data != NULL);
+	assert(values != NULL);
+
+	rc = kcr_alloc_events(root_data, values);
+	if(rc != KCR_RC_OK)
+	{
+		goto EXIT_LABEL;
+	}
+	for(curr_event = 0; curr_event < root_data->no_events; curr_event++)
+	{
+		event = &root_data->event_heap[curr_event];
+		event->time = values[root_data->no_pops + (unsigned long)event->population->index*root_data->no_indivs +
+		                     event->individual->index];
+	}
+	kcr_build_event_heap(root_data);
+
+EXIT_LABEL:
+	/* Return */
+	return(rc);
+}
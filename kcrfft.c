@@ -0,0 +1,383 @@
+/***************************************************************************************
+ * Filename: kcrfft.c
+ *
+ * Description: Fast Fourier transforms of any length, for the convolutions of the
+ *              mean-field solver.  Lengths whose prime factors are all at most
+ *              KCR_FFT_MAX_RADIX use a mixed-radix transform; other lengths are
+ *              turned into a convolution of power-of-two length by Bluestein's chirp
+ *              method.  Either way the box need not be padded and the convolutions
+ *              stay exactly periodic.
+ ***************************************************************************************/
+
+#include <kcr.h>
+
+/***************************************************************************************
+ * Name: kcr_fft_init()
+ *
+ * Purpose: Set up the tables for transforms of a given length.
+ *
+ * Parameters: OUT    fft - the transform
+ *             IN     size - length of the transforms
+ *
+ * Returns: rc - KCR_RC_OK if ok or KCR_RC_ERROR if memory allocation fails.
+ *
+ * Operation: Factorise the length of the mixed-radix transform (size itself, or for
+ *            Bluestein's method the first power of two of at least 2*size - 1) and
+ *            tabulate its twiddle factors.  For Bluestein's method, also tabulate the
+ *            chirp exp(-i*pi*k^2/size) and the transform of the conjugate chirp
+ *            filter.
+ ***************************************************************************************/
+unsigned short kcr_fft_init(KCR_FFT *fft, unsigned long size)
+{
+	/* Local variables */
+	unsigned long pos;
+	unsigned long rest;
+	unsigned long factor;
+	double angle;
+	unsigned short rc = KCR_RC_OK;
+
+	/* Sanity checks */
+	assert(fft != NULL);
+	assert(size > 0);
+
+	memset(fft, 0, sizeof(KCR_FFT));
+	fft->size = size;
+
+	/* Mixed radix if size has only small factors, else Bluestein */
+	rest = size;
+	for(factor = 2; factor <= KCR_FFT_MAX_RADIX; factor++)
+	{
+		while(rest % factor == 0)
+		{
+			rest /= factor;
+		}
+	}
+	fft->inner_size = size;
+	if(rest != 1)
+	{
+		fft->inner_size = 1;
+		while(fft->inner_size < 2*size - 1)
+		{
+			fft->inner_size *= 2;
+		}
+	}
+	rest = fft->inner_size;
+	for(factor = 2; rest > 1; )
+	{
+		if(rest % factor == 0)
+		{
+			assert(fft->no_factors < KCR_FFT_MAX_FACTORS);
+			fft->factors[fft->no_factors++] = (unsigned short)factor;
+			rest /= factor;
+		}
+		else
+		{
+			factor++;
+		}
+	}
+
+	fft->twiddles = (KCR_COMPLEX *)malloc(fft->inner_size*sizeof(KCR_COMPLEX));
+	fft->work = (KCR_COMPLEX *)malloc(fft->inner_size*sizeof(KCR_COMPLEX));
+	fft->scratch = (KCR_COMPLEX *)malloc(fft->inner_size*sizeof(KCR_COMPLEX));
+	if((fft->twiddles == NULL) || (fft->work == NULL) || (fft->scratch == NULL))
+	{
+		fprintf(stderr,"MEMORY ALLOCATION FAILURE FOR FFT\n");
+		rc = KCR_RC_ERROR;
+		goto EXIT_LABEL;
+	}
+	for(pos = 0; pos < fft->inner_size; pos++)
+	{
+		angle = -2*KCR_PI*pos/fft->inner_size;
+		fft->twiddles[pos].re = cos(angle);
+		fft->twiddles[pos].im = sin(angle);
+	}
+
+	if(fft->inner_size != size)
+	{
+		/* Bluestein: the chirp, and the transform of the filter conj(chirp[|k|]) laid out
+		 * for a cyclic convolution */
+		fft->chirp = (KCR_COMPLEX *)malloc(size*sizeof(KCR_COMPLEX));
+		fft->filter = (KCR_COMPLEX *)calloc(fft->inner_size, sizeof(KCR_COMPLEX));
+		if((fft->chirp == NULL) || (fft->filter == NULL))
+		{
+			fprintf(stderr,"MEMORY ALLOCATION FAILURE FOR FFT\n");
+			rc = KCR_RC_ERROR;
+			goto EXIT_LABEL;
+		}
+		for(pos = 0; pos < size; pos++)
+		{
+			/* k^2 is reduced modulo 2*size first, to keep the angle accurate */
+			angle = -KCR_PI*(double)((unsigned long long)pos*pos % (2*size))/size;
+			fft->chirp[pos].re = cos(angle);
+			fft->chirp[pos].im = sin(angle);
+			fft->work[pos].re = fft->chirp[pos].re;
+			fft->work[pos].im = -fft->chirp[pos].im;
+		}
+		memset(fft->work + size, 0, (fft->inner_size - size)*sizeof(KCR_COMPLEX));
+		for(pos = 1; pos < size; pos++)
+		{
+			fft->work[fft->inner_size - pos] = fft->work[pos];
+		}
+		kcr_fft_stage(fft, fft->work, 1, fft->filter, fft->inner_size, 0);
+	}
+
+EXIT_LABEL:
+	if(rc != KCR_RC_OK)
+	{
+		kcr_fft_term(fft);
+	}
+
+	/* Return */
+	return(rc);
+}
+
+/***************************************************************************************
+ * Name: kcr_fft_term()
+ *
+ * Purpose: Free the tables of a transform.
+ *
+ * Parameters: IN/OUT fft - the transform
+ *
+ * Returns: Nothing.
+ ***************************************************************************************/
+void kcr_fft_term(KCR_FFT *fft)
+{
+	/* Sanity checks */
+	assert(fft != NULL);
+
+	if(fft->twiddles != NULL)
+	{
+		free(fft->twiddles);
+	}
+	if(fft->work != NULL)
+	{
+		free(fft->work);
+	}
+	if(fft->scratch != NULL)
+	{
+		free(fft->scratch);
+	}
+	if(fft->chirp != NULL)
+	{
+		free(fft->chirp);
+	}
+	if(fft->filter != NULL)
+	{
+		free(fft->filter);
+	}
+	memset(fft, 0, sizeof(KCR_FFT));
+
+	/* Return */
+	return;
+}
+
+/***************************************************************************************
+ * Name: kcr_fft_stage()
+ *
+ * Purpose: Forward transform of a sub-sequence, for the mixed-radix transform.
+ *
+ * Parameters: IN     fft - the transform
+ *             IN     in - the first value
+ *             IN     stride - distance between successive values
+ *             OUT    out - array of size values for the result, not overlapping in
+ *             IN     size - length of this transform, the product of the factors from
+ *                           factor on
+ *             IN     factor - index of the first factor
+ *
+ * Returns: Nothing.
+ *
+ * Operation: Decimation in time: with p the first factor, transform each of the p
+ *            interleaved sub-sequences of length size/p, then combine them with
+ *            butterflies of radix p.
+ ***************************************************************************************/
+void kcr_fft_stage(const KCR_FFT *fft,
+                   const KCR_COMPLEX *in,
+                   unsigned long stride,
+                   KCR_COMPLEX *out,
+                   unsigned long size,
+                   unsigned short factor)
+{
+	/* Local variables */
+	KCR_COMPLEX terms[KCR_FFT_MAX_RADIX];
+	KCR_COMPLEX twiddle;
+	KCR_COMPLEX sum;
+	KCR_COMPLEX *lo;
+	KCR_COMPLEX *hi;
+	KCR_COMPLEX product;
+	unsigned long radix;
+	unsigned long span;
+	unsigned long step;
+	unsigned long pos;
+	unsigned long term;
+	unsigned long part;
+
+	if(size == 1)
+	{
+		out[0] = in[0];
+		return;
+	}
+	radix = fft->factors[factor];
+	span = size/radix;
+	step = fft->inner_size/size;
+	for(term = 0; term < radix; term++)
+	{
+		if(span == 1)
+		{
+			out[term] = in[term*stride];
+		}
+		else
+		{
+			kcr_fft_stage(fft, in + term*stride, stride*radix, out + term*span, span, factor + 1);
+		}
+	}
+
+	for(pos = 0; pos < span; pos++)
+	{
+		if(radix == 2)
+		{
+			twiddle = fft->twiddles[pos*step];
+			lo = &out[pos];
+			hi = &out[pos + span];
+			product.re = hi->re*twiddle.re - hi->im*twiddle.im;
+			product.im = hi->re*twiddle.im + hi->im*twiddle.re;
+			hi->re = lo->re - product.re;
+			hi->im = lo->im - product.im;
+			lo->re += product.re;
+			lo->im += product.im;
+			continue;
+		}
+		for(term = 0; term < radix; term++)
+		{
+			twiddle = fft->twiddles[term*pos*step];
+			terms[term].re = out[term*span + pos].re*twiddle.re - out[term*span + pos].im*twiddle.im;
+			terms[term].im = out[term*span + pos].re*twiddle.im + out[term*span + pos].im*twiddle.re;
+		}
+		for(part = 0; part < radix; part++)
+		{
+			sum = terms[0];
+			for(term = 1; term < radix; term++)
+			{
+				twiddle = fft->twiddles[(term*part % radix)*(fft->inner_size/radix)];
+				sum.re += terms[term].re*twiddle.re - terms[term].im*twiddle.im;
+				sum.im += terms[term].re*twiddle.im + terms[term].im*twiddle.re;
+			}
+			out[part*span + pos] = sum;
+		}
+	}
+
+	/* Return */
+	return;
+}
+
+/***************************************************************************************
+ * Name: kcr_fft_line()
+ *
+ * Purpose: Transform one line of values in place.
+ *
+ * Parameters: IN/OUT fft - the transform
+ *             IN/OUT data - the first value
+ *             IN     stride - distance between successive values
+ *             IN     inverse - KCR_YES for the inverse transform (scaled by 1/size),
+ *                              KCR_NO for the forward transform
+ *
+ * Returns: Nothing.
+ *
+ * Operation: The line is copied to the work array, where the inverse transform is
+ *            taken as the conjugate of the forward transform of the conjugate.
+ ***************************************************************************************/
+void kcr_fft_line(KCR_FFT *fft, KCR_COMPLEX *data, unsigned long stride, unsigned short inverse)
+{
+	/* Local variables */
+	KCR_COMPLEX *work;
+	KCR_COMPLEX *result;
+	KCR_COMPLEX value;
+	double sign;
+	double scale;
+	unsigned long pos;
+
+	work = fft->work;
+	result = fft->scratch;
+	sign = (inverse == KCR_YES) ? -1 : 1;
+	if(fft->chirp == NULL)
+	{
+		for(pos = 0; pos < fft->size; pos++)
+		{
+			work[pos].re = data[pos*stride].re;
+			work[pos].im = sign*data[pos*stride].im;
+		}
+		kcr_fft_stage(fft, work, 1, result, fft->size, 0);
+	}
+	else
+	{
+		/* Bluestein: multiply by the chirp, convolve with the filter (by a forward
+		 * transform, a product and the conjugate trick) and multiply by the chirp */
+		for(pos = 0; pos < fft->size; pos++)
+		{
+			value.re = data[pos*stride].re;
+			value.im = sign*data[pos*stride].im;
+			work[pos].re = value.re*fft->chirp[pos].re - value.im*fft->chirp[pos].im;
+			work[pos].im = value.re*fft->chirp[pos].im + value.im*fft->chirp[pos].re;
+		}
+		memset(work + fft->size, 0, (fft->inner_size - fft->size)*sizeof(KCR_COMPLEX));
+		kcr_fft_stage(fft, work, 1, result, fft->inner_size, 0);
+		for(pos = 0; pos < fft->inner_size; pos++)
+		{
+			value = result[pos];
+			work[pos].re = value.re*fft->filter[pos].re - value.im*fft->filter[pos].im;
+			work[pos].im = -(value.re*fft->filter[pos].im + value.im*fft->filter[pos].re);
+		}
+		kcr_fft_stage(fft, work, 1, result, fft->inner_size, 0);
+		scale = 1.0/fft->inner_size;
+		for(pos = 0; pos < fft->size; pos++)
+		{
+			value.re = result[pos].re*scale;
+			value.im = -result[pos].im*scale;
+			result[pos].re = value.re*fft->chirp[pos].re - value.im*fft->chirp[pos].im;
+			result[pos].im = value.re*fft->chirp[pos].im + value.im*fft->chirp[pos].re;
+		}
+	}
+
+	scale = (inverse == KCR_YES) ? 1.0/fft->size : 1;
+	for(pos = 0; pos < fft->size; pos++)
+	{
+		data[pos*stride].re = scale*result[pos].re;
+		data[pos*stride].im = sign*scale*result[pos].im;
+	}
+
+	/* Return */
+	return;
+}
+
+/***************************************************************************************
+ * Name: kcr_fft_2d()
+ *
+ * Purpose: Transform a box of values in place.
+ *
+ * Parameters: IN/OUT x_fft - transform along x (the box width)
+ *             IN/OUT y_fft - transform along y (the box height)
+ *             IN/OUT data - the values, the one at (x,y) at x + y*width
+ *             IN     inverse - KCR_YES for the inverse transform, KCR_NO for the
+ *                              forward transform
+ *
+ * Returns: Nothing.
+ ***************************************************************************************/
+void kcr_fft_2d(KCR_FFT *x_fft, KCR_FFT *y_fft, KCR_COMPLEX *data, unsigned short inverse)
+{
+	/* Local variables */
+	unsigned long pos;
+
+	for(pos = 0; pos < y_fft->size; pos++)
+	{
+		kcr_fft_line(x_fft, data + pos*x_fft->size, 1, inverse);
+	}
+	if(y_fft->size > 1)
+	{
+		for(pos = 0; pos < x_fft->size; pos++)
+		{
+			kcr_fft_line(y_fft, data + pos, x_fft->size, inverse);
+		}
+	}
+
+	/* Return */
+	return;
+}
@@ -0,0 +1,332 @@
+/***************************************************************************************
+ * Filename: kcrfit.c
+ *
+ * Description: Fitting the a_ij to an observed trajectory, by maximising the
+ *              log-likelihood of kcrlik.c with L-BFGS.  Each iteration costs a
+ *              likelihood and gradient evaluation or, if the line search has to
+ *              shorten the step, a few, rather than the one per a_ij of finite
+ *              differences or the many of derivative-free methods.
+ *
+ *              The drifts are clamped at +/-1, so the log-likelihood is only
+ *              piecewise smooth, and a step that makes an observed move impossible
+ *              gives -HUGE_VAL: the line search backtracks from both.
+ ***************************************************************************************/
+
+#include <kcr.h>
+
+/***************************************************************************************
+ * Name: kcr_fit_aijs()
+ *
+ * Purpose: Fit the a_ij to a trajectory.
+ *
+ * Parameters: IN/OUT root_data - pointer to a CB containing all the root data for KCR:
+ *                                the a_ij are the starting point, and are replaced by
+ *                                the fit
+ *             IN     trajectory - the trajectory
+ *             IN     max_iters - most iterations to make
+ *             OUT    log_lik - log-likelihood at the fit
+ *             OUT    gradient - its gradient with respect to the a_ij
+ *
+ * Returns: rc - KCR_RC_OK if ok or KCR_RC_ERROR if error.
+ *
+ * Operation: Minimise minus the log-likelihood.  The direction comes from the
+ *            two-loop recursion over the last KCR_LBFGS_MEMORY steps, scaled by the
+ *            curvature of the last step, or on the first iteration a unit step down
+ *            the gradient.  Steps whose change in gradient does not show positive
+ *            curvature are left out of the memory.  The line search halves the step
+ *            until it gives a sufficient decrease.  The fit has converged when the
+ *            largest derivative is below KCR_LBFGS_GTOL or the log-likelihood changes
+ *            by less than KCR_LBFGS_FTOL relative; it stops early if the line search
+ *            fails, keeping the best a_ij found.
+ ***************************************************************************************/
+unsigned short kcr_fit_aijs(KCR_ROOT_DATA *root_data,
+                            const KCR_TRAJECTORY *trajectory,
+                            unsigned long max_iters,
+                            double *log_lik,
+                            double *gradient)
+{
+	/* Local variables */
+	double *work = NULL;
+	double *x;
+	double *g;
+	double *x_new;
+	double *g_new;
+	double *dir;
+	double *s_hist;
+	double *y_hist;
+	double rho[KCR_LBFGS_MEMORY];
+	double alpha[KCR_LBFGS_MEMORY];
+	double f;
+	double f_new;
+	double slope;
+	double step;
+	double gamma;
+	double beta;
+	double dot;
+	double norm;
+	unsigned long no_params;
+	unsigned long param;
+	unsigned long iter;
+	unsigned short no_hist = 0;
+	unsigned short newest = 0;
+	unsigned short hist;
+	unsigned short curr_hist;
+	unsigned short halving;
+	unsigned short accepted;
+	unsigned short rc = KCR_RC_ERROR;
+
+	/* Sanity checks */
+	assert(root_data != NULL);
+	assert(trajectory != NULL);
+	assert(log_lik != NULL);
+	assert(gradient != NULL);
+
+	no_params = (unsigned long)root_data->no_pops*root_data->no_pops;
+	work = (double *)malloc((5 + 2*KCR_LBFGS_MEMORY)*no_params*sizeof(double));
+	if(work == NULL)
+	{
+		fprintf(stderr,"MEMORY ALLOCATION FAILURE FOR FIT\n");
+		goto EXIT_LABEL;
+	}
+	x = work;
+	g = x + no_params;
+	x_new = g + no_params;
+	g_new = x_new + no_params;
+	dir = g_new + no_params;
+	s_hist = dir + no_params;
+	y_hist = s_hist + KCR_LBFGS_MEMORY*no_params;
+
+	memcpy(x, root_data->aijs, no_params*sizeof(double));
+	if(kcr_fit_evaluate(root_data, trajectory, x, &f, g) != KCR_RC_OK)
+	{
+		goto EXIT_LABEL;
+	}
+	if(!(f > -HUGE_VAL))
+	{
+		fprintf(stderr,"Error: the trajectory makes a move the starting a_ij cannot\n");
+		goto EXIT_LABEL;
+	}
+	/* Minimise minus the log-likelihood */
+	f = -f;
+	for(param = 0; param < no_params; param++)
+	{
+		g[param] = -g[param];
+	}
+
+	for(iter = 1; iter <= max_iters; iter++)
+	{
+		norm = 0;
+		dot = 0;
+		for(param = 0; param < no_params; param++)
+		{
+			norm += g[param]*g[param];
+			dot = KCR_MAX(dot, fabs(g[param]));
+		}
+		if(dot < KCR_LBFGS_GTOL)
+		{
+			break;
+		}
+
+		/* Two-loop recursion: dir = -H g */
+		memcpy(dir, g, no_params*sizeof(double));
+		for(hist = 0; hist < no_hist; hist++)
+		{
+			curr_hist = (newest + KCR_LBFGS_MEMORY - hist) % KCR_LBFGS_MEMORY;
+			dot = 0;
+			for(param = 0; param < no_params; param++)
+			{
+				dot += s_hist[curr_hist*no_params + param]*dir[param];
+			}
+			alpha[curr_hist] = rho[curr_hist]*dot;
+			for(param = 0; param < no_params; param++)
+			{
+				dir[param] -= alpha[curr_hist]*y_hist[curr_hist*no_params + param];
+			}
+		}
+		if(no_hist > 0)
+		{
+			dot = 0;
+			for(param = 0; param < no_params; param++)
+			{
+				dot += y_hist[newest*no_params + param]*y_hist[newest*no_params + param];
+			}
+			gamma = 1/(rho[newest]*dot);
+		}
+		else
+		{
+			gamma = 1/sqrt(norm);
+		}
+		for(param = 0; param < no_params; param++)
+		{
+			dir[param] *= gamma;
+		}
+		for(hist = no_hist; hist > 0; hist--)
+		{
+			curr_hist = (newest + KCR_LBFGS_MEMORY + 1 - hist) % KCR_LBFGS_MEMORY;
+			dot = 0;
+			for(param = 0; param < no_params; param++)
+			{
+				dot += y_hist[curr_hist*no_params + param]*dir[param];
+			}
+			beta = rho[curr_hist]*dot;
+			for(param = 0; param < no_params; param++)
+			{
+				dir[param] += (alpha[curr_hist] - beta)*s_hist[curr_hist*no_params + param];
+			}
+		}
+		slope = 0;
+		for(param = 0; param < no_params; param++)
+		{
+			dir[param] = -dir[param];
+			slope += g[param]*dir[param];
+		}
+		if(!(slope < 0))
+		{
+			/* Not downhill: forget the memory and go down the gradient */
+			no_hist = 0;
+			slope = 0;
+			for(param = 0; param < no_params; param++)
+			{
+				dir[param] = -g[param]/sqrt(norm);
+				slope += g[param]*dir[param];
+			}
+		}
+
+		/* Backtracking line search */
+		accepted = KCR_NO;
+		step = 1;
+		for(halving = 0; halving <= KCR_LBFGS_MAX_HALVINGS; halving++, step /= 2)
+		{
+			for(param = 0; param < no_params; param++)
+			{
+				x_new[param] = x[param] + step*dir[param];
+			}
+			if(kcr_fit_evaluate(root_data, trajectory, x_new, &f_new, g_new) != KCR_RC_OK)
+			{
+				goto EXIT_LABEL;
+			}
+			f_new = -f_new;
+			if((f_new < HUGE_VAL) && (f_new <= f + KCR_LBFGS_ARMIJO*step*slope))
+			{
+				accepted = KCR_YES;
+				break;
+			}
+		}
+		if(accepted == KCR_NO)
+		{
+			fprintf(stderr,"L-BFGS line search failed at iteration %lu\n", iter);
+			break;
+		}
+
+		/* Remember the step and the change in gradient if they show positive curvature */
+		dot = 0;
+		for(param = 0; param < no_params; param++)
+		{
+			g_new[param] = -g_new[param];
+			dot += (x_new[param] - x[param])*(g_new[param] - g[param]);
+		}
+		if(dot > 0)
+		{
+			curr_hist = (no_hist == 0) ? 0 : (newest + 1) % KCR_LBFGS_MEMORY;
+			for(param = 0; param < no_params; param++)
+			{
+				s_hist[curr_hist*no_params + param] = x_new[param] - x[param];
+				y_hist[curr_hist*no_params + param] = g_new[param] - g[param];
+			}
+			rho[curr_hist] = 1/dot;
+			newest = curr_hist;
+			no_hist = KCR_MIN(no_hist + 1, KCR_LBFGS_MEMORY);
+		}
+
+		accepted = (fabs(f - f_new) <= KCR_LBFGS_FTOL*(1 + fabs(f))) ? KCR_YES : KCR_NO;
+		memcpy(x, x_new, no_params*sizeof(double));
+		memcpy(g, g_new, no_params*sizeof(double));
+		f = f_new;
+		fprintf(stderr,"L-BFGS iteration %lu: log-likelihood %.10g\n", iter, -f);
+		if(accepted == KCR_YES)
+		{
+			break;
+		}
+	}
+
+	/* The fit */
+	memcpy(root_data->aijs, x, no_params*sizeof(double));
+	*log_lik = -f;
+	for(param = 0; param < no_params; param++)
+	{
+		gradient[param] = -g[param];
+	}
+	rc = kcr_setup_interactions(root_data);
+
+EXIT_LABEL:
+	if(work != NULL)
+	{
+		free(work);
+	}
+
+	/* Return */
+	return(rc);
+}
+
+/***************************************************************************************
+ * Name: kcr_fit_evaluate()
+ *
+ * Purpose: Work out the log-likelihood and its gradient at given a_ij.
+ *
+ * Parameters: IN/OUT root_data - pointer to a CB containing all the root data for KCR,
+ *                                whose a_ij are set
+ *             IN     trajectory - the trajectory
+ *             IN     aijs - the a_ij
+ *             OUT    log_lik - the log-likelihood
+ *             OUT    gradient - its gradient
+ *
+ * Returns: rc - KCR_RC_OK if ok or KCR_RC_ERROR if error.
+ ***************************************************************************************/
+unsigned short kcr_fit_evaluate(KCR_ROOT_DATA *root_data,
+                                const KCR_TRAJECTORY *trajectory,
+                                const double *aijs,
+                                double *log_lik,
+                                double *gradient)
+{
+	/* Sanity checks */
+	assert(root_data != NULL);
+	assert(aijs != NULL);
+
+	memcpy(root_data->aijs, aijs, (unsigned long)root_data->no_pops*root_data->no_pops*sizeof(double));
+
+	/* Return */
+	return(kcr_trajectory_log_likelihood(root_data, trajectory, log_lik, gradient));
+}
+
+/***************************************************************************************
+ * Name: kcr_write_param_matrix()
+ *
+ * Purpose: Write a value per pair of populations, laid out as the a_ij file.
+ *
+ * Parameters: IN     out_file - the file
+ *             IN     values - the values, laid out as root_data->aijs
+ *             IN     no_pops - number of populations
+ *
+ * Returns: Nothing.
+ ***************************************************************************************/
+void kcr_write_param_matrix(FILE *out_file, const double *values, unsigned short no_pops)
+{
+	/* Local variables */
+	unsigned short row;
+	unsigned short col;
+
+	/* Sanity checks */
+	assert(out_file != NULL);
+	assert(values != NULL);
+
+	for(row = 0; row < no_pops; row++)
+	{
+		for(col = 0; col < no_pops; col++)
+		{
+			fprintf(out_file, "%.17g%s", values[col + (unsigned long)row*no_pops], (col + 1 < no_pops) ? "\t" : "\n");
+		}
+	}
+
+	/* Return */
+	return;
+}
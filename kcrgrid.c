@@ -0,0 +1,303 @@
+/***************************************************************************************
+ * Filename: kcrgrid.c
+ *
+ * Description: Layout of the per-site grids.  A stencil around an individual reads a
+ *              small square of sites; stored row by row, each row of the square is on a
+ *              different cache line and, on large boxes, a different page.  Stored in
+ *              small Morton-ordered tiles, the square falls in one or a few tiles.
+ ***************************************************************************************/
+
+#include <kcr.h>
+
+/***************************************************************************************
+ * Name: kcr_grid_spread()
+ *
+ * Purpose: Spread the bits of a coordinate within a tile out to the even bits, giving
+ *          its contribution to a Morton index.
+ *
+ * Parameters: IN     value - the coordinate, less than KCR_GRID_TILE
+ *
+ * Returns: The value with bit i moved to bit 2i.
+ ***************************************************************************************/
+unsigned long kcr_grid_spread(unsigned long value)
+{
+	/* Local variables */
+	unsigned long result = 0;
+	unsigned short bit;
+
+	/* Sanity checks */
+	assert(value < KCR_GRID_TILE);
+
+	for(bit = 0; bit < KCR_GRID_TILE_SHIFT; bit++)
+	{
+		result |= ((value >> bit) & 1) << (2*bit);
+	}
+
+	/* Return */
+	return(result);
+}
+
+/***************************************************************************************
+ * Name: kcr_grid_init()
+ *
+ * Purpose: Set up the layout of the per-site grids for a box.
+ *
+ * Parameters: OUT    layout - the layout
+ *             IN     box_width - width of box
+ *             IN     box_height - height of box
+ *
+ * Returns: rc - KCR_RC_OK if ok or KCR_RC_ERROR if memory allocation fails.
+ *
+ * Operation: Site (x,y) is in tile (x/T,y/T), at Morton index spread(x%T) +
+ *            2*spread(y%T) within it.  Tiles are T*T elements, stored row by row, so
+ *            the index of the site is
+ *               x_offset[x] = spread(x%T) + (x/T)*T*T
+ *               y_offset[y] = 2*spread(y%T) + (y/T)*tiles_across*T*T
+ *            Entries for sites outside the box are those of the site they wrap round
+ *            to, so stencils near an edge need no special case.
+ ***************************************************************************************/
+unsigned short kcr_grid_init(KCR_GRID_LAYOUT *layout, unsigned long box_width, unsigned long box_height)
+{
+	/* Local variables */
+	unsigned long tiles_across;
+	unsigned long tiles_down;
+	unsigned long site;
+	long pos;
+	unsigned short tiled;
+	unsigned short rc = KCR_RC_OK;
+
+	/* Sanity checks */
+	assert(layout != NULL);
+	assert(box_width > 0);
+	assert(box_height > 0);
+
+	layout->x_table = (unsigned long *)malloc((box_width + 2*KCR_GRID_HALO)*sizeof(unsigned long));
+	layout->y_table = (unsigned long *)malloc((box_height + 2*KCR_GRID_HALO)*sizeof(unsigned long));
+	if((layout->x_table == NULL) || (layout->y_table == NULL))
+	{
+		fprintf(stderr,"MEMORY ALLOCATION FAILURE FOR GRID LAYOUT\n");
+		kcr_grid_term(layout);
+		rc = KCR_RC_ERROR;
+		goto EXIT_LABEL;
+	}
+	layout->x_offsets = layout->x_table + KCR_GRID_HALO;
+	layout->y_offsets = layout->y_table + KCR_GRID_HALO;
+
+	tiled = (box_height >= KCR_GRID_TILE) ? KCR_YES : KCR_NO;
+	tiles_across = (box_width + KCR_GRID_TILE - 1) >> KCR_GRID_TILE_SHIFT;
+	tiles_down = (box_height + KCR_GRID_TILE - 1) >> KCR_GRID_TILE_SHIFT;
+	for(pos = -KCR_GRID_HALO; pos < (long)box_width + KCR_GRID_HALO; pos++)
+	{
+		site = (unsigned long)(((pos % (long)box_width) + (long)box_width) % (long)box_width);
+		layout->x_table[pos + KCR_GRID_HALO] = (tiled == KCR_YES) ?
+		    kcr_grid_spread(site & (KCR_GRID_TILE - 1)) +
+		    (site >> KCR_GRID_TILE_SHIFT)*KCR_GRID_TILE*KCR_GRID_TILE : site;
+	}
+	for(pos = -KCR_GRID_HALO; pos < (long)box_height + KCR_GRID_HALO; pos++)
+	{
+		site = (unsigned long)(((pos % (long)box_height) + (long)box_height) % (long)box_height);
+		layout->y_table[pos + KCR_GRID_HALO] = (tiled == KCR_YES) ?
+		    2*kcr_grid_spread(site & (KCR_GRID_TILE - 1)) +
+		    (site >> KCR_GRID_TILE_SHIFT)*tiles_across*KCR_GRID_TILE*KCR_GRID_TILE : site*box_width;
+	}
+	layout->size = (tiled == KCR_YES) ? tiles_across*tiles_down*KCR_GRID_TILE*KCR_GRID_TILE :
+	                                    box_width*box_height;
+
+EXIT_LABEL:
+	/* Return */
+	return(rc);
+}
+
+/***************************************************************************************
+ * Name: kcr_grid_term()
+ *
+ * Purpose: Free the tables of a grid layout.
+ *
+ * Parameters: IN/OUT layout - the layout
+ *
+ * Returns: Nothing.
+ ***************************************************************************************/
+void kcr_grid_term(KCR_GRID_LAYOUT *layout)
+{
+	/* Sanity checks */
+	assert(layout != NULL);
+
+	if(layout->x_table != NULL)
+	{
+		free(layout->x_table);
+	}
+	if(layout->y_table != NULL)
+	{
+		free(layout->y_table);
+	}
+	layout->x_table = NULL;
+	layout->y_table = NULL;
+	layout->x_offsets = NULL;
+	layout->y_offsets = NULL;
+	layout->size = 0;
+
+	/* Return */
+	return;
+}
+
+/***************************************************************************************
+ * Name: kcr_grid_alloc()
+ *
+ * Purpose: Allocate a per-site grid of doubles.
+ *
+ * Parameters: IN     layout - the layout
+ *
+ * Returns: The grid, all zero (including the padding, so that grids can be compared
+ *          and hashed as a whole), or NULL if memory allocation fails.
+ ***************************************************************************************/
+double *kcr_grid_alloc(const KCR_GRID_LAYOUT *layout)
+{
+	/* Sanity checks */
+	assert(layout != NULL);
+
+	/* Return */
+	return((double *)calloc(layout->size, sizeof(double)));
+}
+
+/***************************************************************************************
+ * Name: kcr_grid_alloc_float()
+ *
+ * Purpose: Allocate a per-site grid of floats, for derived fields where single
+ *          precision is enough and half the memory traffic is worth having.
+ *
+ * Parameters: IN     layout - the layout
+ *
+ * Returns: The grid, all zero, or NULL if memory allocation fails.
+ ***************************************************************************************/
+float *kcr_grid_alloc_float(const KCR_GRID_LAYOUT *layout)
+{
+	/* Sanity checks */
+	assert(layout != NULL);
+
+	/* Return */
+	return((float *)calloc(layout->size, sizeof(float)));
+}
+
+/***************************************************************************************
+ * Name: kcr_axis_init()
+ *
+ * Purpose: Tabulate the boundary condition of one axis of the box.
+ *
+ * Parameters: OUT    axis - the axis
+ *             IN     boundary - boundary condition (KCR_BOUNDARY_*)
+ *             IN     size - number of sites along the axis
+ *
+ * Returns: rc - KCR_RC_OK if ok or KCR_RC_ERROR if memory allocation fails.
+ *
+ * Operation: Away from the edges every condition gives the same entries: both steps
+ *            allowed, to the neighbouring sites, and central differences.  At an
+ *            edge a reflecting axis forbids the step out (and the individual stays
+ *            put should it be taken), a periodic axis wraps round and an absorbing
+ *            axis leads to KCR_OUTSIDE.  Differences are one-sided at the edges unless
+ *            the axis is periodic.  The minimum-image offsets are tabulated for every
+ *            difference of two coordinates, so that the interaction kernels look them
+ *            up rather than work them out.
+ ***************************************************************************************/
+unsigned short kcr_axis_init(KCR_AXIS *axis, unsigned short boundary, unsigned long size)
+{
+	/* Local variables */
+	unsigned long pos;
+	long diff;
+	unsigned short rc = KCR_RC_OK;
+
+	/* Sanity checks */
+	assert(axis != NULL);
+	assert(size > 0);
+
+	axis->boundary = boundary;
+	axis->size = size;
+	axis->lo_weight = (double *)malloc(3*size*sizeof(double));
+	axis->lo_dest = (unsigned long *)malloc(4*size*sizeof(unsigned long));
+	axis->diff_table = (long *)malloc((2*size - 1)*sizeof(long));
+	if((axis->lo_weight == NULL) || (axis->lo_dest == NULL) || (axis->diff_table == NULL))
+	{
+		fprintf(stderr,"MEMORY ALLOCATION FAILURE FOR BOUNDARY TABLES\n");
+		kcr_axis_term(axis);
+		rc = KCR_RC_ERROR;
+		goto EXIT_LABEL;
+	}
+	axis->hi_weight = axis->lo_weight + size;
+	axis->stencil_span = axis->lo_weight + 2*size;
+	axis->hi_dest = axis->lo_dest + size;
+	axis->lo_stencil = axis->lo_dest + 2*size;
+	axis->hi_stencil = axis->lo_dest + 3*size;
+	axis->diffs = axis->diff_table + size - 1;
+
+	for(pos = 0; pos < size; pos++)
+	{
+		axis->lo_weight[pos] = 1;
+		axis->hi_weight[pos] = 1;
+		axis->lo_dest[pos] = pos - 1;
+		axis->hi_dest[pos] = pos + 1;
+		axis->lo_stencil[pos] = pos - 1;
+		axis->hi_stencil[pos] = pos + 1;
+		if(pos == 0)
+		{
+			axis->lo_dest[pos] = (boundary == KCR_BOUNDARY_PERIODIC) ? size - 1 :
+			                     ((boundary == KCR_BOUNDARY_ABSORBING) ? KCR_OUTSIDE : pos);
+			axis->lo_stencil[pos] = (boundary == KCR_BOUNDARY_PERIODIC) ? size - 1 : pos;
+			if(boundary == KCR_BOUNDARY_REFLECTING)
+			{
+				axis->lo_weight[pos] = 0;
+			}
+		}
+		if(pos == size - 1)
+		{
+			axis->hi_dest[pos] = (boundary == KCR_BOUNDARY_PERIODIC) ? 0 :
+			                     ((boundary == KCR_BOUNDARY_ABSORBING) ? KCR_OUTSIDE : pos);
+			axis->hi_stencil[pos] = (boundary == KCR_BOUNDARY_PERIODIC) ? 0 : pos;
+			if(boundary == KCR_BOUNDARY_REFLECTING)
+			{
+				axis->hi_weight[pos] = 0;
+			}
+		}
+		axis->stencil_span[pos] = (size == 1) ? 0 :
+		                          ((boundary == KCR_BOUNDARY_PERIODIC) ? 2 :
+		                           (double)(axis->hi_stencil[pos] - axis->lo_stencil[pos]));
+	}
+	for(diff = 1 - (long)size; diff < (long)size; diff++)
+	{
+		axis->diff_table[diff + size - 1] = KCR_DIFF(diff, 0, size);
+	}
+
+EXIT_LABEL:
+	/* Return */
+	return(rc);
+}
+
+/***************************************************************************************
+ * Name: kcr_axis_term()
+ *
+ * Purpose: Free the tables of an axis.
+ *
+ * Parameters: IN/OUT axis - the axis
+ *
+ * Returns: Nothing.
+ ***************************************************************************************/
+void kcr_axis_term(KCR_AXIS *axis)
+{
+	/* Sanity checks */
+	assert(axis != NULL);
+
+	if(axis->lo_weight != NULL)
+	{
+		free(axis->lo_weight);
+	}
+	if(axis->lo_dest != NULL)
+	{
+		free(axis->lo_dest);
+	}
+	if(axis->diff_table != NULL)
+	{
+		free(axis->diff_table);
+	}
+	memset(axis, 0, sizeof(KCR_AXIS));
+
+	/* Return */
+	return;
+}
@@ -16,15 +16,20 @@
  *             IN     no_pops - number of populations in simulation.
  *             IN     total_time - total time for the simulation.
  *             IN     start_measure_time - time to start measuring output values
- *             IN     aij_file - file containing a_ij values
+ *             IN     aij_file - file containing a_ij values (NULL leaves them at zero)
  *             IN     box_width - width of box
  *             IN     box_height - height of box
  *             IN     delta_file - file containing delta parameters (local averaging radius)
+ *                                 (NULL leaves them at zero)
  *             IN     l_val - lattice spacing
- *             IN     env_file - file containing data on the environment
+ *             IN     env_file - file containing data on the environment (ignored if
+ *                               env_weight is zero)
  *             IN     env_weight - weighting given to the environmental layer
  *             IN     packing_term - set to 1 if there is a packing term; 0 if not
  *             IN     kappa - strength of packing 
+ *             IN     boundary_x - boundary condition of the x-axis (KCR_BOUNDARY_*)
+ *             IN     boundary_y - boundary condition of the y-axis
+ *             IN     no_threads - number of worker threads (0 = one per processor)
  *
  * Returns: root_data - pointer to a CB containing all the root data for KCR.  If
  *                      any memory allocation fail then return NULL.
@@ -45,7 +50,10 @@ KCR_ROOT_DATA *kcr_init(unsigned short no_indivs,
 						FILE *env_file,
 						double env_weight,
 						unsigned short packing_term,
-						double kappa)
+						double kappa,
+						unsigned short boundary_x,
+						unsigned short boundary_y,
+						unsigned short no_threads)
 {
     /* Local variables */
     unsigned short curr_pop;
@@ -54,9 +62,6 @@ KCR_ROOT_DATA *kcr_init(unsigned short no_indivs,
     unsigned short rc;
     unsigned long counter;
 
-	/* Sanity checks. */
-	assert(aij_file != NULL);
-	
     /* Allocate memory for root data */
     root_data = (KCR_ROOT_DATA *)malloc(sizeof(KCR_ROOT_DATA));
 	if(root_data == NULL)
@@ -86,17 +91,28 @@ KCR_ROOT_DATA *kcr_init(unsigned short no_indivs,
 		goto EXIT_LABEL;
     }
 
-    /* Allocate memory for the environmental data */
-	root_data->env_data = (double *)calloc(box_height*box_width,sizeof(double));
-	if(root_data->env_data == NULL)
-	{
-		fprintf(stderr,"MEMORY ALLOCATION FAILURE FOR ROOT_DATA->env_data\n");
-		free(root_data->aijs);
-		free(root_data->deltas);
-		free(root_data);
-		root_data = NULL;
-		goto EXIT_LABEL;
-    }
+    /* The environmental layer is allocated by kcr_setup_env(), only if it is used */
+    root_data->env_data = NULL;
+    root_data->env_grad_x = NULL;
+    root_data->env_grad_y = NULL;
+    root_data->env_active = KCR_NO;
+    root_data->habitat_mask = NULL;
+    root_data->interactions = NULL;
+    root_data->no_interactions = NULL;
+    root_data->kernel_shape = KCR_KERNEL_DIRECT;
+    root_data->kernel_tables = NULL;
+    root_data->no_kernel_tables = 0;
+    root_data->marks_active = KCR_NO;
+    root_data->mark_data = NULL;
+    root_data->mark_times = NULL;
+    root_data->mark_resp = NULL;
+    root_data->mark_decay = NULL;
+    root_data->mark_decay_rate = 0;
+    root_data->mark_deposit = 0;
+    root_data->events_active = KCR_NO;
+    root_data->multirate_active = KCR_NO;
+    root_data->event_heap = NULL;
+    root_data->no_events = 0;
 
     /* Initial conditions of all the variables stored on root */
     root_data->total_time = total_time;
@@ -107,21 +123,65 @@ KCR_ROOT_DATA *kcr_init(unsigned short no_indivs,
     root_data->current_time = 0;
     root_data->box_width = box_width;
     root_data->box_height = box_height;
+    root_data->box_depth = 1;
     root_data->env_weight = env_weight;
     root_data->packing_term = packing_term;
     root_data->kappa = kappa;
-
-    /* Set up aij-values */
-    kcr_setup_array(aij_file, root_data, root_data->aijs);
-
-    /* Set up delta-values */
-    kcr_setup_array(delta_file, root_data, root_data->deltas);
+    root_data->no_threads = (no_threads == 0) ? kcr_num_cpus() : KCR_MIN(no_threads, KCR_MAX_THREADS);
+    root_data->seed = 0;
+    kcr_rng_seed(&root_data->rng, 0);
+    root_data->out_file = stdout;
+    root_data->checkpoint_name = NULL;
+    root_data->checkpoint_interval = 0;
+    memset(&root_data->env_raster, 0, sizeof(root_data->env_raster));
+    memset(&root_data->env_frames, 0, sizeof(root_data->env_frames));
+    memset(&root_data->mean_field, 0, sizeof(root_data->mean_field));
+    root_data->env_frames.loading = KCR_NO;
+    if(env_weight == 0)
+    {
+        /* The layer would have no effect: do not read it */
+        env_file = NULL;
+    }
 
     /* l_val */
     root_data->l_val = l_val;
 
-    /* Put environmental data from file into CB */
-    kcr_setup_env(env_file, root_data);
+    /* Set up aij-values, delta-values, the layout of the per-site grids, the boundary
+     * tables and put environmental data from file into CB */
+    memset(&root_data->grid, 0, sizeof(root_data->grid));
+    memset(&root_data->x_axis, 0, sizeof(root_data->x_axis));
+    memset(&root_data->y_axis, 0, sizeof(root_data->y_axis));
+    memset(&root_data->z_axis, 0, sizeof(root_data->z_axis));
+    if(((aij_file != NULL) && (kcr_setup_array(aij_file, root_data, root_data->aijs) != KCR_RC_OK)) ||
+       ((delta_file != NULL) && (kcr_setup_array(delta_file, root_data, root_data->deltas) != KCR_RC_OK)) ||
+       (kcr_grid_init(&root_data->grid, box_width, box_height) != KCR_RC_OK) ||
+       (kcr_axis_init(&root_data->x_axis, boundary_x, box_width) != KCR_RC_OK) ||
+       (kcr_axis_init(&root_data->y_axis, boundary_y, box_height) != KCR_RC_OK) ||
+       (kcr_setup_env(env_file, root_data) != KCR_RC_OK))
+    {
+        fprintf(stderr,"Failed to read input files\n");
+        free(root_data->aijs);
+        free(root_data->deltas);
+        kcr_grid_term(&root_data->grid);
+        kcr_axis_term(&root_data->x_axis);
+        kcr_axis_term(&root_data->y_axis);
+        if(root_data->env_data != NULL)
+        {
+            free(root_data->env_data);
+        }
+        if(root_data->env_grad_x != NULL)
+        {
+            free(root_data->env_grad_x);
+        }
+        if(root_data->env_grad_y != NULL)
+        {
+            free(root_data->env_grad_y);
+        }
+        kcr_unmap_file(&root_data->env_raster.mapping);
+        free(root_data);
+        root_data = NULL;
+        goto EXIT_LABEL;
+    }
 
     /* Initialise populations */
     for(curr_pop = 0; curr_pop < no_pops; curr_pop++)
@@ -135,6 +195,25 @@ KCR_ROOT_DATA *kcr_init(unsigned short no_indivs,
             goto EXIT_LABEL;
         }
     }
+
+    /* Work out which populations interact */
+    root_data->interactions = (KCR_INTERACTION *)malloc(no_pops*no_pops*sizeof(KCR_INTERACTION));
+    root_data->no_interactions = (unsigned short *)malloc(no_pops*sizeof(unsigned short));
+    root_data->kernel_tables = (KCR_KERNEL_TABLE *)malloc(no_pops*no_pops*sizeof(KCR_KERNEL_TABLE));
+    if((root_data->interactions == NULL) || (root_data->no_interactions == NULL) ||
+       (root_data->kernel_tables == NULL))
+    {
+        fprintf(stderr,"MEMORY ALLOCATION FAILURE FOR ROOT_DATA->interactions\n");
+        kcr_term(root_data);
+        root_data = NULL;
+        goto EXIT_LABEL;
+    }
+    if(kcr_setup_interactions(root_data) != KCR_RC_OK)
+    {
+        kcr_term(root_data);
+        root_data = NULL;
+        goto EXIT_LABEL;
+    }
     
 EXIT_LABEL:
     /* Return pointer to the root data */
@@ -181,6 +260,7 @@ KCR_POPULATION *kcr_pop_init(unsigned short index, KCR_ROOT_DATA *root_data)
 
 	/* Input initial values */
     population->index = index;
+    population->move_rate = 1;
 
     /* Create the individual list */
     LIST_CREATE(population->individual_list_root);
@@ -244,6 +324,7 @@ KCR_INDIVIDUAL *kcr_indiv_init(unsigned short index, KCR_POPULATION *population,
     individual->index = index;
     individual->current_x_pos = root_data->box_width;
     individual->current_y_pos = root_data->box_height;
+    individual->current_z_pos = 0;
 
 EXIT_LABEL:
 	/* Return pointer to the individual */
@@ -266,19 +347,14 @@ EXIT_LABEL:
  *                  ...
  *                  ...
  *               a_N1 a_N2 ... a_NN
- *            where N=root_data->no_indivs and there is a tab (\t) between each value. 
+ *            where N=root_data->no_pops and there is a tab (\t) between each value. 
  *            Here, a_ij is the response of individuals from population i to marks of j.
+ *            Malformed numbers and surplus values are reported with their line and
+ *            column.
  ***************************************************************************************/
 unsigned short kcr_setup_array(FILE *in_file, KCR_ROOT_DATA *root_data, double *dbl_array)
 {
 	/* Local variables */
-	double curr_val = 0;
-	char curr_char;
-	char prev_char;
-	unsigned long y_val = 0;
-	unsigned long x_val = 0;
-	double digit_after_dec = 0;
-	unsigned short neg = KCR_NO;
 	unsigned short rc = KCR_RC_OK;
     
 	/* Sanity checks */
@@ -287,104 +363,8 @@ unsigned short kcr_setup_array(FILE *in_file, KCR_ROOT_DATA *root_data, double *
 	assert(dbl_array != NULL);
 
     /* Get numbers from file */
-    rewind(in_file);
-	curr_char = getc(in_file);
-	while(curr_char != EOF)
-	{
-		if((curr_char >= '0') && (curr_char <= '9') && (digit_after_dec == 0))
-        { 
-            /* This is a digit of a number */
-            curr_val = curr_val*10+(double)(curr_char-'0');
-        }
-  		else if((curr_char >= '0') && (curr_char <= '9'))
-        { 
-            /* This is a digit of a number after the decimal point */
-            curr_val += (double)(curr_char-'0')/pow(10,digit_after_dec);
-            digit_after_dec++;
-        }
-        else if(curr_char == '-')
-        {
-            /* Negative number */
-            neg = KCR_YES;
-        }
-        else if(curr_char == '.')
-        {
-            /* Decimal point. */
-            digit_after_dec++;
-        }
-		else if((curr_char == '\n') && (prev_char >= '0') && (prev_char <= '9'))
-		{
-            /* End of row of numbers */
-            assert(x_val < root_data->no_pops);
-            assert(y_val < root_data->no_pops);
-            if(neg == KCR_NO)
-            {
-                dbl_array[x_val+y_val*root_data->no_pops] = curr_val;
-			}
-			else
-			{
-                dbl_array[x_val+y_val*root_data->no_pops] = -curr_val;
-			}
-            curr_val = 0;
-            y_val++;
-            x_val = 0;
-            digit_after_dec = 0;
-            neg = KCR_NO;
-        } 
-		else if((curr_char == '\n') && (prev_char == '\t'))
-		{
-            /* End of row of numbers after a tab.  No need to store values in array.  Just
-             * change x_val and y_val to reflect the fact that we are about to start a new
-             * row.  */
-            assert(x_val <= root_data->no_pops); /* could have x_val=no_pops due to tab */
-            assert(y_val < root_data->no_pops);
-            curr_val = 0;
-            y_val++;
-            x_val = 0;
-            digit_after_dec = 0;
-            neg = KCR_NO;
-        } 
-    	else if((curr_char == '\t') && (prev_char >= '0') && (prev_char <= '9'))
-		{
-            /* End of a number */
-            assert(x_val < root_data->no_pops);
-            assert(y_val < root_data->no_pops);
-            if(neg == KCR_NO)
-            {
-                dbl_array[x_val+y_val*root_data->no_pops] = curr_val;
-			}
-			else
-			{
-                dbl_array[x_val+y_val*root_data->no_pops] = -curr_val;
-			}
-            curr_val = 0;
-            x_val++;
-            digit_after_dec = 0;
-            neg = KCR_NO;
-        }                            
-        else
-        {
-            /* Unrecognised character.  Maybe benign.  No-op */
-        }             
-        prev_char = curr_char;              
-    	curr_char = getc(in_file);
-	}
-	if((prev_char >= '0') && (prev_char <= '9'))
-	{
-		/* Got to the end of the file but not stored final value */
-        assert(x_val < root_data->no_pops);
-        assert(y_val < root_data->no_pops);
-        if(neg == KCR_NO)
-        {
-            dbl_array[x_val+y_val*root_data->no_pops] = curr_val;
-        }
-		else
-		{
-            dbl_array[x_val+y_val*root_data->no_pops] = -curr_val;
-		}
-	}
+    rc = kcr_parse_matrix(in_file, "parameter file", dbl_array, NULL, root_data->no_pops, root_data->no_pops, KCR_YES);
 	        
-EXIT_LABEL:   
 	/* Return */
 	return(rc);
 }
@@ -397,23 +377,25 @@ EXIT_LABEL:
  * Parameters: IN     start_file - file contining initial conditions
  *             IN     root_data - pointer to a CB containing all the root data for KCR.
  *
- * Returns: Nothing.
+ * Returns: rc - return code.  Either KCR_RC_OK if ok or KCR_RC_ERROR if error.
  *
- * Operation: Set up position data in individual CB from the start data in ROOT.
+ * Operation: Set up position data in individual CB from the start file, which is either
+ *            a binary state file or a text file of tab-separated x- and y-positions
+ *            (x-, y- and z-positions in a three-dimensional box) in population-list
+ *            order.  With no start file, place individuals at
+ *            random on open cells, or from the mean-field densities if there are any.
  *            Set the current_time_step in ROOT to 0.
  ***************************************************************************************/
- void kcr_set_init_conds(FILE *start_file, KCR_ROOT_DATA *root_data)
- {
+unsigned short kcr_set_init_conds(FILE *start_file, KCR_ROOT_DATA *root_data)
+{
 	/* Local variables */
 	KCR_INDIVIDUAL *curr_indiv_cb;
     KCR_POPULATION *curr_pop_cb;
-	unsigned long x_val;
-	unsigned long y_val;
- 	unsigned long counter;
-	unsigned long curr_val = 0;
-	char curr_char;
-	char prev_char;
+	KCR_PARSER parser;
+	unsigned short token;
+	double value;
 	unsigned short xy_val;
+	unsigned short rc = KCR_RC_OK;
 
 	/* Sanity checks */
 	assert(root_data != NULL);
@@ -427,8 +409,19 @@ EXIT_LABEL:
             curr_indiv_cb = (KCR_INDIVIDUAL *)LIST_GET_FIRST(curr_pop_cb->individual_list_root);                        
             while(curr_indiv_cb != NULL)
             {
-       	        curr_indiv_cb->current_x_pos = rand() % root_data->box_width;
-                curr_indiv_cb->current_y_pos = rand() % root_data->box_height;
+                if(root_data->mean_field.density != NULL)
+                {
+                    /* Warm start: draw from the mean-field densities */
+                    rc = kcr_mf_place_individual(curr_indiv_cb, curr_pop_cb, root_data);
+                    if(rc != KCR_RC_OK)
+                    {
+                        goto EXIT_LABEL;
+                    }
+                }
+                else
+                {
+                    kcr_place_individual(curr_indiv_cb, root_data);
+                }
 
                 /* Get next individual */
                 curr_indiv_cb = (KCR_INDIVIDUAL *)LIST_GET_NEXT(curr_indiv_cb->list_elt);
@@ -437,89 +430,201 @@ EXIT_LABEL:
             curr_pop_cb = (KCR_POPULATION *)LIST_GET_NEXT(curr_pop_cb->list_elt);
         }
 	}
+	else if(kcr_state_is_binary(start_file) == KCR_YES)
+	{
+        /* Update positions from a binary state file */
+        rc = kcr_read_state(start_file, root_data);
+	}
 	else
 	{
         /* Update positions on population and individual CBs based on file. */
-    	rewind(start_file);
-		curr_char = getc(start_file);
+		rc = kcr_parser_open_file(&parser, start_file, "start file");
+		if(rc != KCR_RC_OK)
+		{
+			goto EXIT_LABEL;
+		}
         curr_pop_cb = (KCR_POPULATION *)LIST_GET_FIRST(root_data->population_list_root);                        
         curr_indiv_cb = (KCR_INDIVIDUAL *)LIST_GET_FIRST(curr_pop_cb->individual_list_root);    
 		xy_val = KCR_X;                    
-		while(curr_char != EOF)
+		while(curr_indiv_cb != NULL)
 		{
-			if((curr_char >= '0') && (curr_char <= '9'))
-	        { 
-	            /* This is a digit of a number */
-	            curr_val = curr_val*10+(unsigned long)(curr_char-'0');
-	        }
-			else if(((curr_char == '\n') || (curr_char == '\t')) && (prev_char >= '0') && (prev_char <= '9'))
+			token = kcr_parser_next(&parser, &value);
+			if(token == KCR_TOKEN_END_OF_ROW)
 			{
-	            /* End of number */
-	            if(xy_val == KCR_X)
-	            {
-	            	/* Got an x-value */
-					assert(curr_indiv_cb != NULL);
-    	            curr_indiv_cb->current_x_pos = curr_val;
-    	            curr_val = 0;
-    	            xy_val = KCR_Y;
-				}
-				else
+				/* Rows are not significant: positions may span several lines */
+				continue;
+			}
+			if(token == KCR_TOKEN_END_OF_FILE)
+			{
+				fprintf(stderr,"Error: start file holds too few positions\n");
+				rc = KCR_RC_ERROR;
+				break;
+			}
+			if((token == KCR_TOKEN_ERROR) ||
+			   (value < 0) || (value != floor(value)) ||
+			   (value >= ((xy_val == KCR_X) ? root_data->box_width :
+			              ((xy_val == KCR_Y) ? root_data->box_height : root_data->box_depth))))
+			{
+				if(token != KCR_TOKEN_ERROR)
 				{
-					/* Got a y-value */
-					assert(curr_indiv_cb != NULL);
-					assert(xy_val == KCR_Y);
-    	            curr_indiv_cb->current_y_pos = curr_val;					
-    	            curr_val = 0;
-    	            xy_val = KCR_X;
-    	            
-                    /* Get next individual */
-                    curr_indiv_cb = (KCR_INDIVIDUAL *)LIST_GET_NEXT(curr_indiv_cb->list_elt);
-    	            
-    	            /* If next individual is NULL, get the next population */
-    	            if(curr_indiv_cb == NULL)
-    	            {
-                        /* Get next population */
-       					assert(curr_pop_cb != NULL);
-                        curr_pop_cb = (KCR_POPULATION *)LIST_GET_NEXT(curr_pop_cb->list_elt);
-                        if(curr_pop_cb != NULL)
-                        {
-                        	/* Get the first individual from this list */
-                            curr_indiv_cb = (KCR_INDIVIDUAL *)LIST_GET_FIRST(curr_pop_cb->individual_list_root);                        
-						}
-						else
-						{
-							/* Run out of populations.  Break. */
-							break;
-						}
-					}
+					kcr_parser_error(&parser, "position outside the box");
 				}
-	        } 
-	        prev_char = curr_char;              
-	    	curr_char = getc(start_file);
-		}
-		if((prev_char >= '0') && (prev_char <= '9'))
-		{
-			/* Got to the end of the file but not stored final value */
-            if((xy_val == KCR_X) && (curr_indiv_cb != NULL))
+				rc = KCR_RC_ERROR;
+				break;
+			}
+
+            if(xy_val == KCR_X)
             {
             	/* Got an x-value */
-   	            curr_indiv_cb->current_x_pos = curr_val;
+   	            curr_indiv_cb->current_x_pos = (unsigned long)value;
    	            xy_val = KCR_Y;
 			}
-			else if(curr_indiv_cb != NULL) 
+			else if((xy_val == KCR_Y) && (root_data->box_depth > 1))
 			{
-				/* Got a y-value */
-				assert(xy_val == KCR_Y);
-   	            curr_indiv_cb->current_y_pos = curr_val;					
-            }
+				/* Got a y-value, with a z-value to come */
+   	            curr_indiv_cb->current_y_pos = (unsigned long)value;
+   	            xy_val = KCR_Z;
+			}
+			else
+			{
+				/* Got the last value of the position: y, or z in a three-dimensional box */
+				if(xy_val == KCR_Y)
+				{
+   	                curr_indiv_cb->current_y_pos = (unsigned long)value;
+				}
+				else
+				{
+   	                curr_indiv_cb->current_z_pos = (unsigned long)value;
+				}
+   	            xy_val = KCR_X;
+				if((root_data->habitat_mask != NULL) &&
+				   KCR_MASK_BLOCKED(root_data->habitat_mask,
+				                    KCR_GRID_INDEX(&root_data->grid, curr_indiv_cb->current_x_pos,
+				                                   curr_indiv_cb->current_y_pos)))
+				{
+					kcr_parser_error(&parser, "position on a blocked cell");
+					rc = KCR_RC_ERROR;
+					break;
+				}
+
+                /* Get next individual, moving on to the next population at the end of
+                 * this one */
+                curr_indiv_cb = (KCR_INDIVIDUAL *)LIST_GET_NEXT(curr_indiv_cb->list_elt);
+                if(curr_indiv_cb == NULL)
+                {
+                    curr_pop_cb = (KCR_POPULATION *)LIST_GET_NEXT(curr_pop_cb->list_elt);
+                    if(curr_pop_cb != NULL)
+                    {
+                        curr_indiv_cb = (KCR_INDIVIDUAL *)LIST_GET_FIRST(curr_pop_cb->individual_list_root);
+                    }
+                }
+			}
 		}
+		kcr_parser_close(&parser);
 	}
     
     /* Set initial time in root data */
     root_data->current_time = 0;
    
+EXIT_LABEL:
     /* Return */
-	return;
+	return(rc);
+}
+
+/***************************************************************************************
+ * Name: kcr_setup_interactions()
+ *
+ * Purpose: Work out, for each population, which populations its individuals have to
+ *          look at when they move.
+ *
+ * Parameters: IN/OUT root_data - pointer to a CB containing all the root data for KCR.
+ *
+ * Returns: rc - KCR_RC_OK if ok or KCR_RC_ERROR if memory allocation fails.
+ *
+ * Operation: Population j acts on population i if a_ij is non-zero and delta_ij is
+ *            in range (positive in one dimension, non-zero in two); otherwise every
+ *            term it would add to the drift is zero.  If
+ *            there is a packing term, every population is listed, since all
+ *            individuals count towards the density, but those that do not act on i
+ *            are marked so that only their site is compared.  The sources are kept in
+ *            list order, so the drift is summed in the same order as over all the
+ *            populations.  The coefficient of each interaction is worked out here in
+ *            the form the kernel would have worked it out, for the one- or
+ *            two-dimensional kernel as the box needs.  If the kernel is tabulated,
+ *            as it always is in a three-dimensional box, the coefficient is a_ij, and
+ *            the tables are rebuilt.
+ ***************************************************************************************/
+unsigned short kcr_setup_interactions(KCR_ROOT_DATA *root_data)
+{
+    /* Local variables */
+    KCR_POPULATION *target_cb;
+    KCR_POPULATION *source_cb;
+    KCR_INTERACTION *interaction;
+    unsigned long param;
+    double delta;
+    double aij;
+    unsigned short interacts;
+    unsigned short rc = KCR_RC_OK;
+
+	/* Sanity checks. */
+	assert(root_data != NULL);
+	assert(root_data->interactions != NULL);
+	assert(root_data->no_interactions != NULL);
+
+    kcr_kernel_tables_term(root_data);
+
+    target_cb = (KCR_POPULATION *)LIST_GET_FIRST(root_data->population_list_root);
+    while(target_cb != NULL)
+    {
+        root_data->no_interactions[target_cb->index] = 0;
+        source_cb = (KCR_POPULATION *)LIST_GET_FIRST(root_data->population_list_root);
+        while(source_cb != NULL)
+        {
+            param = source_cb->index + (unsigned long)target_cb->index*root_data->no_pops;
+            aij = root_data->aijs[param];
+            delta = root_data->deltas[param];
+            interacts = ((aij != 0) && ((root_data->box_height == 1) ? (delta > 0) : (delta != 0))) ? KCR_YES : KCR_NO;
+            if((interacts == KCR_YES) || (root_data->packing_term == 1))
+            {
+                interaction = root_data->interactions + (unsigned long)target_cb->index*root_data->no_pops +
+                              root_data->no_interactions[target_cb->index];
+                interaction->source = source_cb;
+                interaction->delta = delta;
+                interaction->delta_sq = pow(delta,2);
+                interaction->interacts = interacts;
+                interaction->table = NULL;
+                if(interacts == KCR_NO)
+                {
+                    interaction->coeff = 0;
+                }
+                else if((root_data->kernel_shape != KCR_KERNEL_DIRECT) || (root_data->box_depth > 1))
+                {
+                    interaction->coeff = aij;
+                    interaction->table = kcr_kernel_table(root_data, delta);
+                    if(interaction->table == NULL)
+                    {
+                        rc = KCR_RC_ERROR;
+                        goto EXIT_LABEL;
+                    }
+                }
+                else if(root_data->box_height == 1)
+                {
+                    interaction->coeff = root_data->l_val*aij/(4*delta);
+                }
+                else
+                {
+                    interaction->coeff = root_data->l_val*aij*(1/(2*KCR_PI*pow(delta,2)));
+                }
+                root_data->no_interactions[target_cb->index]++;
+            }
+            source_cb = (KCR_POPULATION *)LIST_GET_NEXT(source_cb->list_elt);
+        }
+        target_cb = (KCR_POPULATION *)LIST_GET_NEXT(target_cb->list_elt);
+    }
+
+EXIT_LABEL:
+    /* Return */
+    return(rc);
 }
 
 /***************************************************************************************
@@ -539,6 +644,45 @@ void kcr_term(KCR_ROOT_DATA *root_data)
 	/* Sanity checks. */
 	assert(root_data != NULL);
 
+    /* Free up parameters and the environmental layer */
+    kcr_env_frames_term(root_data);
+    kcr_marks_term(root_data);
+    kcr_events_term(root_data);
+    kcr_mask_term(root_data);
+    kcr_mean_field_term(root_data);
+    kcr_grid_term(&root_data->grid);
+    kcr_axis_term(&root_data->x_axis);
+    kcr_axis_term(&root_data->y_axis);
+    kcr_axis_term(&root_data->z_axis);
+    free(root_data->aijs);
+    free(root_data->deltas);
+    if(root_data->interactions != NULL)
+    {
+        free(root_data->interactions);
+    }
+    if(root_data->no_interactions != NULL)
+    {
+        free(root_data->no_interactions);
+    }
+    if(root_data->kernel_tables != NULL)
+    {
+        kcr_kernel_tables_term(root_data);
+        free(root_data->kernel_tables);
+    }
+    if(root_data->env_data != NULL)
+    {
+        free(root_data->env_data);
+    }
+    if(root_data->env_grad_x != NULL)
+    {
+        free(root_data->env_grad_x);
+    }
+    if(root_data->env_grad_y != NULL)
+    {
+        free(root_data->env_grad_y);
+    }
+    kcr_unmap_file(&root_data->env_raster.mapping);
+
     /* Free up populations */		
     if(LIST_EMPTY(root_data->population_list_root))
     {
@@ -632,138 +776,66 @@ void kcr_indiv_term(KCR_INDIVIDUAL *individual)
  * Parameters: IN     env_file - file contining environmental data
  *             IN     root_data - pointer to a CB containing all the root data for KCR.
  *
- * Returns: Nothing.
+ * Returns: rc - return code.  Either KCR_RC_OK if ok or KCR_RC_ERROR if error.
  *
- * Operation: If the file is NULL then put zeros in the environmental data array.  Else
- *            populate the array with numbers from file.
+ * Operation: If there is no file then there is no environmental layer: env_data stays
+ *            NULL and env_active KCR_NO.  If the file is a binary raster then map it:
+ *            values are read from the mapping.  Else allocate the environmental data
+ *            array, laid out as a per-site grid, and populate it with numbers from
+ *            file, one row of the box per line, splitting large files between
+ *            root_data->no_threads threads.  The array comes from calloc(), so values
+ *            missing from the file are zero without a separate pass to clear it.
  ***************************************************************************************/
-void kcr_setup_env(FILE *env_file, KCR_ROOT_DATA *root_data)
+unsigned short kcr_setup_env(FILE *env_file, KCR_ROOT_DATA *root_data)
 {
 	/* Local variables */
-	double curr_val = 0;
-	char curr_char;
-	char prev_char;
-	unsigned long y_val;
-	unsigned long x_val;
-	double digit_after_dec = 0;
-	unsigned short neg = KCR_NO;
 	unsigned short rc = KCR_RC_OK;
 
 	/* Sanity checks */
 	assert(root_data != NULL);
 
-  	/* Populate environmental data array with default values of zero */
-   	for(y_val = 0; y_val < root_data->box_height; y_val++)
-	{
-       	for(x_val = 0; x_val < root_data->box_width; x_val++)
-    	{
-		    root_data->env_data[y_val*root_data->box_width+x_val] = 0;
-	    }
-	}
-	x_val = 0;
-	y_val = 0;
-    if(env_file != NULL)
-	{
-		/* Populate environmental data array with values from file */
-        /* Get numbers from file */
-        rewind(env_file);
-	    curr_char = getc(env_file);
-	    while(curr_char != EOF)
-	    {
-    		if((curr_char >= '0') && (curr_char <= '9') && (digit_after_dec == 0))
-            { 
-                /* This is a digit of a number */
-                curr_val = curr_val*10+(double)(curr_char-'0');
-            }
-      		else if((curr_char >= '0') && (curr_char <= '9'))
-            { 
-                /* This is a digit of a number after the decimal point */
-                curr_val += (double)(curr_char-'0')/pow(10,digit_after_dec);
-                digit_after_dec++;
-            }
-            else if(curr_char == '-')
-            {
-                /* Negative number */
-                neg = KCR_YES;
-            }
-            else if(curr_char == '.')
-            {
-                /* Decimal point. */
-                digit_after_dec++;
-            }
-    		else if((curr_char == '\n') && (prev_char >= '0') && (prev_char <= '9'))
-    		{
-                /* End of row of numbers */
-                assert(x_val < root_data->box_width);
-                assert(y_val < root_data->box_height);
-                if(neg == KCR_NO)
-                {
-                    root_data->env_data[x_val+y_val*root_data->box_width] = curr_val;
-    			}
-    			else
-    			{
-                    root_data->env_data[x_val+y_val*root_data->box_width] = -curr_val;
-    			}
-                curr_val = 0;
-                y_val++;
-                x_val = 0;
-                digit_after_dec = 0;
-                neg = KCR_NO;
-            } 
-    		else if((curr_char == '\n') && (prev_char == '\t'))
-    		{
-                /* End of row of numbers after a tab.  No need to store values in array.  Just
-                 * change x_val and y_val to reflect the fact that we are about to start a new
-                 * row.  */
-                assert(x_val <= root_data->box_width); /* could have x_val=box_width due to tab */
-                assert(y_val < root_data->box_height);
-                curr_val = 0;
-                y_val++;
-                x_val = 0;
-                digit_after_dec = 0;
-                neg = KCR_NO;
-            } 
-        	else if((curr_char == '\t') && (prev_char >= '0') && (prev_char <= '9'))
-    		{
-                /* End of a number */
-                assert(x_val < root_data->box_width);
-                assert(y_val < root_data->box_height);
-                if(neg == KCR_NO)
-                {
-                    root_data->env_data[x_val+y_val*root_data->box_width] = curr_val;
-    			}
-    			else
-    			{
-                    root_data->env_data[x_val+y_val*root_data->box_width] = -curr_val;
-    			}
-                curr_val = 0;
-                x_val++;
-                digit_after_dec = 0;
-                neg = KCR_NO;
-            }                            
-            else
-            {
-                /* Unrecognised character.  Maybe benign.  No-op */
-            }             
-            prev_char = curr_char;              
-        	curr_char = getc(env_file);
-    	}
-    	if((prev_char >= '0') && (prev_char <= '9'))
-    	{
-    		/* Got to the end of the file but not stored final value */
-            assert(x_val < root_data->box_width);
-            assert(y_val < root_data->box_height);
-            if(neg == KCR_NO)
-            {
-                root_data->env_data[x_val+y_val*root_data->box_width] = curr_val;
-            }
-    		else
-    		{
-                root_data->env_data[x_val+y_val*root_data->box_width] = -curr_val;
-    		}
-    	}
-	}
+    if(env_file == NULL)
+    {
+        /* No environmental layer */
+        goto EXIT_LABEL;
+    }
+
+    if(kcr_env_is_raster(env_file) == KCR_YES)
+    {
+        /* Binary raster: map it rather than copying it into env_data */
+        rc = kcr_env_map_raster(env_file,
+                                &root_data->env_raster,
+                                root_data->box_width,
+                                root_data->box_height,
+                                KCR_YES);
+    }
+    else
+    {
+        /* Populate environmental data array with values from file */
+        root_data->env_data = kcr_grid_alloc(&root_data->grid);
+        if(root_data->env_data == NULL)
+        {
+            fprintf(stderr,"MEMORY ALLOCATION FAILURE FOR ROOT_DATA->env_data\n");
+            rc = KCR_RC_ERROR;
+            goto EXIT_LABEL;
+        }
+        rc = kcr_parse_matrix_parallel(env_file,
+                                       "environmental data file",
+                                       root_data->env_data,
+                                       &root_data->grid,
+                                       root_data->box_width,
+                                       root_data->box_height,
+                                       root_data->no_threads,
+                                       KCR_YES);
+    }
+    if((rc == KCR_RC_OK) && (root_data->env_weight != 0))
+    {
+        /* The kernels use the layer through its gradient */
+        root_data->env_active = KCR_YES;
+        rc = kcr_setup_env_gradient(root_data);
+    }
 
+EXIT_LABEL:
 	/* Return */
-	return;
+	return(rc);
 }
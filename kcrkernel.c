@@ -0,0 +1,230 @@
+/***************************************************************************************
+ * Filename: kcrkernel.c
+ *
+ * Description: Shapes of the interaction kernel.  Other than the top-hat worked out
+ *              directly, the kernel of each value of delta is tabulated once for every
+ *              lattice offset within its cutoff, so that all shapes cost the same per
+ *              pair of individuals and none needs exp() while moving.
+ ***************************************************************************************/
+
+#include <kcr.h>
+
+/***************************************************************************************
+ * Name: kcr_kernel_weight()
+ *
+ * Purpose: Get the weight of the kernel at a distance.
+ *
+ * Parameters: IN     shape - shape of the kernel (KCR_KERNEL_*)
+ *             IN     dist - the distance (greater than zero)
+ *             IN     delta - the range of the kernel
+ *             IN     no_dims - number of dimensions, 1, 2 or 3
+ *
+ * Returns: The drift, per unit a_ij and lattice spacing, towards an individual at
+ *          dist.  Zero beyond the cutoff.
+ *
+ * Operation: Every shape integrates to a half over the line, plane or space, as the
+ *            top-hat always has: 1/(4 delta) in one dimension, 1/(2 pi delta^2) in two
+ *            and 3/(8 pi delta^3) in three.
+ ***************************************************************************************/
+double kcr_kernel_weight(unsigned short shape, double dist, double delta, unsigned short no_dims)
+{
+	/* Local variables */
+	double weight = 0;
+
+	delta = fabs(delta);
+	if((delta == 0) || (dist > kcr_kernel_cutoff(shape, delta)))
+	{
+		goto EXIT_LABEL;
+	}
+
+	switch(shape)
+	{
+		case KCR_KERNEL_GAUSSIAN:
+			weight = exp(-pow(dist/delta,2)/2)/((no_dims == 1) ? 2*sqrt(2*KCR_PI)*delta :
+			                                    ((no_dims == 2) ? 4*KCR_PI*pow(delta,2) :
+			                                                      2*pow(2*KCR_PI,1.5)*pow(delta,3)));
+			break;
+
+		case KCR_KERNEL_EXPONENTIAL:
+			weight = exp(-dist/delta)/((no_dims == 1) ? 4*delta :
+			                           ((no_dims == 2) ? 4*KCR_PI*pow(delta,2) : 16*KCR_PI*pow(delta,3)));
+			break;
+
+		case KCR_KERNEL_LINEAR:
+			weight = (1 - dist/delta)*((no_dims == 1) ? 1/(2*delta) :
+			                           ((no_dims == 2) ? 3/(2*KCR_PI*pow(delta,2)) : 3/(2*KCR_PI*pow(delta,3))));
+			break;
+
+		default:
+			weight = (no_dims == 1) ? 1/(4*delta) :
+			         ((no_dims == 2) ? 1/(2*KCR_PI*pow(delta,2)) : 3/(8*KCR_PI*pow(delta,3)));
+			break;
+	}
+
+EXIT_LABEL:
+	/* Return */
+	return(weight);
+}
+
+/***************************************************************************************
+ * Name: kcr_kernel_cutoff()
+ *
+ * Purpose: Get the distance beyond which the kernel is zero.
+ *
+ * Parameters: IN     shape - shape of the kernel (KCR_KERNEL_*)
+ *             IN     delta - the range of the kernel
+ *
+ * Returns: The cutoff.
+ ***************************************************************************************/
+double kcr_kernel_cutoff(unsigned short shape, double delta)
+{
+	/* Local variables */
+	double cutoff;
+
+	delta = fabs(delta);
+	if(shape == KCR_KERNEL_GAUSSIAN)
+	{
+		cutoff = KCR_KERNEL_GAUSSIAN_CUTOFF*delta;
+	}
+	else if(shape == KCR_KERNEL_EXPONENTIAL)
+	{
+		cutoff = KCR_KERNEL_EXPONENTIAL_CUTOFF*delta;
+	}
+	else
+	{
+		cutoff = delta;
+	}
+
+	/* Return */
+	return(cutoff);
+}
+
+/***************************************************************************************
+ * Name: kcr_kernel_table()
+ *
+ * Purpose: Get the table of the kernel for a value of delta, building it if there is
+ *          none yet.
+ *
+ * Parameters: IN/OUT root_data - pointer to a CB containing all the root data for KCR.
+ *             IN     delta - the range of the kernel
+ *
+ * Returns: The table, or NULL if memory allocation fails.
+ *
+ * Operation: root_data->kernel_tables has room for a table for every pair of
+ *            populations.  Offsets are tabulated out to the cutoff, but no further
+ *            than half the box, the largest offset KCR_DIFF gives.  The weight at an
+ *            offset is the kernel at its length, times the lattice spacing, along the
+ *            unit vector of the offset, so that the drift of a pair of individuals is
+ *            a_ij times the weight, as the direct top-hat has it.  A three-dimensional
+ *            box has no direct kernel, so there the top-hat is tabulated in its place:
+ *            a sphere of radius delta.
+ ***************************************************************************************/
+KCR_KERNEL_TABLE *kcr_kernel_table(KCR_ROOT_DATA *root_data, double delta)
+{
+	/* Local variables */
+	KCR_KERNEL_TABLE *table = NULL;
+	unsigned long curr_table;
+	unsigned short shape;
+	unsigned short no_dims;
+	double cutoff_sq;
+	double dist_sq;
+	double weight;
+	double norm;
+	long radius;
+	long x_diff;
+	long y_diff;
+	long z_diff;
+	double *entry;
+
+	/* Sanity checks */
+	assert(root_data != NULL);
+	assert(root_data->kernel_tables != NULL);
+
+	for(curr_table = 0; curr_table < root_data->no_kernel_tables; curr_table++)
+	{
+		if(root_data->kernel_tables[curr_table].delta == delta)
+		{
+			table = &root_data->kernel_tables[curr_table];
+			goto EXIT_LABEL;
+		}
+	}
+	assert(root_data->no_kernel_tables < (unsigned long)root_data->no_pops*root_data->no_pops);
+
+	no_dims = (root_data->box_depth > 1) ? 3 : ((root_data->box_height == 1) ? 1 : 2);
+	shape = (root_data->kernel_shape == KCR_KERNEL_DIRECT) ? KCR_KERNEL_TOP_HAT : root_data->kernel_shape;
+	cutoff_sq = pow(kcr_kernel_cutoff(shape, delta),2);
+	radius = (long)floor(kcr_kernel_cutoff(shape, delta)/root_data->l_val);
+	table = &root_data->kernel_tables[root_data->no_kernel_tables];
+	table->delta = delta;
+	table->x_radius = KCR_MIN(radius, (long)(root_data->box_width/2));
+	table->y_radius = (no_dims == 1) ? 0 : KCR_MIN(radius, (long)(root_data->box_height/2));
+	table->z_radius = (no_dims < 3) ? 0 : KCR_MIN(radius, (long)(root_data->box_depth/2));
+	table->weights = (double *)calloc(((no_dims == 3) ? 3 : 2)*(2*table->x_radius + 1)*(2*table->y_radius + 1)*
+	                                  (2*table->z_radius + 1), sizeof(double));
+	if(table->weights == NULL)
+	{
+		fprintf(stderr,"MEMORY ALLOCATION FAILURE FOR KERNEL TABLE\n");
+		table = NULL;
+		goto EXIT_LABEL;
+	}
+	root_data->no_kernel_tables++;
+
+	entry = table->weights;
+	for(z_diff = -table->z_radius; z_diff <= table->z_radius; z_diff++)
+	{
+		for(y_diff = -table->y_radius; y_diff <= table->y_radius; y_diff++)
+		{
+			for(x_diff = -table->x_radius; x_diff <= table->x_radius; x_diff++, entry += (no_dims == 3) ? 3 : 2)
+			{
+				dist_sq = pow(x_diff*root_data->l_val,2) + pow(y_diff*root_data->l_val,2);
+				if(no_dims == 3)
+				{
+					dist_sq += pow(z_diff*root_data->l_val,2);
+				}
+				if((dist_sq == 0) || (dist_sq > cutoff_sq))
+				{
+					continue;
+				}
+				weight = root_data->l_val*kcr_kernel_weight(shape, sqrt(dist_sq), delta, no_dims);
+				norm = sqrt((double)(x_diff*x_diff + y_diff*y_diff + z_diff*z_diff));
+				entry[0] = weight*x_diff/norm;
+				entry[1] = weight*y_diff/norm;
+				if(no_dims == 3)
+				{
+					entry[2] = weight*z_diff/norm;
+				}
+			}
+		}
+	}
+
+EXIT_LABEL:
+	/* Return */
+	return(table);
+}
+
+/***************************************************************************************
+ * Name: kcr_kernel_tables_term()
+ *
+ * Purpose: Free the tables of the kernel, keeping room for new ones.
+ *
+ * Parameters: IN/OUT root_data - pointer to a CB containing all the root data for KCR.
+ *
+ * Returns: Nothing.
+ ***************************************************************************************/
+void kcr_kernel_tables_term(KCR_ROOT_DATA *root_data)
+{
+	/* Local variables */
+	unsigned long curr_table;
+
+	/* Sanity checks */
+	assert(root_data != NULL);
+
+	for(curr_table = 0; curr_table < root_data->no_kernel_tables; curr_table++)
+	{
+		free(root_data->kernel_tables[curr_table].weights);
+	}
+	root_data->no_kernel_tables = 0;
+
+	/* Return */
+	return;
+}
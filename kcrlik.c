@@ -0,0 +1,912 @@
+/***************************************************************************************
+ * Filename: kcrlik.c
+ *
+ * Description: Likelihood of an observed trajectory.  Given the positions of every
+ *              individual at successive time steps, the likelihood of the parameters
+ *              is the product, over steps and individuals, of the probability of the
+ *              move the individual made, worked out from the same weights as the
+ *              simulation moves it with.
+ *
+ *              Within a step individuals move in turn, each seeing the moves already
+ *              made by those before it, so a step is replayed in the same order:
+ *              the probability of each individual's move is worked out and then the
+ *              individual put where it was observed next.  Each step depends only on
+ *              the rows either side of it, so the steps are shared out among threads,
+ *              each with its own copy of the simulation to move.
+ *
+ *              The drifts are linear in the a_ij until they are clamped, so the
+ *              gradient of the log-likelihood with respect to the a_ij comes from the
+ *              same replay at the cost of one more pass over the neighbours of each
+ *              individual, and kcrfit.c fits the a_ij with it.
+ ***************************************************************************************/
+
+#include <kcr.h>
+
+/***************************************************************************************
+ * Name: kcr_read_trajectory()
+ *
+ * Purpose: Read an observed trajectory.
+ *
+ * Parameters: IN     traj_file - file containing one row per time step, each holding
+ *                                the coordinates of every individual in the order the
+ *                                simulation prints them
+ *             IN     root_data - pointer to a CB containing all the root data for KCR.
+ *             OUT    trajectory - the trajectory
+ *
+ * Returns: rc - KCR_RC_OK if ok or KCR_RC_ERROR if error.
+ ***************************************************************************************/
+unsigned short kcr_read_trajectory(FILE *traj_file, KCR_ROOT_DATA *root_data, KCR_TRAJECTORY *trajectory)
+{
+	/* Local variables */
+	KCR_PARSER parser;
+	unsigned int *new_positions;
+	unsigned long array_size = 0;
+	unsigned long no_values = 0;
+	unsigned long limit;
+	unsigned short no_coords;
+	double value;
+	unsigned short token;
+	unsigned short rc;
+
+	/* Sanity checks */
+	assert(traj_file != NULL);
+	assert(root_data != NULL);
+	assert(trajectory != NULL);
+
+	no_coords = KCR_NO_COORDS(root_data);
+	trajectory->no_rows = 0;
+	trajectory->no_values = no_coords*(unsigned long)root_data->no_pops*root_data->no_indivs;
+	trajectory->positions = NULL;
+	rc = kcr_parser_open_file(&parser, traj_file, "trajectory file");
+	if(rc != KCR_RC_OK)
+	{
+		goto EXIT_LABEL;
+	}
+
+	for(;;)
+	{
+		token = kcr_parser_next(&parser, &value);
+		if(token == KCR_TOKEN_NUMBER)
+		{
+			if(no_values == trajectory->no_values)
+			{
+				kcr_parser_error(&parser, "too many values");
+				rc = KCR_RC_ERROR;
+				break;
+			}
+			limit = (no_values % no_coords == 0) ? root_data->box_width :
+			        ((no_values % no_coords == 1) ? root_data->box_height : root_data->box_depth);
+			if(!(value >= 0) || (value >= limit) || (value != floor(value)))
+			{
+				kcr_parser_error(&parser, "position outside the box");
+				rc = KCR_RC_ERROR;
+				break;
+			}
+
+			/* Grow the array a row at a time as needed */
+			if(trajectory->no_rows == array_size)
+			{
+				array_size = KCR_MAX(16, 2*array_size);
+				new_positions = (unsigned int *)realloc(trajectory->positions,
+				                                        array_size*trajectory->no_values*sizeof(unsigned int));
+				if(new_positions == NULL)
+				{
+					fprintf(stderr,"MEMORY ALLOCATION FAILURE FOR TRAJECTORY\n");
+					rc = KCR_RC_ERROR;
+					break;
+				}
+				trajectory->positions = new_positions;
+			}
+			trajectory->positions[trajectory->no_rows*trajectory->no_values + no_values++] = (unsigned int)value;
+		}
+		else if(token == KCR_TOKEN_END_OF_ROW)
+		{
+			if(no_values != trajectory->no_values)
+			{
+				kcr_parser_error(&parser, "row does not hold the position of every individual");
+				rc = KCR_RC_ERROR;
+				break;
+			}
+			trajectory->no_rows++;
+			no_values = 0;
+		}
+		else if(token == KCR_TOKEN_END_OF_FILE)
+		{
+			break;
+		}
+		else
+		{
+			rc = KCR_RC_ERROR;
+			break;
+		}
+	}
+	kcr_parser_close(&parser);
+	if((rc == KCR_RC_OK) && (trajectory->no_rows < 2))
+	{
+		fprintf(stderr,"Error: a trajectory needs at least two time steps\n");
+		rc = KCR_RC_ERROR;
+	}
+
+EXIT_LABEL:
+	if(rc != KCR_RC_OK)
+	{
+		kcr_trajectory_term(trajectory);
+	}
+
+	/* Return */
+	return(rc);
+}
+
+/***************************************************************************************
+ * Name: kcr_trajectory_term()
+ *
+ * Purpose: Free a trajectory.
+ *
+ * Parameters: IN/OUT trajectory - the trajectory
+ *
+ * Returns: Nothing.
+ ***************************************************************************************/
+void kcr_trajectory_term(KCR_TRAJECTORY *trajectory)
+{
+	/* Sanity checks */
+	assert(trajectory != NULL);
+
+	if(trajectory->positions != NULL)
+	{
+		free(trajectory->positions);
+		trajectory->positions = NULL;
+	}
+	trajectory->no_rows = 0;
+
+	/* Return */
+	return;
+}
+
+/***************************************************************************************
+ * Name: kcr_trajectory_log_likelihood()
+ *
+ * Purpose: Work out the log-likelihood of the parameters of a simulation given an
+ *          observed trajectory, and optionally its gradient with respect to the a_ij.
+ *
+ * Parameters: IN     root_data - pointer to a CB containing all the root data for KCR.
+ *             IN     trajectory - the trajectory
+ *             OUT    log_lik - the log-likelihood (-HUGE_VAL if the trajectory makes
+ *                              a move the parameters cannot)
+ *             OUT    gradient - if not NULL, the derivative of the log-likelihood with
+ *                               respect to each a_ij, laid out as root_data->aijs
+ *
+ * Returns: rc - KCR_RC_OK if ok or KCR_RC_ERROR if error.
+ *
+ * Operation: Split the steps into at most KCR_LIKELIHOOD_BLOCKS blocks, share the
+ *            blocks out in contiguous runs among root_data->no_threads threads, each
+ *            moving its own copy of the simulation, and add up the blocks in order.
+ *            The blocks do not depend on the number of threads, so neither do the
+ *            results.
+ ***************************************************************************************/
+unsigned short kcr_trajectory_log_likelihood(KCR_ROOT_DATA *root_data,
+                                             const KCR_TRAJECTORY *trajectory,
+                                             double *log_lik,
+                                             double *gradient)
+{
+	/* Local variables */
+	KCR_LIKELIHOOD_CHUNK *chunks = NULL;
+	KCR_THREAD *threads = NULL;
+	double *block_log_liks = NULL;
+	double *block_gradients = NULL;
+	unsigned long no_params;
+	unsigned long no_blocks;
+	unsigned long no_open;
+	unsigned long curr_block;
+	unsigned long param;
+	unsigned short no_chunks;
+	unsigned short curr_chunk;
+	unsigned short rc = KCR_RC_ERROR;
+
+	/* Sanity checks */
+	assert(root_data != NULL);
+	assert(trajectory != NULL);
+	assert(trajectory->no_rows >= 2);
+	assert(log_lik != NULL);
+
+	no_params = (unsigned long)root_data->no_pops*root_data->no_pops;
+	no_blocks = KCR_MIN(trajectory->no_rows - 1, KCR_LIKELIHOOD_BLOCKS);
+	no_chunks = (unsigned short)KCR_MIN((unsigned long)KCR_MAX(root_data->no_threads, 1), no_blocks);
+	no_open = kcr_count_open_sites(root_data);
+	chunks = (KCR_LIKELIHOOD_CHUNK *)calloc(no_chunks, sizeof(KCR_LIKELIHOOD_CHUNK));
+	threads = (KCR_THREAD *)calloc(no_chunks, sizeof(KCR_THREAD));
+	block_log_liks = (double *)calloc(no_blocks, sizeof(double));
+	if(gradient != NULL)
+	{
+		block_gradients = (double *)calloc(no_blocks*no_params, sizeof(double));
+	}
+	if((chunks == NULL) || (threads == NULL) || (block_log_liks == NULL) ||
+	   ((gradient != NULL) && (block_gradients == NULL)))
+	{
+		fprintf(stderr,"MEMORY ALLOCATION FAILURE FOR LIKELIHOOD\n");
+		goto EXIT_LABEL;
+	}
+
+	for(curr_chunk = 0; curr_chunk < no_chunks; curr_chunk++)
+	{
+		chunks[curr_chunk].root_data = kcr_likelihood_copy(root_data);
+		if(chunks[curr_chunk].root_data == NULL)
+		{
+			goto EXIT_LABEL;
+		}
+		if(gradient != NULL)
+		{
+			chunks[curr_chunk].terms = (double *)malloc(3*root_data->no_pops*sizeof(double));
+			if(chunks[curr_chunk].terms == NULL)
+			{
+				fprintf(stderr,"MEMORY ALLOCATION FAILURE FOR LIKELIHOOD\n");
+				goto EXIT_LABEL;
+			}
+		}
+		chunks[curr_chunk].trajectory = trajectory;
+		chunks[curr_chunk].no_open = no_open;
+		chunks[curr_chunk].no_blocks = no_blocks;
+		chunks[curr_chunk].first_block = no_blocks*curr_chunk/no_chunks;
+		chunks[curr_chunk].last_block = no_blocks*(curr_chunk + 1)/no_chunks;
+		chunks[curr_chunk].block_log_liks = block_log_liks;
+		chunks[curr_chunk].block_gradients = block_gradients;
+	}
+	for(curr_chunk = 0; curr_chunk < no_chunks; curr_chunk++)
+	{
+		if((curr_chunk == no_chunks - 1) ||
+		   (kcr_thread_create(&threads[curr_chunk], kcr_likelihood_chunk, &chunks[curr_chunk]) != KCR_RC_OK))
+		{
+			/* The last chunk, or no thread: do the work here instead */
+			threads[curr_chunk].function = NULL;
+			kcr_likelihood_chunk(&chunks[curr_chunk]);
+		}
+	}
+	for(curr_chunk = 0; curr_chunk < no_chunks; curr_chunk++)
+	{
+		if(threads[curr_chunk].function != NULL)
+		{
+			kcr_thread_join(&threads[curr_chunk]);
+		}
+	}
+
+	*log_lik = 0;
+	if(gradient != NULL)
+	{
+		memset(gradient, 0, no_params*sizeof(double));
+	}
+	for(curr_block = 0; curr_block < no_blocks; curr_block++)
+	{
+		*log_lik += block_log_liks[curr_block];
+		for(param = 0; (gradient != NULL) && (param < no_params); param++)
+		{
+			gradient[param] += block_gradients[curr_block*no_params + param];
+		}
+	}
+	rc = KCR_RC_OK;
+
+EXIT_LABEL:
+	if(chunks != NULL)
+	{
+		for(curr_chunk = 0; curr_chunk < no_chunks; curr_chunk++)
+		{
+			if(chunks[curr_chunk].root_data != NULL)
+			{
+				kcr_likelihood_copy_term(chunks[curr_chunk].root_data);
+			}
+			if(chunks[curr_chunk].terms != NULL)
+			{
+				free(chunks[curr_chunk].terms);
+			}
+		}
+		free(chunks);
+	}
+	if(threads != NULL)
+	{
+		free(threads);
+	}
+	if(block_log_liks != NULL)
+	{
+		free(block_log_liks);
+	}
+	if(block_gradients != NULL)
+	{
+		free(block_gradients);
+	}
+
+	/* Return */
+	return(rc);
+}
+
+/***************************************************************************************
+ * Name: kcr_likelihood_copy()
+ *
+ * Purpose: Make a copy of a simulation, for a thread working out likelihoods to move
+ *          the individuals of.
+ *
+ * Parameters: IN     root_data - pointer to a CB containing all the root data for KCR.
+ *
+ * Returns: The copy, or NULL if error.
+ *
+ * Operation: As kcr_coarse_equilibrate() does, set up a simulation with the same
+ *            parameters; it lists its populations and individuals in the same order.
+ *            The gradients of the environment and the habitat mask are only read
+ *            while moving, so the copy borrows them rather than setting them up
+ *            again, and kcr_likelihood_copy_term() hands them back.  If the kernel is
+ *            tabulated, the tables of pairs of populations that do not interact are
+ *            built as well, for kcr_interaction_terms().
+ ***************************************************************************************/
+KCR_ROOT_DATA *kcr_likelihood_copy(KCR_ROOT_DATA *root_data)
+{
+	/* Local variables */
+	KCR_ROOT_DATA *copy;
+	unsigned long no_params;
+	unsigned long param;
+	unsigned short rc;
+
+	/* Sanity checks */
+	assert(root_data != NULL);
+
+	copy = kcr_init(root_data->no_indivs,
+	                root_data->no_pops,
+	                root_data->total_time,
+	                root_data->start_measure_time,
+	                NULL,
+	                root_data->box_width,
+	                root_data->box_height,
+	                NULL,
+	                root_data->l_val,
+	                NULL,
+	                0,
+	                root_data->packing_term,
+	                root_data->kappa,
+	                root_data->x_axis.boundary,
+	                root_data->y_axis.boundary,
+	                1);
+	if(copy == NULL)
+	{
+		goto EXIT_LABEL;
+	}
+	no_params = (unsigned long)root_data->no_pops*root_data->no_pops;
+	memcpy(copy->aijs, root_data->aijs, no_params*sizeof(double));
+	memcpy(copy->deltas, root_data->deltas, no_params*sizeof(double));
+	copy->kernel_shape = root_data->kernel_shape;
+	if(root_data->box_depth > 1)
+	{
+		rc = kcr_setup_3d(copy, root_data->box_depth, root_data->z_axis.boundary);
+	}
+	else
+	{
+		rc = kcr_setup_interactions(copy);
+	}
+	for(param = 0; (rc == KCR_RC_OK) && (param < no_params); param++)
+	{
+		if(((copy->kernel_shape != KCR_KERNEL_DIRECT) || (copy->box_depth > 1)) &&
+		   ((copy->box_height == 1) ? (copy->deltas[param] > 0) : (copy->deltas[param] != 0)) &&
+		   (kcr_kernel_table(copy, copy->deltas[param]) == NULL))
+		{
+			rc = KCR_RC_ERROR;
+		}
+	}
+	if(rc != KCR_RC_OK)
+	{
+		kcr_term(copy);
+		copy = NULL;
+		goto EXIT_LABEL;
+	}
+	copy->env_weight = root_data->env_weight;
+	copy->env_active = root_data->env_active;
+	copy->env_grad_x = root_data->env_grad_x;
+	copy->env_grad_y = root_data->env_grad_y;
+	copy->habitat_mask = root_data->habitat_mask;
+
+EXIT_LABEL:
+	/* Return */
+	return(copy);
+}
+
+/***************************************************************************************
+ * Name: kcr_likelihood_copy_term()
+ *
+ * Purpose: Free a copy made by kcr_likelihood_copy().
+ *
+ * Parameters: IN     copy - the copy
+ *
+ * Returns: Nothing.
+ ***************************************************************************************/
+void kcr_likelihood_copy_term(KCR_ROOT_DATA *copy)
+{
+	/* Sanity checks */
+	assert(copy != NULL);
+
+	/* Hand back what was borrowed */
+	copy->env_active = KCR_NO;
+	copy->env_grad_x = NULL;
+	copy->env_grad_y = NULL;
+	copy->habitat_mask = NULL;
+	kcr_term(copy);
+
+	/* Return */
+	return;
+}
+
+/***************************************************************************************
+ * Name: kcr_likelihood_chunk()
+ *
+ * Purpose: Work out the log-likelihoods, and gradients if wanted, of a run of blocks of
+ *          steps.  Run in a thread of its own.
+ *
+ * Parameters: IN/OUT arg - the KCR_LIKELIHOOD_CHUNK
+ *
+ * Returns: Nothing.
+ ***************************************************************************************/
+void kcr_likelihood_chunk(void *arg)
+{
+	/* Local variables */
+	KCR_LIKELIHOOD_CHUNK *chunk = (KCR_LIKELIHOOD_CHUNK *)arg;
+	const KCR_TRAJECTORY *trajectory;
+	double *gradient = NULL;
+	unsigned long no_steps;
+	unsigned long no_params;
+	unsigned long curr_block;
+	unsigned long curr_step;
+
+	/* Sanity checks */
+	assert(chunk != NULL);
+
+	trajectory = chunk->trajectory;
+	no_steps = trajectory->no_rows - 1;
+	no_params = (unsigned long)chunk->root_data->no_pops*chunk->root_data->no_pops;
+	for(curr_block = chunk->first_block; curr_block < chunk->last_block; curr_block++)
+	{
+		if(chunk->block_gradients != NULL)
+		{
+			gradient = chunk->block_gradients + curr_block*no_params;
+		}
+		for(curr_step = no_steps*curr_block/chunk->no_blocks;
+		    curr_step < no_steps*(curr_block + 1)/chunk->no_blocks;
+		    curr_step++)
+		{
+			chunk->block_log_liks[curr_block] +=
+				kcr_step_log_likelihood(chunk->root_data,
+				                        trajectory->positions + curr_step*trajectory->no_values,
+				                        trajectory->positions + (curr_step + 1)*trajectory->no_values,
+				                        chunk->no_open,
+				                        gradient,
+				                        chunk->terms);
+		}
+	}
+
+	/* Return */
+	return;
+}
+
+/***************************************************************************************
+ * Name: kcr_count_open_sites()
+ *
+ * Purpose: Count the sites an individual replacing one that stepped off an absorbing
+ *          edge can be placed on.
+ *
+ * Parameters: IN     root_data - pointer to a CB containing all the root data for KCR.
+ *
+ * Returns: The number of sites not blocked by the habitat mask.
+ ***************************************************************************************/
+unsigned long kcr_count_open_sites(KCR_ROOT_DATA *root_data)
+{
+	/* Local variables */
+	unsigned long x_val;
+	unsigned long y_val;
+	unsigned long no_open;
+
+	/* Sanity checks */
+	assert(root_data != NULL);
+
+	if(root_data->habitat_mask == NULL)
+	{
+		no_open = root_data->box_width*root_data->box_height*root_data->box_depth;
+		goto EXIT_LABEL;
+	}
+	no_open = 0;
+	for(y_val = 0; y_val < root_data->box_height; y_val++)
+	{
+		for(x_val = 0; x_val < root_data->box_width; x_val++)
+		{
+			if(!KCR_MASK_BLOCKED(root_data->habitat_mask, KCR_GRID_INDEX(&root_data->grid, x_val, y_val)))
+			{
+				no_open++;
+			}
+		}
+	}
+
+EXIT_LABEL:
+	/* Return */
+	return(no_open);
+}
+
+/***************************************************************************************
+ * Name: kcr_step_log_likelihood()
+ *
+ * Purpose: Work out the log-likelihood of one step of a trajectory.
+ *
+ * Parameters: IN/OUT root_data - pointer to a CB containing all the root data for KCR,
+ *                                whose individuals are moved
+ *             IN     row - positions at the start of the step
+ *             IN     next_row - positions at the end of the step
+ *             IN     no_open - number of sites a replacement individual can be placed on
+ *             IN/OUT gradient - if not NULL, the derivatives with respect to the a_ij,
+ *                               added to
+ *             OUT    terms - if gradient is not NULL, room for 3*no_pops values
+ *
+ * Returns: The log-likelihood.
+ *
+ * Operation: Put every individual where row has it, then replay the step: in the
+ *            order the simulation moves them, add the log of the probability of each
+ *            individual's move and put it where next_row has it.
+ *
+ *            The drift on an individual of population i is linear in a_ij, with
+ *            coefficient the drift population j would give it with a_ij = 1 (from
+ *            kcr_interaction_terms()) scaled by the packing term, until the drift is
+ *            clamped at +/-1, beyond which it no longer depends on a_ij.  So the
+ *            derivative of the log-probability with respect to a_ij is its derivative
+ *            with respect to each drift the move is not clamped in, times that
+ *            coefficient.
+ ***************************************************************************************/
+double kcr_step_log_likelihood(KCR_ROOT_DATA *root_data,
+                               const unsigned int *row,
+                               const unsigned int *next_row,
+                               unsigned long no_open,
+                               double *gradient,
+                               double *terms)
+{
+	/* Local variables */
+	KCR_POPULATION *curr_pop_cb;
+	KCR_INDIVIDUAL *curr_indiv_cb;
+	double dlogp_ds[3];
+	double log_prob;
+	double popsum;
+	double scale;
+	unsigned short no_coords;
+	unsigned short source;
+	double log_lik = 0;
+
+	/* Sanity checks */
+	assert(root_data != NULL);
+	assert(row != NULL);
+	assert(next_row != NULL);
+	assert((gradient == NULL) || (terms != NULL));
+
+	no_coords = KCR_NO_COORDS(root_data);
+	curr_pop_cb = (KCR_POPULATION *)LIST_GET_FIRST(root_data->population_list_root);
+	while(curr_pop_cb != NULL)
+	{
+		curr_indiv_cb = (KCR_INDIVIDUAL *)LIST_GET_FIRST(curr_pop_cb->individual_list_root);
+		while(curr_indiv_cb != NULL)
+		{
+			curr_indiv_cb->current_x_pos = row[0];
+			curr_indiv_cb->current_y_pos = row[1];
+			if(no_coords == 3)
+			{
+				curr_indiv_cb->current_z_pos = row[2];
+			}
+			row += no_coords;
+			curr_indiv_cb = (KCR_INDIVIDUAL *)LIST_GET_NEXT(curr_indiv_cb->list_elt);
+		}
+		curr_pop_cb = (KCR_POPULATION *)LIST_GET_NEXT(curr_pop_cb->list_elt);
+	}
+
+	/* The moves */
+	curr_pop_cb = (KCR_POPULATION *)LIST_GET_FIRST(root_data->population_list_root);
+	while(curr_pop_cb != NULL)
+	{
+		curr_indiv_cb = (KCR_INDIVIDUAL *)LIST_GET_FIRST(curr_pop_cb->individual_list_root);
+		while(curr_indiv_cb != NULL)
+		{
+			log_prob = log(kcr_move_probability(curr_indiv_cb, curr_pop_cb, root_data, next_row, no_open,
+			                                    (gradient != NULL) ? dlogp_ds : NULL));
+			log_lik += log_prob;
+			if((gradient != NULL) && (log_prob > -HUGE_VAL) &&
+			   ((dlogp_ds[0] != 0) || (dlogp_ds[1] != 0) || (dlogp_ds[2] != 0)))
+			{
+				popsum = 0;
+				kcr_interaction_terms(curr_indiv_cb, curr_pop_cb, root_data, terms, &popsum);
+				scale = ((root_data->packing_term == 1) && (root_data->box_height > 1)) ?
+				        1/(1+root_data->kappa*popsum) : 1;
+				for(source = 0; source < root_data->no_pops; source++)
+				{
+					gradient[source + (unsigned long)curr_pop_cb->index*root_data->no_pops] +=
+						scale*(dlogp_ds[0]*terms[3*source] + dlogp_ds[1]*terms[3*source+1] +
+						       dlogp_ds[2]*terms[3*source+2]);
+				}
+			}
+			curr_indiv_cb->current_x_pos = next_row[0];
+			curr_indiv_cb->current_y_pos = next_row[1];
+			if(no_coords == 3)
+			{
+				curr_indiv_cb->current_z_pos = next_row[2];
+			}
+			next_row += no_coords;
+			curr_indiv_cb = (KCR_INDIVIDUAL *)LIST_GET_NEXT(curr_indiv_cb->list_elt);
+		}
+		curr_pop_cb = (KCR_POPULATION *)LIST_GET_NEXT(curr_pop_cb->list_elt);
+	}
+
+	/* Return */
+	return(log_lik);
+}
+
+/***************************************************************************************
+ * Name: kcr_move_probability()
+ *
+ * Purpose: Get the probability of an individual moving to a site.
+ *
+ * Parameters: IN     individual - the individual
+ *             IN     population - pointer to the population CB containing this individual
+ *             IN     root_data - pointer to a CB containing all the root data for KCR.
+ *             IN     next - coordinates of the site
+ *             IN     no_open - number of sites a replacement individual can be placed on
+ *             OUT    dlogp_ds - if not NULL, the derivative of the log of the
+ *                               probability with respect to the drift in x, y and z
+ *                               (zero where the drift is clamped)
+ *
+ * Returns: The probability.
+ *
+ * Operation: Weigh the moves as kcr_move_individual(), kcr_move_individual1d() or
+ *            kcr_move_individual3d() does.  The moves are down and up the y-axis,
+ *            then down and up the x-axis, then down and up the z-axis, or only along
+ *            the x-axis in one dimension.  A move off an absorbing edge replaces the
+ *            individual by one placed on any open site with equal probability.  If
+ *            every weight is zero the simulation makes the last move, unless there is
+ *            a habitat mask, when the individual stays put.
+ *
+ *            The probability is a sum of weights over the sum of all the weights, and
+ *            a move down or up an axis is weighted in proportion to 1 -/+ the drift
+ *            along it, which gives the derivatives.
+ ***************************************************************************************/
+double kcr_move_probability(KCR_INDIVIDUAL *individual,
+                            KCR_POPULATION *population,
+                            KCR_ROOT_DATA *root_data,
+                            const unsigned int *next,
+                            unsigned long no_open,
+                            double *dlogp_ds)
+{
+	/* Local variables */
+	KCR_AXIS *axes[3];
+	unsigned long pos[3];
+	unsigned long dest;
+	double weights[6];
+	double drifts[3];
+	double d_matched[3];
+	double d_sum[3];
+	double sum = 0;
+	double matched = 0;
+	double share;
+	double d_weight;
+	double sign;
+	double prob = 0;
+	unsigned short no_moves;
+	unsigned short move;
+	unsigned short axis;
+	unsigned short next_open;
+	unsigned short fallback = KCR_NO;
+
+	/* Sanity checks */
+	assert(root_data != NULL);
+	assert(individual != NULL);
+	assert(population != NULL);
+	assert(next != NULL);
+
+	axes[0] = &root_data->x_axis;
+	axes[1] = &root_data->y_axis;
+	axes[2] = &root_data->z_axis;
+	pos[0] = individual->current_x_pos;
+	pos[1] = individual->current_y_pos;
+	pos[2] = individual->current_z_pos;
+	for(axis = 0; axis < 3; axis++)
+	{
+		drifts[axis] = 0;
+		d_matched[axis] = 0;
+		d_sum[axis] = 0;
+	}
+	if(root_data->box_height == 1)
+	{
+		kcr_move_weights1d(individual, population, root_data, weights, drifts);
+		no_moves = 2;
+	}
+	else if(root_data->box_depth > 1)
+	{
+		kcr_move_weights3d(individual, population, root_data, weights, drifts);
+		no_moves = 6;
+	}
+	else
+	{
+		kcr_move_weights(individual, population, root_data, weights, drifts);
+		no_moves = 4;
+	}
+	for(move = 0; move < no_moves; move++)
+	{
+		sum += weights[move];
+	}
+	if(sum == 0)
+	{
+		if(root_data->habitat_mask != NULL)
+		{
+			prob = ((next[0] == pos[0]) && (next[1] == pos[1])) ? 1 : 0;
+			goto EXIT_LABEL;
+		}
+		weights[no_moves - 1] = 1;
+		sum = 1;
+		fallback = KCR_YES;
+	}
+	next_open = (root_data->habitat_mask == NULL) ||
+	            !KCR_MASK_BLOCKED(root_data->habitat_mask, KCR_GRID_INDEX(&root_data->grid, next[0], next[1]));
+
+	for(move = 0; move < no_moves; move++)
+	{
+		if(weights[move] == 0)
+		{
+			continue;
+		}
+		axis = (no_moves == 2) ? 0 : ((move < 2) ? 1 : ((move < 4) ? 0 : 2));
+		dest = (move & 1) ? axes[axis]->hi_dest[pos[axis]] : axes[axis]->lo_dest[pos[axis]];
+		share = 0;
+		if(dest == KCR_OUTSIDE)
+		{
+			/* Replaced by an individual placed anywhere open */
+			share = next_open ? 1.0/no_open : 0;
+		}
+		else if((dest == next[axis]) && ((axis == 0) || (next[0] == pos[0])) &&
+		        ((axis == 1) || (next[1] == pos[1])) && ((axis == 2) || (no_moves < 6) || (next[2] == pos[2])))
+		{
+			share = 1;
+		}
+		matched += share*weights[move];
+		if(fabs(drifts[axis]) < 1)
+		{
+			sign = (move & 1) ? 1 : -1;
+			d_weight = sign*weights[move]/(1 + sign*drifts[axis]);
+			d_matched[axis] += share*d_weight;
+			d_sum[axis] += d_weight;
+		}
+	}
+	prob = matched/sum;
+
+EXIT_LABEL:
+	if(dlogp_ds != NULL)
+	{
+		for(axis = 0; axis < 3; axis++)
+		{
+			dlogp_ds[axis] = ((prob > 0) && (fallback == KCR_NO) && (sum > 0)) ?
+			                 d_matched[axis]/matched - d_sum[axis]/sum : 0;
+		}
+	}
+
+	/* Return */
+	return(prob);
+}
+
+/***************************************************************************************
+ * Name: kcr_interaction_terms()
+ *
+ * Purpose: Get the drift every population would give an individual with a_ij = 1.
+ *
+ * Parameters: IN     individual - the individual
+ *             IN     population - pointer to the population CB containing this individual
+ *             IN     root_data - pointer to a CB containing all the root data for KCR,
+ *                                set up by kcr_likelihood_copy()
+ *             OUT    terms - the drift in x, y and z from each population, by index
+ *             IN/OUT popsum - density at the individual's site, added to
+ *
+ * Returns: Nothing.
+ *
+ * Operation: As the kernel the simulation uses, tabulated or worked out directly, but
+ *            over every population whose delta is in range, whether or not its a_ij
+ *            is zero, and without multiplying by a_ij.
+ ***************************************************************************************/
+void kcr_interaction_terms(KCR_INDIVIDUAL *individual,
+                           KCR_POPULATION *population,
+                           KCR_ROOT_DATA *root_data,
+                           double *terms,
+                           double *popsum)
+{
+	/* Local variables */
+	KCR_POPULATION *source_cb;
+	KCR_KERNEL_TABLE *table;
+	LIST_ELT *curr_elt;
+	KCR_INDIVIDUAL *curr_indiv_cb;
+	const long x_pos = (long)individual->current_x_pos;
+	const long y_pos = (long)individual->current_y_pos;
+	const long z_pos = (long)individual->current_z_pos;
+	const double l_val = root_data->l_val;
+	const unsigned short no_coords = KCR_NO_COORDS(root_data);
+	const double site_density = 1/pow(l_val,no_coords);
+	const double *weight;
+	double *term;
+	double delta;
+	double coeff = 0;
+	double dist;
+	double dist_sq;
+	double norm;
+	long x_diff;
+	long y_diff;
+	long z_diff;
+	unsigned short in_range;
+	unsigned short tabulated;
+
+	/* Sanity checks */
+	assert(root_data != NULL);
+	assert(terms != NULL);
+	assert(popsum != NULL);
+
+	memset(terms, 0, 3*root_data->no_pops*sizeof(double));
+	tabulated = ((root_data->kernel_shape != KCR_KERNEL_DIRECT) || (root_data->box_depth > 1)) ? KCR_YES : KCR_NO;
+	source_cb = (KCR_POPULATION *)LIST_GET_FIRST(root_data->population_list_root);
+	while(source_cb != NULL)
+	{
+		delta = root_data->deltas[source_cb->index + (unsigned long)population->index*root_data->no_pops];
+		in_range = ((root_data->box_height == 1) ? (delta > 0) : (delta != 0)) ? KCR_YES : KCR_NO;
+		table = NULL;
+		if((in_range == KCR_YES) && (tabulated == KCR_YES))
+		{
+			table = kcr_kernel_table(root_data, delta);
+			assert(table != NULL);
+		}
+		else if(in_range == KCR_YES)
+		{
+			coeff = (root_data->box_height == 1) ? l_val/(4*delta) : l_val*(1/(2*KCR_PI*pow(delta,2)));
+		}
+		term = terms + 3*source_cb->index;
+		for(curr_elt = source_cb->individual_list_root; curr_elt != NULL; curr_elt = curr_elt->next)
+		{
+			curr_indiv_cb = (KCR_INDIVIDUAL *)curr_elt->data;
+			x_diff = root_data->x_axis.diffs[(long)curr_indiv_cb->current_x_pos - x_pos];
+			y_diff = root_data->y_axis.diffs[(long)curr_indiv_cb->current_y_pos - y_pos];
+			z_diff = (no_coords == 3) ? root_data->z_axis.diffs[(long)curr_indiv_cb->current_z_pos - z_pos] : 0;
+			if(table != NULL)
+			{
+				if((labs(x_diff) <= table->x_radius) && (labs(y_diff) <= table->y_radius) &&
+				   (labs(z_diff) <= table->z_radius))
+				{
+					weight = table->weights +
+					         ((no_coords == 3) ? 3 : 2)*(((z_diff + table->z_radius)*(2*table->y_radius + 1) +
+					                                      y_diff + table->y_radius)*(2*table->x_radius + 1) +
+					                                     x_diff + table->x_radius);
+					term[0] += weight[0];
+					term[1] += weight[1];
+					if(no_coords == 3)
+					{
+						term[2] += weight[2];
+					}
+				}
+			}
+			else if((in_range == KCR_YES) && (root_data->box_height == 1))
+			{
+				dist = x_diff*l_val;
+				if((dist <= delta) && (dist > 0))
+				{
+					term[0] += coeff;
+				}
+				else if((dist >= -delta) && (dist < 0))
+				{
+					term[0] -= coeff;
+				}
+			}
+			else if(in_range == KCR_YES)
+			{
+				dist_sq = (x_diff*l_val)*(x_diff*l_val) + (y_diff*l_val)*(y_diff*l_val);
+				if((dist_sq <= pow(delta,2)) && (dist_sq > 0))
+				{
+					norm = sqrt((double)(x_diff*x_diff + y_diff*y_diff));
+					term[0] += coeff*x_diff/norm;
+					term[1] += coeff*y_diff/norm;
+				}
+			}
+			if((x_diff == 0) && (y_diff == 0) && (z_diff == 0))
+			{
+				/* Individuals are in the same place */
+				*popsum += site_density;
+			}
+		}
+		source_cb = (KCR_POPULATION *)LIST_GET_NEXT(source_cb->list_elt);
+	}
+
+	/* Return */
+	return;
+}
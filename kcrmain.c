@@ -23,6 +23,7 @@ int main(int argc, char** argv)
     unsigned short no_pops;
     unsigned long box_width;
     unsigned long box_height;
+    unsigned long box_depth;
     KCR_ROOT_DATA *root_data;
 	KCR_INDIVIDUAL *curr_indiv_cb;
 	KCR_POPULATION *curr_pop_cb;
@@ -37,10 +38,49 @@ int main(int argc, char** argv)
     time_t current_time;
     char *c_time_string;
     FILE *env_file;
+    FILE *frame_file;
     double env_weight;
     FILE *mark_resp_file;
+    double mark_decay_rate;
+    double mark_deposit;
+    FILE *rate_file;
+    unsigned short rate_mode;
+    FILE *mask_file;
+    double mask_threshold;
+    unsigned short mask_active;
+    unsigned long mf_steps;
+    FILE *mf_file;
+    unsigned short mf_warm_start;
+    unsigned long coarse_factor;
+    unsigned long coarse_time;
+    unsigned short boundary[3];
+    unsigned short axis;
     unsigned short packing_term;
     double kappa;
+    unsigned short kernel_shape;
+    FILE *env_cvt_file;
+    unsigned short env_cvt_type;
+    unsigned short no_threads;
+    unsigned short end_file_binary;
+    char *checkpoint_name;
+    unsigned long checkpoint_interval;
+    FILE *restart_file;
+    unsigned short total_time_set;
+    FILE *branch_file;
+    char *branch_prefix;
+    char *cache_dir;
+    unsigned long cache_size;
+    FILE *traj_file;
+    KCR_TRAJECTORY trajectory;
+    double log_lik;
+    double *gradient;
+    unsigned short print_gradient;
+    unsigned long fit_iters;
+    FILE *abc_prior_file;
+    unsigned long abc_particles;
+    unsigned short abc_generations;
+    double abc_quantile;
+    unsigned short rc;
  
     /* If no arguments then print usage statement */
 	if(argc == 1)
@@ -52,15 +92,54 @@ int main(int argc, char** argv)
 		printf("               [-af <aij-file>]\n");
 		printf("               [-bw <box-width> (default = 100)]\n");
 		printf("               [-bh <box-height> (default = 100)]\n");
+		printf("               [-bd <box-depth> (default = 1: two-dimensional)]\n");
 		printf("               [-df <delta-file>]\n");
+		printf("               [-ks <kernel-shape: tophat, gaussian, exponential or linear> (default = top-hat worked out directly)]\n");
 		printf("               [-l <lattice spacing> (default = 0.1)]\n");
+		printf("               [-bdx <x-boundary: reflecting, periodic or absorbing> (default = %s)]\n",
+		       (KCR_BOUNDARY_DEFAULT == KCR_BOUNDARY_PERIODIC) ? "periodic" : "reflecting");
+		printf("               [-bdy <y-boundary: reflecting, periodic or absorbing> (default = %s)]\n",
+		       (KCR_BOUNDARY_DEFAULT == KCR_BOUNDARY_PERIODIC) ? "periodic" : "reflecting");
+		printf("               [-bdz <z-boundary: reflecting, periodic or absorbing> (default = %s)]\n",
+		       (KCR_BOUNDARY_DEFAULT == KCR_BOUNDARY_PERIODIC) ? "periodic" : "reflecting");
 		printf("               [-r <random seed> (default = 0)]\n");
 		printf("               [-ew <environment-weighting> (default = 0)]\n");
 		printf("               [-sf <start-file> (default = NULL)]\n");
 		printf("               [-ef <end-file> (default = NULL)]\n");
+		printf("               [-eft <end-file-type: txt or bin> (default = txt)]\n");
 		printf("               [-edf <environmental-data-file> (default = NULL)]\n");
+		printf("               [-eff <environmental-frame-list> (default = NULL)]\n");
+		printf("               [-mrf <mark-response-file> (default = NULL: no marks)]\n");
+		printf("               [-mdr <mark-decay-rate> (default = 0.01)]\n");
+		printf("               [-mdp <mark-deposit> (default = 1)]\n");
+		printf("               [-rtf <move-rate-file: per-population move rates> (default = NULL)]\n");
+		printf("               [-rtm <move-rate-mode: events or steps> (default = events)]\n");
+		printf("               [-hmf <habitat-mask-file> (default = NULL: no mask)]\n");
+		printf("               [-hmt <habitat-mask-threshold> (default = %g)]\n", KCR_MASK_DEFAULT_THRESHOLD);
+		printf("               [-mfs <mean-field-time-steps> (default = 0: no mean field)]\n");
+		printf("               [-mfo <mean-field-output-file> (default = NULL)]\n");
+		printf("               [-mfw <mean-field-warm-start: yes or no> (default = no)]\n");
+		printf("               [-cgf <coarse-lattice-factor> (default = 1: no coarse lattice)]\n");
+		printf("               [-cgt <time-to-run-on-coarse-lattice> (default = 0)]\n");
 		printf("               [-pck <packing-term> (default = 0)]\n");
 		printf("               [-kap <kappa> (default = 1)]\n");
+		printf("               [-cpf <checkpoint-file> (default = NULL)]\n");
+		printf("               [-cpi <checkpoint-interval> (default = 0: only on SIGTERM)]\n");
+		printf("               [-rf <restart-checkpoint-file> (default = NULL)]\n");
+		printf("               [-bf <branch-file> (default = NULL)]\n");
+		printf("               [-bo <branch-output-prefix> (default = branch)]\n");
+		printf("               [-bcd <burn-in-cache-directory> (default = NULL)]\n");
+		printf("               [-bcs <burn-in-cache-size-in-MB> (default = 1024)]\n");
+		printf("               [-nt <number-of-threads> (default = 0: one per processor)]\n");
+		printf("               [-ecf <converted-environmental-data-file> (default = NULL)]\n");
+		printf("               [-ect <converted-type: f32, f16 or u8> (default = f32)]\n");
+		printf("               [-ltf <trajectory-file: print the log-likelihood of the parameters> (default = NULL)]\n");
+		printf("               [-ltg <print-log-likelihood-gradient: yes or no> (default = no)]\n");
+		printf("               [-lfi <a_ij-fitting-iterations> (default = 0: no fitting)]\n");
+		printf("               [-abp <abc-prior-file: ABC-SMC of the a_ij given the -ltf trajectory> (default = NULL)]\n");
+		printf("               [-abn <abc-particles-per-generation> (default = 100)]\n");
+		printf("               [-abg <abc-generations> (default = 5)]\n");
+		printf("               [-abq <abc-tolerance-quantile> (default = 0.5)]\n");
 		goto EXIT_LABEL;
 	}
 	
@@ -72,14 +151,53 @@ int main(int argc, char** argv)
     start_measure_time = 0;
     box_width = 50;
     box_height = 50;
+    box_depth = 1;
 	rseed = 0;
 	env_weight = 0;
 	l_val = 0.1;
 	start_file = NULL;
 	end_file = NULL;
 	env_file = NULL;
+	frame_file = NULL;
     mark_resp_file = NULL;
+    mark_decay_rate = KCR_MARK_DEFAULT_DECAY;
+    mark_deposit = KCR_MARK_DEFAULT_DEPOSIT;
+    rate_file = NULL;
+    rate_mode = KCR_NO;
+    mask_file = NULL;
+    mask_threshold = KCR_MASK_DEFAULT_THRESHOLD;
+    mask_active = KCR_NO;
+    mf_steps = 0;
+    mf_file = NULL;
+    mf_warm_start = KCR_NO;
+    coarse_factor = 1;
+    coarse_time = 0;
+    boundary[0] = KCR_BOUNDARY_DEFAULT;
+    boundary[1] = KCR_BOUNDARY_DEFAULT;
+    boundary[2] = KCR_BOUNDARY_DEFAULT;
     kappa = 1;
+    env_cvt_file = NULL;
+    env_cvt_type = KCR_ENV_TYPE_FLOAT32;
+    no_threads = 0;
+    end_file_binary = KCR_NO;
+    checkpoint_name = NULL;
+    checkpoint_interval = 0;
+    restart_file = NULL;
+    total_time_set = KCR_NO;
+    branch_file = NULL;
+    branch_prefix = "branch";
+    cache_dir = NULL;
+    cache_size = KCR_CACHE_DEFAULT_SIZE;
+    traj_file = NULL;
+    print_gradient = KCR_NO;
+    fit_iters = 0;
+    abc_prior_file = NULL;
+    abc_particles = 100;
+    abc_generations = 5;
+    abc_quantile = 0.5;
+    delta_file = NULL;
+    packing_term = 0;
+    kernel_shape = KCR_KERNEL_DIRECT;
 	
 	/* Process arguments */
     for(curr_arg = 1; curr_arg < argc; curr_arg++)
@@ -98,6 +216,7 @@ int main(int argc, char** argv)
         {
             /* Total time */
         	total_time = atof(argv[++curr_arg]);
+        	total_time_set = KCR_YES;
         }
         else if(!strcmp(argv[curr_arg], "-smt"))
         {
@@ -114,18 +233,113 @@ int main(int argc, char** argv)
         {
             /* File containing start locations.  Contains one row of the form: 
 			 *   x_00 y_00 x_01 y_01 ... x_0N y_0N x_10 y_10 x_11 y_11 ... x_1N y_1N ... ... x_n0 y_n0 x_n1 y_n1 ... x_nN y_nN
-             * where n is the number of populations and N the number of individuals per population */
-        	start_file = fopen(argv[++curr_arg],"r");
+             * where n is the number of populations and N the number of individuals per population.
+             * Alternatively a binary state file, e.g. one written by -ef with -eft bin */
+        	start_file = fopen(argv[++curr_arg],"rb");
         }
         else if(!strcmp(argv[curr_arg], "-ef"))
         {
-            /* File for putting end locations in */
-        	end_file = fopen(argv[++curr_arg],"w");
+            /* File for putting end locations in (opened in binary mode so that a binary
+             * end file can be written; the text format only uses tabs and newlines) */
+        	end_file = fopen(argv[++curr_arg],"wb");
+        }
+        else if(!strcmp(argv[curr_arg], "-eft"))
+        {
+            /* End file type: txt (as the start file) or bin (binary state file) */
+        	end_file_binary = strcmp(argv[++curr_arg], "bin") ? KCR_NO : KCR_YES;
         }
         else if(!strcmp(argv[curr_arg], "-edf"))
         {
-            /* File containing environmental data */
-        	env_file = fopen(argv[++curr_arg],"r");
+            /* File containing environmental data: tab-separated text or binary raster */
+        	env_file = fopen(argv[++curr_arg],"rb");
+        }
+        else if(!strcmp(argv[curr_arg], "-eff"))
+        {
+            /* Time-varying environment: each line is "switch_time file", the file
+             * being in either format accepted by -edf */
+        	frame_file = fopen(argv[++curr_arg],"r");
+        }
+        else if(!strcmp(argv[curr_arg], "-mrf"))
+        {
+            /* Scent marks: matrix of each population's response to the gradient of each
+             * population's marks (positive is attraction) */
+        	mark_resp_file = fopen(argv[++curr_arg],"r");
+        }
+        else if(!strcmp(argv[curr_arg], "-mdr"))
+        {
+            /* Rate at which marks decay per time step */
+         	mark_decay_rate = atof(argv[++curr_arg]);
+        }
+        else if(!strcmp(argv[curr_arg], "-mdp"))
+        {
+            /* Amount of mark left at each site visited */
+         	mark_deposit = atof(argv[++curr_arg]);
+        }
+        else if(!strcmp(argv[curr_arg], "-rtf"))
+        {
+            /* Event-driven moves: each individual moves at random times, at the rate
+             * (moves per time step) given for its population in this file */
+        	rate_file = fopen(argv[++curr_arg],"r");
+        }
+        else if(!strcmp(argv[curr_arg], "-rtm"))
+        {
+            /* How the rates are used: as rates of event-driven moves, or as numbers of
+             * sweeps per time step, made in multirate time steps */
+            curr_arg++;
+            if(!strcmp(argv[curr_arg], "steps"))
+            {
+                rate_mode = KCR_YES;
+            }
+            else if(strcmp(argv[curr_arg], "events"))
+            {
+                fprintf(stderr,"Error: unrecognised move rate mode: %s\n", argv[curr_arg]);
+                goto EXIT_LABEL;
+            }
+        }
+        else if(!strcmp(argv[curr_arg], "-hmf"))
+        {
+            /* Habitat mask: cells whose value in this file (in either format accepted
+             * by -edf) is below the threshold cannot be entered */
+        	mask_file = fopen(argv[++curr_arg],"rb");
+        	if(mask_file == NULL)
+        	{
+        		fprintf(stderr,"Error: cannot open habitat mask file %s\n", argv[curr_arg]);
+        		goto EXIT_LABEL;
+        	}
+        	mask_active = KCR_YES;
+        }
+        else if(!strcmp(argv[curr_arg], "-hmt"))
+        {
+            /* Habitat mask threshold.  Without -hmf, the mask is taken from the
+             * environmental layer, which must then be weighted by -ew. */
+         	mask_threshold = atof(argv[++curr_arg]);
+        	mask_active = KCR_YES;
+        }
+        else if(!strcmp(argv[curr_arg], "-mfs"))
+        {
+            /* Integrate the mean-field equations for up to this many time steps (fewer
+             * if they reach a steady state) */
+         	mf_steps = atol(argv[++curr_arg]);
+        }
+        else if(!strcmp(argv[curr_arg], "-mfo"))
+        {
+            /* Write the mean-field densities to this file */
+        	mf_file = fopen(argv[++curr_arg],"w");
+        }
+        else if(!strcmp(argv[curr_arg], "-mfw"))
+        {
+            /* Warm start: draw the initial positions from the mean-field densities */
+        	mf_warm_start = strcmp(argv[++curr_arg], "yes") ? KCR_NO : KCR_YES;
+        }
+        else if(!strcmp(argv[curr_arg], "-cgf"))
+        {
+            /* Equilibrate first on a lattice this many times coarser */
+         	coarse_factor = atol(argv[++curr_arg]);
+        }
+        else if(!strcmp(argv[curr_arg], "-cgt"))
+        {
+            /* The coarse lattice stands in for the time steps up to this one */
+         	coarse_time = atol(argv[++curr_arg]);
         }
         else if(!strcmp(argv[curr_arg], "-bw"))
         {
@@ -137,6 +351,62 @@ int main(int argc, char** argv)
             /* Box height */ 
          	box_height = atol(argv[++curr_arg]);
         }
+        else if(!strcmp(argv[curr_arg], "-bd"))
+        {
+            /* Box depth: more than 1 for a three-dimensional box */
+         	box_depth = atol(argv[++curr_arg]);
+        }
+        else if(!strcmp(argv[curr_arg], "-bdx") || !strcmp(argv[curr_arg], "-bdy") ||
+                !strcmp(argv[curr_arg], "-bdz"))
+        {
+            /* Boundary condition of the x-, y- or z-axis, e.g. periodic in x and
+             * reflecting in y for a cylinder */
+            axis = argv[curr_arg][3] - 'x';
+            curr_arg++;
+            if(!strcmp(argv[curr_arg], "reflecting"))
+            {
+                boundary[axis] = KCR_BOUNDARY_REFLECTING;
+            }
+            else if(!strcmp(argv[curr_arg], "periodic"))
+            {
+                boundary[axis] = KCR_BOUNDARY_PERIODIC;
+            }
+            else if(!strcmp(argv[curr_arg], "absorbing"))
+            {
+                boundary[axis] = KCR_BOUNDARY_ABSORBING;
+            }
+            else
+            {
+                fprintf(stderr,"Error: unrecognised boundary condition: %s\n", argv[curr_arg]);
+                goto EXIT_LABEL;
+            }
+        }
+        else if(!strcmp(argv[curr_arg], "-ks"))
+        {
+            /* Shape of the interaction kernel, tabulated per lattice offset */
+            curr_arg++;
+            if(!strcmp(argv[curr_arg], "tophat"))
+            {
+                kernel_shape = KCR_KERNEL_TOP_HAT;
+            }
+            else if(!strcmp(argv[curr_arg], "gaussian"))
+            {
+                kernel_shape = KCR_KERNEL_GAUSSIAN;
+            }
+            else if(!strcmp(argv[curr_arg], "exponential"))
+            {
+                kernel_shape = KCR_KERNEL_EXPONENTIAL;
+            }
+            else if(!strcmp(argv[curr_arg], "linear"))
+            {
+                kernel_shape = KCR_KERNEL_LINEAR;
+            }
+            else
+            {
+                fprintf(stderr,"Error: unrecognised kernel shape: %s\n", argv[curr_arg]);
+                goto EXIT_LABEL;
+            }
+        }
         else if(!strcmp(argv[curr_arg], "-df"))
         {
             /* File storing delta parameter values (spatial averaging radius) */ 
@@ -167,6 +437,129 @@ int main(int argc, char** argv)
             /* Strength of packing constant */ 
          	kappa = atof(argv[++curr_arg]);
         }
+        else if(!strcmp(argv[curr_arg], "-cpf"))
+        {
+            /* File for checkpoints */
+        	checkpoint_name = argv[++curr_arg];
+        }
+        else if(!strcmp(argv[curr_arg], "-cpi"))
+        {
+            /* Time steps between checkpoints */
+        	checkpoint_interval = atol(argv[++curr_arg]);
+        }
+        else if(!strcmp(argv[curr_arg], "-rf"))
+        {
+            /* Checkpoint to restart from.  Replaces -i, -p, -smt, -af, -bw, -bh, -df, -ks,
+             * -l, -ew, -pck, -kap, -bdx, -bdy, -r, -sf, -mrf, -mdr, -mdp and -rtf; -edf must
+             * name the same environment, and -hmf and -hmt the same habitat mask. */
+        	restart_file = fopen(argv[++curr_arg],"rb");
+        }
+        else if(!strcmp(argv[curr_arg], "-bf"))
+        {
+            /* Branch mode: continue the starting state (usually a checkpoint given by -rf)
+             * once for each row of this file.  Each row is: seed total_time [a_ij ...] */
+        	branch_file = fopen(argv[++curr_arg],"rb");
+        }
+        else if(!strcmp(argv[curr_arg], "-bo"))
+        {
+            /* Branch n prints to <prefix>.n.out and leaves its end state in <prefix>.n.end */
+        	branch_prefix = argv[++curr_arg];
+        }
+        else if(!strcmp(argv[curr_arg], "-bcd"))
+        {
+            /* Cache of burn-in states (the state before start_measure_time), shared
+             * between runs whose burn-ins are identical */
+        	cache_dir = argv[++curr_arg];
+        }
+        else if(!strcmp(argv[curr_arg], "-bcs"))
+        {
+            /* Least recently used burn-in states are removed beyond this size */
+        	cache_size = atol(argv[++curr_arg]);
+        }
+        else if(!strcmp(argv[curr_arg], "-nt"))
+        {
+            /* Number of worker threads */
+         	no_threads = atoi(argv[++curr_arg]);
+        }
+        else if(!strcmp(argv[curr_arg], "-ecf"))
+        {
+            /* Convert the environmental data file to a binary raster in this file, then
+             * exit without simulating */
+        	env_cvt_file = fopen(argv[++curr_arg],"wb");
+        }
+        else if(!strcmp(argv[curr_arg], "-ect"))
+        {
+            /* Value type of the converted binary raster */
+            curr_arg++;
+            if(!strcmp(argv[curr_arg], "f16"))
+            {
+                env_cvt_type = KCR_ENV_TYPE_FLOAT16;
+            }
+            else if(!strcmp(argv[curr_arg], "u8"))
+            {
+                env_cvt_type = KCR_ENV_TYPE_UINT8;
+            }
+            else if(!strcmp(argv[curr_arg], "f32"))
+            {
+                env_cvt_type = KCR_ENV_TYPE_FLOAT32;
+            }
+            else
+            {
+                fprintf(stderr,"Error: unrecognised converted type: %s\n", argv[curr_arg]);
+                goto EXIT_LABEL;
+            }
+        }
+        else if(!strcmp(argv[curr_arg], "-ltf"))
+        {
+            /* Likelihood mode: rather than simulating, print the log-likelihood of the
+             * parameters given the trajectory in this file, each row holding the
+             * positions of every individual at a time step as the simulation prints them */
+        	traj_file = fopen(argv[++curr_arg],"r");
+        	if(traj_file == NULL)
+        	{
+        		fprintf(stderr,"Error: cannot open trajectory file %s\n", argv[curr_arg]);
+        		goto EXIT_LABEL;
+        	}
+        }
+        else if(!strcmp(argv[curr_arg], "-ltg"))
+        {
+            /* Also print the gradient of the log-likelihood with respect to the a_ij,
+             * laid out as the a_ij file */
+        	print_gradient = strcmp(argv[++curr_arg], "yes") ? KCR_NO : KCR_YES;
+        }
+        else if(!strcmp(argv[curr_arg], "-lfi"))
+        {
+            /* Fit the a_ij to the trajectory by L-BFGS, starting from those of -af, in
+             * up to this many iterations, then print them as the a_ij file */
+         	fit_iters = atol(argv[++curr_arg]);
+        }
+        else if(!strcmp(argv[curr_arg], "-abp"))
+        {
+            /* ABC-SMC mode: rather than working out the likelihood, draw the a_ij from
+             * the uniform prior in this file (a row of low and high bounds per a_ij)
+             * and keep those whose simulations come close to the trajectory */
+        	abc_prior_file = fopen(argv[++curr_arg],"r");
+        	if(abc_prior_file == NULL)
+        	{
+        		fprintf(stderr,"Error: cannot open prior file %s\n", argv[curr_arg]);
+        		goto EXIT_LABEL;
+        	}
+        }
+        else if(!strcmp(argv[curr_arg], "-abn"))
+        {
+            /* Number of particles in each ABC-SMC generation */
+         	abc_particles = atol(argv[++curr_arg]);
+        }
+        else if(!strcmp(argv[curr_arg], "-abg"))
+        {
+            /* Number of ABC-SMC generations, the first drawn from the prior */
+         	abc_generations = atoi(argv[++curr_arg]);
+        }
+        else if(!strcmp(argv[curr_arg], "-abq"))
+        {
+            /* Quantile of the distances of a generation that is the tolerance of the next */
+         	abc_quantile = atof(argv[++curr_arg]);
+        }
         else
         {
             /* Unrecognised parameter */
@@ -175,43 +568,136 @@ int main(int argc, char** argv)
         }
 	}
                        
-	/* Check a_ij file exists.  Else exit. */
-	if(aij_file == NULL)
+	/* Check a_ij file exists, unless restarting from a checkpoint.  Else exit. */
+	if((aij_file == NULL) && (restart_file == NULL))
 	{
         fprintf(stderr, "Error: no file for storing a_ij values\n");
         goto EXIT_LABEL;
     }
 	
-	/* Initialise random seed. */
+	/* Random seed. */
 	if(rseed == 0)
 	{
-     	srand(time(NULL));
+     	rseed = (unsigned int)time(NULL);
 	}
-	else
+
+	if((env_file != NULL) && (frame_file != NULL))
 	{
-        srand(rseed);
+		fprintf(stderr,"Error: give either -edf or -eff, not both\n");
+		goto EXIT_LABEL;
 	}
-
-	/* Initialisation: Enter values into CBs and allocate memory where necessary */
-    root_data = kcr_init(no_indivs,
-                         no_pops,
-                         total_time,
-                         start_measure_time,
-                         aij_file,
-                         box_width,
-                         box_height,
-						 delta_file,
-						 l_val,
-						 env_file,
-						 env_weight,
-						 packing_term,
-						 kappa);
-		
-	if(root_data == NULL)
+	if((mf_warm_start == KCR_YES) && ((mf_steps == 0) || (start_file != NULL) || (restart_file != NULL)))
+	{
+		fprintf(stderr,"Error: -mfw needs -mfs, and cannot be given with -sf or -rf\n");
+		goto EXIT_LABEL;
+	}
+	if((coarse_factor > 1) &&
+	   ((restart_file != NULL) || (env_file != NULL) || (frame_file != NULL) || (mask_active == KCR_YES) ||
+	    (mark_resp_file != NULL) || (rate_file != NULL) || ((double)coarse_time > start_measure_time)))
+	{
+		fprintf(stderr,"Error: -cgf cannot be given with -rf, -edf, -eff, -hmf, -hmt, -mrf or -rtf, "
+		               "and -cgt must not be after the start-measure time\n");
+		goto EXIT_LABEL;
+	}
+	if((box_depth > 1) &&
+	   ((env_file != NULL) || (frame_file != NULL) || (mask_active == KCR_YES) || (mark_resp_file != NULL) ||
+	    (mf_steps > 0) || (coarse_factor > 1) || (env_cvt_file != NULL)))
 	{
-		printf("Memory allocation failure\n");
+		/* These are all held on two-dimensional per-site grids */
+		fprintf(stderr,"Error: -bd cannot be given with -edf, -eff, -hmf, -hmt, -mrf, -mfs, -cgf or -ecf\n");
 		goto EXIT_LABEL;
 	}
+	if((traj_file != NULL) &&
+	   ((restart_file != NULL) || (start_file != NULL) || (frame_file != NULL) || (mark_resp_file != NULL) ||
+	    (rate_file != NULL) || (mf_steps > 0) || (coarse_factor > 1) || (branch_file != NULL) ||
+	    (cache_dir != NULL) || (env_cvt_file != NULL)))
+	{
+		/* The trajectory gives the positions, and the moves must depend only on them */
+		fprintf(stderr,"Error: -ltf cannot be given with -rf, -sf, -eff, -mrf, -rtf, -mfs, -cgf, -bf, -bcd or -ecf\n");
+		goto EXIT_LABEL;
+	}
+	if((traj_file == NULL) && ((print_gradient == KCR_YES) || (fit_iters > 0)))
+	{
+		fprintf(stderr,"Error: -ltg and -lfi need -ltf\n");
+		goto EXIT_LABEL;
+	}
+	if((abc_prior_file != NULL) &&
+	   ((traj_file == NULL) || (print_gradient == KCR_YES) || (fit_iters > 0) || (abc_particles == 0) ||
+	    (abc_generations == 0) || !(abc_quantile > 0) || (abc_quantile > 1)))
+	{
+		fprintf(stderr,"Error: -abp needs -ltf and cannot be given with -ltg or -lfi; -abn and -abg must be "
+		               "positive and -abq more than 0 and at most 1\n");
+		goto EXIT_LABEL;
+	}
+	if((env_cvt_file != NULL) && (env_weight == 0))
+	{
+		/* The environmental layer is only read when it is weighted, and converting
+		 * needs it read */
+		env_weight = 1;
+	}
+
+	if(restart_file != NULL)
+	{
+		/* Restart: parameters, positions, time and random state come from the
+		 * checkpoint.  Only the total time may be changed, to extend a run. */
+		root_data = kcr_read_checkpoint(restart_file, env_file, no_threads);
+		fclose(restart_file);
+		if(root_data == NULL)
+		{
+			goto EXIT_LABEL;
+		}
+		if(total_time_set == KCR_YES)
+		{
+			root_data->total_time = total_time;
+		}
+	}
+	else
+	{
+		/* Initialisation: Enter values into CBs and allocate memory where necessary */
+	    root_data = kcr_init(no_indivs,
+	                         no_pops,
+	                         total_time,
+	                         start_measure_time,
+	                         aij_file,
+	                         box_width,
+	                         box_height,
+							 delta_file,
+							 l_val,
+							 env_file,
+							 env_weight,
+							 packing_term,
+							 kappa,
+							 boundary[0],
+							 boundary[1],
+							 no_threads);
+			
+		if(root_data == NULL)
+		{
+			/* kcr_init() has already said why */
+			fprintf(stderr,"Error: initialisation failed\n");
+			goto EXIT_LABEL;
+		}
+
+		/* Initialise random seed. */
+		root_data->seed = rseed;
+		kcr_rng_seed(&root_data->rng, rseed);
+
+		/* Tabulate the kernel, as a three-dimensional box always does */
+		root_data->kernel_shape = kernel_shape;
+		if(box_depth > 1)
+		{
+			rc = kcr_setup_3d(root_data, box_depth, boundary[2]);
+		}
+		else
+		{
+			rc = (kernel_shape != KCR_KERNEL_DIRECT) ? kcr_setup_interactions(root_data) : KCR_RC_OK;
+		}
+		if(rc != KCR_RC_OK)
+		{
+			kcr_term(root_data);
+			goto EXIT_LABEL;
+		}
+	}
 
 	/* Close the various files */
 	if(aij_file != NULL)
@@ -219,11 +705,201 @@ int main(int argc, char** argv)
 		fclose(aij_file);
 	}
 
-    kcr_set_init_conds(start_file, root_data);
+	if(env_cvt_file != NULL)
+	{
+		/* Conversion only: write the environmental layer out as a binary raster */
+		if(kcr_write_env_raster(env_cvt_file, root_data, env_cvt_type) != KCR_RC_OK)
+		{
+			fprintf(stderr,"Error: conversion of the environmental data failed\n");
+		}
+		fclose(env_cvt_file);
+		kcr_term(root_data);
+		goto EXIT_LABEL;
+	}
+
+    if(frame_file != NULL)
+    {
+        /* Load the current environmental frame; later ones are loaded in the background */
+        rc = kcr_setup_env_frames(frame_file, root_data);
+        fclose(frame_file);
+        if(rc != KCR_RC_OK)
+        {
+            kcr_term(root_data);
+            goto EXIT_LABEL;
+        }
+    }
+
+    if(mask_active == KCR_YES)
+    {
+        /* The habitat mask is input, like the environment, so it is set up on a
+         * restart too */
+        rc = kcr_setup_mask(mask_file, root_data, mask_threshold);
+        if(mask_file != NULL)
+        {
+            fclose(mask_file);
+        }
+        if(rc != KCR_RC_OK)
+        {
+            kcr_term(root_data);
+            goto EXIT_LABEL;
+        }
+    }
+
+    if((restart_file == NULL) && (mf_steps > 0))
+    {
+        /* Mean field, for its densities or to draw the initial positions from */
+        rc = kcr_setup_mean_field(root_data, mf_steps);
+        if((rc == KCR_RC_OK) && (mf_file != NULL))
+        {
+            kcr_write_mean_field(mf_file, root_data);
+        }
+        if(mf_warm_start != KCR_YES)
+        {
+            kcr_mean_field_term(root_data);
+        }
+        if(rc != KCR_RC_OK)
+        {
+            kcr_term(root_data);
+            goto EXIT_LABEL;
+        }
+    }
+    if(mf_file != NULL)
+    {
+        fclose(mf_file);
+    }
+
+    if((restart_file == NULL) && (kcr_set_init_conds(start_file, root_data) != KCR_RC_OK))
+    {
+        kcr_term(root_data);
+        goto EXIT_LABEL;
+    }
+    /* The mean field is only needed for the initial positions */
+    kcr_mean_field_term(root_data);
+
+    if((restart_file == NULL) && (coarse_factor > 1) &&
+       (kcr_coarse_equilibrate(root_data, coarse_factor, coarse_time) != KCR_RC_OK))
+    {
+        kcr_term(root_data);
+        goto EXIT_LABEL;
+    }
+
+    if((restart_file == NULL) && (mark_resp_file != NULL))
+    {
+        /* Scent marks start empty */
+        rc = kcr_setup_marks(mark_resp_file, root_data, mark_decay_rate, mark_deposit);
+        fclose(mark_resp_file);
+        if(rc != KCR_RC_OK)
+        {
+            kcr_term(root_data);
+            goto EXIT_LABEL;
+        }
+    }
+
+    if((restart_file == NULL) && (rate_file != NULL))
+    {
+        /* Multirate time steps, or event-driven moves first scheduled from the
+         * initial conditions */
+        rc = (rate_mode == KCR_YES) ? kcr_setup_multirate(rate_file, root_data) :
+                                      kcr_setup_events(rate_file, root_data);
+        fclose(rate_file);
+        if(rc != KCR_RC_OK)
+        {
+            kcr_term(root_data);
+            goto EXIT_LABEL;
+        }
+    }
+
+    /* Checkpointing.  SIGTERM stops the run after a final checkpoint. */
+    root_data->checkpoint_name = checkpoint_name;
+    root_data->checkpoint_interval = checkpoint_interval;
+    if(checkpoint_name != NULL)
+    {
+        signal(SIGTERM, kcr_request_stop);
+    }
+
+    if((cache_dir != NULL) && (kcr_perform_burn_in(root_data, cache_dir, cache_size) != KCR_RC_OK))
+    {
+        kcr_term(root_data);
+        goto EXIT_LABEL;
+    }
+
     current_time = time(NULL);
     c_time_string = ctime(&current_time);
     fprintf(stderr,"Initial conditions set up on %s", c_time_string);                 
-    kcr_perform_simulation(end_file, root_data);
+    if((traj_file != NULL) && (abc_prior_file != NULL))
+    {
+        /* ABC-SMC mode: the trajectory is the observed data.  Print the particles of
+         * every generation. */
+        rc = kcr_read_trajectory(traj_file, root_data, &trajectory);
+        fclose(traj_file);
+        if(rc == KCR_RC_OK)
+        {
+            kcr_perform_abc(root_data, &trajectory, abc_prior_file, abc_particles, abc_generations, abc_quantile);
+        }
+        fclose(abc_prior_file);
+        kcr_trajectory_term(&trajectory);
+    }
+    else if(traj_file != NULL)
+    {
+        /* Likelihood mode: the trajectory stands in for the simulation.  Print the
+         * log-likelihood, then its gradient if asked for, then the fitted a_ij if
+         * fitting (the log-likelihood and gradient being those at the fit). */
+        rc = kcr_read_trajectory(traj_file, root_data, &trajectory);
+        fclose(traj_file);
+        gradient = (double *)malloc((unsigned long)root_data->no_pops*root_data->no_pops*sizeof(double));
+        if(gradient == NULL)
+        {
+            fprintf(stderr,"MEMORY ALLOCATION FAILURE FOR GRADIENT\n");
+            rc = KCR_RC_ERROR;
+        }
+        if(rc == KCR_RC_OK)
+        {
+            rc = (fit_iters > 0) ? kcr_fit_aijs(root_data, &trajectory, fit_iters, &log_lik, gradient) :
+                                   kcr_trajectory_log_likelihood(root_data, &trajectory, &log_lik,
+                                                                 (print_gradient == KCR_YES) ? gradient : NULL);
+        }
+        if(rc == KCR_RC_OK)
+        {
+            fprintf(root_data->out_file, "%.17g\n", log_lik);
+            if(print_gradient == KCR_YES)
+            {
+                kcr_write_param_matrix(root_data->out_file, gradient, root_data->no_pops);
+            }
+            if(fit_iters > 0)
+            {
+                kcr_write_param_matrix(root_data->out_file, root_data->aijs, root_data->no_pops);
+            }
+            fprintf(stderr,"Log-likelihood over %lu time steps: %g\n", trajectory.no_rows - 1, log_lik);
+        }
+        if(gradient != NULL)
+        {
+            free(gradient);
+        }
+        kcr_trajectory_term(&trajectory);
+    }
+    else if(branch_file != NULL)
+    {
+        /* Branch mode: each branch writes its own output and end files */
+        kcr_perform_branches(branch_file, root_data, branch_prefix);
+        fclose(branch_file);
+    }
+    else if(end_file_binary == KCR_YES)
+    {
+        /* Positions are written in one go at the end rather than during the last step */
+        kcr_perform_simulation(NULL, root_data);
+        if(end_file != NULL)
+        {
+            kcr_write_state(end_file, root_data);
+        }
+    }
+    else
+    {
+        kcr_perform_simulation(end_file, root_data);
+    }
+    if(end_file != NULL)
+    {
+        fclose(end_file);
+    }
     current_time = time(NULL);
     c_time_string = ctime(&current_time);
     fprintf(stderr,"Simulation finished on %s", c_time_string);                 
@@ -0,0 +1,314 @@
+/***************************************************************************************
+ * Filename: kcrmark.c
+ *
+ * Description: Scent marks.  Every individual deposits a mark of its population at
+ *              each site it visits, and marks decay exponentially.  Individuals drift
+ *              up or down the gradients of the mark fields according to the mark
+ *              response matrix.
+ *
+ *              Decay is applied lazily: each site records the time step at which its
+ *              marks were last brought up to date, and a mark is read as
+ *              stored_value*exp(-decay_rate*(now - last_update)).  Nothing sweeps the
+ *              grid each step, so the cost is per visit rather than per site.  The
+ *              marks of all populations at a site are stored together so that one
+ *              cache line serves a whole stencil point.
+ ***************************************************************************************/
+
+#include <kcr.h>
+
+/***************************************************************************************
+ * Name: kcr_setup_marks()
+ *
+ * Purpose: Set up the mark grids and read the mark response matrix.
+ *
+ * Parameters: IN     mark_resp_file - file containing the mark response matrix: entry
+ *                                     (i,j) is the drift of population i up the
+ *                                     gradient of the marks of population j
+ *             IN/OUT root_data - pointer to a CB containing all the root data for KCR.
+ *             IN     decay_rate - fraction of a mark lost per time step is
+ *                                 1-exp(-decay_rate)
+ *             IN     deposit - amount of mark deposited per visit
+ *
+ * Returns: rc - KCR_RC_OK if ok or KCR_RC_ERROR if error.
+ ***************************************************************************************/
+unsigned short kcr_setup_marks(FILE *mark_resp_file,
+                               KCR_ROOT_DATA *root_data,
+                               double decay_rate,
+                               double deposit)
+{
+	/* Local variables */
+	unsigned short rc;
+
+	/* Sanity checks */
+	assert(root_data != NULL);
+
+	rc = kcr_alloc_marks(root_data, decay_rate, deposit);
+	if(rc != KCR_RC_OK)
+	{
+		goto EXIT_LABEL;
+	}
+	if(mark_resp_file != NULL)
+	{
+		rc = kcr_parse_matrix(mark_resp_file,
+		                      "mark response file",
+		                      root_data->mark_resp,
+		                      NULL,
+		                      root_data->no_pops,
+		                      root_data->no_pops,
+		                      KCR_YES);
+	}
+
+EXIT_LABEL:
+	if(rc != KCR_RC_OK)
+	{
+		kcr_marks_term(root_data);
+	}
+
+	/* Return */
+	return(rc);
+}
+
+/***************************************************************************************
+ * Name: kcr_alloc_marks()
+ *
+ * Purpose: Allocate empty mark grids and a zero response matrix.
+ *
+ * Parameters: IN/OUT root_data - pointer to a CB containing all the root data for KCR.
+ *             IN     decay_rate - decay rate per time step
+ *             IN     deposit - amount of mark deposited per visit
+ *
+ * Returns: rc - KCR_RC_OK if ok or KCR_RC_ERROR if memory allocation fails.
+ *
+ * Operation: Also tabulate the decay factors exp(-decay_rate*k) for the first
+ *            KCR_MARK_DECAY_TABLE_SIZE time steps, which covers nearly every read.
+ ***************************************************************************************/
+unsigned short kcr_alloc_marks(KCR_ROOT_DATA *root_data, double decay_rate, double deposit)
+{
+	/* Local variables */
+	unsigned long elapsed;
+	unsigned short rc = KCR_RC_OK;
+
+	/* Sanity checks */
+	assert(root_data != NULL);
+
+	root_data->mark_decay_rate = decay_rate;
+	root_data->mark_deposit = deposit;
+	root_data->mark_data = (double *)calloc(root_data->grid.size*root_data->no_pops, sizeof(double));
+	root_data->mark_times = (unsigned long long *)calloc(root_data->grid.size, sizeof(unsigned long long));
+	root_data->mark_resp = (double *)calloc((unsigned long)root_data->no_pops*root_data->no_pops, sizeof(double));
+	root_data->mark_decay = (double *)malloc(KCR_MARK_DECAY_TABLE_SIZE*sizeof(double));
+	if((root_data->mark_data == NULL) || (root_data->mark_times == NULL) ||
+	   (root_data->mark_resp == NULL) || (root_data->mark_decay == NULL))
+	{
+		fprintf(stderr,"MEMORY ALLOCATION FAILURE FOR MARKS\n");
+		rc = KCR_RC_ERROR;
+		goto EXIT_LABEL;
+	}
+	for(elapsed = 0; elapsed < KCR_MARK_DECAY_TABLE_SIZE; elapsed++)
+	{
+		root_data->mark_decay[elapsed] = exp(-decay_rate*elapsed);
+	}
+	root_data->marks_active = KCR_YES;
+
+EXIT_LABEL:
+	/* Return */
+	return(rc);
+}
+
+/***************************************************************************************
+ * Name: kcr_marks_term()
+ *
+ * Purpose: Free the mark grids.
+ *
+ * Parameters: IN/OUT root_data - pointer to a CB containing all the root data for KCR.
+ *
+ * Returns: Nothing.
+ ***************************************************************************************/
+void kcr_marks_term(KCR_ROOT_DATA *root_data)
+{
+	/* Sanity checks */
+	assert(root_data != NULL);
+
+	if(root_data->mark_data != NULL)
+	{
+		free(root_data->mark_data);
+	}
+	if(root_data->mark_times != NULL)
+	{
+		free(root_data->mark_times);
+	}
+	if(root_data->mark_resp != NULL)
+	{
+		free(root_data->mark_resp);
+	}
+	if(root_data->mark_decay != NULL)
+	{
+		free(root_data->mark_decay);
+	}
+	root_data->mark_data = NULL;
+	root_data->mark_times = NULL;
+	root_data->mark_resp = NULL;
+	root_data->mark_decay = NULL;
+	root_data->marks_active = KCR_NO;
+
+	/* Return */
+	return;
+}
+
+/***************************************************************************************
+ * Name: kcr_mark_decay_factor()
+ *
+ * Purpose: Get the factor by which marks decay over a number of time steps.
+ *
+ * Parameters: IN     root_data - pointer to a CB containing all the root data for KCR.
+ *             IN     elapsed - number of time steps
+ *
+ * Returns: exp(-decay_rate*elapsed), from the table where possible.
+ ***************************************************************************************/
+double kcr_mark_decay_factor(KCR_ROOT_DATA *root_data, unsigned long long elapsed)
+{
+	/* Return */
+	return((elapsed < KCR_MARK_DECAY_TABLE_SIZE) ? root_data->mark_decay[elapsed] :
+	                                               exp(-root_data->mark_decay_rate*(double)elapsed));
+}
+
+/***************************************************************************************
+ * Name: kcr_mark_value()
+ *
+ * Purpose: Get the current strength of a population's mark at a site.
+ *
+ * Parameters: IN     root_data - pointer to a CB containing all the root data for KCR.
+ *             IN     index - grid index of the site
+ *             IN     pop - index of the population
+ *
+ * Returns: The mark, decayed to the current time step.  The site is not updated.
+ ***************************************************************************************/
+double kcr_mark_value(KCR_ROOT_DATA *root_data, unsigned long index, unsigned short pop)
+{
+	/* Local variables */
+	double value;
+
+	value = root_data->mark_data[index*root_data->no_pops + pop];
+	if(value != 0)
+	{
+		value *= kcr_mark_decay_factor(root_data, root_data->current_time - root_data->mark_times[index]);
+	}
+
+	/* Return */
+	return(value);
+}
+
+/***************************************************************************************
+ * Name: kcr_deposit_mark()
+ *
+ * Purpose: Deposit a population's mark at a site.
+ *
+ * Parameters: IN/OUT root_data - pointer to a CB containing all the root data for KCR.
+ *             IN     x_val - x-position of the site
+ *             IN     y_val - y-position of the site
+ *             IN     pop - index of the population
+ *
+ * Returns: Nothing.
+ *
+ * Operation: Bring every population's mark at the site up to the current time step,
+ *            then add the deposit.
+ ***************************************************************************************/
+void kcr_deposit_mark(KCR_ROOT_DATA *root_data, unsigned long x_val, unsigned long y_val, unsigned short pop)
+{
+	/* Local variables */
+	unsigned long index;
+	double *marks;
+	double factor;
+	unsigned short curr_pop;
+
+	/* Sanity checks */
+	assert(root_data != NULL);
+	assert(pop < root_data->no_pops);
+
+	index = KCR_GRID_INDEX(&root_data->grid, x_val, y_val);
+	marks = root_data->mark_data + index*root_data->no_pops;
+	if(root_data->mark_times[index] != root_data->current_time)
+	{
+		factor = kcr_mark_decay_factor(root_data, root_data->current_time - root_data->mark_times[index]);
+		for(curr_pop = 0; curr_pop < root_data->no_pops; curr_pop++)
+		{
+			marks[curr_pop] *= factor;
+		}
+		root_data->mark_times[index] = root_data->current_time;
+	}
+	marks[pop] += root_data->mark_deposit;
+
+	/* Return */
+	return;
+}
+
+/***************************************************************************************
+ * Name: kcr_mark_drift()
+ *
+ * Purpose: Add the drift due to marks to an individual's drift.
+ *
+ * Parameters: IN     root_data - pointer to a CB containing all the root data for KCR.
+ *             IN     x_val - x-position of the individual
+ *             IN     y_val - y-position of the individual
+ *             IN     pop - index of the individual's population
+ *             IN/OUT sx - drift in x
+ *             IN/OUT sy - drift in y (NULL in a 1d box)
+ *
+ * Returns: Nothing.
+ *
+ * Operation: For each population j with a non-zero response, add response(pop,j)
+ *            times the gradient of j's marks, by differences across the site (from the
+ *            boundary tables) as for the environmental gradient.
+ ***************************************************************************************/
+void kcr_mark_drift(KCR_ROOT_DATA *root_data,
+                    unsigned long x_val,
+                    unsigned long y_val,
+                    unsigned short pop,
+                    double *sx,
+                    double *sy)
+{
+	/* Local variables */
+	const KCR_GRID_LAYOUT *grid;
+	const double *resp;
+	unsigned short curr_pop;
+	double span_x;
+	double span_y;
+	unsigned long left;
+	unsigned long right;
+	unsigned long down;
+	unsigned long up;
+
+	/* Sanity checks */
+	assert(root_data != NULL);
+	assert(sx != NULL);
+
+	grid = &root_data->grid;
+	resp = root_data->mark_resp + pop*root_data->no_pops;
+	left = KCR_GRID_INDEX(grid, root_data->x_axis.lo_stencil[x_val], y_val);
+	right = KCR_GRID_INDEX(grid, root_data->x_axis.hi_stencil[x_val], y_val);
+	down = KCR_GRID_INDEX(grid, x_val, root_data->y_axis.lo_stencil[y_val]);
+	up = KCR_GRID_INDEX(grid, x_val, root_data->y_axis.hi_stencil[y_val]);
+	span_x = root_data->x_axis.stencil_span[x_val];
+	span_y = root_data->y_axis.stencil_span[y_val];
+
+	for(curr_pop = 0; curr_pop < root_data->no_pops; curr_pop++)
+	{
+		if(resp[curr_pop] == 0)
+		{
+			continue;
+		}
+		if(span_x > 0)
+		{
+			*sx += resp[curr_pop]*(kcr_mark_value(root_data, right, curr_pop) -
+			                       kcr_mark_value(root_data, left, curr_pop))/span_x;
+		}
+		if((sy != NULL) && (span_y > 0))
+		{
+			*sy += resp[curr_pop]*(kcr_mark_value(root_data, up, curr_pop) -
+			                       kcr_mark_value(root_data, down, curr_pop))/span_y;
+		}
+	}
+
+	/* Return */
+	return;
+}
@@ -0,0 +1,160 @@
+/***************************************************************************************
+ * Filename: kcrmask.c
+ *
+ * Description: Habitat mask: cells that individuals cannot enter, such as rivers or
+ *              urban areas.  The mask is a bit grid in the per-site grid layout, so
+ *              one 64-bit word covers a whole 8x8 tile and the cells around an
+ *              individual are nearly always tested in a single word.
+ ***************************************************************************************/
+
+#include <kcr.h>
+
+/***************************************************************************************
+ * Name: kcr_setup_mask()
+ *
+ * Purpose: Set up the habitat mask.
+ *
+ * Parameters: IN     mask_file - file of per-cell values, in either format accepted
+ *                                for environmental data, or NULL to use the
+ *                                environmental layer
+ *             IN/OUT root_data - pointer to a CB containing all the root data for KCR.
+ *             IN     threshold - cells whose value is below this are blocked
+ *
+ * Returns: rc - KCR_RC_OK if ok or KCR_RC_ERROR if error.
+ *
+ * Operation: Read the values (missing values in a text file are zero), then set the
+ *            bit of every cell below the threshold.  At least one cell must be open,
+ *            since individuals are only ever placed on open cells.
+ ***************************************************************************************/
+unsigned short kcr_setup_mask(FILE *mask_file, KCR_ROOT_DATA *root_data, double threshold)
+{
+	/* Local variables */
+	double *values = NULL;
+	KCR_ENV_RASTER raster;
+	unsigned long x_val;
+	unsigned long y_val;
+	unsigned long index;
+	unsigned long no_open = 0;
+	double value;
+	unsigned short rc = KCR_RC_OK;
+
+	/* Sanity checks */
+	assert(root_data != NULL);
+
+	memset(&raster, 0, sizeof(raster));
+	if((mask_file == NULL) && (root_data->env_data == NULL) && (root_data->env_raster.values == NULL))
+	{
+		fprintf(stderr,"Error: no habitat mask file, and no environmental layer in use to derive one from\n");
+		rc = KCR_RC_ERROR;
+		goto EXIT_LABEL;
+	}
+
+	root_data->habitat_mask = (unsigned long long *)calloc((root_data->grid.size + 63)/64,
+	                                                       sizeof(unsigned long long));
+	if(root_data->habitat_mask == NULL)
+	{
+		fprintf(stderr,"MEMORY ALLOCATION FAILURE FOR HABITAT MASK\n");
+		rc = KCR_RC_ERROR;
+		goto EXIT_LABEL;
+	}
+
+	/* Per-cell values */
+	if((mask_file != NULL) && (kcr_env_is_raster(mask_file) == KCR_YES))
+	{
+		rc = kcr_env_map_raster(mask_file, &raster, root_data->box_width, root_data->box_height, KCR_YES);
+	}
+	else if(mask_file != NULL)
+	{
+		values = kcr_grid_alloc(&root_data->grid);
+		if(values == NULL)
+		{
+			fprintf(stderr,"MEMORY ALLOCATION FAILURE FOR HABITAT MASK\n");
+			rc = KCR_RC_ERROR;
+			goto EXIT_LABEL;
+		}
+		rc = kcr_parse_matrix_parallel(mask_file,
+		                               "habitat mask file",
+		                               values,
+		                               &root_data->grid,
+		                               root_data->box_width,
+		                               root_data->box_height,
+		                               root_data->no_threads,
+		                               KCR_YES);
+	}
+	if(rc != KCR_RC_OK)
+	{
+		goto EXIT_LABEL;
+	}
+
+	/* Block the cells below the threshold */
+	for(y_val = 0; y_val < root_data->box_height; y_val++)
+	{
+		for(x_val = 0; x_val < root_data->box_width; x_val++)
+		{
+			index = KCR_GRID_INDEX(&root_data->grid, x_val, y_val);
+			if(values != NULL)
+			{
+				value = values[index];
+			}
+			else if(raster.values != NULL)
+			{
+				value = kcr_env_raster_value(&raster, x_val + y_val*root_data->box_width);
+			}
+			else
+			{
+				value = kcr_env_value(root_data, x_val, y_val);
+			}
+			if(value < threshold)
+			{
+				root_data->habitat_mask[index >> 6] |= 1ULL << (index & 63);
+			}
+			else
+			{
+				no_open++;
+			}
+		}
+	}
+	if(no_open == 0)
+	{
+		fprintf(stderr,"Error: the habitat mask blocks every cell\n");
+		rc = KCR_RC_ERROR;
+	}
+
+EXIT_LABEL:
+	if(values != NULL)
+	{
+		free(values);
+	}
+	kcr_unmap_file(&raster.mapping);
+	if(rc != KCR_RC_OK)
+	{
+		kcr_mask_term(root_data);
+	}
+
+	/* Return */
+	return(rc);
+}
+
+/***************************************************************************************
+ * Name: kcr_mask_term()
+ *
+ * Purpose: Free the habitat mask.
+ *
+ * Parameters: IN/OUT root_data - pointer to a CB containing all the root data for KCR.
+ *
+ * Returns: Nothing.
+ ***************************************************************************************/
+void kcr_mask_term(KCR_ROOT_DATA *root_data)
+{
+	/* Sanity checks */
+	assert(root_data != NULL);
+
+	if(root_data->habitat_mask != NULL)
+	{
+		free(root_data->habitat_mask);
+	}
+	root_data->habitat_mask = NULL;
+
+	/* Return */
+	return;
+}
@@ -0,0 +1,752 @@
+/***************************************************************************************
+ * Filename: kcrmf.c
+ *
+ * Description: Mean-field solver.  Instead of moving individuals, move the expected
+ *              number of individuals of each population at each site: every step,
+ *              the density at a site is shared between its neighbours with the
+ *              probabilities an individual there would move with, the drift being
+ *              worked out from the densities rather than from individual
+ *              neighbours.  This is the lattice form of the advection-diffusion
+ *              equations with nonlocal interactions that the individual-based model
+ *              tends to, with the same a_ij, delta, l_val, packing, environment,
+ *              boundaries and habitat mask.
+ *
+ *              The interaction drift is a convolution of each density with a
+ *              kernel that is fixed for the run, so it is done by FFT, at a cost
+ *              that does not depend on delta.  Interactions use the same minimum-
+ *              image distances as the kernels, so the convolutions are periodic
+ *              whatever the boundary conditions.
+ *
+ *              The densities are used to check the individual-based kernels against
+ *              and to draw initial positions from near the steady state, which cuts
+ *              the burn-in.  Scent marks are not modelled, and move rates only
+ *              change how fast the steady state is reached, so steps are always
+ *              time-stepped moves.
+ ***************************************************************************************/
+
+#include <kcr.h>
+
+/***************************************************************************************
+ * Name: kcr_setup_mean_field()
+ *
+ * Purpose: Integrate the mean-field equations from a near-uniform start.
+ *
+ * Parameters: IN/OUT root_data - pointer to a CB containing all the root data for KCR.
+ *             IN     no_steps - largest number of time steps to integrate for
+ *
+ * Returns: rc - KCR_RC_OK if ok or KCR_RC_ERROR if error.
+ *
+ * Operation: Start each population spread evenly over the open cells, with a small
+ *            random ripple (from a generator of its own, so the simulation's random
+ *            numbers are unchanged) to break the symmetry of the even state, which
+ *            is a steady state whatever the interactions.  Stop early once a step
+ *            changes the densities by less than KCR_MF_TOLERANCE of their total.
+ ***************************************************************************************/
+unsigned short kcr_setup_mean_field(KCR_ROOT_DATA *root_data, unsigned long no_steps)
+{
+	/* Local variables */
+	KCR_MEAN_FIELD *mf;
+	KCR_RNG rng;
+	unsigned long site;
+	unsigned long no_open;
+	unsigned short curr_pop;
+	double *density;
+	double change;
+	double total;
+	unsigned short rc;
+
+	/* Sanity checks */
+	assert(root_data != NULL);
+
+	mf = &root_data->mean_field;
+	rc = kcr_alloc_mean_field(root_data);
+	if(rc != KCR_RC_OK)
+	{
+		goto EXIT_LABEL;
+	}
+
+	/* Near-uniform start over the open cells */
+	kcr_rng_seed(&rng, root_data->seed ^ KCR_MF_SEED_MIX);
+	for(curr_pop = 0; curr_pop < root_data->no_pops; curr_pop++)
+	{
+		density = mf->density + curr_pop*mf->size;
+		total = 0;
+		for(site = 0; site < mf->size; site++)
+		{
+			density[site] = (mf->open[site] == KCR_YES) ? 1 + KCR_MF_RIPPLE*(kcr_rng_uniform(&rng) - 0.5) : 0;
+			total += density[site];
+		}
+		for(site = 0; site < mf->size; site++)
+		{
+			density[site] *= root_data->no_indivs/total;
+		}
+	}
+
+	total = (double)root_data->no_pops*root_data->no_indivs;
+	change = 0;
+	for(mf->no_steps = 0; mf->no_steps < no_steps; mf->no_steps++)
+	{
+		change = kcr_mf_step(root_data);
+		if(change < KCR_MF_TOLERANCE*total)
+		{
+			mf->no_steps++;
+			break;
+		}
+	}
+	for(site = 0, no_open = 0; site < mf->size; site++)
+	{
+		no_open += (mf->open[site] == KCR_YES);
+	}
+	fprintf(stderr,"Mean field: %lu time steps over %lu open sites, last change %g\n",
+	        mf->no_steps, no_open, change/total);
+
+EXIT_LABEL:
+	if(rc != KCR_RC_OK)
+	{
+		kcr_mean_field_term(root_data);
+	}
+
+	/* Return */
+	return(rc);
+}
+
+/***************************************************************************************
+ * Name: kcr_alloc_mean_field()
+ *
+ * Purpose: Allocate the mean-field arrays and set up the transition tables and the
+ *          transformed interaction kernels.
+ *
+ * Parameters: IN/OUT root_data - pointer to a CB containing all the root data for KCR.
+ *
+ * Returns: rc - KCR_RC_OK if ok or KCR_RC_ERROR if memory allocation fails.
+ *
+ * Operation: For each site, tabulate whether it is open and the weight and
+ *            destination of each of the four moves, with the boundary and mask
+ *            rules of the kernels (a 1d box has no moves up or down).
+ ***************************************************************************************/
+unsigned short kcr_alloc_mean_field(KCR_ROOT_DATA *root_data)
+{
+	/* Local variables */
+	KCR_MEAN_FIELD *mf;
+	unsigned long x_val;
+	unsigned long y_val;
+	unsigned long site;
+	unsigned long dest;
+	unsigned short dir;
+	unsigned long stencil_x[KCR_MF_NO_MOVES];
+	unsigned long stencil_y[KCR_MF_NO_MOVES];
+	unsigned short rc = KCR_RC_ERROR;
+
+	/* Sanity checks */
+	assert(root_data != NULL);
+
+	mf = &root_data->mean_field;
+	memset(mf, 0, sizeof(KCR_MEAN_FIELD));
+	mf->size = root_data->box_width*root_data->box_height;
+	mf->density = (double *)malloc(root_data->no_pops*mf->size*sizeof(double));
+	mf->next = (double *)malloc(mf->size*sizeof(double));
+	mf->drift_x = (double *)malloc(mf->size*sizeof(double));
+	mf->drift_y = (double *)malloc(mf->size*sizeof(double));
+	mf->crowding = (double *)malloc(mf->size*sizeof(double));
+	mf->open = (unsigned char *)malloc(mf->size);
+	mf->weights = (double *)malloc(KCR_MF_NO_MOVES*mf->size*sizeof(double));
+	mf->dests = (unsigned long *)malloc(KCR_MF_NO_MOVES*mf->size*sizeof(unsigned long));
+	mf->density_hat = (KCR_COMPLEX *)malloc(root_data->no_pops*mf->size*sizeof(KCR_COMPLEX));
+	mf->kernel_x_hat = (KCR_COMPLEX *)malloc((unsigned long)root_data->no_pops*root_data->no_pops*
+	                                         mf->size*sizeof(KCR_COMPLEX));
+	mf->kernel_y_hat = (KCR_COMPLEX *)malloc((unsigned long)root_data->no_pops*root_data->no_pops*
+	                                         mf->size*sizeof(KCR_COMPLEX));
+	mf->work = (KCR_COMPLEX *)malloc(mf->size*sizeof(KCR_COMPLEX));
+	if((mf->density == NULL) || (mf->next == NULL) || (mf->drift_x == NULL) || (mf->drift_y == NULL) ||
+	   (mf->crowding == NULL) || (mf->open == NULL) || (mf->weights == NULL) || (mf->dests == NULL) ||
+	   (mf->density_hat == NULL) || (mf->kernel_x_hat == NULL) || (mf->kernel_y_hat == NULL) ||
+	   (mf->work == NULL))
+	{
+		fprintf(stderr,"MEMORY ALLOCATION FAILURE FOR MEAN FIELD\n");
+		goto EXIT_LABEL;
+	}
+	if((kcr_fft_init(&mf->x_fft, root_data->box_width) != KCR_RC_OK) ||
+	   (kcr_fft_init(&mf->y_fft, root_data->box_height) != KCR_RC_OK))
+	{
+		goto EXIT_LABEL;
+	}
+
+	/* Transition tables: moves down, up, left and right */
+	for(y_val = 0; y_val < root_data->box_height; y_val++)
+	{
+		for(x_val = 0; x_val < root_data->box_width; x_val++)
+		{
+			site = x_val + y_val*root_data->box_width;
+			mf->open[site] = ((root_data->habitat_mask == NULL) ||
+			                  !KCR_MASK_BLOCKED(root_data->habitat_mask,
+			                                    KCR_GRID_INDEX(&root_data->grid, x_val, y_val))) ? KCR_YES : KCR_NO;
+			mf->weights[KCR_MF_DOWN*mf->size + site] = root_data->y_axis.lo_weight[y_val];
+			mf->weights[KCR_MF_UP*mf->size + site] = root_data->y_axis.hi_weight[y_val];
+			mf->weights[KCR_MF_LEFT*mf->size + site] = root_data->x_axis.lo_weight[x_val];
+			mf->weights[KCR_MF_RIGHT*mf->size + site] = root_data->x_axis.hi_weight[x_val];
+			if(root_data->box_height == 1)
+			{
+				mf->weights[KCR_MF_DOWN*mf->size + site] = 0;
+				mf->weights[KCR_MF_UP*mf->size + site] = 0;
+			}
+			stencil_x[KCR_MF_DOWN] = x_val;
+			stencil_y[KCR_MF_DOWN] = root_data->y_axis.lo_stencil[y_val];
+			stencil_x[KCR_MF_UP] = x_val;
+			stencil_y[KCR_MF_UP] = root_data->y_axis.hi_stencil[y_val];
+			stencil_x[KCR_MF_LEFT] = root_data->x_axis.lo_stencil[x_val];
+			stencil_y[KCR_MF_LEFT] = y_val;
+			stencil_x[KCR_MF_RIGHT] = root_data->x_axis.hi_stencil[x_val];
+			stencil_y[KCR_MF_RIGHT] = y_val;
+			for(dir = 0; dir < KCR_MF_NO_MOVES; dir++)
+			{
+				if((root_data->habitat_mask != NULL) &&
+				   KCR_MASK_BLOCKED(root_data->habitat_mask,
+				                    KCR_GRID_INDEX(&root_data->grid, stencil_x[dir], stencil_y[dir])))
+				{
+					mf->weights[dir*mf->size + site] = 0;
+				}
+			}
+			dest = root_data->y_axis.lo_dest[y_val];
+			mf->dests[KCR_MF_DOWN*mf->size + site] = (dest == KCR_OUTSIDE) ? KCR_OUTSIDE : x_val + dest*root_data->box_width;
+			dest = root_data->y_axis.hi_dest[y_val];
+			mf->dests[KCR_MF_UP*mf->size + site] = (dest == KCR_OUTSIDE) ? KCR_OUTSIDE : x_val + dest*root_data->box_width;
+			dest = root_data->x_axis.lo_dest[x_val];
+			mf->dests[KCR_MF_LEFT*mf->size + site] = (dest == KCR_OUTSIDE) ? KCR_OUTSIDE : dest + y_val*root_data->box_width;
+			dest = root_data->x_axis.hi_dest[x_val];
+			mf->dests[KCR_MF_RIGHT*mf->size + site] = (dest == KCR_OUTSIDE) ? KCR_OUTSIDE : dest + y_val*root_data->box_width;
+		}
+	}
+
+	kcr_mf_init_kernels(root_data);
+	rc = KCR_RC_OK;
+
+EXIT_LABEL:
+	/* Return */
+	return(rc);
+}
+
+/***************************************************************************************
+ * Name: kcr_mean_field_term()
+ *
+ * Purpose: Free the mean field.
+ *
+ * Parameters: IN/OUT root_data - pointer to a CB containing all the root data for KCR.
+ *
+ * Returns: Nothing.
+ ***************************************************************************************/
+void kcr_mean_field_term(KCR_ROOT_DATA *root_data)
+{
+	/* Local variables */
+	KCR_MEAN_FIELD *mf;
+
+	/* Sanity checks */
+	assert(root_data != NULL);
+
+	mf = &root_data->mean_field;
+	if(mf->density != NULL)
+	{
+		free(mf->density);
+	}
+	if(mf->next != NULL)
+	{
+		free(mf->next);
+	}
+	if(mf->drift_x != NULL)
+	{
+		free(mf->drift_x);
+	}
+	if(mf->drift_y != NULL)
+	{
+		free(mf->drift_y);
+	}
+	if(mf->crowding != NULL)
+	{
+		free(mf->crowding);
+	}
+	if(mf->open != NULL)
+	{
+		free(mf->open);
+	}
+	if(mf->weights != NULL)
+	{
+		free(mf->weights);
+	}
+	if(mf->dests != NULL)
+	{
+		free(mf->dests);
+	}
+	if(mf->density_hat != NULL)
+	{
+		free(mf->density_hat);
+	}
+	if(mf->kernel_x_hat != NULL)
+	{
+		free(mf->kernel_x_hat);
+	}
+	if(mf->kernel_y_hat != NULL)
+	{
+		free(mf->kernel_y_hat);
+	}
+	if(mf->work != NULL)
+	{
+		free(mf->work);
+	}
+	if(mf->cumulative != NULL)
+	{
+		free(mf->cumulative);
+	}
+	kcr_fft_term(&mf->x_fft);
+	kcr_fft_term(&mf->y_fft);
+	memset(mf, 0, sizeof(KCR_MEAN_FIELD));
+
+	/* Return */
+	return;
+}
+
+/***************************************************************************************
+ * Name: kcr_mf_init_kernels()
+ *
+ * Purpose: Tabulate and transform the interaction kernel of every pair of
+ *          populations.
+ *
+ * Parameters: IN/OUT root_data - pointer to a CB containing all the root data for KCR.
+ *
+ * Returns: Nothing.
+ *
+ * Operation: The kernel of the drift of population i due to population j at offset d
+ *            (from i to j, as a minimum image) is the drift one individual of j at d
+ *            adds in the kernels.  The drift at a site is the sum over offsets of the
+ *            kernel times the density at the site plus the offset, so the array
+ *            transformed holds the kernel at minus each offset, making it a
+ *            convolution.  An individual does not drift towards itself, so j's own
+ *            density is scaled by (no_indivs-1)/no_indivs when i is j.  The kernel
+ *            has the shape the individuals' kernels have.
+ *
+ *            On an axis with an even number of sites, the kernels take an offset of
+ *            half the axis as plus or minus according to which position is larger,
+ *            which no convolution can follow.  So the drift is exact only when the
+ *            kernel's cutoff over l_val is less than half the box.
+ ***************************************************************************************/
+void kcr_mf_init_kernels(KCR_ROOT_DATA *root_data)
+{
+	/* Local variables */
+	KCR_MEAN_FIELD *mf;
+	KCR_COMPLEX *kernel_x;
+	KCR_COMPLEX *kernel_y;
+	unsigned short pop_i;
+	unsigned short pop_j;
+	unsigned long pair;
+	unsigned long x_val;
+	unsigned long y_val;
+	long x_diff;
+	long y_diff;
+	double dist;
+	double delta;
+	double scale;
+	double weight;
+
+	mf = &root_data->mean_field;
+	for(pop_i = 0; pop_i < root_data->no_pops; pop_i++)
+	{
+		for(pop_j = 0; pop_j < root_data->no_pops; pop_j++)
+		{
+			pair = pop_j + pop_i*root_data->no_pops;
+			kernel_x = mf->kernel_x_hat + pair*mf->size;
+			kernel_y = mf->kernel_y_hat + pair*mf->size;
+			delta = root_data->deltas[pair];
+			scale = root_data->aijs[pair];
+			if(pop_i == pop_j)
+			{
+				scale *= (root_data->no_indivs - 1.0)/root_data->no_indivs;
+			}
+			scale *= root_data->l_val;
+			memset(kernel_x, 0, mf->size*sizeof(KCR_COMPLEX));
+			memset(kernel_y, 0, mf->size*sizeof(KCR_COMPLEX));
+			for(y_val = 0; y_val < root_data->box_height; y_val++)
+			{
+				y_diff = KCR_DIFF((root_data->box_height - y_val) % root_data->box_height, 0, root_data->box_height);
+				for(x_val = 0; x_val < root_data->box_width; x_val++)
+				{
+					x_diff = KCR_DIFF((root_data->box_width - x_val) % root_data->box_width, 0, root_data->box_width);
+					dist = sqrt((double)(x_diff*x_diff + y_diff*y_diff));
+					if(dist == 0)
+					{
+						continue;
+					}
+					weight = scale*kcr_kernel_weight(root_data->kernel_shape, dist*root_data->l_val, delta,
+					                                 (root_data->box_height == 1) ? 1 : 2);
+					kernel_x[x_val + y_val*root_data->box_width].re = weight*x_diff/dist;
+					kernel_y[x_val + y_val*root_data->box_width].re = weight*y_diff/dist;
+				}
+			}
+			kcr_fft_2d(&mf->x_fft, &mf->y_fft, kernel_x, KCR_NO);
+			kcr_fft_2d(&mf->x_fft, &mf->y_fft, kernel_y, KCR_NO);
+		}
+	}
+
+	/* Return */
+	return;
+}
+
+/***************************************************************************************
+ * Name: kcr_mf_drift()
+ *
+ * Purpose: Work out the drift of one population at every site.
+ *
+ * Parameters: IN/OUT root_data - pointer to a CB containing all the root data for KCR,
+ *                                with density_hat and crowding up to date.
+ *             IN     pop - index of the population
+ *
+ * Returns: Nothing.
+ *
+ * Operation: Sum the products of the transformed kernels and densities, transform
+ *            back, then apply the packing term, add the environmental drift and clip
+ *            to [-1,1] as the kernels do.
+ ***************************************************************************************/
+void kcr_mf_drift(KCR_ROOT_DATA *root_data, unsigned short pop)
+{
+	/* Local variables */
+	KCR_MEAN_FIELD *mf;
+	const KCR_COMPLEX *kernel;
+	const KCR_COMPLEX *density_hat;
+	KCR_COMPLEX *work;
+	double *drift;
+	unsigned short pop_j;
+	unsigned short axis;
+	unsigned long site;
+	unsigned long x_val;
+	unsigned long y_val;
+	unsigned long index;
+	unsigned short no_axes;
+	double packing;
+
+	mf = &root_data->mean_field;
+	work = mf->work;
+	no_axes = (root_data->box_height == 1) ? 1 : 2;
+	memset(mf->drift_y, 0, mf->size*sizeof(double));
+	for(pop_j = 0; pop_j < root_data->no_pops; pop_j++)
+	{
+		if(root_data->aijs[pop_j + pop*root_data->no_pops] != 0)
+		{
+			break;
+		}
+	}
+	if(pop_j == root_data->no_pops)
+	{
+		/* No interactions: no convolutions */
+		memset(mf->drift_x, 0, mf->size*sizeof(double));
+		no_axes = 0;
+	}
+	for(axis = 0; axis < no_axes; axis++)
+	{
+		drift = (axis == 0) ? mf->drift_x : mf->drift_y;
+		memset(work, 0, mf->size*sizeof(KCR_COMPLEX));
+		for(pop_j = 0; pop_j < root_data->no_pops; pop_j++)
+		{
+			if(root_data->aijs[pop_j + pop*root_data->no_pops] == 0)
+			{
+				continue;
+			}
+			kernel = ((axis == 0) ? mf->kernel_x_hat : mf->kernel_y_hat) +
+			         (pop_j + (unsigned long)pop*root_data->no_pops)*mf->size;
+			density_hat = mf->density_hat + pop_j*mf->size;
+			for(site = 0; site < mf->size; site++)
+			{
+				work[site].re += kernel[site].re*density_hat[site].re - kernel[site].im*density_hat[site].im;
+				work[site].im += kernel[site].re*density_hat[site].im + kernel[site].im*density_hat[site].re;
+			}
+		}
+		kcr_fft_2d(&mf->x_fft, &mf->y_fft, work, KCR_YES);
+		for(site = 0; site < mf->size; site++)
+		{
+			drift[site] = work[site].re;
+		}
+	}
+
+	if(root_data->packing_term == 1)
+	{
+		/* The individual itself is always at its own site */
+		for(site = 0; site < mf->size; site++)
+		{
+			packing = 1 + root_data->kappa*(1 + mf->crowding[site])/pow(root_data->l_val,2);
+			mf->drift_x[site] /= packing;
+			mf->drift_y[site] /= packing;
+		}
+	}
+	for(y_val = 0; y_val < root_data->box_height; y_val++)
+	{
+		for(x_val = 0; x_val < root_data->box_width; x_val++)
+		{
+			site = x_val + y_val*root_data->box_width;
+			if(root_data->env_active == KCR_YES)
+			{
+				index = KCR_GRID_INDEX(&root_data->grid, x_val, y_val);
+				mf->drift_x[site] += root_data->env_weight*root_data->env_grad_x[index];
+				if(root_data->box_height > 1)
+				{
+					mf->drift_y[site] += root_data->env_weight*root_data->env_grad_y[index];
+				}
+			}
+			mf->drift_x[site] = KCR_MAX(-1,KCR_MIN(1,mf->drift_x[site]));
+			mf->drift_y[site] = KCR_MAX(-1,KCR_MIN(1,mf->drift_y[site]));
+		}
+	}
+
+	/* Return */
+	return;
+}
+
+/***************************************************************************************
+ * Name: kcr_mf_step()
+ *
+ * Purpose: Advance the mean field by one time step.
+ *
+ * Parameters: IN/OUT root_data - pointer to a CB containing all the root data for KCR.
+ *
+ * Returns: The total absolute change in the densities.
+ *
+ * Operation: Transform every density, then for each population work out the drift
+ *            and share the density at each site between the move destinations in
+ *            proportion to the move weights, as the kernels choose moves.  Density
+ *            with no open move stays put, but without a mask it goes right, as in
+ *            the kernels.  Density stepping off an absorbing edge comes back spread
+ *            evenly over the open cells, as replacement individuals do.
+ *
+ *            Only half the density moves in a step.  Moving all of it would swap
+ *            it between the two checkerboard sublattices every step, as every
+ *            individual changes sublattice, so it would never settle; moving half
+ *            has the same steady states, which is all the mean field is used for.
+ ***************************************************************************************/
+double kcr_mf_step(KCR_ROOT_DATA *root_data)
+{
+	/* Local variables */
+	KCR_MEAN_FIELD *mf;
+	double *density;
+	double *next;
+	const double *weights;
+	const unsigned long *dests;
+	unsigned short pop;
+	unsigned short pop_i;
+	unsigned short dir;
+	unsigned long site;
+	unsigned long no_open;
+	double share[KCR_MF_NO_MOVES];
+	double total;
+	double lost;
+	double change;
+
+	mf = &root_data->mean_field;
+	weights = mf->weights;
+	dests = mf->dests;
+	memset(mf->crowding, 0, mf->size*sizeof(double));
+	for(pop = 0; pop < root_data->no_pops; pop++)
+	{
+		density = mf->density + pop*mf->size;
+		for(site = 0; site < mf->size; site++)
+		{
+			mf->density_hat[pop*mf->size + site].re = density[site];
+			mf->density_hat[pop*mf->size + site].im = 0;
+			mf->crowding[site] += density[site];
+		}
+		for(pop_i = 0; pop_i < root_data->no_pops; pop_i++)
+		{
+			if(root_data->aijs[pop + pop_i*root_data->no_pops] != 0)
+			{
+				/* Only transformed if some population is affected by it */
+				kcr_fft_2d(&mf->x_fft, &mf->y_fft, mf->density_hat + pop*mf->size, KCR_NO);
+				break;
+			}
+		}
+	}
+
+	change = 0;
+	for(pop = 0; pop < root_data->no_pops; pop++)
+	{
+		density = mf->density + pop*mf->size;
+		next = mf->next;
+		kcr_mf_drift(root_data, pop);
+		memset(next, 0, mf->size*sizeof(double));
+		lost = 0;
+		for(site = 0; site < mf->size; site++)
+		{
+			if(density[site] == 0)
+			{
+				continue;
+			}
+			next[site] += 0.5*density[site];
+			share[KCR_MF_DOWN] = weights[KCR_MF_DOWN*mf->size + site]*(1 - mf->drift_y[site]);
+			share[KCR_MF_UP] = weights[KCR_MF_UP*mf->size + site]*(1 + mf->drift_y[site]);
+			share[KCR_MF_LEFT] = weights[KCR_MF_LEFT*mf->size + site]*(1 - mf->drift_x[site]);
+			share[KCR_MF_RIGHT] = weights[KCR_MF_RIGHT*mf->size + site]*(1 + mf->drift_x[site]);
+			total = share[KCR_MF_DOWN] + share[KCR_MF_UP] + share[KCR_MF_LEFT] + share[KCR_MF_RIGHT];
+			if(total == 0)
+			{
+				if(root_data->habitat_mask != NULL)
+				{
+					next[site] += 0.5*density[site];
+					continue;
+				}
+				share[KCR_MF_RIGHT] = 1;
+				total = 1;
+			}
+			for(dir = 0; dir < KCR_MF_NO_MOVES; dir++)
+			{
+				if(share[dir] == 0)
+				{
+					continue;
+				}
+				if(dests[dir*mf->size + site] == KCR_OUTSIDE)
+				{
+					lost += 0.5*density[site]*share[dir]/total;
+				}
+				else
+				{
+					next[dests[dir*mf->size + site]] += 0.5*density[site]*share[dir]/total;
+				}
+			}
+		}
+		if(lost > 0)
+		{
+			for(site = 0, no_open = 0; site < mf->size; site++)
+			{
+				no_open += (mf->open[site] == KCR_YES);
+			}
+			for(site = 0; site < mf->size; site++)
+			{
+				next[site] += (mf->open[site] == KCR_YES) ? lost/no_open : 0;
+			}
+		}
+		for(site = 0; site < mf->size; site++)
+		{
+			change += fabs(next[site] - density[site]);
+		}
+		memcpy(density, next, mf->size*sizeof(double));
+	}
+
+	/* Return */
+	return(change);
+}
+
+/***************************************************************************************
+ * Name: kcr_write_mean_field()
+ *
+ * Purpose: Write out the mean-field densities.
+ *
+ * Parameters: IN     out_file - file to write to
+ *             IN     root_data - pointer to a CB containing all the root data for KCR.
+ *
+ * Returns: Nothing.
+ *
+ * Operation: For each population in turn, the expected number of individuals at each
+ *            site, as box_height tab-separated rows of box_width values (the layout of
+ *            a text environmental data file), followed by a blank line.
+ ***************************************************************************************/
+void kcr_write_mean_field(FILE *out_file, KCR_ROOT_DATA *root_data)
+{
+	/* Local variables */
+	KCR_MEAN_FIELD *mf;
+	unsigned short pop;
+	unsigned long x_val;
+	unsigned long y_val;
+
+	/* Sanity checks */
+	assert(out_file != NULL);
+	assert(root_data != NULL);
+	assert(root_data->mean_field.density != NULL);
+
+	mf = &root_data->mean_field;
+	for(pop = 0; pop < root_data->no_pops; pop++)
+	{
+		for(y_val = 0; y_val < root_data->box_height; y_val++)
+		{
+			for(x_val = 0; x_val < root_data->box_width; x_val++)
+			{
+				fprintf(out_file, (x_val == 0) ? "%.9g" : "\t%.9g",
+				        mf->density[pop*mf->size + x_val + y_val*root_data->box_width]);
+			}
+			fprintf(out_file, "\n");
+		}
+		fprintf(out_file, "\n");
+	}
+
+	/* Return */
+	return;
+}
+
+/***************************************************************************************
+ * Name: kcr_mf_place_individual()
+ *
+ * Purpose: Place an individual at a site drawn from its population's mean-field
+ *          density.
+ *
+ * Parameters: IN/OUT individual - the individual
+ *             IN     population - pointer to the population CB containing it
+ *             IN/OUT root_data - pointer to a CB containing all the root data for KCR.
+ *
+ * Returns: rc - KCR_RC_OK if ok or KCR_RC_ERROR if memory allocation fails.
+ *
+ * Operation: On first use, build the cumulative sums of the densities.  Then draw a
+ *            point below the population's total and find the first site whose
+ *            cumulative sum is above it, so sites with no density (such as blocked
+ *            cells) are never chosen.
+ ***************************************************************************************/
+unsigned short kcr_mf_place_individual(KCR_INDIVIDUAL *individual,
+                                       KCR_POPULATION *population,
+                                       KCR_ROOT_DATA *root_data)
+{
+	/* Local variables */
+	KCR_MEAN_FIELD *mf;
+	const double *cumulative;
+	unsigned long site;
+	unsigned long lo;
+	unsigned long hi;
+	unsigned long mid;
+	double point;
+	double total;
+	unsigned short rc = KCR_RC_OK;
+
+	/* Sanity checks */
+	assert(root_data != NULL);
+	assert(root_data->mean_field.density != NULL);
+
+	mf = &root_data->mean_field;
+	if(mf->cumulative == NULL)
+	{
+		mf->cumulative = (double *)malloc(root_data->no_pops*mf->size*sizeof(double));
+		if(mf->cumulative == NULL)
+		{
+			fprintf(stderr,"MEMORY ALLOCATION FAILURE FOR MEAN FIELD\n");
+			rc = KCR_RC_ERROR;
+			goto EXIT_LABEL;
+		}
+		for(site = 0, total = 0; site < root_data->no_pops*mf->size; site++)
+		{
+			total = ((site % mf->size) == 0) ? 0 : total;
+			total += mf->density[site];
+			mf->cumulative[site] = total;
+		}
+	}
+
+	cumulative = mf->cumulative + population->index*mf->size;
+	point = kcr_rng_uniform(&root_data->rng)*cumulative[mf->size - 1];
+	lo = 0;
+	hi = mf->size - 1;
+	while(lo < hi)
+	{
+		mid = lo + (hi - lo)/2;
+		if(cumulative[mid] > point)
+		{
+			hi = mid;
+		}
+		else
+		{
+			lo = mid + 1;
+		}
+	}
+	individual->current_x_pos = lo % root_data->box_width;
+	individual->current_y_pos = lo / root_data->box_width;
+
+EXIT_LABEL:
+	/* Return */
+	return(rc);
+}
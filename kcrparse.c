@@ -0,0 +1,896 @@
+/***************************************************************************************
+ * Filename: kcrparse.c
+ *
+ * Description: Block-buffered parser for the tab-separated numeric files used by KCR
+ *              (a_ij, delta and environmental data files).
+ ***************************************************************************************/
+
+#include <kcr.h>
+
+/***************************************************************************************
+ * Exact powers of ten.  Every power up to 10^22 is exactly representable as a double,
+ * so a mantissa of at most 2^53 scaled by one of these is correctly rounded.
+ ***************************************************************************************/
+static const double kcr_pow10_table[] =
+{
+    1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+/***************************************************************************************
+ * Name: kcr_parse_double()
+ *
+ * Purpose: Convert the decimal number at *curr_pos into a double.
+ *
+ * Parameters: IN/OUT curr_pos - pointer to the first character of the number.  On
+ *                               return, points to the first character after it.
+ *             IN     end_pos - end of the characters available for parsing.
+ *             OUT    value - the number.
+ *
+ * Returns: rc - KCR_RC_OK if a number was found, else KCR_RC_ERROR.
+ *
+ * Operation: Accept an optional sign, digits with an optional decimal point and an
+ *            optional exponent (e.g. -1.25e-3).  Accumulate up to 19 significant
+ *            digits in an integer mantissa.  If the mantissa is exact in a double and
+ *            the decimal exponent is at most 22 in magnitude then a single multiply or
+ *            divide by an exact power of ten gives the correctly rounded result.
+ *            Otherwise fall back to strtod() on a copy of the number.
+ ***************************************************************************************/
+unsigned short kcr_parse_double(const char **curr_pos, const char *end_pos, double *value)
+{
+	/* Local variables */
+	const char *pos;
+	const char *start_pos;
+	unsigned long long mantissa = 0;
+	unsigned short sig_digits = 0;
+	unsigned short all_digits = 0;
+	unsigned short truncated = KCR_NO;
+	unsigned short neg = KCR_NO;
+	long exp10 = 0;
+	long explicit_exp = 0;
+	unsigned short exp_neg = KCR_NO;
+	char copy[KCR_PARSER_MAX_TOKEN];
+	unsigned short rc = KCR_RC_OK;
+
+	/* Sanity checks */
+	assert(curr_pos != NULL);
+	assert(value != NULL);
+
+	pos = *curr_pos;
+	start_pos = pos;
+
+	/* Sign */
+	if((pos < end_pos) && ((*pos == '-') || (*pos == '+')))
+	{
+		neg = (*pos == '-') ? KCR_YES : KCR_NO;
+		pos++;
+	}
+
+	/* Digits before the decimal point.  Leading zeros are not significant. */
+	while((pos < end_pos) && (*pos >= '0') && (*pos <= '9'))
+	{
+		if((mantissa == 0) && (*pos == '0'))
+		{
+			/* Leading zero */
+		}
+		else if(sig_digits < 19)
+		{
+			mantissa = mantissa*10 + (unsigned long long)(*pos - '0');
+			sig_digits++;
+		}
+		else
+		{
+			/* Too many digits to hold: drop this one but keep its magnitude */
+			exp10++;
+			truncated = KCR_YES;
+		}
+		all_digits++;
+		pos++;
+	}
+
+	/* Digits after the decimal point */
+	if((pos < end_pos) && (*pos == '.'))
+	{
+		pos++;
+		while((pos < end_pos) && (*pos >= '0') && (*pos <= '9'))
+		{
+			if((mantissa == 0) && (*pos == '0'))
+			{
+				/* Leading zero after the point: only shifts the exponent */
+				exp10--;
+			}
+			else if(sig_digits < 19)
+			{
+				mantissa = mantissa*10 + (unsigned long long)(*pos - '0');
+				sig_digits++;
+				exp10--;
+			}
+			else
+			{
+				/* Too many digits: ignore */
+				truncated = KCR_YES;
+			}
+			all_digits++;
+			pos++;
+		}
+	}
+
+	if(all_digits == 0)
+	{
+		/* No digits at all: not a number */
+		rc = KCR_RC_ERROR;
+		goto EXIT_LABEL;
+	}
+
+	/* Exponent */
+	if((pos < end_pos) && ((*pos == 'e') || (*pos == 'E')))
+	{
+		pos++;
+		if((pos < end_pos) && ((*pos == '-') || (*pos == '+')))
+		{
+			exp_neg = (*pos == '-') ? KCR_YES : KCR_NO;
+			pos++;
+		}
+		if((pos >= end_pos) || (*pos < '0') || (*pos > '9'))
+		{
+			/* Exponent marker without any exponent digits */
+			rc = KCR_RC_ERROR;
+			goto EXIT_LABEL;
+		}
+		while((pos < end_pos) && (*pos >= '0') && (*pos <= '9'))
+		{
+			if(explicit_exp < 100000)
+			{
+				explicit_exp = explicit_exp*10 + (*pos - '0');
+			}
+			pos++;
+		}
+		exp10 += (exp_neg == KCR_YES) ? -explicit_exp : explicit_exp;
+	}
+
+	if(mantissa == 0)
+	{
+		/* Zero, whatever the exponent */
+		*value = 0;
+	}
+	else if((truncated == KCR_NO) &&
+	        (mantissa <= ((unsigned long long)1 << 53)) &&
+	        (exp10 >= -22) && (exp10 <= 22))
+	{
+		/* Fast path: exact mantissa and exact power of ten */
+		if(exp10 >= 0)
+		{
+			*value = (double)mantissa*kcr_pow10_table[exp10];
+		}
+		else
+		{
+			*value = (double)mantissa/kcr_pow10_table[-exp10];
+		}
+	}
+	else
+	{
+		/* Slow path: let the C library do the rounding */
+		if(pos - start_pos >= KCR_PARSER_MAX_TOKEN)
+		{
+			rc = KCR_RC_ERROR;
+			goto EXIT_LABEL;
+		}
+		memcpy(copy, start_pos, pos - start_pos);
+		copy[pos - start_pos] = '\0';
+		*value = strtod(copy, NULL);
+		neg = KCR_NO;
+	}
+	if(neg == KCR_YES)
+	{
+		*value = -*value;
+	}
+
+EXIT_LABEL:
+	/* Return */
+	*curr_pos = pos;
+	return(rc);
+}
+
+/***************************************************************************************
+ * Name: kcr_parser_open_file()
+ *
+ * Purpose: Set up a parser reading from a file in large blocks.
+ *
+ * Parameters: OUT    parser - the parser
+ *             IN     in_file - file to read
+ *             IN     name - description of the file used in error messages
+ *
+ * Returns: rc - KCR_RC_OK if ok or KCR_RC_ERROR if the buffer cannot be allocated.
+ ***************************************************************************************/
+unsigned short kcr_parser_open_file(KCR_PARSER *parser, FILE *in_file, const char *name)
+{
+	/* Local variables */
+	unsigned short rc = KCR_RC_OK;
+
+	/* Sanity checks */
+	assert(parser != NULL);
+	assert(in_file != NULL);
+
+	parser->in_file = in_file;
+	parser->name = name;
+	parser->line = 1;
+	parser->line_offset = 0;
+	parser->base_offset = 0;
+	parser->token_line = 1;
+	parser->token_column = 1;
+	parser->eof = KCR_NO;
+	parser->row_has_values = KCR_NO;
+	parser->hold_errors = KCR_NO;
+	parser->error_text = NULL;
+
+	parser->buffer = (char *)malloc(KCR_PARSER_BLOCK_SIZE);
+	if(parser->buffer == NULL)
+	{
+		fprintf(stderr,"MEMORY ALLOCATION FAILURE FOR PARSER BUFFER\n");
+		rc = KCR_RC_ERROR;
+		goto EXIT_LABEL;
+	}
+	parser->base = parser->buffer;
+	parser->curr = parser->buffer;
+	parser->end = parser->buffer;
+
+	/* Read the first block */
+	rewind(in_file);
+	kcr_parser_fill(parser);
+
+EXIT_LABEL:
+	/* Return */
+	return(rc);
+}
+
+/***************************************************************************************
+ * Name: kcr_parser_open_memory()
+ *
+ * Purpose: Set up a parser over a range of characters already in memory.
+ *
+ * Parameters: OUT    parser - the parser
+ *             IN     start - first character
+ *             IN     end - one past the last character
+ *             IN     first_line - line number of the first character (for messages)
+ *             IN     name - description of the data used in error messages
+ *
+ * Returns: Nothing.
+ *
+ * Operation: Errors are held in the parser rather than printed, for the caller to
+ *            pass to kcr_parser_report(), since ranges parsed in parallel must be
+ *            reported in file order.
+ ***************************************************************************************/
+void kcr_parser_open_memory(KCR_PARSER *parser,
+                            const char *start,
+                            const char *end,
+                            unsigned long first_line,
+                            const char *name)
+{
+	/* Sanity checks */
+	assert(parser != NULL);
+	assert(start <= end);
+
+	parser->in_file = NULL;
+	parser->buffer = NULL;
+	parser->name = name;
+	parser->base = start;
+	parser->curr = start;
+	parser->end = end;
+	parser->line = first_line;
+	parser->line_offset = 0;
+	parser->base_offset = 0;
+	parser->token_line = first_line;
+	parser->token_column = 1;
+	parser->eof = KCR_YES;
+	parser->row_has_values = KCR_NO;
+	parser->hold_errors = KCR_YES;
+	parser->error_text = NULL;
+
+	/* Return */
+	return;
+}
+
+/***************************************************************************************
+ * Name: kcr_parser_close()
+ *
+ * Purpose: Free any memory held by a parser.
+ *
+ * Parameters: IN     parser - the parser
+ *
+ * Returns: Nothing.
+ ***************************************************************************************/
+void kcr_parser_close(KCR_PARSER *parser)
+{
+	/* Sanity checks */
+	assert(parser != NULL);
+
+	if(parser->buffer != NULL)
+	{
+		free(parser->buffer);
+		parser->buffer = NULL;
+	}
+
+	/* Return */
+	return;
+}
+
+/***************************************************************************************
+ * Name: kcr_parser_fill()
+ *
+ * Purpose: Top up the parser's buffer from its file.
+ *
+ * Parameters: IN/OUT parser - the parser
+ *
+ * Returns: Nothing.
+ *
+ * Operation: Move the unparsed tail of the buffer to the start, then read as much of
+ *            the file as fits after it.  A no-op for memory parsers and at end of file.
+ ***************************************************************************************/
+void kcr_parser_fill(KCR_PARSER *parser)
+{
+	/* Local variables */
+	size_t remaining;
+	size_t got;
+
+	/* Sanity checks */
+	assert(parser != NULL);
+
+	if((parser->in_file == NULL) || (parser->eof == KCR_YES))
+	{
+		goto EXIT_LABEL;
+	}
+
+	/* Keep the unparsed tail */
+	remaining = parser->end - parser->curr;
+	parser->base_offset += parser->curr - parser->buffer;
+	memmove(parser->buffer, parser->curr, remaining);
+	parser->curr = parser->buffer;
+	parser->end = parser->buffer + remaining;
+
+	/* Read until the buffer is full or the file is exhausted */
+	while(remaining < KCR_PARSER_BLOCK_SIZE)
+	{
+		got = fread(parser->buffer + remaining, 1, KCR_PARSER_BLOCK_SIZE - remaining, parser->in_file);
+		if(got == 0)
+		{
+			parser->eof = KCR_YES;
+			break;
+		}
+		remaining += got;
+	}
+	parser->end = parser->buffer + remaining;
+
+EXIT_LABEL:
+	/* Return */
+	return;
+}
+
+/***************************************************************************************
+ * Name: kcr_parser_next()
+ *
+ * Purpose: Get the next token from the parser.
+ *
+ * Parameters: IN/OUT parser - the parser
+ *             OUT    value - the number, if the token is KCR_TOKEN_NUMBER
+ *
+ * Returns: token - KCR_TOKEN_NUMBER, KCR_TOKEN_END_OF_ROW, KCR_TOKEN_END_OF_FILE or
+ *                  KCR_TOKEN_ERROR.  On error a message giving the line and column has
+ *                  already been written to stderr.
+ *
+ * Operation: Tabs, spaces and carriage returns separate numbers.  A newline ends the
+ *            row if the row contained any numbers; blank lines are skipped.  A final
+ *            row without a trailing newline is ended by the end of the file.  A number
+ *            of KCR_PARSER_MAX_TOKEN characters or more is malformed, since only that
+ *            many are sure to be in the buffer when it is parsed.
+ ***************************************************************************************/
+unsigned short kcr_parser_next(KCR_PARSER *parser, double *value)
+{
+	/* Local variables */
+	const char *token_start;
+	char curr_char;
+	unsigned short token;
+
+	/* Sanity checks */
+	assert(parser != NULL);
+	assert(value != NULL);
+
+	for(;;)
+	{
+		if(parser->end - parser->curr < KCR_PARSER_MAX_TOKEN)
+		{
+			/* Make sure a whole number is available before parsing it */
+			kcr_parser_fill(parser);
+		}
+		if(parser->curr == parser->end)
+		{
+			/* End of data.  End any unfinished row first. */
+			if(parser->row_has_values == KCR_YES)
+			{
+				parser->row_has_values = KCR_NO;
+				token = KCR_TOKEN_END_OF_ROW;
+			}
+			else
+			{
+				token = KCR_TOKEN_END_OF_FILE;
+			}
+			goto EXIT_LABEL;
+		}
+
+		curr_char = *parser->curr;
+		if((curr_char == '\t') || (curr_char == ' ') || (curr_char == '\r'))
+		{
+			/* Separator */
+			parser->curr++;
+		}
+		else if(curr_char == '\n')
+		{
+			/* End of line */
+			parser->curr++;
+			parser->line++;
+			parser->line_offset = parser->base_offset + (parser->curr - parser->base);
+			if(parser->row_has_values == KCR_YES)
+			{
+				parser->row_has_values = KCR_NO;
+				token = KCR_TOKEN_END_OF_ROW;
+				goto EXIT_LABEL;
+			}
+		}
+		else
+		{
+			/* Must be a number, followed by a separator or the end of the data */
+			parser->token_line = parser->line;
+			parser->token_column = (unsigned long)(parser->base_offset + (parser->curr - parser->base) -
+			                                       parser->line_offset + 1);
+			token_start = parser->curr;
+			if((kcr_parse_double(&parser->curr, parser->end, value) != KCR_RC_OK) ||
+			   (parser->curr - token_start >= KCR_PARSER_MAX_TOKEN) ||
+			   ((parser->curr != parser->end) &&
+			    (*parser->curr != '\t') && (*parser->curr != ' ') &&
+			    (*parser->curr != '\r') && (*parser->curr != '\n')))
+			{
+				kcr_parser_error(parser, "malformed number");
+				token = KCR_TOKEN_ERROR;
+				goto EXIT_LABEL;
+			}
+			parser->row_has_values = KCR_YES;
+			token = KCR_TOKEN_NUMBER;
+			goto EXIT_LABEL;
+		}
+	}
+
+EXIT_LABEL:
+	/* Return */
+	return(token);
+}
+
+/***************************************************************************************
+ * Name: kcr_parser_error()
+ *
+ * Purpose: Record an error at the position of the most recent number, and print it
+ *          unless the parser holds its errors.
+ *
+ * Parameters: IN/OUT parser - the parser
+ *             IN     text - description of the error (a string constant)
+ *
+ * Returns: Nothing.
+ ***************************************************************************************/
+void kcr_parser_error(KCR_PARSER *parser, const char *text)
+{
+	/* Sanity checks */
+	assert(parser != NULL);
+
+	parser->error_text = text;
+	if(parser->hold_errors == KCR_NO)
+	{
+		kcr_parser_report(parser);
+	}
+
+	/* Return */
+	return;
+}
+
+/***************************************************************************************
+ * Name: kcr_parser_report()
+ *
+ * Purpose: Print the error recorded by a parser, if any.
+ *
+ * Parameters: IN     parser - the parser
+ *
+ * Returns: Nothing.
+ ***************************************************************************************/
+void kcr_parser_report(KCR_PARSER *parser)
+{
+	/* Sanity checks */
+	assert(parser != NULL);
+
+	if(parser->error_text != NULL)
+	{
+		fprintf(stderr, "Error: %s in %s at line %lu, column %lu\n",
+		        parser->error_text, parser->name, parser->token_line, parser->token_column);
+	}
+
+	/* Return */
+	return;
+}
+
+/***************************************************************************************
+ * Name: kcr_parse_matrix()
+ *
+ * Purpose: Read a tab-separated matrix of numbers from a file into an array.
+ *
+ * Parameters: IN     in_file - file containing the matrix
+ *             IN     name - description of the file used in error messages
+ *             OUT    dbl_array - array of width*height values
+ *             IN     layout - layout of the array if it is a per-site grid, or NULL
+ *                             if it is stored row by row
+ *             IN     width - number of values per row
+ *             IN     height - number of rows
+ *             IN     report_errors - KCR_YES to print any error in the file, KCR_NO to
+ *                                    fail silently
+ *
+ * Returns: rc - KCR_RC_OK if ok or KCR_RC_ERROR if the file is malformed or holds more
+ *               rows or columns than the array.
+ *
+ * Operation: Values not present in the file are left untouched, so short rows and
+ *            missing rows keep whatever the caller put in the array.
+ ***************************************************************************************/
+unsigned short kcr_parse_matrix(FILE *in_file,
+                                const char *name,
+                                double *dbl_array,
+                                const KCR_GRID_LAYOUT *layout,
+                                unsigned long width,
+                                unsigned long height,
+                                unsigned short report_errors)
+{
+	/* Local variables */
+	KCR_PARSER parser;
+	unsigned long x_val = 0;
+	unsigned long y_val = 0;
+	unsigned short token;
+	double value;
+	unsigned short rc;
+
+	/* Sanity checks */
+	assert(in_file != NULL);
+	assert(dbl_array != NULL);
+
+	rc = kcr_parser_open_file(&parser, in_file, name);
+	if(rc != KCR_RC_OK)
+	{
+		goto EXIT_LABEL;
+	}
+	parser.hold_errors = (report_errors == KCR_YES) ? KCR_NO : KCR_YES;
+
+	for(;;)
+	{
+		token = kcr_parser_next(&parser, &value);
+		if(token == KCR_TOKEN_NUMBER)
+		{
+			if((x_val >= width) || (y_val >= height))
+			{
+				kcr_parser_error(&parser, "too many values");
+				rc = KCR_RC_ERROR;
+				break;
+			}
+			if(layout != NULL)
+			{
+				dbl_array[KCR_GRID_INDEX(layout, x_val, y_val)] = value;
+			}
+			else
+			{
+				dbl_array[x_val+y_val*width] = value;
+			}
+			x_val++;
+		}
+		else if(token == KCR_TOKEN_END_OF_ROW)
+		{
+			x_val = 0;
+			y_val++;
+		}
+		else if(token == KCR_TOKEN_END_OF_FILE)
+		{
+			break;
+		}
+		else
+		{
+			rc = KCR_RC_ERROR;
+			break;
+		}
+	}
+	kcr_parser_close(&parser);
+
+EXIT_LABEL:
+	/* Return */
+	return(rc);
+}
+
+/***************************************************************************************
+ * Name: kcr_count_chunk_rows()
+ *
+ * Purpose: Count the lines and rows in a chunk.  Thread function.
+ *
+ * Parameters: IN/OUT arg - the KCR_PARSE_CHUNK
+ *
+ * Returns: Nothing.
+ *
+ * Operation: A row is a line holding anything other than separators, matching the
+ *            rows produced by kcr_parser_next().
+ ***************************************************************************************/
+void kcr_count_chunk_rows(void *arg)
+{
+	/* Local variables */
+	KCR_PARSE_CHUNK *chunk = (KCR_PARSE_CHUNK *)arg;
+	const char *pos;
+	unsigned short has_content = KCR_NO;
+
+	/* Sanity checks */
+	assert(chunk != NULL);
+
+	chunk->no_lines = 0;
+	chunk->no_rows = 0;
+	for(pos = chunk->start; pos < chunk->end; pos++)
+	{
+		if(*pos == '\n')
+		{
+			chunk->no_lines++;
+			if(has_content == KCR_YES)
+			{
+				chunk->no_rows++;
+			}
+			has_content = KCR_NO;
+		}
+		else if((*pos != '\t') && (*pos != ' ') && (*pos != '\r'))
+		{
+			has_content = KCR_YES;
+		}
+	}
+	if(has_content == KCR_YES)
+	{
+		/* Final line of the file without a newline */
+		chunk->no_rows++;
+	}
+
+	/* Return */
+	return;
+}
+
+/***************************************************************************************
+ * Name: kcr_parse_chunk()
+ *
+ * Purpose: Parse the rows of a chunk into the destination array.  Thread function.
+ *
+ * Parameters: IN/OUT arg - the KCR_PARSE_CHUNK, with first_line and first_row set
+ *
+ * Returns: Nothing.  The result is left in chunk->rc, and any error in chunk->parser.
+ ***************************************************************************************/
+void kcr_parse_chunk(void *arg)
+{
+	/* Local variables */
+	KCR_PARSE_CHUNK *chunk = (KCR_PARSE_CHUNK *)arg;
+	KCR_PARSER *parser = &chunk->parser;
+	unsigned long x_val = 0;
+	unsigned long y_val;
+	unsigned short token;
+	double value;
+
+	/* Sanity checks */
+	assert(chunk != NULL);
+
+	kcr_parser_open_memory(parser, chunk->start, chunk->end, chunk->first_line, chunk->name);
+	y_val = chunk->first_row;
+	chunk->rc = KCR_RC_OK;
+	for(;;)
+	{
+		token = kcr_parser_next(parser, &value);
+		if(token == KCR_TOKEN_NUMBER)
+		{
+			if((x_val >= chunk->width) || (y_val >= chunk->height))
+			{
+				kcr_parser_error(parser, "too many values");
+				chunk->rc = KCR_RC_ERROR;
+				break;
+			}
+			if(chunk->layout != NULL)
+			{
+				chunk->dbl_array[KCR_GRID_INDEX(chunk->layout, x_val, y_val)] = value;
+			}
+			else
+			{
+				chunk->dbl_array[x_val+y_val*chunk->width] = value;
+			}
+			x_val++;
+		}
+		else if(token == KCR_TOKEN_END_OF_ROW)
+		{
+			x_val = 0;
+			y_val++;
+		}
+		else if(token == KCR_TOKEN_END_OF_FILE)
+		{
+			break;
+		}
+		else
+		{
+			chunk->rc = KCR_RC_ERROR;
+			break;
+		}
+	}
+	kcr_parser_close(parser);
+
+	/* Return */
+	return;
+}
+
+/***************************************************************************************
+ * Name: kcr_parse_matrix_parallel()
+ *
+ * Purpose: Read a tab-separated matrix of numbers from a file into an array, using
+ *          several threads.
+ *
+ * Parameters: IN     in_file - file containing the matrix
+ *             IN     name - description of the file used in error messages
+ *             OUT    dbl_array - array of width*height values
+ *             IN     layout - layout of the array, or NULL if stored row by row
+ *             IN     width - number of values per row
+ *             IN     height - number of rows
+ *             IN     no_threads - number of threads to use
+ *             IN     report_errors - KCR_YES to print any error in the file, KCR_NO to
+ *                                    fail silently
+ *
+ * Returns: rc - as kcr_parse_matrix().
+ *
+ * Operation: Map the file and split it into one chunk per thread, moving each split
+ *            point forward to the start of a line.  First each thread counts the lines
+ *            and rows in its chunk; a prefix sum of the counts gives the line number
+ *            and row index at which each chunk starts.  Then each thread parses its
+ *            chunk straight into its rows of the array, holding any error so that only
+ *            the first in the file is reported, as kcr_parse_matrix() would.  Small
+ *            files, single threads and files that cannot be mapped (e.g. pipes) use
+ *            kcr_parse_matrix().
+ ***************************************************************************************/
+unsigned short kcr_parse_matrix_parallel(FILE *in_file,
+                                         const char *name,
+                                         double *dbl_array,
+                                         const KCR_GRID_LAYOUT *layout,
+                                         unsigned long width,
+                                         unsigned long height,
+                                         unsigned short no_threads,
+                                         unsigned short report_errors)
+{
+	/* Local variables */
+	KCR_MAPPING mapping;
+	KCR_PARSE_CHUNK *chunks = NULL;
+	KCR_THREAD *threads = NULL;
+	const char *data;
+	const char *data_end;
+	const char *split;
+	unsigned long long chunk_size;
+	unsigned short curr_chunk;
+	unsigned long no_lines;
+	unsigned long no_rows;
+	unsigned short rc = KCR_RC_OK;
+
+	/* Sanity checks */
+	assert(in_file != NULL);
+	assert(dbl_array != NULL);
+
+	if((no_threads <= 1) || (kcr_map_file(in_file, &mapping) != KCR_RC_OK))
+	{
+		rc = kcr_parse_matrix(in_file, name, dbl_array, layout, width, height, report_errors);
+		goto EXIT_LABEL;
+	}
+	if(mapping.size < KCR_PARSE_PARALLEL_MIN_SIZE)
+	{
+		kcr_unmap_file(&mapping);
+		rc = kcr_parse_matrix(in_file, name, dbl_array, layout, width, height, report_errors);
+		goto EXIT_LABEL;
+	}
+
+	chunks = (KCR_PARSE_CHUNK *)calloc(no_threads, sizeof(KCR_PARSE_CHUNK));
+	threads = (KCR_THREAD *)calloc(no_threads, sizeof(KCR_THREAD));
+	if((chunks == NULL) || (threads == NULL))
+	{
+		fprintf(stderr,"MEMORY ALLOCATION FAILURE FOR PARSE CHUNKS\n");
+		rc = KCR_RC_ERROR;
+		goto UNMAP_LABEL;
+	}
+
+	/* Split the file into chunks of whole lines */
+	data = (const char *)mapping.data;
+	data_end = data + mapping.size;
+	chunk_size = mapping.size/no_threads;
+	split = data;
+	for(curr_chunk = 0; curr_chunk < no_threads; curr_chunk++)
+	{
+		chunks[curr_chunk].start = split;
+		if(curr_chunk == no_threads - 1)
+		{
+			split = data_end;
+		}
+		else
+		{
+			split = KCR_MAX(split, data + chunk_size*(curr_chunk + 1));
+			while((split < data_end) && (split[-1] != '\n'))
+			{
+				split++;
+			}
+		}
+		chunks[curr_chunk].end = split;
+		chunks[curr_chunk].dbl_array = dbl_array;
+		chunks[curr_chunk].layout = layout;
+		chunks[curr_chunk].width = width;
+		chunks[curr_chunk].height = height;
+		chunks[curr_chunk].name = name;
+		chunks[curr_chunk].rc = KCR_RC_OK;
+	}
+
+	/* Count the lines and rows in each chunk */
+	for(curr_chunk = 0; curr_chunk < no_threads; curr_chunk++)
+	{
+		if(kcr_thread_create(&threads[curr_chunk], kcr_count_chunk_rows, &chunks[curr_chunk]) != KCR_RC_OK)
+		{
+			/* No thread: do the work here instead */
+			threads[curr_chunk].function = NULL;
+			kcr_count_chunk_rows(&chunks[curr_chunk]);
+		}
+	}
+	for(curr_chunk = 0; curr_chunk < no_threads; curr_chunk++)
+	{
+		if(threads[curr_chunk].function != NULL)
+		{
+			kcr_thread_join(&threads[curr_chunk]);
+		}
+	}
+
+	/* Prefix sum: where each chunk starts */
+	no_lines = 0;
+	no_rows = 0;
+	for(curr_chunk = 0; curr_chunk < no_threads; curr_chunk++)
+	{
+		chunks[curr_chunk].first_line = no_lines + 1;
+		chunks[curr_chunk].first_row = no_rows;
+		no_lines += chunks[curr_chunk].no_lines;
+		no_rows += chunks[curr_chunk].no_rows;
+	}
+
+	/* Parse each chunk into its rows */
+	for(curr_chunk = 0; curr_chunk < no_threads; curr_chunk++)
+	{
+		if(kcr_thread_create(&threads[curr_chunk], kcr_parse_chunk, &chunks[curr_chunk]) != KCR_RC_OK)
+		{
+			threads[curr_chunk].function = NULL;
+			kcr_parse_chunk(&chunks[curr_chunk]);
+		}
+	}
+	for(curr_chunk = 0; curr_chunk < no_threads; curr_chunk++)
+	{
+		if(threads[curr_chunk].function != NULL)
+		{
+			kcr_thread_join(&threads[curr_chunk]);
+		}
+		if((chunks[curr_chunk].rc != KCR_RC_OK) && (rc == KCR_RC_OK))
+		{
+			/* Later chunks may fail too, but the serial parse would stop here */
+			if(report_errors == KCR_YES)
+			{
+				kcr_parser_report(&chunks[curr_chunk].parser);
+			}
+			rc = KCR_RC_ERROR;
+		}
+	}
+
+UNMAP_LABEL:
+	kcr_unmap_file(&mapping);
+	if(chunks != NULL)
+	{
+		free(chunks);
+	}
+	if(threads != NULL)
+	{
+		free(threads);
+	}
+
+EXIT_LABEL:
+	/* Return */
+	return(rc);
+}
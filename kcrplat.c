@@ -0,0 +1,599 @@
+/***************************************************************************************
+ * Filename: kcrplat.c
+ *
+ * Description: Operating system dependent procedures for the KCR simulator.  Windows
+ *              and POSIX versions of each procedure are kept side by side.
+ ***************************************************************************************/
+
+#include <kcr.h>
+#ifdef _WIN32
+#include <io.h>
+#include <sys/utime.h>
+#else /* _WIN32 */
+#include <dirent.h>
+#include <utime.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif /* _WIN32 */
+
+/***************************************************************************************
+ * Name: kcr_map_file()
+ *
+ * Purpose: Map the whole of an open file read-only into memory.
+ *
+ * Parameters: IN     in_file - the open file
+ *             OUT    mapping - the mapping
+ *
+ * Returns: rc - KCR_RC_OK if ok or KCR_RC_ERROR if the file could not be mapped.
+ *               Nothing is printed, since some callers fall back to reading the file.
+ *
+ * Operation: The mapping is shared, so every process mapping the same file uses the
+ *            same page-cache copy, and pages are only read when first touched.  The
+ *            file may be closed once it is mapped.
+ ***************************************************************************************/
+unsigned short kcr_map_file(FILE *in_file, KCR_MAPPING *mapping)
+{
+	/* Local variables */
+	unsigned short rc = KCR_RC_OK;
+#ifdef _WIN32
+	HANDLE file_handle;
+	LARGE_INTEGER file_size;
+#else /* _WIN32 */
+	struct stat file_stat;
+	void *data;
+#endif /* _WIN32 */
+
+	/* Sanity checks */
+	assert(in_file != NULL);
+	assert(mapping != NULL);
+
+	mapping->data = NULL;
+	mapping->size = 0;
+	mapping->handle = NULL;
+
+#ifdef _WIN32
+	file_handle = (HANDLE)_get_osfhandle(_fileno(in_file));
+	if((file_handle == INVALID_HANDLE_VALUE) || !GetFileSizeEx(file_handle, &file_size))
+	{
+		rc = KCR_RC_ERROR;
+		goto EXIT_LABEL;
+	}
+	mapping->size = (unsigned long long)file_size.QuadPart;
+	if(mapping->size == 0)
+	{
+		goto EXIT_LABEL;
+	}
+	mapping->handle = CreateFileMapping(file_handle, NULL, PAGE_READONLY, 0, 0, NULL);
+	if(mapping->handle == NULL)
+	{
+		rc = KCR_RC_ERROR;
+		goto EXIT_LABEL;
+	}
+	mapping->data = MapViewOfFile((HANDLE)mapping->handle, FILE_MAP_READ, 0, 0, 0);
+	if(mapping->data == NULL)
+	{
+		CloseHandle((HANDLE)mapping->handle);
+		mapping->handle = NULL;
+		rc = KCR_RC_ERROR;
+	}
+#else /* _WIN32 */
+	if(fstat(fileno(in_file), &file_stat) != 0)
+	{
+		rc = KCR_RC_ERROR;
+		goto EXIT_LABEL;
+	}
+	mapping->size = (unsigned long long)file_stat.st_size;
+	if(mapping->size == 0)
+	{
+		goto EXIT_LABEL;
+	}
+	data = mmap(NULL, (size_t)mapping->size, PROT_READ, MAP_SHARED, fileno(in_file), 0);
+	if(data == MAP_FAILED)
+	{
+		rc = KCR_RC_ERROR;
+		goto EXIT_LABEL;
+	}
+	mapping->data = data;
+#endif /* _WIN32 */
+
+EXIT_LABEL:
+	if(rc != KCR_RC_OK)
+	{
+		mapping->size = 0;
+	}
+
+	/* Return */
+	return(rc);
+}
+
+/***************************************************************************************
+ * Name: kcr_unmap_file()
+ *
+ * Purpose: Release a mapping made by kcr_map_file().
+ *
+ * Parameters: IN/OUT mapping - the mapping.  Safe to call on an empty mapping.
+ *
+ * Returns: Nothing.
+ ***************************************************************************************/
+void kcr_unmap_file(KCR_MAPPING *mapping)
+{
+	/* Sanity checks */
+	assert(mapping != NULL);
+
+	if(mapping->data != NULL)
+	{
+#ifdef _WIN32
+		UnmapViewOfFile(mapping->data);
+		CloseHandle((HANDLE)mapping->handle);
+#else /* _WIN32 */
+		munmap((void *)mapping->data, (size_t)mapping->size);
+#endif /* _WIN32 */
+	}
+	mapping->data = NULL;
+	mapping->size = 0;
+	mapping->handle = NULL;
+
+	/* Return */
+	return;
+}
+
+/***************************************************************************************
+ * Name: kcr_thread_start()
+ *
+ * Purpose: Entry point of every thread created by kcr_thread_create().
+ *
+ * Parameters: IN     arg - the KCR_THREAD CB of the thread
+ *
+ * Returns: Nothing of interest.
+ *
+ * Operation: Call the function recorded in the CB with its argument.
+ ***************************************************************************************/
+#ifdef _WIN32
+static DWORD WINAPI kcr_thread_start(LPVOID arg)
+#else /* _WIN32 */
+static void *kcr_thread_start(void *arg)
+#endif /* _WIN32 */
+{
+	/* Local variables */
+	KCR_THREAD *thread = (KCR_THREAD *)arg;
+
+	thread->function(thread->arg);
+
+	/* Return */
+	return(0);
+}
+
+/***************************************************************************************
+ * Name: kcr_thread_create()
+ *
+ * Purpose: Start a thread.
+ *
+ * Parameters: OUT    thread - CB for the thread.  Must stay valid until the thread has
+ *                             been joined.
+ *             IN     function - function for the thread to run
+ *             IN     arg - argument to pass to the function
+ *
+ * Returns: rc - KCR_RC_OK if ok or KCR_RC_ERROR if the thread could not be started.
+ ***************************************************************************************/
+unsigned short kcr_thread_create(KCR_THREAD *thread, void (*function)(void *), void *arg)
+{
+	/* Local variables */
+	unsigned short rc = KCR_RC_OK;
+
+	/* Sanity checks */
+	assert(thread != NULL);
+	assert(function != NULL);
+
+	thread->function = function;
+	thread->arg = arg;
+#ifdef _WIN32
+	thread->handle = CreateThread(NULL, 0, kcr_thread_start, thread, 0, NULL);
+	if(thread->handle == NULL)
+	{
+		rc = KCR_RC_ERROR;
+	}
+#else /* _WIN32 */
+	if(pthread_create(&thread->handle, NULL, kcr_thread_start, thread) != 0)
+	{
+		rc = KCR_RC_ERROR;
+	}
+#endif /* _WIN32 */
+
+	/* Return */
+	return(rc);
+}
+
+/***************************************************************************************
+ * Name: kcr_thread_join()
+ *
+ * Purpose: Wait for a thread started by kcr_thread_create() to finish.
+ *
+ * Parameters: IN     thread - CB for the thread
+ *
+ * Returns: Nothing.
+ ***************************************************************************************/
+void kcr_thread_join(KCR_THREAD *thread)
+{
+	/* Sanity checks */
+	assert(thread != NULL);
+
+#ifdef _WIN32
+	WaitForSingleObject(thread->handle, INFINITE);
+	CloseHandle(thread->handle);
+#else /* _WIN32 */
+	pthread_join(thread->handle, NULL);
+#endif /* _WIN32 */
+
+	/* Return */
+	return;
+}
+
+/***************************************************************************************
+ * Name: kcr_num_cpus()
+ *
+ * Purpose: Get the number of processors available.
+ *
+ * Parameters: None.
+ *
+ * Returns: The number of online processors (at least 1).
+ ***************************************************************************************/
+unsigned short kcr_num_cpus(void)
+{
+	/* Local variables */
+	long no_cpus;
+#ifdef _WIN32
+	SYSTEM_INFO system_info;
+
+	GetSystemInfo(&system_info);
+	no_cpus = (long)system_info.dwNumberOfProcessors;
+#else /* _WIN32 */
+	no_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+#endif /* _WIN32 */
+
+	/* Return */
+	return((unsigned short)KCR_MAX(1, KCR_MIN(no_cpus, KCR_MAX_THREADS)));
+}
+
+/***************************************************************************************
+ * Name: kcr_commit_file()
+ *
+ * Purpose: Make sure everything written to a file has reached the disk.
+ *
+ * Parameters: IN     out_file - the file
+ *
+ * Returns: rc - KCR_RC_OK if ok or KCR_RC_ERROR if error.
+ ***************************************************************************************/
+unsigned short kcr_commit_file(FILE *out_file)
+{
+	/* Local variables */
+	unsigned short rc = KCR_RC_OK;
+
+	/* Sanity checks */
+	assert(out_file != NULL);
+
+	if(fflush(out_file) != 0)
+	{
+		rc = KCR_RC_ERROR;
+		goto EXIT_LABEL;
+	}
+#ifdef _WIN32
+	if(_commit(_fileno(out_file)) != 0)
+#else /* _WIN32 */
+	if(fsync(fileno(out_file)) != 0)
+#endif /* _WIN32 */
+	{
+		rc = KCR_RC_ERROR;
+	}
+
+EXIT_LABEL:
+	/* Return */
+	return(rc);
+}
+
+/***************************************************************************************
+ * Name: kcr_replace_file()
+ *
+ * Purpose: Atomically rename a file over another, replacing it.
+ *
+ * Parameters: IN     from_name - the new file
+ *             IN     to_name - the file to replace (need not exist)
+ *
+ * Returns: rc - KCR_RC_OK if ok or KCR_RC_ERROR if error.
+ ***************************************************************************************/
+unsigned short kcr_replace_file(const char *from_name, const char *to_name)
+{
+	/* Local variables */
+	unsigned short rc = KCR_RC_OK;
+
+	/* Sanity checks */
+	assert(from_name != NULL);
+	assert(to_name != NULL);
+
+#ifdef _WIN32
+	if(!MoveFileEx(from_name, to_name, MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH))
+#else /* _WIN32 */
+	if(rename(from_name, to_name) != 0)
+#endif /* _WIN32 */
+	{
+		fprintf(stderr,"Error: cannot replace %s\n", to_name);
+		rc = KCR_RC_ERROR;
+	}
+
+	/* Return */
+	return(rc);
+}
+
+/***************************************************************************************
+ * Name: kcr_fork_process()
+ *
+ * Purpose: Create a copy-on-write child process, where the operating system can.
+ *
+ * Parameters: None.
+ *
+ * Returns: KCR_FORK_CHILD in the child, KCR_FORK_PARENT in the parent, or
+ *          KCR_FORK_NONE if no child was created (fork failed, or Windows, which
+ *          cannot fork).
+ *
+ * Operation: All output streams are flushed first so that the child does not
+ *            inherit, and later repeat, buffered output.
+ ***************************************************************************************/
+unsigned short kcr_fork_process(void)
+{
+	/* Local variables */
+	unsigned short result = KCR_FORK_NONE;
+#ifndef _WIN32
+	pid_t pid;
+
+	fflush(NULL);
+	pid = fork();
+	if(pid == 0)
+	{
+		result = KCR_FORK_CHILD;
+	}
+	else if(pid > 0)
+	{
+		result = KCR_FORK_PARENT;
+	}
+#endif /* _WIN32 */
+
+	/* Return */
+	return(result);
+}
+
+/***************************************************************************************
+ * Name: kcr_exit_process()
+ *
+ * Purpose: End a child created by kcr_fork_process().
+ *
+ * Parameters: IN     rc - KCR_RC_OK to exit with status 0, else status 1
+ *
+ * Returns: Does not return.
+ *
+ * Operation: The child must have closed its own files.  _exit() does not flush the
+ *            stdio buffers, so any output the child inherited from the parent is not
+ *            written a second time.
+ ***************************************************************************************/
+void kcr_exit_process(unsigned short rc)
+{
+#ifndef _WIN32
+	_exit((rc == KCR_RC_OK) ? 0 : 1);
+#else /* _WIN32 */
+	exit((rc == KCR_RC_OK) ? 0 : 1);
+#endif /* _WIN32 */
+}
+
+/***************************************************************************************
+ * Name: kcr_wait_process()
+ *
+ * Purpose: Wait for any child created by kcr_fork_process() to exit.
+ *
+ * Parameters: None.
+ *
+ * Returns: rc - KCR_RC_OK if the child exited with status 0, else KCR_RC_ERROR
+ *               (including when there is no child to wait for).
+ ***************************************************************************************/
+unsigned short kcr_wait_process(void)
+{
+	/* Local variables */
+	unsigned short rc = KCR_RC_ERROR;
+#ifndef _WIN32
+	int status;
+
+	if((wait(&status) > 0) && WIFEXITED(status) && (WEXITSTATUS(status) == 0))
+	{
+		rc = KCR_RC_OK;
+	}
+#endif /* _WIN32 */
+
+	/* Return */
+	return(rc);
+}
+
+/***************************************************************************************
+ * Name: kcr_touch_file()
+ *
+ * Purpose: Set the modification time of a file to now.
+ *
+ * Parameters: IN     name - the file
+ *
+ * Returns: Nothing.  Failure is ignored.
+ ***************************************************************************************/
+void kcr_touch_file(const char *name)
+{
+	/* Sanity checks */
+	assert(name != NULL);
+
+#ifdef _WIN32
+	_utime(name, NULL);
+#else /* _WIN32 */
+	utime(name, NULL);
+#endif /* _WIN32 */
+
+	/* Return */
+	return;
+}
+
+/***************************************************************************************
+ * Name: kcr_list_files()
+ *
+ * Purpose: List the files in a directory whose names end in a given suffix.
+ *
+ * Parameters: IN     dir_name - the directory
+ *             IN     suffix - the suffix
+ *             OUT    files - array of the files found, with their full names, sizes
+ *                            and modification times, to be freed by
+ *                            kcr_free_file_list()
+ *             OUT    no_files - number of files found
+ *
+ * Returns: rc - KCR_RC_OK if ok or KCR_RC_ERROR if the directory cannot be read.
+ ***************************************************************************************/
+unsigned short kcr_list_files(const char *dir_name,
+                              const char *suffix,
+                              KCR_FILE_INFO **files,
+                              unsigned long *no_files)
+{
+	/* Local variables */
+	KCR_FILE_INFO *file_array = NULL;
+	KCR_FILE_INFO *new_array;
+	unsigned long array_size = 0;
+	const char *entry_name;
+	size_t name_length;
+	char *full_name;
+	unsigned short rc = KCR_RC_OK;
+#ifdef _WIN32
+	char *pattern;
+	HANDLE find_handle;
+	WIN32_FIND_DATA find_data;
+#else /* _WIN32 */
+	DIR *dir;
+	struct dirent *entry;
+	struct stat file_stat;
+#endif /* _WIN32 */
+
+	/* Sanity checks */
+	assert(dir_name != NULL);
+	assert(suffix != NULL);
+
+	*no_files = 0;
+#ifdef _WIN32
+	pattern = (char *)malloc(strlen(dir_name) + strlen(suffix) + 3);
+	if(pattern == NULL)
+	{
+		rc = KCR_RC_ERROR;
+		goto EXIT_LABEL;
+	}
+	sprintf(pattern, "%s/*%s", dir_name, suffix);
+	find_handle = FindFirstFile(pattern, &find_data);
+	free(pattern);
+	if(find_handle == INVALID_HANDLE_VALUE)
+	{
+		/* Nothing matches */
+		goto EXIT_LABEL;
+	}
+	do
+	{
+		entry_name = find_data.cFileName;
+#else /* _WIN32 */
+	dir = opendir(dir_name);
+	if(dir == NULL)
+	{
+		rc = KCR_RC_ERROR;
+		goto EXIT_LABEL;
+	}
+	while((entry = readdir(dir)) != NULL)
+	{
+		entry_name = entry->d_name;
+#endif /* _WIN32 */
+		name_length = strlen(entry_name);
+		if((name_length < strlen(suffix)) ||
+		   (strcmp(entry_name + name_length - strlen(suffix), suffix) != 0))
+		{
+			continue;
+		}
+
+		/* Grow the array as needed */
+		if(*no_files == array_size)
+		{
+			array_size = KCR_MAX(16, 2*array_size);
+			new_array = (KCR_FILE_INFO *)realloc(file_array, array_size*sizeof(KCR_FILE_INFO));
+			if(new_array == NULL)
+			{
+				rc = KCR_RC_ERROR;
+				break;
+			}
+			file_array = new_array;
+		}
+		full_name = (char *)malloc(strlen(dir_name) + name_length + 2);
+		if(full_name == NULL)
+		{
+			rc = KCR_RC_ERROR;
+			break;
+		}
+		sprintf(full_name, "%s/%s", dir_name, entry_name);
+#ifdef _WIN32
+		file_array[*no_files].size = ((unsigned long long)find_data.nFileSizeHigh << 32) |
+		                             find_data.nFileSizeLow;
+		file_array[*no_files].mtime = ((long long)find_data.ftLastWriteTime.dwHighDateTime << 32) |
+		                              find_data.ftLastWriteTime.dwLowDateTime;
+#else /* _WIN32 */
+		if(stat(full_name, &file_stat) != 0)
+		{
+			/* Removed since it was listed */
+			free(full_name);
+			continue;
+		}
+		file_array[*no_files].size = (unsigned long long)file_stat.st_size;
+		file_array[*no_files].mtime = (long long)file_stat.st_mtime;
+#endif /* _WIN32 */
+		file_array[*no_files].name = full_name;
+		(*no_files)++;
+#ifdef _WIN32
+	} while(FindNextFile(find_handle, &find_data));
+	FindClose(find_handle);
+#else /* _WIN32 */
+	}
+	closedir(dir);
+#endif /* _WIN32 */
+
+EXIT_LABEL:
+	if(rc != KCR_RC_OK)
+	{
+		kcr_free_file_list(file_array, *no_files);
+		file_array = NULL;
+		*no_files = 0;
+	}
+	*files = file_array;
+
+	/* Return */
+	return(rc);
+}
+
+/***************************************************************************************
+ * Name: kcr_free_file_list()
+ *
+ * Purpose: Free the array allocated by kcr_list_files().
+ *
+ * Parameters: IN     files - the array (may be NULL)
+ *             IN     no_files - number of files in it
+ *
+ * Returns: Nothing.
+ ***************************************************************************************/
+void kcr_free_file_list(KCR_FILE_INFO *files, unsigned long no_files)
+{
+	/* Local variables */
+	unsigned long curr_file;
+
+	if(files != NULL)
+	{
+		for(curr_file = 0; curr_file < no_files; curr_file++)
+		{
+			free(files[curr_file].name);
+		}
+		free(files);
+	}
+
+	/* Return */
+	return;
+}
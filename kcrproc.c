@@ -6,6 +6,43 @@
 
 #include <kcr.h>
 
+/***************************************************************************************
+ * Set by kcr_request_stop() when the simulator is asked to stop (e.g. by SIGTERM).
+ ***************************************************************************************/
+static volatile sig_atomic_t kcr_stop_requested = 0;
+
+/***************************************************************************************
+ * Interaction kernels, indexed by the number of populations.  Entry 0 is the generic
+ * kernel, used when there are more than KCR_MAX_SPECIALISED_POPS populations.
+ ***************************************************************************************/
+static const KCR_INTERACTION_KERNEL kcr_interaction_kernels[KCR_MAX_SPECIALISED_POPS + 1] =
+{
+    kcr_interactions, kcr_interactions_1, kcr_interactions_2, kcr_interactions_3, kcr_interactions_4
+};
+static const KCR_INTERACTION_KERNEL1D kcr_interaction_kernels1d[KCR_MAX_SPECIALISED_POPS + 1] =
+{
+    kcr_interactions1d, kcr_interactions1d_1, kcr_interactions1d_2, kcr_interactions1d_3, kcr_interactions1d_4
+};
+
+/***************************************************************************************
+ * Name: kcr_request_stop()
+ *
+ * Purpose: Signal handler asking the simulation to stop at the end of the current
+ *          time step.
+ *
+ * Parameters: IN     signal_no - the signal received
+ *
+ * Returns: Nothing.
+ ***************************************************************************************/
+void kcr_request_stop(int signal_no)
+{
+    (void)signal_no;
+    kcr_stop_requested = 1;
+
+    /* Return */
+    return;
+}
+
 /***************************************************************************************
  * Name: kcr_perform_simulation()
  *
@@ -16,79 +53,154 @@
  *
  * Returns: Nothing.
  *
+ * Operation: Perform time steps from root_data->current_time (0, or the time of the
+ *            checkpoint a run was restarted from) until root_data->total_time has
+ *            passed.  If checkpointing is on, write a checkpoint every
+ *            root_data->checkpoint_interval steps.  If a stop is requested, write a
+ *            checkpoint (if checkpointing is on) and stop early.
+ ***************************************************************************************/
+void kcr_perform_simulation(FILE *end_file, KCR_ROOT_DATA *root_data)
+{
+    /* Sanity checks. */
+	assert(root_data != NULL);
+	
+	while(root_data->current_time < root_data->total_time)
+	{
+        kcr_perform_time_step(end_file, root_data);
+
+        if((root_data->checkpoint_name != NULL) &&
+           (kcr_stop_requested ||
+            ((root_data->checkpoint_interval != 0) &&
+             (root_data->current_time % root_data->checkpoint_interval == 0))))
+        {
+            kcr_write_checkpoint(root_data);
+        }
+        if(kcr_stop_requested)
+        {
+            fprintf(stderr,"Simulation stopped after time step %lu\n", root_data->current_time);
+            break;
+        }
+    }
+  
+    /* Return */
+    return;
+}
+
+/***************************************************************************************
+ * Name: kcr_perform_time_step()
+ *
+ * Purpose: Perform one time step of the simulation.
+ *
+ * Parameters: IN    end_file - file for putting-out end locations
+ *             IN    root_data - pointer to a CB containing all the root data for KCR.
+ *
+ * Returns: Nothing.
+ *
  * Operation: Loop through the list of individuals, calling into the function that moves
  *            an individual and stores its position, resource and territorial cue data.  
- *            Repeat this process until root_data->total_time has passed.
+ *            In event-driven mode the moves due by the end of the step are made first,
+ *            in time order, and with multirate time steps the sweeps due in the step;
+ *            the loop then only prints the positions.
  ***************************************************************************************/
-void kcr_perform_simulation(FILE *end_file, KCR_ROOT_DATA *root_data)
+void kcr_perform_time_step(FILE *end_file, KCR_ROOT_DATA *root_data)
 {
 	/* Local variables */
 	KCR_INDIVIDUAL *curr_indiv_cb;
     KCR_POPULATION *curr_pop_cb;
-    unsigned long counter;
 
-    /* Sanity checks. Current time step should be 0. */
+    /* Sanity checks. */
 	assert(root_data != NULL);
-	assert(root_data->current_time == 0);
 	
 	/* Loop through all the individuals, moving them according to the rules and 
-     * updating the per-population mark information.
-     * Repeat for each time step */
-	while(root_data->current_time < root_data->total_time)
-	{
-        root_data->current_time++;
-        curr_pop_cb = (KCR_POPULATION *)LIST_GET_FIRST(root_data->population_list_root);                        
-        while(curr_pop_cb != NULL)
+     * updating the per-population mark information. */
+    root_data->current_time++;
+    if((root_data->env_frames.next_frame < root_data->env_frames.no_frames) &&
+       (root_data->current_time >= root_data->env_frames.switch_times[root_data->env_frames.next_frame]))
+    {
+        /* Next environmental frame (normally already loaded in the background) */
+        if(kcr_switch_env_frame(root_data) != KCR_RC_OK)
         {
-            /* Go through individuals in current population, moving each */
-			curr_indiv_cb = (KCR_INDIVIDUAL *)LIST_GET_FIRST(curr_pop_cb->individual_list_root);                        
-            while(curr_indiv_cb != NULL)
+            fprintf(stderr,"Error: cannot switch environmental frame at time step %lu\n", root_data->current_time);
+            kcr_request_stop(0);
+        }
+    }
+    if(root_data->events_active == KCR_YES)
+    {
+        /* Event-driven: make the moves falling in this time step */
+        kcr_perform_events(root_data, (double)root_data->current_time);
+    }
+    else if(root_data->multirate_active == KCR_YES)
+    {
+        /* Multirate: make the sweeps due in this time step */
+        kcr_perform_multirate_moves(root_data);
+    }
+    curr_pop_cb = (KCR_POPULATION *)LIST_GET_FIRST(root_data->population_list_root);                        
+    while(curr_pop_cb != NULL)
+    {
+        /* Go through individuals in current population, moving each */
+		curr_indiv_cb = (KCR_INDIVIDUAL *)LIST_GET_FIRST(curr_pop_cb->individual_list_root);                        
+        while(curr_indiv_cb != NULL)
+        {
+            /* Move the current individual, unless moves are event-driven or multirate */
+            if((root_data->events_active != KCR_YES) && (root_data->multirate_active != KCR_YES))
             {
-                /* Move the current individual */
                 if(root_data->box_height == 1)
                 {
                     kcr_move_individual1d(curr_indiv_cb, curr_pop_cb, root_data);
-				}
-				else
-				{
+                }
+                else if(root_data->box_depth > 1)
+                {
+                    kcr_move_individual3d(curr_indiv_cb, curr_pop_cb, root_data);
+                }
+                else
+                {
                     kcr_move_individual(curr_indiv_cb, curr_pop_cb, root_data);
-				}
+                }
+            }
 
-                if((double)root_data->current_time >= root_data->start_measure_time)
-                {
-                	/* Print out locations of individuals */
-                	printf("%i\t%i\t",curr_indiv_cb->current_x_pos,curr_indiv_cb->current_y_pos);
-                	if(((double)root_data->current_time == root_data->total_time) && (end_file != NULL))
-                	{
-                		/* Last time step.  Print out end locations */
-                		fprintf(end_file, "%i\t%i\t",curr_indiv_cb->current_x_pos,curr_indiv_cb->current_y_pos);
+            if((double)root_data->current_time >= root_data->start_measure_time)
+            {
+            	/* Print out locations of individuals */
+            	fprintf(root_data->out_file, "%i\t%i\t",curr_indiv_cb->current_x_pos,curr_indiv_cb->current_y_pos);
+            	if(root_data->box_depth > 1)
+            	{
+            		fprintf(root_data->out_file, "%lu\t",curr_indiv_cb->current_z_pos);
+				}
+            	if(((double)root_data->current_time == root_data->total_time) && (end_file != NULL))
+            	{
+            		/* Last time step.  Print out end locations */
+            		fprintf(end_file, "%i\t%i\t",curr_indiv_cb->current_x_pos,curr_indiv_cb->current_y_pos);
+            		if(root_data->box_depth > 1)
+            		{
+            			fprintf(end_file, "%lu\t",curr_indiv_cb->current_z_pos);
 					}
-			    }
-			    
-			    /* Individual cannot have moved outside the box */
-                assert(curr_indiv_cb->current_x_pos >= 0);
-                assert(curr_indiv_cb->current_y_pos >= 0);
-                assert(curr_indiv_cb->current_x_pos < root_data->box_width);
-                assert(curr_indiv_cb->current_y_pos < root_data->box_height);
-
-                /* Get the next CB */
-                curr_indiv_cb = (KCR_INDIVIDUAL *)LIST_GET_NEXT(curr_indiv_cb->list_elt);
-            }
+				}
+		    }
+		    
+		    /* Individual cannot have moved outside the box */
+            assert(curr_indiv_cb->current_x_pos >= 0);
+            assert(curr_indiv_cb->current_y_pos >= 0);
+            assert(curr_indiv_cb->current_x_pos < root_data->box_width);
+            assert(curr_indiv_cb->current_y_pos < root_data->box_height);
+            assert(curr_indiv_cb->current_z_pos < root_data->box_depth);
 
-            /* Get next population */
-            curr_pop_cb = (KCR_POPULATION *)LIST_GET_NEXT(curr_pop_cb->list_elt);
+            /* Get the next CB */
+            curr_indiv_cb = (KCR_INDIVIDUAL *)LIST_GET_NEXT(curr_indiv_cb->list_elt);
         }
-        if((double)root_data->current_time >= root_data->start_measure_time)
-        {
-          	/* Gone through all populations: carriage return */
-          	printf("\n");
-           	if(((double)root_data->current_time == root_data->total_time) && (end_file != NULL))
-           	{
-           		/* Last time step.  Print out end locations */
-           		fprintf(end_file, "\n");
-			}
-		}
+
+        /* Get next population */
+        curr_pop_cb = (KCR_POPULATION *)LIST_GET_NEXT(curr_pop_cb->list_elt);
     }
+    if((double)root_data->current_time >= root_data->start_measure_time)
+    {
+      	/* Gone through all populations: carriage return */
+      	fprintf(root_data->out_file, "\n");
+       	if(((double)root_data->current_time == root_data->total_time) && (end_file != NULL))
+       	{
+       		/* Last time step.  Print out end locations */
+       		fprintf(end_file, "\n");
+		}
+	}
   
     /* Return */
     return;
@@ -105,7 +217,8 @@ void kcr_perform_simulation(FILE *end_file, KCR_ROOT_DATA *root_data)
  *
  * Returns: Nothing.
  *
- * Operation: Move individual and deposit marks
+ * Operation: Weigh the four moves with kcr_move_weights(), choose one at random,
+ *            and deposit marks: the individual marks the site it moves to.
  ***************************************************************************************/
 void kcr_move_individual(KCR_INDIVIDUAL *individual, 
                          KCR_POPULATION *population, 
@@ -113,105 +226,147 @@ void kcr_move_individual(KCR_INDIVIDUAL *individual,
 {
 	/* Local variables */
 	double random;
+	double weights[4];
+
+    /* Sanity checks. */
+	assert(root_data != NULL);
+	assert(individual != NULL);
+	assert(population != NULL);
+	
+    kcr_move_weights(individual, population, root_data, weights, NULL);
+
+    /* Get a random number between 0 and up+down+left+right */
+    random = kcr_rng_uniform(&root_data->rng)*(weights[0]+weights[1]+weights[2]+weights[3]);
+
+   	/* Use this random number to determine next position */
+   	if(random < weights[0])
+   	{
+   		/* Move down */
+   		individual->current_y_pos = root_data->y_axis.lo_dest[individual->current_y_pos];
+	}
+	else if(random < weights[0] + weights[1])
+	{
+   		/* Move up */
+   		individual->current_y_pos = root_data->y_axis.hi_dest[individual->current_y_pos];
+	}
+	else if(random < weights[0] + weights[1] + weights[2])
+	{
+   		/* Move left */
+   		individual->current_x_pos = root_data->x_axis.lo_dest[individual->current_x_pos];
+	}
+   	else if((weights[3] > 0) || (root_data->habitat_mask == NULL))
+   	{
+   		/* Move right (with a habitat mask, an individual with no open move stays put) */
+   		individual->current_x_pos = root_data->x_axis.hi_dest[individual->current_x_pos];
+    }
+    if((individual->current_x_pos == KCR_OUTSIDE) || (individual->current_y_pos == KCR_OUTSIDE))
+    {
+        /* Stepped off an absorbing edge: replaced by a new individual */
+        kcr_place_individual(individual, root_data);
+    }
+   
+    if(root_data->marks_active == KCR_YES)
+    {
+        /* Mark the site moved to */
+        kcr_deposit_mark(root_data, individual->current_x_pos, individual->current_y_pos, population->index);
+    }
+
+    /* Return */
+    return;
+}
+
+/***************************************************************************************
+ * Name: kcr_move_weights()
+ *
+ * Purpose: Weigh the moves an individual can make.
+ *
+ * Parameters: IN     individual - the individual
+ *             IN     population - pointer to the population CB containing this individual
+ *             IN     root_data - pointer to a CB containing all the root data for KCR.
+ *             OUT    weights - weights of moving down, up, left and right, in that order
+ *             OUT    drifts - if not NULL, the horizontal and vertical drifts
+ *
+ * Returns: Nothing.
+ *
+ * Operation: The drift is the sum of the interactions with nearby individuals and, if
+ *            the environmental layer is active, env_weight times its gradient at the
+ *            individual's site, and, if there are marks, the response to the mark
+ *            gradients.  Each move is weighted (1 +/- drift)/4, and moves across a
+ *            reflecting edge or into a blocked cell have no weight.  The probability
+ *            of a move is its weight over the sum of the weights.
+ ***************************************************************************************/
+void kcr_move_weights(KCR_INDIVIDUAL *individual,
+                      KCR_POPULATION *population,
+                      KCR_ROOT_DATA *root_data,
+                      double *weights,
+                      double *drifts)
+{
+	/* Local variables */
 	double up;
 	double down;
 	double left;
 	double right;
 	double sx;
 	double sy;
-	KCR_POPULATION *curr_pop_cb;
-	KCR_INDIVIDUAL *curr_indiv_cb;
-	double delta;
 	double popsum;
+	unsigned long index;
 
     /* Sanity checks. */
 	assert(root_data != NULL);
 	assert(individual != NULL);
 	assert(population != NULL);
+	assert(weights != NULL);
 	
-    /* Calculate probabilities of moving up/down/left/right */
-#ifdef KCR_PBC
-	down = 1;
-	up = 1;
-	left = 1;
-	right = 1;
-#else /* KCR_PBC */
-    if(individual->current_y_pos == 0)
-    {
-    	/* Cannot move down */
-    	down = 0;
-	}
-	else
-	{
-    	/* Can move down */
-		down = 1;
-	}
-    if(individual->current_y_pos == root_data->box_height - 1)
-    {
-    	/* Cannot move up */
-    	up = 0;
-	}
-	else
-	{
-    	/* Can move up */
-		up = 1;
-	}
-    if(individual->current_x_pos == 0)
-    {
-    	/* Cannot move left */
-    	left = 0;
-	}
-	else
-	{
-    	/* Can move left */
-		left = 1;
-	}
-    if(individual->current_x_pos == root_data->box_width - 1)
+    /* Calculate probabilities of moving up/down/left/right: a reflecting edge cannot
+     * be crossed */
+    down = root_data->y_axis.lo_weight[individual->current_y_pos];
+    up = root_data->y_axis.hi_weight[individual->current_y_pos];
+    left = root_data->x_axis.lo_weight[individual->current_x_pos];
+    right = root_data->x_axis.hi_weight[individual->current_x_pos];
+    if(root_data->habitat_mask != NULL)
     {
-    	/* Cannot move right */
-    	right = 0;
-	}
-	else
-	{
-    	/* Can move right */
-		right = 1;
-	}
-#endif /* KCR_PBC */
+        /* Nor can a blocked cell be entered */
+        if(KCR_MASK_BLOCKED(root_data->habitat_mask,
+                            KCR_GRID_INDEX(&root_data->grid, individual->current_x_pos,
+                                           root_data->y_axis.lo_stencil[individual->current_y_pos])))
+        {
+            down = 0;
+        }
+        if(KCR_MASK_BLOCKED(root_data->habitat_mask,
+                            KCR_GRID_INDEX(&root_data->grid, individual->current_x_pos,
+                                           root_data->y_axis.hi_stencil[individual->current_y_pos])))
+        {
+            up = 0;
+        }
+        if(KCR_MASK_BLOCKED(root_data->habitat_mask,
+                            KCR_GRID_INDEX(&root_data->grid, root_data->x_axis.lo_stencil[individual->current_x_pos],
+                                           individual->current_y_pos)))
+        {
+            left = 0;
+        }
+        if(KCR_MASK_BLOCKED(root_data->habitat_mask,
+                            KCR_GRID_INDEX(&root_data->grid, root_data->x_axis.hi_stencil[individual->current_x_pos],
+                                           individual->current_y_pos)))
+        {
+            right = 0;
+        }
+    }
 
     /* Weights for going vertically and horizontally */
     sx = 0;
     sy = 0;
     popsum = 0;
-    /* Go through populations counting number of animals within R_AA,R_AB,R_BA,R_BB of the current individual */
-    curr_pop_cb = (KCR_POPULATION *)LIST_GET_FIRST(root_data->population_list_root);                        
-    while(curr_pop_cb != NULL)
+    /* Sum the interactions with every individual, from the kernel's tables if it is
+     * tabulated, else using the kernel specialised for this number of populations if
+     * there is one */
+    if(root_data->kernel_shape != KCR_KERNEL_DIRECT)
     {
-        curr_indiv_cb = (KCR_INDIVIDUAL *)LIST_GET_FIRST(curr_pop_cb->individual_list_root);                        
-        while(curr_indiv_cb != NULL)
-        {
-            delta = root_data->deltas[curr_pop_cb->index + population->index*root_data->no_pops];
-        	if((pow(KCR_DIFF(curr_indiv_cb->current_x_pos,individual->current_x_pos,root_data->box_width)*root_data->l_val,2)+
-			    pow(KCR_DIFF(curr_indiv_cb->current_y_pos,individual->current_y_pos,root_data->box_height)*root_data->l_val,2) <= pow(delta,2)) &&
-			   (pow(KCR_DIFF(curr_indiv_cb->current_x_pos,individual->current_x_pos,root_data->box_width)*root_data->l_val,2)+
-			    pow(KCR_DIFF(curr_indiv_cb->current_y_pos,individual->current_y_pos,root_data->box_height)*root_data->l_val,2) > 0))
-			{
-			    sx += (root_data->l_val*root_data->aijs[curr_pop_cb->index + population->index*root_data->no_pops]
-			        *(1/(2*KCR_PI*pow(delta,2)))*KCR_DIFF(curr_indiv_cb->current_x_pos,individual->current_x_pos,root_data->box_width)/
-					  sqrt(pow(KCR_DIFF(curr_indiv_cb->current_x_pos,individual->current_x_pos,root_data->box_width),2)+
-			               pow(KCR_DIFF(curr_indiv_cb->current_y_pos,individual->current_y_pos,root_data->box_height),2)));
-			    sy += (root_data->l_val*root_data->aijs[curr_pop_cb->index + population->index*root_data->no_pops]
-			        *(1/(2*KCR_PI*pow(delta,2)))*KCR_DIFF(curr_indiv_cb->current_y_pos,individual->current_y_pos,root_data->box_height)/
-					  sqrt(pow(KCR_DIFF(curr_indiv_cb->current_x_pos,individual->current_x_pos,root_data->box_width),2)+
-			               pow(KCR_DIFF(curr_indiv_cb->current_y_pos,individual->current_y_pos,root_data->box_height),2)));
-			}
-			if((curr_indiv_cb->current_x_pos == individual->current_x_pos) && (curr_indiv_cb->current_y_pos == individual->current_y_pos))
-			{
-				/* Individuals are in the same place; increment popsum, storing sum of all populations at current point */
-				popsum+=1/pow(root_data->l_val,2);
-			}
-        	curr_indiv_cb = (KCR_INDIVIDUAL *)LIST_GET_NEXT(curr_indiv_cb->list_elt);
-        }
-        curr_pop_cb = (KCR_POPULATION *)LIST_GET_NEXT(curr_pop_cb->list_elt);
+        kcr_tabulated_interactions(individual, population, root_data, &sx, &sy, &popsum);
+    }
+    else
+    {
+        kcr_interaction_kernels[(root_data->no_pops <= KCR_MAX_SPECIALISED_POPS) ? root_data->no_pops : 0](
+            individual, population, root_data, &sx, &sy, &popsum);
     }
 
     if(root_data->packing_term == 1)
@@ -220,6 +375,18 @@ void kcr_move_individual(KCR_INDIVIDUAL *individual,
     	sy /= (1+root_data->kappa*popsum);
     	sx /= (1+root_data->kappa*popsum);
 	}
+    if(root_data->env_active == KCR_YES)
+    {
+    	/* Environmental taxis: drift up the (precomputed) gradient of the environment */
+    	index = KCR_GRID_INDEX(&root_data->grid, individual->current_x_pos, individual->current_y_pos);
+    	sx += root_data->env_weight*root_data->env_grad_x[index];
+    	sy += root_data->env_weight*root_data->env_grad_y[index];
+	}
+    if(root_data->marks_active == KCR_YES)
+    {
+    	/* Drift up or down the gradients of the scent marks */
+    	kcr_mark_drift(root_data, individual->current_x_pos, individual->current_y_pos, population->index, &sx, &sy);
+	}
     sy = max(-1,min(1,sy));
     sx = max(-1,min(1,sx));
     up *= (1+sy)/4;
@@ -227,7 +394,6 @@ void kcr_move_individual(KCR_INDIVIDUAL *individual,
     right *= (1+sx)/4;
     left *= (1-sx)/4;
     
-    /* Get a random number between 0 and up+down+left+right */
     assert(down<=1);
     assert(down>=0);
     assert(up<=1);
@@ -236,178 +402,548 @@ void kcr_move_individual(KCR_INDIVIDUAL *individual,
     assert(left>=0);
     assert(right<=1);
     assert(right>=0);
-    random = ((double)rand())*(down+up+left+right)/((double)RAND_MAX);
+    weights[0] = down;
+    weights[1] = up;
+    weights[2] = left;
+    weights[3] = right;
+    if(drifts != NULL)
+    {
+        drifts[0] = sx;
+        drifts[1] = sy;
+    }
+
+    /* Return */
+    return;
+}
+
+/***************************************************************************************
+ * Name: kcr_move_individual1d()
+ *
+ * Purpose: Move the individual in a 1d environment.
+ *
+ * Parameters: IN/OUT individual - the individual
+ *             IN     population - pointer to the population CB containing this individual
+ *             IN     root_data - pointer to a CB containing all the root data for KCR.
+ *
+ * Returns: Nothing.
+ *
+ * Operation: Weigh the two moves with kcr_move_weights1d(), choose one at random,
+ *            and deposit marks.
+ ***************************************************************************************/
+void kcr_move_individual1d(KCR_INDIVIDUAL *individual, 
+                           KCR_POPULATION *population, 
+						   KCR_ROOT_DATA *root_data)
+{
+	/* Local variables */
+	double random;
+	double weights[2];
+
+    /* Sanity checks. */
+	assert(root_data != NULL);
+	assert(individual != NULL);
+	assert(population != NULL);
+	
+    kcr_move_weights1d(individual, population, root_data, weights, NULL);
+
+    /* Get a random number between 0 and left+right */
+    random = kcr_rng_uniform(&root_data->rng)*(weights[0]+weights[1]);
 
    	/* Use this random number to determine next position */
-   	if(random < down)
-   	{
-   		/* Move down */
-#ifdef KCR_PBC
-   		individual->current_y_pos = KCR_MOD(individual->current_y_pos - 1, root_data->box_height);
-#else /* KCR_PBC */
-   		individual->current_y_pos -= 1;
-#endif /* KCR_PBC */
-	}
-	else if(random < down + up)
-	{
-   		/* Move up */
-#ifdef KCR_PBC
-   		individual->current_y_pos = KCR_MOD(individual->current_y_pos + 1, root_data->box_height);
-#else /* KCR_PBC */
-   		individual->current_y_pos += 1;
-#endif /* KCR_PBC */
-	}
-	else if(random < down + up + left)
+   	if(random < weights[0])
 	{
    		/* Move left */
-#ifdef KCR_PBC
-   		individual->current_x_pos = KCR_MOD(individual->current_x_pos - 1, root_data->box_width);
-#else /* KCR_PBC */
-   		individual->current_x_pos -= 1;
-#endif /* KCR_PBC */
+   		individual->current_x_pos = root_data->x_axis.lo_dest[individual->current_x_pos];
 	}
-#ifdef KCR_PBC
-   	else
+   	else if((weights[1] > 0) || (root_data->habitat_mask == NULL))
    	{
-   		/* Move right */
-   		individual->current_x_pos = KCR_MOD(individual->current_x_pos + 1, root_data->box_width);
+   		/* Move right (with a habitat mask, an individual with no open move stays put) */
+   		individual->current_x_pos = root_data->x_axis.hi_dest[individual->current_x_pos];
     }
-#else /* KCR_PBC */
-   	else if(individual->current_x_pos != root_data->box_width - 1)
-   	{
-   		/* Move right */
-   		individual->current_x_pos += 1;
+
+    /* y-positions should always be zero */
+    individual->current_y_pos = 0;
+    if(individual->current_x_pos == KCR_OUTSIDE)
+    {
+        /* Stepped off an absorbing edge: replaced by a new individual */
+        kcr_place_individual(individual, root_data);
     }
-#endif /* KCR_PBC */
    
+    if(root_data->marks_active == KCR_YES)
+    {
+        /* Mark the site moved to */
+        kcr_deposit_mark(root_data, individual->current_x_pos, individual->current_y_pos, population->index);
+    }
+
     /* Return */
     return;
 }
 
 /***************************************************************************************
- * Name: kcr_move_individual1d()
+ * Name: kcr_move_weights1d()
  *
- * Purpose: Move the individual in a 1d environment.
+ * Purpose: Weigh the moves an individual can make in a 1d environment.
  *
- * Parameters: IN/OUT individual - the individual
+ * Parameters: IN     individual - the individual
  *             IN     population - pointer to the population CB containing this individual
  *             IN     root_data - pointer to a CB containing all the root data for KCR.
+ *             OUT    weights - weights of moving left and right, in that order
+ *             OUT    drifts - if not NULL, the drift
  *
  * Returns: Nothing.
  *
- * Operation: Move individual and deposit marks
+ * Operation: As kcr_move_weights(), each move weighted (1 +/- drift)/2.
  ***************************************************************************************/
-void kcr_move_individual1d(KCR_INDIVIDUAL *individual, 
-                           KCR_POPULATION *population, 
-						   KCR_ROOT_DATA *root_data)
+void kcr_move_weights1d(KCR_INDIVIDUAL *individual,
+                        KCR_POPULATION *population,
+                        KCR_ROOT_DATA *root_data,
+                        double *weights,
+                        double *drifts)
 {
 	/* Local variables */
-	double random;
 	double left;
 	double right;
 	double sx;
-	KCR_POPULATION *curr_pop_cb;
-	KCR_INDIVIDUAL *curr_indiv_cb;
+	double sy = 0;
+	double popsum = 0;
 
     /* Sanity checks. */
 	assert(root_data != NULL);
 	assert(individual != NULL);
 	assert(population != NULL);
+	assert(weights != NULL);
 	
-    /* Calculate probabilities of moving left/right */
-#ifdef KCR_PBC
-	left = 1;
-	right = 1;
-#else /* KCR_PBC */
-    if(individual->current_x_pos == 0)
-    {
-    	/* Cannot move left */
-    	left = 0;
-	}
-	else
-	{
-    	/* Can move left */
-		left = 1;
-	}
-    if(individual->current_x_pos == root_data->box_width - 1)
+    /* Calculate probabilities of moving left/right: a reflecting edge cannot be
+     * crossed */
+    left = root_data->x_axis.lo_weight[individual->current_x_pos];
+    right = root_data->x_axis.hi_weight[individual->current_x_pos];
+    if(root_data->habitat_mask != NULL)
     {
-    	/* Cannot move right */
-    	right = 0;
-	}
-	else
-	{
-    	/* Can move right */
-		right = 1;
-	}
-#endif /* KCR_PBC */
+        /* Nor can a blocked cell be entered */
+        if(KCR_MASK_BLOCKED(root_data->habitat_mask,
+                            KCR_GRID_INDEX(&root_data->grid, root_data->x_axis.lo_stencil[individual->current_x_pos], 0)))
+        {
+            left = 0;
+        }
+        if(KCR_MASK_BLOCKED(root_data->habitat_mask,
+                            KCR_GRID_INDEX(&root_data->grid, root_data->x_axis.hi_stencil[individual->current_x_pos], 0)))
+        {
+            right = 0;
+        }
+    }
 
     /* Weights for going horizontally */
     sx = 0;
-    /* Go through populations counting number of animals within delta of the current individual */
-    curr_pop_cb = (KCR_POPULATION *)LIST_GET_FIRST(root_data->population_list_root);                        
-    while(curr_pop_cb != NULL)
+    /* Sum the interactions with every individual, from the kernel's tables if it is
+     * tabulated, else using the kernel specialised for this number of populations if
+     * there is one */
+    if(root_data->kernel_shape != KCR_KERNEL_DIRECT)
     {
-        curr_indiv_cb = (KCR_INDIVIDUAL *)LIST_GET_FIRST(curr_pop_cb->individual_list_root);                        
-        while(curr_indiv_cb != NULL)
-        {
-        	if((KCR_DIFF(curr_indiv_cb->current_x_pos,individual->current_x_pos,root_data->box_width)*root_data->l_val <= 
-			    root_data->deltas[curr_pop_cb->index + population->index*root_data->no_pops]) &&
-			   (KCR_DIFF(curr_indiv_cb->current_x_pos,individual->current_x_pos,root_data->box_width)*root_data->l_val > 0))
-			{
-				/* Individual just to the right: increment sx */
-			    sx += root_data->l_val*root_data->aijs[curr_pop_cb->index + population->index*root_data->no_pops]/(
-				    4*root_data->deltas[curr_pop_cb->index + population->index*root_data->no_pops]);
-			}
-        	else if((KCR_DIFF(curr_indiv_cb->current_x_pos,individual->current_x_pos,root_data->box_width)*root_data->l_val >= 
-			         -root_data->deltas[curr_pop_cb->index + population->index*root_data->no_pops]) &&
-			        (KCR_DIFF(curr_indiv_cb->current_x_pos,individual->current_x_pos,root_data->box_width)*root_data->l_val < 0))
-			{
-				/* Individual just to the left: decrement sx */
-			    sx -= root_data->l_val*root_data->aijs[curr_pop_cb->index + population->index*root_data->no_pops]/(
-				    4*root_data->deltas[curr_pop_cb->index + population->index*root_data->no_pops]);
-			}
-        	curr_indiv_cb = (KCR_INDIVIDUAL *)LIST_GET_NEXT(curr_indiv_cb->list_elt);
-        }
-        curr_pop_cb = (KCR_POPULATION *)LIST_GET_NEXT(curr_pop_cb->list_elt);
+        kcr_tabulated_interactions(individual, population, root_data, &sx, &sy, &popsum);
     }
+    else
+    {
+        kcr_interaction_kernels1d[(root_data->no_pops <= KCR_MAX_SPECIALISED_POPS) ? root_data->no_pops : 0](
+            individual, population, root_data, &sx);
+    }
+
+    if(root_data->env_active == KCR_YES)
+    {
+    	/* Environmental taxis: drift up the (precomputed) gradient of the environment */
+    	sx += root_data->env_weight*root_data->env_grad_x[KCR_GRID_INDEX(&root_data->grid, individual->current_x_pos, 0)];
+	}
+    if(root_data->marks_active == KCR_YES)
+    {
+    	/* Drift up or down the gradients of the scent marks */
+    	kcr_mark_drift(root_data, individual->current_x_pos, 0, population->index, &sx, NULL);
+	}
     sx = max(-1,min(1,sx));
     right *= (1+sx)/2;
     left *= (1-sx)/2;
     
-    /* Get a random number between 0 and up+down+left+right */
     assert(left<=1);
     assert(left>=0);
     assert(right<=1);
     assert(right>=0);
-    random = ((double)rand())*(left+right)/((double)RAND_MAX);
+    weights[0] = left;
+    weights[1] = right;
+    if(drifts != NULL)
+    {
+        drifts[0] = sx;
+    }
 
-   	/* Use this random number to determine next position */
-   	if(random < left)
-	{
-   		/* Move left */
-#ifdef KCR_PBC
-   		individual->current_x_pos = KCR_MOD(individual->current_x_pos - 1, root_data->box_width);
-#else /* KCR_PBC */
-   		individual->current_x_pos -= 1;
-#endif /* KCR_PBC */
-	}
-#ifdef KCR_PBC
-   	else
-   	{
-   		/* Move right */
-   		individual->current_x_pos = KCR_MOD(individual->current_x_pos + 1, root_data->box_width);
+    /* Return */
+    return;
+}
+
+/***************************************************************************************
+ * Name: kcr_place_individual()
+ *
+ * Purpose: Place an individual at random: at the start, or in place of one that has
+ *          stepped off an absorbing edge, so that the population size stays fixed.
+ *
+ * Parameters: IN/OUT individual - the individual
+ *             IN     root_data - pointer to a CB containing all the root data for KCR.
+ *
+ * Returns: Nothing.
+ *
+ * Operation: Choose a site uniformly at random, choosing again while it is blocked by
+ *            the habitat mask (which always leaves at least one cell open).
+ ***************************************************************************************/
+void kcr_place_individual(KCR_INDIVIDUAL *individual, KCR_ROOT_DATA *root_data)
+{
+    /* Sanity checks. */
+	assert(root_data != NULL);
+	assert(individual != NULL);
+
+    do
+    {
+        individual->current_x_pos = kcr_rng_below(&root_data->rng, root_data->box_width);
+        individual->current_y_pos = kcr_rng_below(&root_data->rng, root_data->box_height);
+        if(root_data->box_depth > 1)
+        {
+            individual->current_z_pos = kcr_rng_below(&root_data->rng, root_data->box_depth);
+        }
     }
-#else /* KCR_PBC */
-   	else if(individual->current_x_pos != root_data->box_width - 1)
-   	{
-   		/* Move right */
-   		individual->current_x_pos += 1;
+    while((root_data->habitat_mask != NULL) &&
+          KCR_MASK_BLOCKED(root_data->habitat_mask,
+                           KCR_GRID_INDEX(&root_data->grid, individual->current_x_pos,
+                                          individual->current_y_pos)));
+
+    /* Return */
+    return;
+}
+
+/***************************************************************************************
+ * Name: kcr_interactions()
+ *
+ * Purpose: Sum the interactions of an individual with every individual, for any number
+ *          of populations.
+ *
+ * Parameters: IN     individual - the individual
+ *             IN     population - pointer to the population CB containing this individual
+ *             IN     root_data - pointer to a CB containing all the root data for KCR.
+ *             IN/OUT sx - horizontal drift, added to
+ *             IN/OUT sy - vertical drift, added to
+ *             IN/OUT popsum - density at the individual's site, added to
+ *
+ * Returns: Nothing.
+ *
+ * Operation: Only the populations set up by kcr_setup_interactions() are looked at, so
+ *            with many populations the cost goes with the number that interact rather
+ *            than the square of the number of populations.
+ ***************************************************************************************/
+void kcr_interactions(KCR_INDIVIDUAL *individual,
+                      KCR_POPULATION *population,
+                      KCR_ROOT_DATA *root_data,
+                      double *sx,
+                      double *sy,
+                      double *popsum)
+{
+	/* Local variables */
+	KCR_INTERACTION *interaction;
+	KCR_INTERACTION *last_interaction;
+	LIST_ELT *curr_elt;
+	KCR_INDIVIDUAL *curr_indiv_cb;
+	long x_diff;
+	long y_diff;
+	double dist_sq;
+	double norm;
+
+    interaction = root_data->interactions + (unsigned long)population->index*root_data->no_pops;
+    last_interaction = interaction + root_data->no_interactions[population->index];
+    for(; interaction < last_interaction; interaction++)
+    {
+        for(curr_elt = interaction->source->individual_list_root; curr_elt != NULL; curr_elt = curr_elt->next)
+        {
+            curr_indiv_cb = (KCR_INDIVIDUAL *)curr_elt->data;
+            x_diff = KCR_DIFF(curr_indiv_cb->current_x_pos,individual->current_x_pos,root_data->box_width);
+            y_diff = KCR_DIFF(curr_indiv_cb->current_y_pos,individual->current_y_pos,root_data->box_height);
+            if(interaction->interacts == KCR_YES)
+            {
+                /* Within delta of the current individual? */
+                dist_sq = (x_diff*root_data->l_val)*(x_diff*root_data->l_val) +
+                          (y_diff*root_data->l_val)*(y_diff*root_data->l_val);
+                if((dist_sq <= interaction->delta_sq) && (dist_sq > 0))
+                {
+                    norm = sqrt((double)(x_diff*x_diff + y_diff*y_diff));
+                    *sx += interaction->coeff*x_diff/norm;
+                    *sy += interaction->coeff*y_diff/norm;
+                }
+            }
+            if((x_diff == 0) && (y_diff == 0))
+            {
+                /* Individuals are in the same place; increment popsum, storing sum of all populations at current point */
+                *popsum += 1/pow(root_data->l_val,2);
+            }
+        }
     }
-#endif /* KCR_PBC */
 
-    /* y-positions should always be zero */
-    individual->current_y_pos = 0;
-   
     /* Return */
     return;
 }
+
+/***************************************************************************************
+ * Name: kcr_interactions1d()
+ *
+ * Purpose: Sum the interactions of an individual with every individual in one
+ *          dimension, for any number of populations.
+ *
+ * Parameters: IN     individual - the individual
+ *             IN     population - pointer to the population CB containing this individual
+ *             IN     root_data - pointer to a CB containing all the root data for KCR.
+ *             IN/OUT sx - drift, added to
+ *
+ * Returns: Nothing.
+ *
+ * Operation: As kcr_interactions(), only the populations that interact are looked at.
+ ***************************************************************************************/
+void kcr_interactions1d(KCR_INDIVIDUAL *individual,
+                        KCR_POPULATION *population,
+                        KCR_ROOT_DATA *root_data,
+                        double *sx)
+{
+	/* Local variables */
+	KCR_INTERACTION *interaction;
+	KCR_INTERACTION *last_interaction;
+	LIST_ELT *curr_elt;
+	double dist;
+
+    interaction = root_data->interactions + (unsigned long)population->index*root_data->no_pops;
+    last_interaction = interaction + root_data->no_interactions[population->index];
+    for(; interaction < last_interaction; interaction++)
+    {
+        if(interaction->interacts == KCR_NO)
+        {
+            /* Only listed for the packing term, which does not apply in one dimension */
+            continue;
+        }
+        for(curr_elt = interaction->source->individual_list_root; curr_elt != NULL; curr_elt = curr_elt->next)
+        {
+            dist = KCR_DIFF(((KCR_INDIVIDUAL *)curr_elt->data)->current_x_pos,individual->current_x_pos,
+                            root_data->box_width)*root_data->l_val;
+            if((dist <= interaction->delta) && (dist > 0))
+            {
+                /* Individual just to the right: increment sx */
+                *sx += interaction->coeff;
+            }
+            else if((dist >= -interaction->delta) && (dist < 0))
+            {
+                /* Individual just to the left: decrement sx */
+                *sx -= interaction->coeff;
+            }
+        }
+    }
+
+    /* Return */
+    return;
+}
+
+/***************************************************************************************
+ * Name: kcr_tabulated_interactions()
+ *
+ * Purpose: Sum the interactions of an individual with every individual, from the
+ *          tables of the kernel.
+ *
+ * Parameters: IN     individual - the individual
+ *             IN     population - pointer to the population CB containing this individual
+ *             IN     root_data - pointer to a CB containing all the root data for KCR.
+ *             IN/OUT sx - horizontal drift, added to
+ *             IN/OUT sy - vertical drift, added to (stays zero in one dimension)
+ *             IN/OUT popsum - density at the individual's site, added to
+ *
+ * Returns: Nothing.
+ *
+ * Operation: Whatever the shape of the kernel, each individual in range costs one
+ *            look-up.  The weights of each source population are summed and then
+ *            multiplied by its a_ij once.
+ ***************************************************************************************/
+void kcr_tabulated_interactions(KCR_INDIVIDUAL *individual,
+                                KCR_POPULATION *population,
+                                KCR_ROOT_DATA *root_data,
+                                double *sx,
+                                double *sy,
+                                double *popsum)
+{
+	/* Local variables */
+	KCR_INTERACTION *interaction;
+	KCR_INTERACTION *last_interaction;
+	KCR_KERNEL_TABLE *table;
+	LIST_ELT *curr_elt;
+	KCR_INDIVIDUAL *curr_indiv_cb;
+	const double *weight;
+	double x_sum;
+	double y_sum;
+	long x_diff;
+	long y_diff;
+
+    interaction = root_data->interactions + (unsigned long)population->index*root_data->no_pops;
+    last_interaction = interaction + root_data->no_interactions[population->index];
+    for(; interaction < last_interaction; interaction++)
+    {
+        table = interaction->table;
+        x_sum = 0;
+        y_sum = 0;
+        for(curr_elt = interaction->source->individual_list_root; curr_elt != NULL; curr_elt = curr_elt->next)
+        {
+            curr_indiv_cb = (KCR_INDIVIDUAL *)curr_elt->data;
+            x_diff = KCR_DIFF(curr_indiv_cb->current_x_pos,individual->current_x_pos,root_data->box_width);
+            y_diff = KCR_DIFF(curr_indiv_cb->current_y_pos,individual->current_y_pos,root_data->box_height);
+            if((table != NULL) && (labs(x_diff) <= table->x_radius) && (labs(y_diff) <= table->y_radius))
+            {
+                weight = table->weights + 2*((y_diff + table->y_radius)*(2*table->x_radius + 1) + x_diff + table->x_radius);
+                x_sum += weight[0];
+                y_sum += weight[1];
+            }
+            if((x_diff == 0) && (y_diff == 0))
+            {
+                /* Individuals are in the same place; increment popsum, storing sum of all populations at current point */
+                *popsum += 1/pow(root_data->l_val,2);
+            }
+        }
+        *sx += interaction->coeff*x_sum;
+        *sy += interaction->coeff*y_sum;
+    }
+
+    /* Return */
+    return;
+}
+
+/***************************************************************************************
+ * Specialised interaction kernels.
+ *
+ * KCR_DEFINE_INTERACTIONS(NO_POPS) defines kcr_interactions_<NO_POPS>() and
+ * kcr_interactions1d_<NO_POPS>(), which do the same as kcr_interactions() and
+ * kcr_interactions1d() for exactly NO_POPS populations.  With the number of populations
+ * a constant, the per-population coefficients are worked out once into arrays small
+ * enough to live in registers, the population loop is unrolled, and the individuals are
+ * walked through the list elements directly rather than by function calls.  The sums
+ * are made in the same order and with the same arithmetic as the generic kernels, so
+ * the results are identical.
+ ***************************************************************************************/
+#define KCR_DEFINE_INTERACTIONS(NO_POPS) \
+void kcr_interactions_##NO_POPS(KCR_INDIVIDUAL *individual, \
+                                KCR_POPULATION *population, \
+                                KCR_ROOT_DATA *root_data, \
+                                double *sx, \
+                                double *sy, \
+                                double *popsum) \
+{ \
+	/* Local variables */ \
+	LIST_ELT *elts[NO_POPS]; \
+	double coeffs[NO_POPS]; \
+	double delta_sqs[NO_POPS]; \
+	KCR_POPULATION *curr_pop_cb; \
+	LIST_ELT *curr_elt; \
+	KCR_INDIVIDUAL *curr_indiv_cb; \
+	const long x_pos = (long)individual->current_x_pos; \
+	const long y_pos = (long)individual->current_y_pos; \
+	const unsigned long width = root_data->box_width; \
+	const unsigned long height = root_data->box_height; \
+	const double l_val = root_data->l_val; \
+	const double site_density = 1/pow(root_data->l_val,2); \
+	double delta; \
+	double x_sum = 0; \
+	double y_sum = 0; \
+	double site_sum = 0; \
+	double dist_sq; \
+	double norm; \
+	long x_diff; \
+	long y_diff; \
+	unsigned short pop_no; \
+ \
+	/* Coefficients, in the order the populations are listed */ \
+	curr_pop_cb = (KCR_POPULATION *)LIST_GET_FIRST(root_data->population_list_root); \
+	for(pop_no = 0; pop_no < NO_POPS; pop_no++) \
+	{ \
+		delta = root_data->deltas[curr_pop_cb->index + population->index*NO_POPS]; \
+		elts[pop_no] = curr_pop_cb->individual_list_root; \
+		delta_sqs[pop_no] = pow(delta,2); \
+		coeffs[pop_no] = l_val*root_data->aijs[curr_pop_cb->index + population->index*NO_POPS] \
+		                 *(1/(2*KCR_PI*pow(delta,2))); \
+		curr_pop_cb = (KCR_POPULATION *)LIST_GET_NEXT(curr_pop_cb->list_elt); \
+	} \
+ \
+	for(pop_no = 0; pop_no < NO_POPS; pop_no++) \
+	{ \
+		for(curr_elt = elts[pop_no]; curr_elt != NULL; curr_elt = curr_elt->next) \
+		{ \
+			curr_indiv_cb = (KCR_INDIVIDUAL *)curr_elt->data; \
+			x_diff = KCR_DIFF(curr_indiv_cb->current_x_pos, x_pos, width); \
+			y_diff = KCR_DIFF(curr_indiv_cb->current_y_pos, y_pos, height); \
+			dist_sq = (x_diff*l_val)*(x_diff*l_val) + (y_diff*l_val)*(y_diff*l_val); \
+			if((dist_sq <= delta_sqs[pop_no]) && (dist_sq > 0)) \
+			{ \
+				norm = sqrt((double)(x_diff*x_diff + y_diff*y_diff)); \
+				x_sum += coeffs[pop_no]*x_diff/norm; \
+				y_sum += coeffs[pop_no]*y_diff/norm; \
+			} \
+			if((x_diff == 0) && (y_diff == 0)) \
+			{ \
+				site_sum += site_density; \
+			} \
+		} \
+	} \
+	*sx += x_sum; \
+	*sy += y_sum; \
+	*popsum += site_sum; \
+ \
+	/* Return */ \
+	return; \
+} \
+ \
+void kcr_interactions1d_##NO_POPS(KCR_INDIVIDUAL *individual, \
+                                  KCR_POPULATION *population, \
+                                  KCR_ROOT_DATA *root_data, \
+                                  double *sx) \
+{ \
+	/* Local variables */ \
+	LIST_ELT *elts[NO_POPS]; \
+	double coeffs[NO_POPS]; \
+	double deltas[NO_POPS]; \
+	KCR_POPULATION *curr_pop_cb; \
+	LIST_ELT *curr_elt; \
+	const long x_pos = (long)individual->current_x_pos; \
+	const unsigned long width = root_data->box_width; \
+	const double l_val = root_data->l_val; \
+	double x_sum = 0; \
+	double dist; \
+	unsigned short pop_no; \
+ \
+	/* Coefficients, in the order the populations are listed */ \
+	curr_pop_cb = (KCR_POPULATION *)LIST_GET_FIRST(root_data->population_list_root); \
+	for(pop_no = 0; pop_no < NO_POPS; pop_no++) \
+	{ \
+		elts[pop_no] = curr_pop_cb->individual_list_root; \
+		deltas[pop_no] = root_data->deltas[curr_pop_cb->index + population->index*NO_POPS]; \
+		coeffs[pop_no] = l_val*root_data->aijs[curr_pop_cb->index + population->index*NO_POPS]/( \
+		                 4*deltas[pop_no]); \
+		curr_pop_cb = (KCR_POPULATION *)LIST_GET_NEXT(curr_pop_cb->list_elt); \
+	} \
+ \
+	for(pop_no = 0; pop_no < NO_POPS; pop_no++) \
+	{ \
+		for(curr_elt = elts[pop_no]; curr_elt != NULL; curr_elt = curr_elt->next) \
+		{ \
+			dist = KCR_DIFF(((KCR_INDIVIDUAL *)curr_elt->data)->current_x_pos, x_pos, width)*l_val; \
+			if((dist <= deltas[pop_no]) && (dist > 0)) \
+			{ \
+				/* Individual just to the right */ \
+				x_sum += coeffs[pop_no]; \
+			} \
+			else if((dist >= -deltas[pop_no]) && (dist < 0)) \
+			{ \
+				/* Individual just to the left */ \
+				x_sum -= coeffs[pop_no]; \
+			} \
+		} \
+	} \
+	*sx += x_sum; \
+ \
+	/* Return */ \
+	return; \
+}
+
+KCR_DEFINE_INTERACTIONS(1)
+KCR_DEFINE_INTERACTIONS(2)
+KCR_DEFINE_INTERACTIONS(3)
+KCR_DEFINE_INTERACTIONS(4)
@@ -0,0 +1,138 @@
+/***************************************************************************************
+ * Filename: kcrrand.c
+ *
+ * Description: Random number generator for the KCR simulator.  The generator state is
+ *              held in a KCR_RNG CB rather than inside the C library, so that it can be
+ *              saved in checkpoints and restored exactly.  The generator is xoshiro256**
+ *              seeded through splitmix64.
+ ***************************************************************************************/
+
+#include <kcr.h>
+
+/***************************************************************************************
+ * Rotate a 64-bit value left.
+ ***************************************************************************************/
+#define KCR_ROTL(X,K) (((X) << (K)) | ((X) >> (64 - (K))))
+
+/***************************************************************************************
+ * Name: kcr_rng_seed()
+ *
+ * Purpose: Seed a random number generator.
+ *
+ * Parameters: OUT    rng - the generator
+ *             IN     seed - the seed
+ *
+ * Returns: Nothing.
+ *
+ * Operation: Expand the seed into the four words of state with splitmix64, which never
+ *            produces the all-zero state.
+ ***************************************************************************************/
+void kcr_rng_seed(KCR_RNG *rng, unsigned long long seed)
+{
+	/* Local variables */
+	unsigned short word;
+	unsigned long long z;
+
+	/* Sanity checks */
+	assert(rng != NULL);
+
+	for(word = 0; word < 4; word++)
+	{
+		seed += 0x9e3779b97f4a7c15ULL;
+		z = seed;
+		z = (z ^ (z >> 30))*0xbf58476d1ce4e5b9ULL;
+		z = (z ^ (z >> 27))*0x94d049bb133111ebULL;
+		rng->state[word] = z ^ (z >> 31);
+	}
+
+	/* Return */
+	return;
+}
+
+/***************************************************************************************
+ * Name: kcr_rng_next()
+ *
+ * Purpose: Get the next 64 random bits.
+ *
+ * Parameters: IN/OUT rng - the generator
+ *
+ * Returns: 64 random bits.
+ ***************************************************************************************/
+unsigned long long kcr_rng_next(KCR_RNG *rng)
+{
+	/* Local variables */
+	unsigned long long result;
+	unsigned long long t;
+
+	result = KCR_ROTL(rng->state[1]*5, 7)*9;
+	t = rng->state[1] << 17;
+	rng->state[2] ^= rng->state[0];
+	rng->state[3] ^= rng->state[1];
+	rng->state[1] ^= rng->state[2];
+	rng->state[0] ^= rng->state[3];
+	rng->state[2] ^= t;
+	rng->state[3] = KCR_ROTL(rng->state[3], 45);
+
+	/* Return */
+	return(result);
+}
+
+/***************************************************************************************
+ * Name: kcr_rng_uniform()
+ *
+ * Purpose: Get a random number uniformly distributed on [0,1).
+ *
+ * Parameters: IN/OUT rng - the generator
+ *
+ * Returns: The random number, a multiple of 2^-53.
+ ***************************************************************************************/
+double kcr_rng_uniform(KCR_RNG *rng)
+{
+	/* Return */
+	return((double)(kcr_rng_next(rng) >> 11)*(1.0/9007199254740992.0));
+}
+
+/***************************************************************************************
+ * Name: kcr_rng_below()
+ *
+ * Purpose: Get a random integer uniformly distributed on 0..limit-1.
+ *
+ * Parameters: IN/OUT rng - the generator
+ *             IN     limit - one more than the largest value wanted
+ *
+ * Returns: The random integer.
+ ***************************************************************************************/
+unsigned long kcr_rng_below(KCR_RNG *rng, unsigned long limit)
+{
+	/* Sanity checks */
+	assert(limit > 0);
+
+	/* Return */
+	return((unsigned long)(kcr_rng_uniform(rng)*limit));
+}
+
+/***************************************************************************************
+ * Name: kcr_rng_gaussian()
+ *
+ * Purpose: Get a random number normally distributed with mean 0 and variance 1.
+ *
+ * Parameters: IN/OUT rng - the generator
+ *
+ * Returns: The random number.
+ *
+ * Operation: Box-Muller transform of two uniform numbers, the first taken from (0,1]
+ *            so that its log is finite.  The second normal number the transform gives
+ *            is not kept, so that the generator state is all there is to save.
+ ***************************************************************************************/
+double kcr_rng_gaussian(KCR_RNG *rng)
+{
+	/* Local variables */
+	double radius;
+	double angle;
+
+	radius = sqrt(-2*log(1 - kcr_rng_uniform(rng)));
+	angle = 2*KCR_PI*kcr_rng_uniform(rng);
+
+	/* Return */
+	return(radius*cos(angle));
+}
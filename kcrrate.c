@@ -0,0 +1,199 @@
+/***************************************************************************************
+ * Filename: kcrrate.c
+ *
+ * Description: Multirate time steps.  Each population has a move rate (sweeps per
+ *              time step), and in each time step a population sweeps as many times as
+ *              its rate has brought due: a fast predator several times, a slow prey
+ *              only on some steps.  Unlike event-driven mode, the whole population
+ *              moves in each sweep, so with every rate 1 the simulation is exactly
+ *              the ordinary one.
+ *
+ *              The number of sweeps population p has made by time step t is
+ *              floor(rate_p*t), so the schedule needs no state beyond the rates and
+ *              the time, and a restart picks it up exactly.
+ ***************************************************************************************/
+
+#include <kcr.h>
+
+/***************************************************************************************
+ * Name: kcr_setup_multirate()
+ *
+ * Purpose: Switch to multirate time steps, reading the move rates of the populations.
+ *
+ * Parameters: IN     rate_file - file containing one row of no_pops move rates (sweeps
+ *                                per time step; missing values are 1)
+ *             IN/OUT root_data - pointer to a CB containing all the root data for KCR.
+ *
+ * Returns: rc - KCR_RC_OK if ok or KCR_RC_ERROR if error.
+ ***************************************************************************************/
+unsigned short kcr_setup_multirate(FILE *rate_file, KCR_ROOT_DATA *root_data)
+{
+	/* Local variables */
+	double *rates;
+	unsigned short rc = KCR_RC_ERROR;
+
+	/* Sanity checks */
+	assert(rate_file != NULL);
+	assert(root_data != NULL);
+
+	rates = kcr_read_move_rates(rate_file, root_data);
+	if(rates == NULL)
+	{
+		goto EXIT_LABEL;
+	}
+	kcr_set_multirate(root_data, rates);
+	free(rates);
+	rc = KCR_RC_OK;
+
+EXIT_LABEL:
+	/* Return */
+	return(rc);
+}
+
+/***************************************************************************************
+ * Name: kcr_set_multirate()
+ *
+ * Purpose: Set the move rates of the populations and switch to multirate time steps.
+ *
+ * Parameters: IN/OUT root_data - pointer to a CB containing all the root data for KCR.
+ *             IN     rates - move rate of each population, by index
+ *
+ * Returns: Nothing.
+ ***************************************************************************************/
+void kcr_set_multirate(KCR_ROOT_DATA *root_data, const double *rates)
+{
+	/* Local variables */
+	KCR_POPULATION *curr_pop_cb;
+
+	/* Sanity checks */
+	assert(root_data != NULL);
+	assert(rates != NULL);
+
+	curr_pop_cb = (KCR_POPULATION *)LIST_GET_FIRST(root_data->population_list_root);
+	while(curr_pop_cb != NULL)
+	{
+		curr_pop_cb->move_rate = rates[curr_pop_cb->index];
+		curr_pop_cb = (KCR_POPULATION *)LIST_GET_NEXT(curr_pop_cb->list_elt);
+	}
+	root_data->multirate_active = KCR_YES;
+
+	/* Return */
+	return;
+}
+
+/***************************************************************************************
+ * Name: kcr_pack_multirate()
+ *
+ * Purpose: Copy the move rates into an array.
+ *
+ * Parameters: IN     root_data - pointer to a CB containing all the root data for KCR.
+ *             OUT    rates - array of no_pops rates, by population index
+ *
+ * Returns: Nothing.
+ ***************************************************************************************/
+void kcr_pack_multirate(KCR_ROOT_DATA *root_data, double *rates)
+{
+	/* Local variables */
+	KCR_POPULATION *curr_pop_cb;
+
+	/* Sanity checks */
+	assert(root_data != NULL);
+	assert(rates != NULL);
+
+	curr_pop_cb = (KCR_POPULATION *)LIST_GET_FIRST(root_data->population_list_root);
+	while(curr_pop_cb != NULL)
+	{
+		rates[curr_pop_cb->index] = curr_pop_cb->move_rate;
+		curr_pop_cb = (KCR_POPULATION *)LIST_GET_NEXT(curr_pop_cb->list_elt);
+	}
+
+	/* Return */
+	return;
+}
+
+/***************************************************************************************
+ * Name: kcr_sweeps_due()
+ *
+ * Purpose: Get the number of sweeps a population makes in a time step.
+ *
+ * Parameters: IN     population - the population
+ *             IN     time_step - the time step (1 for the first)
+ *
+ * Returns: The number of sweeps.
+ *
+ * Operation: floor(rate*t) - floor(rate*(t-1)).  KCR_RATE_EPSILON stops a product
+ *            that should be whole from rounding just below it and putting a sweep
+ *            off by a step.
+ ***************************************************************************************/
+unsigned long kcr_sweeps_due(KCR_POPULATION *population, unsigned long time_step)
+{
+	/* Sanity checks */
+	assert(population != NULL);
+	assert(time_step > 0);
+
+	/* Return */
+	return((unsigned long)floor(population->move_rate*time_step + KCR_RATE_EPSILON) -
+	       (unsigned long)floor(population->move_rate*(time_step - 1) + KCR_RATE_EPSILON));
+}
+
+/***************************************************************************************
+ * Name: kcr_perform_multirate_moves()
+ *
+ * Purpose: Make the sweeps due in the current time step.
+ *
+ * Parameters: IN/OUT root_data - pointer to a CB containing all the root data for KCR.
+ *
+ * Returns: Nothing.
+ *
+ * Operation: The sweeps are made in rounds, so that populations moving several times
+ *            in a step do so in between the others' moves rather than all at once:
+ *            in round r, every population with more than r sweeps due sweeps once,
+ *            in list order.  Populations with no sweeps due cost nothing.
+ ***************************************************************************************/
+void kcr_perform_multirate_moves(KCR_ROOT_DATA *root_data)
+{
+	/* Local variables */
+	KCR_POPULATION *curr_pop_cb;
+	KCR_INDIVIDUAL *curr_indiv_cb;
+	unsigned long round = 0;
+	unsigned short moved;
+
+	/* Sanity checks */
+	assert(root_data != NULL);
+
+	do
+	{
+		moved = KCR_NO;
+		curr_pop_cb = (KCR_POPULATION *)LIST_GET_FIRST(root_data->population_list_root);
+		while(curr_pop_cb != NULL)
+		{
+			if(kcr_sweeps_due(curr_pop_cb, root_data->current_time) > round)
+			{
+				curr_indiv_cb = (KCR_INDIVIDUAL *)LIST_GET_FIRST(curr_pop_cb->individual_list_root);
+				while(curr_indiv_cb != NULL)
+				{
+					if(root_data->box_height == 1)
+					{
+						kcr_move_individual1d(curr_indiv_cb, curr_pop_cb, root_data);
+					}
+					else if(root_data->box_depth > 1)
+					{
+						kcr_move_individual3d(curr_indiv_cb, curr_pop_cb, root_data);
+					}
+					else
+					{
+						kcr_move_individual(curr_indiv_cb, curr_pop_cb, root_data);
+					}
+					curr_indiv_cb = (KCR_INDIVIDUAL *)LIST_GET_NEXT(curr_indiv_cb->list_elt);
+				}
+				moved = KCR_YES;
+			}
+			curr_pop_cb = (KCR_POPULATION *)LIST_GET_NEXT(curr_pop_cb->list_elt);
+		}
+		round++;
+	}
+	while(moved == KCR_YES);
+
+	/* Return */
+	return;
+}
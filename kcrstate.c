@@ -0,0 +1,780 @@
+/***************************************************************************************
+ * Filename: kcrstate.c
+ *
+ * Description: Procedures for saving and restoring the positions of individuals.
+ *
+ *              A binary state file is a KCR_STATE_HEADER followed by the x- and
+ *              y-position (and z-position, in a three-dimensional box) of every
+ *              individual as packed 32-bit values, population 0 first and, within a
+ *              population, individual 0 first.
+ ***************************************************************************************/
+
+#include <kcr.h>
+
+/***************************************************************************************
+ * Name: kcr_pack_positions()
+ *
+ * Purpose: Copy the positions of all individuals into an array.
+ *
+ * Parameters: IN     root_data - pointer to a CB containing all the root data for KCR.
+ *             OUT    coords - array of KCR_NO_COORDS(root_data)*no_pops*no_indivs values
+ *
+ * Returns: Nothing.
+ *
+ * Operation: The x- and y-position of individual i of population p are stored at
+ *            coords[n*(p*no_indivs+i)] and the value after it, followed by the
+ *            z-position in a three-dimensional box, where n is the number of
+ *            coordinates.
+ ***************************************************************************************/
+void kcr_pack_positions(KCR_ROOT_DATA *root_data, unsigned int *coords)
+{
+	/* Local variables */
+	KCR_POPULATION *curr_pop_cb;
+	KCR_INDIVIDUAL *curr_indiv_cb;
+	unsigned long slot;
+	unsigned short no_coords;
+
+	/* Sanity checks */
+	assert(root_data != NULL);
+	assert(coords != NULL);
+
+    no_coords = KCR_NO_COORDS(root_data);
+    curr_pop_cb = (KCR_POPULATION *)LIST_GET_FIRST(root_data->population_list_root);
+    while(curr_pop_cb != NULL)
+    {
+        curr_indiv_cb = (KCR_INDIVIDUAL *)LIST_GET_FIRST(curr_pop_cb->individual_list_root);
+        while(curr_indiv_cb != NULL)
+        {
+            slot = no_coords*((unsigned long)curr_pop_cb->index*root_data->no_indivs + curr_indiv_cb->index);
+            coords[slot] = (unsigned int)curr_indiv_cb->current_x_pos;
+            coords[slot+1] = (unsigned int)curr_indiv_cb->current_y_pos;
+            if(no_coords == 3)
+            {
+                coords[slot+2] = (unsigned int)curr_indiv_cb->current_z_pos;
+            }
+            curr_indiv_cb = (KCR_INDIVIDUAL *)LIST_GET_NEXT(curr_indiv_cb->list_elt);
+        }
+        curr_pop_cb = (KCR_POPULATION *)LIST_GET_NEXT(curr_pop_cb->list_elt);
+    }
+
+	/* Return */
+	return;
+}
+
+/***************************************************************************************
+ * Name: kcr_unpack_positions()
+ *
+ * Purpose: Set the positions of all individuals from an array.
+ *
+ * Parameters: IN/OUT root_data - pointer to a CB containing all the root data for KCR.
+ *             IN     coords - array laid out as by kcr_pack_positions()
+ *
+ * Returns: rc - KCR_RC_OK if ok or KCR_RC_ERROR if a position lies outside the box.
+ ***************************************************************************************/
+unsigned short kcr_unpack_positions(KCR_ROOT_DATA *root_data, const unsigned int *coords)
+{
+	/* Local variables */
+	KCR_POPULATION *curr_pop_cb;
+	KCR_INDIVIDUAL *curr_indiv_cb;
+	unsigned long slot;
+	unsigned short no_coords;
+	unsigned short rc = KCR_RC_OK;
+
+	/* Sanity checks */
+	assert(root_data != NULL);
+	assert(coords != NULL);
+
+    no_coords = KCR_NO_COORDS(root_data);
+    curr_pop_cb = (KCR_POPULATION *)LIST_GET_FIRST(root_data->population_list_root);
+    while(curr_pop_cb != NULL)
+    {
+        curr_indiv_cb = (KCR_INDIVIDUAL *)LIST_GET_FIRST(curr_pop_cb->individual_list_root);
+        while(curr_indiv_cb != NULL)
+        {
+            slot = no_coords*((unsigned long)curr_pop_cb->index*root_data->no_indivs + curr_indiv_cb->index);
+            if((coords[slot] >= root_data->box_width) || (coords[slot+1] >= root_data->box_height) ||
+               ((no_coords == 3) && (coords[slot+2] >= root_data->box_depth)))
+            {
+                fprintf(stderr,"Error: individual %u of population %u is outside the box\n",
+                        curr_indiv_cb->index, curr_pop_cb->index);
+                rc = KCR_RC_ERROR;
+                goto EXIT_LABEL;
+            }
+            curr_indiv_cb->current_x_pos = coords[slot];
+            curr_indiv_cb->current_y_pos = coords[slot+1];
+            if(no_coords == 3)
+            {
+                curr_indiv_cb->current_z_pos = coords[slot+2];
+            }
+            curr_indiv_cb = (KCR_INDIVIDUAL *)LIST_GET_NEXT(curr_indiv_cb->list_elt);
+        }
+        curr_pop_cb = (KCR_POPULATION *)LIST_GET_NEXT(curr_pop_cb->list_elt);
+    }
+
+EXIT_LABEL:
+	/* Return */
+	return(rc);
+}
+
+/***************************************************************************************
+ * Name: kcr_state_is_binary()
+ *
+ * Purpose: Determine whether a file is a binary state file.
+ *
+ * Parameters: IN     state_file - the file
+ *
+ * Returns: KCR_YES if the file starts with the state magic number, else KCR_NO.
+ ***************************************************************************************/
+unsigned short kcr_state_is_binary(FILE *state_file)
+{
+	/* Local variables */
+	char magic[8];
+	unsigned short is_binary = KCR_NO;
+
+	/* Sanity checks */
+	assert(state_file != NULL);
+
+	rewind(state_file);
+	if((fread(magic, 1, sizeof(magic), state_file) == sizeof(magic)) &&
+	   (memcmp(magic, KCR_STATE_MAGIC, sizeof(magic)) == 0))
+	{
+		is_binary = KCR_YES;
+	}
+	rewind(state_file);
+
+	/* Return */
+	return(is_binary);
+}
+
+/***************************************************************************************
+ * Name: kcr_read_state()
+ *
+ * Purpose: Set the positions of all individuals from a binary state file.
+ *
+ * Parameters: IN     state_file - the file (opened for binary reading)
+ *             IN/OUT root_data - pointer to a CB containing all the root data for KCR.
+ *
+ * Returns: rc - KCR_RC_OK if ok or KCR_RC_ERROR if the file does not match the
+ *               simulation.
+ *
+ * Operation: Read the whole file with a single fread(), check that the header
+ *            matches the populations and the box, then unpack the positions.
+ ***************************************************************************************/
+unsigned short kcr_read_state(FILE *state_file, KCR_ROOT_DATA *root_data)
+{
+	/* Local variables */
+	char *buffer = NULL;
+	long file_size;
+	const KCR_STATE_HEADER *header;
+	unsigned long no_coords;
+	unsigned short rc = KCR_RC_OK;
+
+	/* Sanity checks */
+	assert(state_file != NULL);
+	assert(root_data != NULL);
+
+	no_coords = KCR_NO_COORDS(root_data)*(unsigned long)root_data->no_pops*root_data->no_indivs;
+	fseek(state_file, 0, SEEK_END);
+	file_size = ftell(state_file);
+	rewind(state_file);
+	if((file_size < 0) ||
+	   ((unsigned long)file_size != sizeof(KCR_STATE_HEADER) + no_coords*sizeof(unsigned int)))
+	{
+		fprintf(stderr,"Error: state file does not hold %u populations of %u individuals\n",
+		        root_data->no_pops, root_data->no_indivs);
+		rc = KCR_RC_ERROR;
+		goto EXIT_LABEL;
+	}
+
+	buffer = (char *)malloc(file_size);
+	if(buffer == NULL)
+	{
+		fprintf(stderr,"MEMORY ALLOCATION FAILURE FOR STATE BUFFER\n");
+		rc = KCR_RC_ERROR;
+		goto EXIT_LABEL;
+	}
+	if(fread(buffer, 1, file_size, state_file) != (size_t)file_size)
+	{
+		fprintf(stderr,"Error: failed to read state file\n");
+		rc = KCR_RC_ERROR;
+		goto EXIT_LABEL;
+	}
+
+	header = (const KCR_STATE_HEADER *)buffer;
+	if((header->version != KCR_STATE_VERSION) ||
+	   (header->no_pops != root_data->no_pops) ||
+	   (header->no_indivs != root_data->no_indivs) ||
+	   (header->box_width != root_data->box_width) ||
+	   (header->box_height != root_data->box_height) ||
+	   (KCR_MAX(header->box_depth, 1) != root_data->box_depth))
+	{
+		fprintf(stderr,"Error: state file does not match the populations or the box\n");
+		rc = KCR_RC_ERROR;
+		goto EXIT_LABEL;
+	}
+	rc = kcr_unpack_positions(root_data, (const unsigned int *)(buffer + sizeof(KCR_STATE_HEADER)));
+
+EXIT_LABEL:
+	if(buffer != NULL)
+	{
+		free(buffer);
+	}
+
+	/* Return */
+	return(rc);
+}
+
+/***************************************************************************************
+ * Name: kcr_write_state()
+ *
+ * Purpose: Write the positions of all individuals to a binary state file.
+ *
+ * Parameters: IN     state_file - the file (opened for binary writing)
+ *             IN     root_data - pointer to a CB containing all the root data for KCR.
+ *
+ * Returns: rc - KCR_RC_OK if ok or KCR_RC_ERROR if error.
+ *
+ * Operation: Build the header and packed positions in one buffer and write it with a
+ *            single fwrite().
+ ***************************************************************************************/
+unsigned short kcr_write_state(FILE *state_file, KCR_ROOT_DATA *root_data)
+{
+	/* Local variables */
+	char *buffer;
+	KCR_STATE_HEADER *header;
+	unsigned long no_coords;
+	size_t buffer_size;
+	unsigned short rc = KCR_RC_OK;
+
+	/* Sanity checks */
+	assert(state_file != NULL);
+	assert(root_data != NULL);
+
+	no_coords = KCR_NO_COORDS(root_data)*(unsigned long)root_data->no_pops*root_data->no_indivs;
+	buffer_size = sizeof(KCR_STATE_HEADER) + no_coords*sizeof(unsigned int);
+	buffer = (char *)calloc(1, buffer_size);
+	if(buffer == NULL)
+	{
+		fprintf(stderr,"MEMORY ALLOCATION FAILURE FOR STATE BUFFER\n");
+		rc = KCR_RC_ERROR;
+		goto EXIT_LABEL;
+	}
+
+	header = (KCR_STATE_HEADER *)buffer;
+	memcpy(header->magic, KCR_STATE_MAGIC, sizeof(header->magic));
+	header->version = KCR_STATE_VERSION;
+	header->no_pops = root_data->no_pops;
+	header->no_indivs = root_data->no_indivs;
+	header->box_width = (unsigned int)root_data->box_width;
+	header->box_height = (unsigned int)root_data->box_height;
+	header->box_depth = (unsigned int)root_data->box_depth;
+	kcr_pack_positions(root_data, (unsigned int *)(buffer + sizeof(KCR_STATE_HEADER)));
+
+	if(fwrite(buffer, 1, buffer_size, state_file) != buffer_size)
+	{
+		fprintf(stderr,"Error: failed to write state file\n");
+		rc = KCR_RC_ERROR;
+	}
+	free(buffer);
+
+EXIT_LABEL:
+	/* Return */
+	return(rc);
+}
+
+/***************************************************************************************
+ * Name: kcr_write_checkpoint()
+ *
+ * Purpose: Write a checkpoint from which the simulation can be restarted exactly.
+ *
+ * Parameters: IN     root_data - pointer to a CB containing all the root data for KCR.
+ *
+ * Returns: rc - KCR_RC_OK if ok or KCR_RC_ERROR if error.
+ *
+ * Operation: Save the checkpoint to checkpoint_name.  The output file is flushed first
+ *            so that the output of every step up to the checkpoint has been written.
+ ***************************************************************************************/
+unsigned short kcr_write_checkpoint(KCR_ROOT_DATA *root_data)
+{
+	/* Sanity checks */
+	assert(root_data != NULL);
+	assert(root_data->checkpoint_name != NULL);
+
+	fflush(root_data->out_file);
+
+	/* Return */
+	return(kcr_save_checkpoint(root_data, root_data->checkpoint_name));
+}
+
+/***************************************************************************************
+ * Name: kcr_build_checkpoint()
+ *
+ * Purpose: Build a checkpoint of the simulation in memory.
+ *
+ * Parameters: IN     root_data - pointer to a CB containing all the root data for KCR.
+ *             OUT    size - size of the checkpoint in bytes
+ *
+ * Returns: buffer - the checkpoint, to be freed by the caller.  NULL if memory
+ *                   allocation fails.
+ *
+ * Operation: The checkpoint is a KCR_CHECKPOINT_HEADER (parameters, current time,
+ *            seed and generator state) followed by the a_ij-values, the delta-values
+ *            and the packed positions.  If there are scent marks, a mark section
+ *            follows: the decay rate and deposit, the response matrix, the mark times
+ *            and the mark grids.  With multirate time steps a rate section (as
+ *            packed by kcr_pack_multirate()) follows, and in event-driven mode an
+ *            event section (as packed by kcr_pack_events()) comes last.
+ ***************************************************************************************/
+char *kcr_build_checkpoint(KCR_ROOT_DATA *root_data, size_t *size)
+{
+	/* Local variables */
+	char *buffer;
+	char *section;
+	KCR_CHECKPOINT_HEADER *header;
+	unsigned long no_params;
+	unsigned long no_coords;
+	size_t buffer_size;
+
+	/* Sanity checks */
+	assert(root_data != NULL);
+	assert(size != NULL);
+
+	no_params = (unsigned long)root_data->no_pops*root_data->no_pops;
+	no_coords = KCR_NO_COORDS(root_data)*(unsigned long)root_data->no_pops*root_data->no_indivs;
+	buffer_size = sizeof(KCR_CHECKPOINT_HEADER) + 2*no_params*sizeof(double) + no_coords*sizeof(unsigned int);
+	if(root_data->marks_active == KCR_YES)
+	{
+		buffer_size += (2 + no_params)*sizeof(double) +
+		               root_data->grid.size*(sizeof(unsigned long long) + root_data->no_pops*sizeof(double));
+	}
+	if(root_data->multirate_active == KCR_YES)
+	{
+		buffer_size += root_data->no_pops*sizeof(double);
+	}
+	if(root_data->events_active == KCR_YES)
+	{
+		buffer_size += (root_data->no_pops + (unsigned long)root_data->no_pops*root_data->no_indivs)*sizeof(double);
+	}
+	buffer = (char *)calloc(1, buffer_size);
+	if(buffer == NULL)
+	{
+		fprintf(stderr,"MEMORY ALLOCATION FAILURE FOR CHECKPOINT\n");
+		goto EXIT_LABEL;
+	}
+
+	header = (KCR_CHECKPOINT_HEADER *)buffer;
+	memcpy(header->magic, KCR_CHECKPOINT_MAGIC, sizeof(header->magic));
+	header->version = KCR_CHECKPOINT_VERSION;
+	header->no_pops = root_data->no_pops;
+	header->no_indivs = root_data->no_indivs;
+	header->box_width = (unsigned int)root_data->box_width;
+	header->box_height = (unsigned int)root_data->box_height;
+	header->packing_term = root_data->packing_term;
+	header->current_time = root_data->current_time;
+	header->seed = root_data->seed;
+	memcpy(header->rng_state, root_data->rng.state, sizeof(header->rng_state));
+	header->total_time = root_data->total_time;
+	header->start_measure_time = root_data->start_measure_time;
+	header->l_val = root_data->l_val;
+	header->env_weight = root_data->env_weight;
+	header->kappa = root_data->kappa;
+	header->boundary_x = root_data->x_axis.boundary;
+	header->boundary_y = root_data->y_axis.boundary;
+	header->kernel_shape = root_data->kernel_shape;
+	header->box_depth = (unsigned int)root_data->box_depth;
+	header->boundary_z = (root_data->box_depth > 1) ? root_data->z_axis.boundary : 0;
+	if(root_data->marks_active == KCR_YES)
+	{
+		header->has_marks = KCR_YES;
+		header->mark_grid_size = (unsigned int)root_data->grid.size;
+	}
+	section = buffer + sizeof(KCR_CHECKPOINT_HEADER);
+	memcpy(section, root_data->aijs, no_params*sizeof(double));
+	section += no_params*sizeof(double);
+	memcpy(section, root_data->deltas, no_params*sizeof(double));
+	section += no_params*sizeof(double);
+	kcr_pack_positions(root_data, (unsigned int *)section);
+	section += no_coords*sizeof(unsigned int);
+
+	if(root_data->marks_active == KCR_YES)
+	{
+		/* Mark section */
+		memcpy(section, &root_data->mark_decay_rate, sizeof(double));
+		section += sizeof(double);
+		memcpy(section, &root_data->mark_deposit, sizeof(double));
+		section += sizeof(double);
+		memcpy(section, root_data->mark_resp, no_params*sizeof(double));
+		section += no_params*sizeof(double);
+		memcpy(section, root_data->mark_times, root_data->grid.size*sizeof(unsigned long long));
+		section += root_data->grid.size*sizeof(unsigned long long);
+		memcpy(section, root_data->mark_data, root_data->grid.size*root_data->no_pops*sizeof(double));
+		section += root_data->grid.size*root_data->no_pops*sizeof(double);
+	}
+	if(root_data->multirate_active == KCR_YES)
+	{
+		/* Rate section */
+		header->has_rates = KCR_YES;
+		kcr_pack_multirate(root_data, (double *)section);
+		section += root_data->no_pops*sizeof(double);
+	}
+	if(root_data->events_active == KCR_YES)
+	{
+		/* Event section */
+		header->has_events = KCR_YES;
+		kcr_pack_events(root_data, (double *)section);
+	}
+	*size = buffer_size;
+
+EXIT_LABEL:
+	/* Return */
+	return(buffer);
+}
+
+/***************************************************************************************
+ * Name: kcr_save_checkpoint()
+ *
+ * Purpose: Save the state of the simulation to a checkpoint file.
+ *
+ * Parameters: IN     root_data - pointer to a CB containing all the root data for KCR.
+ *             IN     cp_name - name of the checkpoint file
+ *
+ * Returns: rc - KCR_RC_OK if ok or KCR_RC_ERROR if error.
+ *
+ * Operation: Build the checkpoint in one buffer, write it to <cp_name>.tmp, flush it
+ *            to disk and then rename it over cp_name, so any previous checkpoint
+ *            survives until the new one is complete.
+ ***************************************************************************************/
+unsigned short kcr_save_checkpoint(KCR_ROOT_DATA *root_data, const char *cp_name)
+{
+	/* Local variables */
+	char *buffer;
+	char *tmp_name = NULL;
+	FILE *tmp_file;
+	size_t buffer_size;
+	unsigned short rc = KCR_RC_OK;
+
+	/* Sanity checks */
+	assert(root_data != NULL);
+	assert(cp_name != NULL);
+
+	buffer = kcr_build_checkpoint(root_data, &buffer_size);
+	tmp_name = (char *)malloc(strlen(cp_name) + 5);
+	if((buffer == NULL) || (tmp_name == NULL))
+	{
+		fprintf(stderr,"MEMORY ALLOCATION FAILURE FOR CHECKPOINT\n");
+		rc = KCR_RC_ERROR;
+		goto EXIT_LABEL;
+	}
+
+	/* Write it to a temporary file, then replace the previous checkpoint */
+	sprintf(tmp_name, "%s.tmp", cp_name);
+	tmp_file = fopen(tmp_name, "wb");
+	if(tmp_file == NULL)
+	{
+		fprintf(stderr,"Error: cannot open %s\n", tmp_name);
+		rc = KCR_RC_ERROR;
+		goto EXIT_LABEL;
+	}
+	if((fwrite(buffer, 1, buffer_size, tmp_file) != buffer_size) ||
+	   (kcr_commit_file(tmp_file) != KCR_RC_OK))
+	{
+		fprintf(stderr,"Error: failed to write %s\n", tmp_name);
+		fclose(tmp_file);
+		rc = KCR_RC_ERROR;
+		goto EXIT_LABEL;
+	}
+	fclose(tmp_file);
+	rc = kcr_replace_file(tmp_name, cp_name);
+
+EXIT_LABEL:
+	if(buffer != NULL)
+	{
+		free(buffer);
+	}
+	if(tmp_name != NULL)
+	{
+		free(tmp_name);
+	}
+
+	/* Return */
+	return(rc);
+}
+
+/***************************************************************************************
+ * Name: kcr_load_checkpoint()
+ *
+ * Purpose: Read a whole checkpoint into memory and check it is complete.
+ *
+ * Parameters: IN     cp_file - the checkpoint (opened for binary reading)
+ *
+ * Returns: buffer - the checkpoint, starting with its KCR_CHECKPOINT_HEADER, to be
+ *                   freed by the caller.  NULL on error.
+ *
+ * Operation: Read the file with a single fread(), then check the magic number, the
+ *            version and that the size matches the shape given in the header.
+ ***************************************************************************************/
+char *kcr_load_checkpoint(FILE *cp_file)
+{
+	/* Local variables */
+	char *buffer = NULL;
+	long file_size;
+	const KCR_CHECKPOINT_HEADER *header;
+	unsigned long no_params;
+	unsigned long no_coords;
+	unsigned long base_size;
+	unsigned short rc = KCR_RC_ERROR;
+
+	/* Sanity checks */
+	assert(cp_file != NULL);
+
+	fseek(cp_file, 0, SEEK_END);
+	file_size = ftell(cp_file);
+	rewind(cp_file);
+	if(file_size < (long)sizeof(KCR_CHECKPOINT_HEADER))
+	{
+		fprintf(stderr,"Error: checkpoint is truncated\n");
+		goto EXIT_LABEL;
+	}
+	buffer = (char *)malloc(file_size);
+	if(buffer == NULL)
+	{
+		fprintf(stderr,"MEMORY ALLOCATION FAILURE FOR CHECKPOINT\n");
+		goto EXIT_LABEL;
+	}
+	if(fread(buffer, 1, file_size, cp_file) != (size_t)file_size)
+	{
+		fprintf(stderr,"Error: failed to read checkpoint\n");
+		goto EXIT_LABEL;
+	}
+
+	/* Check the header */
+	header = (const KCR_CHECKPOINT_HEADER *)buffer;
+	no_params = (unsigned long)header->no_pops*header->no_pops;
+	no_coords = ((header->box_depth > 1) ? 3 : 2)*(unsigned long)header->no_pops*header->no_indivs;
+	if((memcmp(header->magic, KCR_CHECKPOINT_MAGIC, sizeof(header->magic)) != 0) ||
+	   (header->version != KCR_CHECKPOINT_VERSION) ||
+	   (header->box_depth == 0) ||
+	   ((header->box_depth > 1) &&
+	    ((header->boundary_z < KCR_BOUNDARY_REFLECTING) || (header->boundary_z > KCR_BOUNDARY_ABSORBING))) ||
+	   (header->boundary_x < KCR_BOUNDARY_REFLECTING) || (header->boundary_x > KCR_BOUNDARY_ABSORBING) ||
+	   (header->boundary_y < KCR_BOUNDARY_REFLECTING) || (header->boundary_y > KCR_BOUNDARY_ABSORBING) ||
+	   (header->kernel_shape > KCR_KERNEL_LINEAR))
+	{
+		fprintf(stderr,"Error: not a checkpoint, or from an incompatible version\n");
+		goto EXIT_LABEL;
+	}
+	base_size = sizeof(KCR_CHECKPOINT_HEADER) + 2*no_params*sizeof(double) + no_coords*sizeof(unsigned int);
+	if(header->has_marks == KCR_YES)
+	{
+		base_size += (2 + no_params)*sizeof(double) +
+		             (unsigned long)header->mark_grid_size*(sizeof(unsigned long long) + header->no_pops*sizeof(double));
+	}
+	if(header->has_rates == KCR_YES)
+	{
+		base_size += header->no_pops*sizeof(double);
+	}
+	if(header->has_events == KCR_YES)
+	{
+		base_size += (header->no_pops + (unsigned long)header->no_pops*header->no_indivs)*sizeof(double);
+	}
+	if((unsigned long)file_size != base_size)
+	{
+		fprintf(stderr,"Error: checkpoint is truncated\n");
+		goto EXIT_LABEL;
+	}
+	rc = KCR_RC_OK;
+
+EXIT_LABEL:
+	if((rc != KCR_RC_OK) && (buffer != NULL))
+	{
+		free(buffer);
+		buffer = NULL;
+	}
+
+	/* Return */
+	return(buffer);
+}
+
+/***************************************************************************************
+ * Name: kcr_restore_checkpoint()
+ *
+ * Purpose: Restore the state of a simulation from a checkpoint in memory.
+ *
+ * Parameters: IN/OUT root_data - pointer to a CB containing all the root data for KCR,
+ *                                of the same shape as the checkpoint.
+ *             IN     buffer - the checkpoint, from kcr_load_checkpoint() or
+ *                             kcr_build_checkpoint()
+ *
+ * Returns: rc - KCR_RC_OK if ok or KCR_RC_ERROR if a position is outside the box or
+ *               the mark section does not fit the box.
+ *
+ * Operation: Restore the a_ij- and delta-values, the kernel shape, the positions, the current time,
+ *            the generator state, any marks, any multirate move rates and any scheduled
+ *            moves, setting the marks, multirate time steps or event-driven mode up if
+ *            need be.
+ ***************************************************************************************/
+unsigned short kcr_restore_checkpoint(KCR_ROOT_DATA *root_data, const char *buffer)
+{
+	/* Local variables */
+	const KCR_CHECKPOINT_HEADER *header;
+	const char *section;
+	unsigned long no_params;
+	unsigned long no_coords;
+	double decay_rate;
+	double deposit;
+	unsigned short rc;
+
+	/* Sanity checks */
+	assert(root_data != NULL);
+	assert(buffer != NULL);
+
+	header = (const KCR_CHECKPOINT_HEADER *)buffer;
+	assert(header->no_pops == root_data->no_pops);
+	assert(header->no_indivs == root_data->no_indivs);
+	assert(header->box_depth == root_data->box_depth);
+	no_params = (unsigned long)header->no_pops*header->no_pops;
+	no_coords = KCR_NO_COORDS(root_data)*(unsigned long)header->no_pops*header->no_indivs;
+
+	section = buffer + sizeof(KCR_CHECKPOINT_HEADER);
+	memcpy(root_data->aijs, section, no_params*sizeof(double));
+	section += no_params*sizeof(double);
+	memcpy(root_data->deltas, section, no_params*sizeof(double));
+	section += no_params*sizeof(double);
+	root_data->kernel_shape = (unsigned short)header->kernel_shape;
+	rc = kcr_setup_interactions(root_data);
+	if(rc != KCR_RC_OK)
+	{
+		goto EXIT_LABEL;
+	}
+	rc = kcr_unpack_positions(root_data, (const unsigned int *)section);
+	if(rc != KCR_RC_OK)
+	{
+		goto EXIT_LABEL;
+	}
+	section += no_coords*sizeof(unsigned int);
+	root_data->current_time = (unsigned long)header->current_time;
+	root_data->seed = header->seed;
+	memcpy(root_data->rng.state, header->rng_state, sizeof(root_data->rng.state));
+
+	if(header->has_marks == KCR_YES)
+	{
+		/* Mark section */
+		memcpy(&decay_rate, section, sizeof(double));
+		section += sizeof(double);
+		memcpy(&deposit, section, sizeof(double));
+		section += sizeof(double);
+		if(header->mark_grid_size != root_data->grid.size)
+		{
+			fprintf(stderr,"Error: marks in checkpoint do not fit the box\n");
+			rc = KCR_RC_ERROR;
+			goto EXIT_LABEL;
+		}
+		if((root_data->marks_active == KCR_YES) && (root_data->mark_decay_rate != decay_rate))
+		{
+			kcr_marks_term(root_data);
+		}
+		if(root_data->marks_active != KCR_YES)
+		{
+			rc = kcr_alloc_marks(root_data, decay_rate, deposit);
+			if(rc != KCR_RC_OK)
+			{
+				goto EXIT_LABEL;
+			}
+		}
+		root_data->mark_deposit = deposit;
+		memcpy(root_data->mark_resp, section, no_params*sizeof(double));
+		section += no_params*sizeof(double);
+		memcpy(root_data->mark_times, section, root_data->grid.size*sizeof(unsigned long long));
+		section += root_data->grid.size*sizeof(unsigned long long);
+		memcpy(root_data->mark_data, section, root_data->grid.size*root_data->no_pops*sizeof(double));
+		section += root_data->grid.size*root_data->no_pops*sizeof(double);
+	}
+	if(header->has_rates == KCR_YES)
+	{
+		/* Rate section */
+		kcr_set_multirate(root_data, (const double *)section);
+		section += root_data->no_pops*sizeof(double);
+	}
+	if(header->has_events == KCR_YES)
+	{
+		/* Event section */
+		rc = kcr_unpack_events(root_data, (const double *)section);
+	}
+
+EXIT_LABEL:
+	/* Return */
+	return(rc);
+}
+
+/***************************************************************************************
+ * Name: kcr_read_checkpoint()
+ *
+ * Purpose: Set up a simulation from a checkpoint.
+ *
+ * Parameters: IN     cp_file - the checkpoint (opened for binary reading)
+ *             IN     env_file - file containing data on the environment, which is not
+ *                               stored in the checkpoint
+ *             IN     no_threads - number of worker threads (0 = one per processor)
+ *
+ * Returns: root_data - pointer to a CB containing all the root data for KCR, exactly
+ *                      as it was when the checkpoint was written.  NULL on error.
+ *
+ * Operation: Load the checkpoint, initialise root data from the parameters in its
+ *            header (making the box three-dimensional if it was), then restore the
+ *            rest of the state.
+ ***************************************************************************************/
+KCR_ROOT_DATA *kcr_read_checkpoint(FILE *cp_file, FILE *env_file, unsigned short no_threads)
+{
+	/* Local variables */
+	KCR_ROOT_DATA *root_data = NULL;
+	char *buffer;
+	const KCR_CHECKPOINT_HEADER *header;
+
+	/* Sanity checks */
+	assert(cp_file != NULL);
+
+	buffer = kcr_load_checkpoint(cp_file);
+	if(buffer == NULL)
+	{
+		goto EXIT_LABEL;
+	}
+
+	/* Rebuild the simulation */
+	header = (const KCR_CHECKPOINT_HEADER *)buffer;
+	root_data = kcr_init((unsigned short)header->no_indivs,
+	                     (unsigned short)header->no_pops,
+	                     header->total_time,
+	                     header->start_measure_time,
+	                     NULL,
+	                     header->box_width,
+	                     header->box_height,
+	                     NULL,
+	                     header->l_val,
+	                     env_file,
+	                     header->env_weight,
+	                     (unsigned short)header->packing_term,
+	                     header->kappa,
+	                     (unsigned short)header->boundary_x,
+	                     (unsigned short)header->boundary_y,
+	                     no_threads);
+	if(root_data == NULL)
+	{
+		goto EXIT_LABEL;
+	}
+	if(((header->box_depth > 1) &&
+	    (kcr_setup_3d(root_data, header->box_depth, (unsigned short)header->boundary_z) != KCR_RC_OK)) ||
+	   (kcr_restore_checkpoint(root_data, buffer) != KCR_RC_OK))
+	{
+		kcr_term(root_data);
+		root_data = NULL;
+	}
+
+EXIT_LABEL:
+	if(buffer != NULL)
+	{
+		free(buffer);
+	}
+
+	/* Return */
+	return(root_data);
+}